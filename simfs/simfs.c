@@ -1,14 +1,14 @@
-#include "simfs.h"
+#define _GNU_SOURCE // sched_getcpu()
 
-//////////////////////////////////////////////////////////////////////////
-//
-// allocation of the in-memory data structures
-//
-//////////////////////////////////////////////////////////////////////////
+#include "simfs.h"
 
-SIMFS_CONTEXT_TYPE *simfsContext; // all in-memory information about the system
-SIMFS_VOLUME *simfsVolume;
-SIMFS_INDEX_TYPE *currentWorkingDirectory;
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -16,21 +16,13 @@ SIMFS_INDEX_TYPE *currentWorkingDirectory;
 //
 //////////////////////////////////////////////////////////////////////////
 
-/*
- * Constructs in-memory directory of all files is the system.
- *
- * Starting with the file system root (pointed to from the superblock) traverses the hierarachy of directories
- * and adds en entry for each folder or file to the directory by hashing the name and adding a directory
- * entry node to the conflict resolution list for that entry. If the entry is NULL, the new node will be
- * the only element of that list.
- *
- * The function sets the current working directory to refer to the block holding the root of the volume. This will
- * be changed as the user navigates the file system hierarchy.
- *
- */
+static void simfsFreeMount(SIMFS_MOUNT *mount);
+static bool simfsDedupRelease(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block);
+static bool simfsSnapshotRelease(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block, unsigned int generation);
+static void simfsTreeDeletionsWait(SIMFS_MOUNT *mount);
 
 /*
- * Retuns a hash value within the limits of the directory.
+ * Retuns a hash value for a name; the directory reduces it to a slot of its current size.
  */
 inline unsigned long hash(unsigned char *str) {
     register unsigned long hash = 5381;
@@ -39,19 +31,24 @@ inline unsigned long hash(unsigned char *str) {
     while ((c = *str++) != '\0')
         hash = ((hash << 5) + hash) ^ c; /* hash * 33 + c */
 
-    return hash % SIMFS_DIRECTORY_SIZE;
+    return hash;
 }
 
 /*
  * Find a free block in a bit vector.
+ *
+ * Returns SIMFS_INVALID_INDEX if all numberOfBlocks blocks, a multiple of 8, are taken.
  */
-inline unsigned short simfsFindFreeBlock(unsigned char *bitvector) {
-    unsigned short i = 0;
-    while (bitvector[i] == 0xFF)
+inline SIMFS_INDEX_TYPE simfsFindFreeBlock(unsigned char *bitvector, size_t numberOfBlocks) {
+    SIMFS_INDEX_TYPE i = 0;
+    while (i < numberOfBlocks / 8 && bitvector[i] == 0xFF)
         i += 1;
 
+    if (i == numberOfBlocks / 8)
+        return SIMFS_INVALID_INDEX;
+
     register unsigned char mask = 0x80;
-    unsigned short j = 0;
+    SIMFS_INDEX_TYPE j = 0;
     while (bitvector[i] & mask) {
         mask >>= 1;
         ++j;
@@ -63,537 +60,5664 @@ inline unsigned short simfsFindFreeBlock(unsigned char *bitvector) {
 /*
  * Three functions for bit manipulation.
  */
-inline void simfsFlipBit(unsigned char *bitvector, unsigned short bitIndex) {
-    unsigned short blockIndex = bitIndex / 8;
-    unsigned short bitShift = bitIndex % 8;
+inline void simfsFlipBit(unsigned char *bitvector, SIMFS_INDEX_TYPE bitIndex) {
+    SIMFS_INDEX_TYPE blockIndex = bitIndex / 8;
+    SIMFS_INDEX_TYPE bitShift = bitIndex % 8;
 
     register unsigned char mask = 0x80;
     bitvector[blockIndex] ^= (mask >> bitShift);
 }
 
-inline void simfsSetBit(unsigned char *bitvector, unsigned short bitIndex) {
-    unsigned short blockIndex = bitIndex / 8;
-    unsigned short bitShift = bitIndex % 8;
+inline void simfsSetBit(unsigned char *bitvector, SIMFS_INDEX_TYPE bitIndex) {
+    SIMFS_INDEX_TYPE blockIndex = bitIndex / 8;
+    SIMFS_INDEX_TYPE bitShift = bitIndex % 8;
 
     register unsigned char mask = 0x80;
     bitvector[blockIndex] |= (mask >> bitShift);
 }
 
-inline void simfsClearBit(unsigned char *bitvector, unsigned short bitIndex) {
-    unsigned short blockIndex = bitIndex / 8;
-    unsigned short bitShift = bitIndex % 8;
+inline void simfsClearBit(unsigned char *bitvector, SIMFS_INDEX_TYPE bitIndex) {
+    SIMFS_INDEX_TYPE blockIndex = bitIndex / 8;
+    SIMFS_INDEX_TYPE bitShift = bitIndex % 8;
 
     register unsigned char mask = 0x80;
     bitvector[blockIndex] &= ~(mask >> bitShift);
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// block allocation
+//
+// Every allocation group has its own lock and free count. A thread allocates from the group of its CPU, or
+// from the group of a goal block when the new block belongs to a file that already has blocks, and only falls
+// over to the other groups when that group is exhausted. Searches start at the goal or at the rotor of the group,
+// so consecutive allocations for a file come out as a contiguous run. The groups past the blocks in service of a
+// volume that was made smaller are kept with a free count of zero, so they are always exhausted.
+//
+// Most allocations happen under directoryLock. A write of a whole file takes its blocks before it takes
+// directoryLock, with the group locks only, so that writes to different files allocate in parallel; it holds
+// resizeLock shared until the blocks are linked into the file or given back, and their lives start at
+// SIMFS_UNBORN_GENERATION, so that no snapshot sees them before then.
+//
+//////////////////////////////////////////////////////////////////////////
+
 /*
- * Allocates space for the file system and saves it to disk.
+ * Returns the allocation group a thread should allocate from when there is no goal block.
  */
-SIMFS_ERROR simfsCreateFileSystem(char *simfsFileName) {
-
-    FILE *file = fopen(simfsFileName, "wb");
-    if (file == NULL)
-        return SIMFS_ALLOC_ERROR;
+static unsigned int simfsHomeAllocationGroup(SIMFS_MOUNT *mount) {
+    int cpu = sched_getcpu();
+    if (cpu < 0) // no per-CPU information; spread threads by their identifiers
+        cpu = (int) (((uintptr_t) pthread_self() >> 6) & 0x7FFFFFFF);
 
-    simfsContext = malloc(sizeof(SIMFS_CONTEXT_TYPE));
-    if (simfsContext == NULL)
-        return SIMFS_ALLOC_ERROR;
+    return (unsigned int) cpu % mount->context->numberOfAllocationGroups;
+}
 
-    simfsVolume = malloc(sizeof(SIMFS_VOLUME));
-    if (simfsVolume == NULL)
-        return SIMFS_ALLOC_ERROR;
+/*
+ * Finds a free block in the bitvector slice of the group starting the search at the block start.
+ * The caller holds the lock of the group.
+ *
+ * Returns SIMFS_INVALID_INDEX if the group is full.
+ */
+static SIMFS_INDEX_TYPE simfsFindFreeBlockInGroup(SIMFS_MOUNT *mount, unsigned int group, SIMFS_INDEX_TYPE start) {
+    unsigned char *bitvector = (unsigned char *) mount->context->bitvector;
+    unsigned int first = group * SIMFS_BLOCKS_PER_ALLOCATION_GROUP;
+    unsigned int end = first + SIMFS_BLOCKS_PER_ALLOCATION_GROUP;
 
-    // initialize the superblock
+    // the rest of the byte holding the start block
+    for (unsigned int bit = start; bit < end && bit % 8 != 0; bit++) {
+        if ((bitvector[bit / 8] & (0x80 >> (bit % 8))) == 0)
+            return (SIMFS_INDEX_TYPE) bit;
+    }
 
-    simfsVolume->superblock.attr.rootNodeIndex = 0;
-    simfsVolume->superblock.attr.blockSize = SIMFS_BLOCK_SIZE;
-    simfsVolume->superblock.attr.numberOfBlocks = SIMFS_NUMBER_OF_BLOCKS;
+    // whole bytes to the end of the group, then from its beginning
+    unsigned int startByte = (start + 7) / 8;
+    for (unsigned int pass = 0; pass < 2; pass++) {
+        unsigned int fromByte = pass == 0 ? startByte : first / 8;
+        unsigned int toByte = pass == 0 ? end / 8 : startByte;
+        for (unsigned int i = fromByte; i < toByte; i++) {
+            if (bitvector[i] != 0xFF) {
+                SIMFS_INDEX_TYPE freeBlock = simfsFindFreeBlock(bitvector + i, 8);
+                return (SIMFS_INDEX_TYPE) (i * 8 + freeBlock);
+            }
+        }
+    }
 
-    // initialize the blocks holding the root folder
+    return SIMFS_INVALID_INDEX;
+}
 
-    // initialize the root folder
+/*
+ * Takes a free block from one group. Returns SIMFS_INVALID_INDEX if the group is exhausted.
+ */
+static SIMFS_INDEX_TYPE simfsAllocateBlockInGroup(SIMFS_MOUNT *mount, unsigned int group, SIMFS_INDEX_TYPE goal) {
+    SIMFS_ALLOCATION_GROUP_TYPE *allocationGroup = &mount->context->allocationGroups[group];
 
-    simfsVolume->block[0].type = FOLDER_CONTENT_TYPE;
-    simfsVolume->block[0].content.fileDescriptor.type = FOLDER_CONTENT_TYPE;
-    strcpy(simfsVolume->block[0].content.fileDescriptor.name, "/");
-    simfsVolume->block[0].content.fileDescriptor.accessRights = umask(00000);
-    simfsVolume->block[0].content.fileDescriptor.owner = 0; // arbitrarily simulated
-    simfsVolume->block[0].content.fileDescriptor.size = 0;
+    if (atomic_load_explicit(&allocationGroup->freeBlocks, memory_order_relaxed) == 0)
+        return SIMFS_INVALID_INDEX;
 
-    struct timespec time;
-    clock_gettime(CLOCK_MONOTONIC, &time);
-    simfsVolume->block[0].content.fileDescriptor.creationTime = time.tv_sec;
-    simfsVolume->block[0].content.fileDescriptor.lastAccessTime = time.tv_sec;
-    simfsVolume->block[0].content.fileDescriptor.lastModificationTime = time.tv_sec;
+    pthread_mutex_lock(&allocationGroup->lock);
 
-    // initialize the index block of the root folder
+    SIMFS_INDEX_TYPE start = goal / SIMFS_BLOCKS_PER_ALLOCATION_GROUP == group ? goal : allocationGroup->rotor;
+    SIMFS_INDEX_TYPE freeBitIndex = SIMFS_INVALID_INDEX;
+    if (atomic_load_explicit(&allocationGroup->freeBlocks, memory_order_relaxed) > 0)
+        freeBitIndex = simfsFindFreeBlockInGroup(mount, group, start);
 
-    // first, point from the root file descriptor to the index block
-    simfsVolume->block[0].content.fileDescriptor.block_ref = 1;
+    if (freeBitIndex != SIMFS_INVALID_INDEX) {
+        simfsFlipBit((unsigned char *) mount->context->bitvector, freeBitIndex);
+        mount->volume->bitvector[freeBitIndex / 8] = mount->context->bitvector[freeBitIndex / 8];
+        atomic_fetch_sub_explicit(&allocationGroup->freeBlocks, 1, memory_order_relaxed);
+        simfsStatsCount(SIMFS_BLOCKS_ALLOCATED_COUNTER, 1);
+        allocationGroup->rotor = freeBitIndex + 1 < (group + 1) * SIMFS_BLOCKS_PER_ALLOCATION_GROUP ?
+                                 freeBitIndex + 1 : group * SIMFS_BLOCKS_PER_ALLOCATION_GROUP;
+    }
 
-    simfsVolume->block[1].type = INDEX_CONTENT_TYPE;
+    pthread_mutex_unlock(&allocationGroup->lock);
+    return freeBitIndex;
+}
 
-    // indicate that the blocks #0 and #1 are allocated
+/*
+ * Starts the life of a block that was just taken in the given generation.
+ */
+static void simfsStartBlockLife(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block, unsigned int generation) {
+    SIMFS_BLOCK_LIFE_TYPE *life = &mount->volume->life[block];
+    life->birth = generation;
+    life->death = 0;
+    life->origin = block;
+}
 
-    // using the function to find a free block for testing purposes
-    simfsFlipBit(simfsVolume->bitvector, simfsFindFreeBlock(simfsVolume->bitvector)); // should be 0
-    simfsFlipBit(simfsVolume->bitvector, simfsFindFreeBlock(simfsVolume->bitvector)); // should be 1
+/*
+ * Takes a free block as close after the goal block as possible, or from the home group of the thread if the goal
+ * is SIMFS_INVALID_INDEX, and copies the modified byte of the bitvector to the simulated disk. The life of the
+ * block starts in the current generation. The caller holds directoryLock.
+ *
+ * Returns SIMFS_INVALID_INDEX if the volume is full.
+ */
+static SIMFS_INDEX_TYPE simfsAllocateBlock(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE goal) {
+    unsigned int numberOfGroups = mount->context->numberOfAllocationGroups;
+    unsigned int home = goal < simfsVolumeBlocks(mount->volume) ? goal / SIMFS_BLOCKS_PER_ALLOCATION_GROUP :
+                        simfsHomeAllocationGroup(mount);
 
-    // sample alternative #1 - illustration of bit-wise operations
-//    simfsVolume->bitvector[0] = 0;
-//    simfsVolume->bitvector[0] |= 0x01 << 7; // set the first bit of the bit vector
-//    simfsVolume->bitvector[0] += 0x80 >> 1; // flip the first bit of the bit vector
+    for (unsigned int i = 0; i < numberOfGroups; i++) {
+        unsigned int group = (home + i) % numberOfGroups;
+        SIMFS_INDEX_TYPE freeBitIndex = simfsAllocateBlockInGroup(mount, group, goal);
+        if (freeBitIndex != SIMFS_INVALID_INDEX) {
+            simfsStartBlockLife(mount, freeBitIndex, mount->volume->generation);
+            return freeBitIndex;
+        }
+    }
 
-    // sample alternative #2 - less educational, but fastest
-//     simfsVolume->bitvector[0] = 0xC0;
-    // 0xC0 is 11000000 in binary (showing the root block and root's index block taken)
+    return SIMFS_INVALID_INDEX;
+}
 
-    fwrite(simfsVolume, 1, sizeof(SIMFS_VOLUME), file);
+/*
+ * Orders block references for qsort() and bsearch().
+ */
+static int simfsCompareIndices(const void *first, const void *second) {
+    SIMFS_INDEX_TYPE a = *(const SIMFS_INDEX_TYPE *) first, b = *(const SIMFS_INDEX_TYPE *) second;
+    return a < b ? -1 : a > b;
+}
 
-    fclose(file);
+/*
+ * Blocks freed by a thread that batches its releases; see simfsReleaseBlock().
+ */
+typedef struct simfs_release_batch_type {
+    SIMFS_MOUNT *mount;
+    SIMFS_INDEX_TYPE blocks[SIMFS_RELEASE_BATCH_BLOCKS];
+    size_t numberOfBlocks;
+} SIMFS_RELEASE_BATCH_TYPE;
 
-    return SIMFS_NO_ERROR;
-}
+static _Thread_local SIMFS_RELEASE_BATCH_TYPE *simfsReleaseBatch = NULL; // set while the thread batches releases
 
 /*
- * Loads the file system from a disk and constructs in-memory directory of all files is the system.
- *
- * Starting with the file system root (pointed to from the superblock) traverses the hierarachy of directories
- * and adds en entry for each folder or file to the directory by hashing the name and adding a directory
- * entry node to the conflict resolution list for that entry. If the entry is NULL, the new node will be
- * the only element of that list.
- *
- * The function sets the current working directory to refer to the block holding the root of the volume. This will
- * be changed as the user navigates the file system hierarchy.
- *
+ * Returns the blocks of a batch to their groups, taking the lock of each group once and copying the bytes of the
+ * bitvector that changed in it to the simulated disk at once.
  */
+static void simfsReleaseBatchFlush(SIMFS_RELEASE_BATCH_TYPE *batch) {
+    SIMFS_INDEX_TYPE *blocks = batch->blocks;
+    qsort(blocks, batch->numberOfBlocks, sizeof(SIMFS_INDEX_TYPE), simfsCompareIndices);
+
+    for (size_t first = 0, end; first < batch->numberOfBlocks; first = end) {
+        unsigned int group = blocks[first] / SIMFS_BLOCKS_PER_ALLOCATION_GROUP;
+        SIMFS_ALLOCATION_GROUP_TYPE *allocationGroup = &batch->mount->context->allocationGroups[group];
+        for (end = first; end < batch->numberOfBlocks && blocks[end] / SIMFS_BLOCKS_PER_ALLOCATION_GROUP == group;)
+            end++;
 
-SIMFS_ERROR simfsMountFileSystem(char *simfsFileName) {
-    simfsContext = malloc(sizeof(SIMFS_CONTEXT_TYPE));
-    for (int i = 0; i < SIMFS_DIRECTORY_SIZE; i++) {
-        simfsContext->directory[i] = NULL;
+        pthread_mutex_lock(&allocationGroup->lock);
+        for (size_t i = first; i < end; i++)
+            simfsClearBit((unsigned char *) batch->mount->context->bitvector, blocks[i]);
+        size_t lowByte = blocks[first] / 8, highByte = blocks[end - 1] / 8;
+        memcpy(batch->mount->volume->bitvector + lowByte, batch->mount->context->bitvector + lowByte,
+               highByte - lowByte + 1);
+        atomic_fetch_add_explicit(&allocationGroup->freeBlocks, end - first, memory_order_relaxed);
+        pthread_mutex_unlock(&allocationGroup->lock);
     }
 
-    if (simfsContext == NULL)
-        return SIMFS_ALLOC_ERROR;
+    simfsStatsCount(SIMFS_BLOCKS_FREED_COUNTER, batch->numberOfBlocks);
+    batch->numberOfBlocks = 0;
+}
 
-    simfsVolume = malloc(sizeof(SIMFS_VOLUME));
-    if (simfsVolume == NULL)
-        return SIMFS_ALLOC_ERROR;
+/*
+ * Returns a block to its group and copies the modified byte of the bitvector to the simulated disk. A thread that
+ * batches its releases for the mount collects the block instead, and returns its batch when it is full.
+ */
+static void simfsReleaseBlock(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE blockIndex) {
+    if (simfsReleaseBatch != NULL && simfsReleaseBatch->mount == mount) {
+        simfsReleaseBatch->blocks[simfsReleaseBatch->numberOfBlocks++] = blockIndex;
+        if (simfsReleaseBatch->numberOfBlocks == SIMFS_RELEASE_BATCH_BLOCKS)
+            simfsReleaseBatchFlush(simfsReleaseBatch);
+        return;
+    }
 
-    FILE *file = fopen(simfsFileName, "rb");
-    if (file == NULL)
-        return SIMFS_ALLOC_ERROR;
+    SIMFS_ALLOCATION_GROUP_TYPE *allocationGroup =
+            &mount->context->allocationGroups[blockIndex / SIMFS_BLOCKS_PER_ALLOCATION_GROUP];
 
-    //Mounting System into memory
-    SIMFS_BLOCK_TYPE currentBlock = simfsVolume->block[simfsVolume->block[0].content.fileDescriptor.block_ref]; //gets us the contents of the initial block
-    hashFileSystem(currentBlock, simfsVolume->block[0].content.fileDescriptor.size);
-    strcpy(simfsContext->bitvector, simfsVolume->bitvector);
+    pthread_mutex_lock(&allocationGroup->lock);
 
+    simfsClearBit((unsigned char *) mount->context->bitvector, blockIndex);
+    mount->volume->bitvector[blockIndex / 8] = mount->context->bitvector[blockIndex / 8];
+    atomic_fetch_add_explicit(&allocationGroup->freeBlocks, 1, memory_order_relaxed);
 
-    fread(simfsVolume, 1, sizeof(SIMFS_VOLUME), file);
-    fclose(file);
-    return SIMFS_NO_ERROR;
+    pthread_mutex_unlock(&allocationGroup->lock);
+    simfsStatsCount(SIMFS_BLOCKS_FREED_COUNTER, 1);
+}
 
-    // TODO: complete
+/*
+ * Returns the number of free blocks in all groups. Without directoryLock held the result is only a snapshot.
+ */
+static size_t simfsNumberOfFreeBlocks(SIMFS_MOUNT *mount) {
+    size_t freeBlocks = 0;
+    for (unsigned int group = 0; group < mount->context->numberOfAllocationGroups; group++)
+        freeBlocks += atomic_load_explicit(&mount->context->allocationGroups[group].freeBlocks, memory_order_relaxed);
 
+    return freeBlocks;
 }
 
-//does a depth first recursive search of all the files in the system and hashes the information into memory
-void hashFileSystem(SIMFS_BLOCK_TYPE currentBlock, size_t numberOfFiles) {
-    for (int i = 0; i < numberOfFiles; i++) {
-        SIMFS_BLOCK_TYPE fileToHash = simfsVolume->block[currentBlock.content.index[i]];
-        unsigned long hashedName = hash(fileToHash.content.fileDescriptor.name);
-        if (fileToHash.type == FOLDER_CONTENT_TYPE) {
-            hashFileSystem(simfsVolume->block[fileToHash.content.fileDescriptor.block_ref],
-                           fileToHash.content.fileDescriptor.size);
+/*
+ * Takes up to count free blocks from one group into blocks in a single scan from its rotor, and copies the bytes
+ * of the bitvector that changed to the simulated disk at once. The lives of the blocks start in the generation
+ * birth before they are marked as used.
+ *
+ * Returns the number of blocks taken.
+ */
+static size_t simfsAllocateBlocksInGroup(SIMFS_MOUNT *mount, unsigned int group, size_t count,
+                                         SIMFS_INDEX_TYPE *blocks, unsigned int birth) {
+    SIMFS_ALLOCATION_GROUP_TYPE *allocationGroup = &mount->context->allocationGroups[group];
+    unsigned char *bitvector = (unsigned char *) mount->context->bitvector;
+    unsigned int first = group * SIMFS_BLOCKS_PER_ALLOCATION_GROUP;
+    size_t taken = 0;
+
+    if (atomic_load_explicit(&allocationGroup->freeBlocks, memory_order_relaxed) == 0)
+        return 0;
+
+    pthread_mutex_lock(&allocationGroup->lock);
+
+    unsigned int lowByte = first / 8 + SIMFS_BLOCKS_PER_ALLOCATION_GROUP / 8, highByte = 0;
+    size_t available = atomic_load_explicit(&allocationGroup->freeBlocks, memory_order_relaxed);
+    unsigned int bit = allocationGroup->rotor;
+    for (unsigned int scanned = 0; scanned < SIMFS_BLOCKS_PER_ALLOCATION_GROUP && taken < count &&
+                                   taken < available; scanned++) {
+        if (bit % 8 == 0 && bitvector[bit / 8] == 0xFF) // a full byte is skipped whole
+            scanned += 7, bit += 7;
+        else if ((bitvector[bit / 8] & (0x80 >> (bit % 8))) == 0) {
+            simfsStartBlockLife(mount, bit, birth);
+            simfsSetBit(bitvector, bit);
+            blocks[taken++] = bit;
+            lowByte = bit / 8 < lowByte ? bit / 8 : lowByte;
+            highByte = bit / 8 > highByte ? bit / 8 : highByte;
         }
-        SIMFS_DIR_ENT *conflictResList = (simfsContext->directory)[hashedName];
-        addFileDescriptorToList(conflictResList, currentBlock.content.index[i]);
+        bit = bit + 1 < first + SIMFS_BLOCKS_PER_ALLOCATION_GROUP ? bit + 1 : first;
+    }
+
+    if (taken > 0) {
+        memcpy(mount->volume->bitvector + lowByte, mount->context->bitvector + lowByte, highByte - lowByte + 1);
+        atomic_fetch_sub_explicit(&allocationGroup->freeBlocks, taken, memory_order_relaxed);
+        simfsStatsCount(SIMFS_BLOCKS_ALLOCATED_COUNTER, taken);
+        allocationGroup->rotor = bit;
     }
+
+    pthread_mutex_unlock(&allocationGroup->lock);
+    return taken;
 }
 
-void addFileDescriptorToList(SIMFS_DIR_ENT *conflictResList, SIMFS_INDEX_TYPE descriptorIndex) {
-    SIMFS_DIR_ENT *currentList = conflictResList;
+/*
+ * Takes count free blocks into blocks in one pass over the groups, from the home group of the thread on, with the
+ * lock of each group taken once, and starts their lives in the generation birth. Only the group locks are taken, so
+ * the caller holds directoryLock or resizeLock.
+ *
+ * Returns false, and takes nothing, if the volume does not have count free blocks.
+ */
+static bool simfsTakeBlocks(SIMFS_MOUNT *mount, size_t count, SIMFS_INDEX_TYPE *blocks, unsigned int birth) {
+    if (simfsNumberOfFreeBlocks(mount) < count)
+        return false;
+
+    unsigned int numberOfGroups = mount->context->numberOfAllocationGroups;
+    unsigned int home = simfsHomeAllocationGroup(mount);
+    size_t taken = 0;
+    for (unsigned int i = 0; i < numberOfGroups && taken < count; i++)
+        taken += simfsAllocateBlocksInGroup(mount, (home + i) % numberOfGroups, count - taken, blocks + taken, birth);
 
-    while (currentList != NULL) {
-        currentList = (currentList->next);
+    if (taken < count) { // a write took blocks outside directoryLock since they were counted
+        for (size_t i = 0; i < taken; i++)
+            simfsReleaseBlock(mount, blocks[i]);
+        return false;
     }
-    currentList = (SIMFS_DIR_ENT *) malloc(sizeof(SIMFS_DIR_ENT));
-    currentList->nodeReference = descriptorIndex;
-    currentList->next = NULL;
+
+    return true;
 }
 
 /*
- * Saves the file system to a disk and de-allocates the memory.
- *
- * Assumes that all synchronization has been done.
+ * Takes count free blocks into blocks with simfsTakeBlocks(); their lives start in the current generation. The
+ * caller holds directoryLock.
  *
+ * Returns false, and takes nothing, if the volume does not have count free blocks.
  */
-SIMFS_ERROR simfsUmountFileSystem(char *simfsFileName) {
-    FILE *file = fopen(simfsFileName, "wb");
-    if (file == NULL)
-        return SIMFS_ALLOC_ERROR;
+static bool simfsAllocateBlocks(SIMFS_MOUNT *mount, size_t count, SIMFS_INDEX_TYPE *blocks) {
+    return simfsTakeBlocks(mount, count, blocks, mount->volume->generation);
+}
 
-    fwrite(simfsVolume, 1, sizeof(SIMFS_VOLUME), file);
-    fclose(file);
+/*
+ * Counts the free blocks of a group in the in-memory bitvector. A group past the blocks in service has none, so
+ * nothing is allocated there.
+ */
+static unsigned int simfsGroupFreeBlocks(SIMFS_MOUNT *mount, unsigned int group) {
+    unsigned int usedBlocks = 0;
+    if ((size_t) group * SIMFS_BLOCKS_PER_ALLOCATION_GROUP >= simfsVolumeBlocks(mount->volume))
+        return 0;
 
-    free(simfsVolume);
-    free(simfsContext);
+    for (unsigned int i = group * SIMFS_BLOCKS_PER_ALLOCATION_GROUP / 8;
+         i < (group + 1) * SIMFS_BLOCKS_PER_ALLOCATION_GROUP / 8; i++)
+        usedBlocks += __builtin_popcount((unsigned char) mount->context->bitvector[i]);
 
-    return SIMFS_NO_ERROR;
+    return SIMFS_BLOCKS_PER_ALLOCATION_GROUP - usedBlocks;
 }
 
-//////////////////////////////////////////////////////////////////////////
+/*
+ * Sets the free counts of the allocation groups from the in-memory bitvector.
+ */
+static void simfsInitAllocationGroups(SIMFS_MOUNT *mount) {
+    for (unsigned int group = 0; group < mount->context->numberOfAllocationGroups; group++)
+        atomic_store_explicit(&mount->context->allocationGroups[group].freeBlocks, simfsGroupFreeBlocks(mount, group),
+                              memory_order_relaxed);
+}
 
 /*
- * Depending on the type parameter the function creates a file or a folder in the current directory
- * of the process. If the process does not have an entry in the processControlBlock, then the root directory
- * is assumed to be its current working directory.
- *
- * Hashes the file name and check if the file with such name already exists in the in-memory directory.
- * If it is then it return SIMFS_DUPLICATE_ERROR.
- * Otherwise:
- *    - finds an available block in the storage using the in-memory bitvector and flips the bit to indicate
- *      that the block is taken
- *    - initializes a local buffer for the file descriptor block with the block type depending on the parameter type
- *      (i.e., folder or file)
- *    - creates an entry in the conflict resolution list for the corresponding in-memory directory entry
- *    - copies the local buffer to the disk block that was found to be free
- *    - copies the in-memory bitvector to the bitevector blocks on the simulated disk
- *
- *  The access rights and the the owner are taken from the context (umask and uid correspondingly).
- *
+ * The arrays of a context and of its fingerprint index that have an entry for every block of the volume.
+ * simfsResizeVolume() allocates them for the new size before it changes anything, so that the change cannot fail
+ * halfway, and swaps them with the arrays in use.
  */
-SIMFS_ERROR simfsCreateFile(SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type) {
-    strcpy(simfsContext->bitvector,simfsVolume->bitvector);
-    unsigned long hashedName;
-    SIMFS_INDEX_TYPE currentDirectoryIndex;
-    SIMFS_BLOCK_TYPE currentDirectory;
-    char *nameWithPath;
+typedef struct simfs_block_arrays_type {
+    char *bitvector;
+    char *verifiedBlocks;
+    _Atomic unsigned int *descriptorSequences;
+    SIMFS_ALLOCATION_GROUP_TYPE *allocationGroups;
+    unsigned int numberOfAllocationGroups;
+    SIMFS_INDEX_TYPE *dedupNext; // NULL unless the volume is deduplicated
+    unsigned int *dedupReferences;
+} SIMFS_BLOCK_ARRAYS_TYPE;
 
-    if (simfsContext->processControlBlocks != NULL) {
-        currentDirectoryIndex = simfsContext->processControlBlocks->currentWorkingDirectory;
-        currentDirectory = simfsVolume->block[currentDirectoryIndex];
-        nameWithPath = (char*)malloc(sizeof(fileName) + sizeof(currentDirectory.content.fileDescriptor.name) + 10);
-        strcpy(nameWithPath, currentDirectory.content.fileDescriptor.name);
-    } else {
-        nameWithPath = (char*)malloc(sizeof(fileName) + 10);
-        currentDirectory = simfsVolume->block[0]; //root directory
-    }
-    strcat(nameWithPath, "/");
-    strcat(nameWithPath, fileName); //creates filename with path prepended
-
-    hashedName = hash(nameWithPath);
-    size_t numberOfFilesInDirectory = currentDirectory.content.fileDescriptor.size;
-    SIMFS_INDEX_TYPE *indexedFiles;
-
-    SIMFS_DIR_ENT *headOfCollisionList = simfsContext->directory[hashedName];
-    char *nameToCheck;
-    while (headOfCollisionList != NULL) {
-        nameToCheck = simfsVolume->block[headOfCollisionList->nodeReference].content.fileDescriptor.name;
-        if (namesAreSame(nameToCheck, nameWithPath))
-            return SIMFS_DUPLICATE_ERROR;
-        headOfCollisionList = headOfCollisionList->next;
-    }
-
-//    if(numberOfFilesInDirectory > 0){
-//        indexedFiles = simfsVolume->block[currentDirectory.content.fileDescriptor.block_ref].content.index;
-//
-//        for(int i = 0; i < numberOfFilesInDirectory; i++){
-//            SIMFS_BLOCK_TYPE currentFileToCheck = simfsVolume->block[indexedFiles[i]];
-//            char *nameToCheck = currentFileToCheck.content.fileDescriptor.name;
-//            if(namesAreSame(nameToCheck,nameWithPath)){
-//                return SIMFS_DUPLICATE_ERROR;
-//            }
-//        }
-//    }
-
-    SIMFS_FILE_DESCRIPTOR_TYPE *descriptorBuffer = (SIMFS_FILE_DESCRIPTOR_TYPE *) malloc(
-            sizeof(SIMFS_FILE_DESCRIPTOR_TYPE));
-    SIMFS_FILE_DESCRIPTOR_TYPE *indexBuffer;
-    time(&descriptorBuffer->creationTime);
-    descriptorBuffer->lastAccessTime = descriptorBuffer->creationTime;
-    descriptorBuffer->lastModificationTime = descriptorBuffer->creationTime;
-    descriptorBuffer->size = 0; //always initialize to 0 which means empty file/folder(may change in the future)
-    // 0  Owner | Group | ALL
-    //    RWE   | RWE   | RWE
-    unsigned short allAccessRights = 0777;
+/*
+ * Releases block arrays; allocation groups are set up, and their locks are destroyed.
+ */
+static void simfsBlockArraysFree(SIMFS_BLOCK_ARRAYS_TYPE *arrays) {
+    for (unsigned int group = 0; arrays->allocationGroups != NULL && group < arrays->numberOfAllocationGroups; group++)
+        pthread_mutex_destroy(&arrays->allocationGroups[group].lock);
 
-    descriptorBuffer->accessRights = allAccessRights;
-    strcpy(descriptorBuffer->name, nameWithPath);
-    descriptorBuffer->type = type;
-    currentDirectory.content.fileDescriptor.size++;
+    free(arrays->bitvector);
+    free(arrays->verifiedBlocks);
+    free(arrays->descriptorSequences);
+    free(arrays->allocationGroups);
+    free(arrays->dedupNext);
+    free(arrays->dedupReferences);
+    memset(arrays, 0, sizeof(SIMFS_BLOCK_ARRAYS_TYPE));
+}
+
+/*
+ * Allocates the block arrays for a volume of numberOfBlocks blocks, and the arrays of the fingerprint index if
+ * isDeduplicated is set. The bitmaps, the descriptor sequences and the references are cleared, and every group has
+ * its lock, no free blocks, and its rotor at its first block.
+ *
+ * Returns false, with nothing allocated, if there is no memory.
+ */
+static bool simfsBlockArraysAlloc(SIMFS_BLOCK_ARRAYS_TYPE *arrays, size_t numberOfBlocks, bool isDeduplicated) {
+    memset(arrays, 0, sizeof(SIMFS_BLOCK_ARRAYS_TYPE));
+    unsigned int numberOfGroups = (unsigned int) (numberOfBlocks / SIMFS_BLOCKS_PER_ALLOCATION_GROUP);
 
-    unsigned short freeBitIndex = simfsFindFreeBlock(simfsContext->bitvector);
-    simfsFlipBit(simfsContext->bitvector, freeBitIndex);
-    simfsVolume->block[freeBitIndex].content.fileDescriptor = *descriptorBuffer;
-    SIMFS_DIR_ENT *newCollisionListEntry;
-    headOfCollisionList = simfsContext->directory[hashedName];
-    if(headOfCollisionList == NULL){
-        simfsContext->directory[hashedName] = (SIMFS_DIR_ENT *) malloc(sizeof(SIMFS_DIR_ENT));
-        simfsContext->directory[hashedName]->nodeReference=freeBitIndex;
-        simfsContext->directory[hashedName]->next = NULL;
+    arrays->bitvector = calloc(numberOfBlocks / 8, 1);
+    arrays->verifiedBlocks = calloc(numberOfBlocks / 8, 1);
+    arrays->descriptorSequences = calloc(numberOfBlocks, sizeof(_Atomic unsigned int));
+    arrays->allocationGroups = aligned_alloc(_Alignof(SIMFS_ALLOCATION_GROUP_TYPE),
+                                             numberOfGroups * sizeof(SIMFS_ALLOCATION_GROUP_TYPE));
+    if (isDeduplicated) {
+        arrays->dedupNext = malloc(numberOfBlocks * sizeof(SIMFS_INDEX_TYPE));
+        arrays->dedupReferences = calloc(numberOfBlocks, sizeof(unsigned int));
     }
-    else{
-        while(headOfCollisionList->next != NULL){
-            headOfCollisionList = headOfCollisionList->next;
-        }
-        headOfCollisionList->next = (SIMFS_DIR_ENT *) malloc(sizeof(SIMFS_DIR_ENT));
-        headOfCollisionList->next->nodeReference=freeBitIndex;
-        headOfCollisionList->next = NULL;
+    if (arrays->bitvector == NULL || arrays->verifiedBlocks == NULL || arrays->descriptorSequences == NULL ||
+        arrays->allocationGroups == NULL ||
+        (isDeduplicated && (arrays->dedupNext == NULL || arrays->dedupReferences == NULL))) {
+        free(arrays->allocationGroups); // no lock is set up yet
+        arrays->allocationGroups = NULL;
+        simfsBlockArraysFree(arrays);
+        return false;
+    }
+
+    arrays->numberOfAllocationGroups = numberOfGroups;
+    for (unsigned int group = 0; group < numberOfGroups; group++) {
+        SIMFS_ALLOCATION_GROUP_TYPE *allocationGroup = &arrays->allocationGroups[group];
+
+        pthread_mutex_init(&allocationGroup->lock, NULL);
+        atomic_init(&allocationGroup->freeBlocks, 0);
+        allocationGroup->rotor = group * SIMFS_BLOCKS_PER_ALLOCATION_GROUP;
     }
+    return true;
+}
+
+/*
+ * Exchanges the block arrays of a context, and those of its fingerprint index if it has one, with arrays.
+ */
+static void simfsSwapBlockArrays(SIMFS_CONTEXT_TYPE *context, SIMFS_BLOCK_ARRAYS_TYPE *arrays) {
+    SIMFS_BLOCK_ARRAYS_TYPE swapped = *arrays;
 
-    simfsVolume->block[freeBitIndex].type = type;
-    if (type == FILE_CONTENT_TYPE){
-        descriptorBuffer->block_ref = SIMFS_INVALID_INDEX;
+    arrays->bitvector = context->bitvector;
+    arrays->verifiedBlocks = context->verifiedBlocks;
+    arrays->descriptorSequences = context->descriptorSequences;
+    arrays->allocationGroups = context->allocationGroups;
+    arrays->numberOfAllocationGroups = context->numberOfAllocationGroups;
+    context->bitvector = swapped.bitvector;
+    context->verifiedBlocks = swapped.verifiedBlocks;
+    context->descriptorSequences = swapped.descriptorSequences;
+    context->allocationGroups = swapped.allocationGroups;
+    context->numberOfAllocationGroups = swapped.numberOfAllocationGroups;
+    if (context->dedup != NULL) {
+        arrays->dedupNext = context->dedup->next;
+        arrays->dedupReferences = context->dedup->references;
+        context->dedup->next = swapped.dedupNext;
+        context->dedup->references = swapped.dedupReferences;
     }
-    else if (type == FOLDER_CONTENT_TYPE) {
-        freeBitIndex = simfsFindFreeBlock(simfsContext->bitvector);
-        simfsFlipBit(simfsContext->bitvector, freeBitIndex);
-        simfsVolume->block[freeBitIndex].type = INDEX_CONTENT_TYPE;
-        newCollisionListEntry = (SIMFS_DIR_ENT *) malloc(sizeof(SIMFS_DIR_ENT));
-        newCollisionListEntry->nodeReference = freeBitIndex;
-        newCollisionListEntry->next = NULL;
-        headOfCollisionList = newCollisionListEntry;
+}
+
+/*
+ * Frees an index chain that holds numberOfEntries references and leaves the tree in the given generation; if
+ * releaseEntries is set, the blocks referenced from the chain are freed as well, except for data blocks that other
+ * references still share, and holes are skipped. Blocks that a snapshot holds are kept for it. A chain always has
+ * at least one index block.
+ *
+ * The caller holds sharingLock.
+ */
+static void simfsReleaseIndexChain(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE indexBlock, size_t numberOfEntries,
+                                   bool releaseEntries, unsigned int generation) {
+    size_t numberOfIndexBlocks = numberOfEntries == 0 ? 1 :
+                                 (numberOfEntries + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK;
+
+    for (size_t i = 0; i < numberOfIndexBlocks; i++) {
+        SIMFS_INDEX_TYPE *index = mount->volume->block[indexBlock].content.index;
+        SIMFS_INDEX_TYPE next = index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        for (size_t j = 0; releaseEntries && j < SIMFS_INDEX_ENTRIES_PER_BLOCK &&
+                           i * SIMFS_INDEX_ENTRIES_PER_BLOCK + j < numberOfEntries; j++) {
+            if (index[j] == SIMFS_HOLE || !simfsDedupRelease(mount, index[j]) ||
+                !simfsSnapshotRelease(mount, index[j], generation))
+                continue;
+            mount->volume->block[index[j]].type = INVALID_CONTENT_TYPE;
+            simfsReleaseBlock(mount, index[j]);
+        }
+        if (simfsSnapshotRelease(mount, indexBlock, generation)) {
+            mount->volume->block[indexBlock].type = INVALID_CONTENT_TYPE;
+            simfsReleaseBlock(mount, indexBlock);
+        }
+        indexBlock = next;
     }
+}
+
+/*
+ * Frees the data blocks of a file and the index chain that references them, leaving an empty file. The caller holds
+ * directoryLock.
+ */
+static void simfsReleaseFileContent(SIMFS_MOUNT *mount, SIMFS_FILE_DESCRIPTOR_TYPE *descriptor) {
+    pthread_mutex_lock(&mount->context->sharingLock);
+    if (descriptor->storedSize > 0)
+        simfsReleaseIndexChain(mount, descriptor->block_ref, SIMFS_DATA_BLOCKS(descriptor), true,
+                               mount->volume->generation);
 
+    descriptor->size = 0;
+    descriptor->storedSize = 0;
+    descriptor->block_ref = SIMFS_INVALID_INDEX;
+    pthread_mutex_unlock(&mount->context->sharingLock);
+}
 
-    strcpy(simfsVolume->bitvector, simfsContext->bitvector);
+/*
+ * Frees the blocks held by the file or folder described in the block descriptorIndex and the block itself, which
+ * left the tree in the given generation.
+ *
+ * For files, the index chain holds one reference per data block; for folders it holds one reference per child,
+ * which must have been removed before.
+ */
+static void simfsReleaseFileBlocks(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex, unsigned int generation) {
+    pthread_mutex_lock(&mount->context->sharingLock); // simfsDedupBuild() must not see the file half released
+    // taken under the lock, since simfsResizeVolume() replaces the image under it
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    if (descriptor->type == FOLDER_CONTENT_TYPE)
+        simfsReleaseIndexChain(mount, descriptor->block_ref, descriptor->size, false, generation);
+    else if (descriptor->storedSize > 0)
+        simfsReleaseIndexChain(mount, descriptor->block_ref, SIMFS_DATA_BLOCKS(descriptor), true, generation);
 
-    return SIMFS_NO_ERROR;
+    if (simfsSnapshotRelease(mount, descriptorIndex, generation)) {
+        mount->volume->block[descriptorIndex].type = INVALID_CONTENT_TYPE;
+        simfsReleaseBlock(mount, descriptorIndex);
+    }
+    pthread_mutex_unlock(&mount->context->sharingLock);
 }
 
 //////////////////////////////////////////////////////////////////////////
+//
+// block checksums
+//
+// Whoever changes a block recomputes its checksum once the block is complete, under directoryLock like every
+// other change of content. Freed blocks keep their last checksum; it is not looked at until the block is used
+// again. A block that was written or checked since mounting is marked in verifiedBlocks, which is all that
+// SIMFS_VERIFY_ONCE needs.
+//
+//////////////////////////////////////////////////////////////////////////
+
+static void simfsChecksumUpdate(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block) {
+    mount->volume->checksum[block] = simfsBlockChecksum(&mount->volume->block[block]);
+    simfsSetBit((unsigned char *) mount->context->verifiedBlocks, block);
+}
 
 /*
- * Deletes a file from the file system.
- *
- * Hashes the file name and check if the file is in the directory. If not, then it returns SIMFS_NOT_FOUND_ERROR.
- * Otherwise:
- *    - finds the reference to the file descriptor block
- *    - if the referenced block is a folder that is not empty, then returns SIMFS_NOT_EMPTY_ERROR.
- *    - Otherwise: 
- *       - checks if the process owner can delete this file or folder; if not, it returns SIMFS_ACCESS_ERROR.
- *       - Otherwise:
- *          - frees all blocks belonging to the file by flipping the corresponding bits in the in-memory bitvector
- *          - frees the reference block by flipping the corresponding bit in the in-memory bitvector
- *          - clears the entry in the folder by removing the corresponding node in the list associated with
- *            the slot for this file
- *          - copies the in-memory bitvector to the bitvector blocks on the simulated disk
- */
-SIMFS_ERROR simfsDeleteFile(SIMFS_NAME_TYPE fileName) {
-    unsigned long hashedName = hash(fileName);
-    SIMFS_DIR_ENT *listElement = simfsContext->directory[hashedName];
-    SIMFS_DIR_ENT *prevListElement = listElement;
-    SIMFS_FILE_DESCRIPTOR_TYPE matchedDescriptor;
-    SIMFS_BLOCK_TYPE potentialMatch;
-    //size_t numberOfFilesToCheck =
-
-    while(listElement != NULL){
-        potentialMatch = simfsVolume->block[listElement->nodeReference];
-        if((potentialMatch.type == FILE_CONTENT_TYPE || potentialMatch.type == FOLDER_CONTENT_TYPE) &&
-            namesAreSame(fileName,potentialMatch.content.fileDescriptor.name)){
-            matchedDescriptor = potentialMatch.content.fileDescriptor;
-            break;
-        }
-        prevListElement = listElement;
-        listElement = listElement->next;
+ * Checks the checksum of a block that is about to be read, as the verify mode of the mount asks for.
+ * Returns false if it does not match.
+ */
+static bool simfsChecksumVerify(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block) {
+    SIMFS_VERIFY_MODE mode = mount->context->verifyMode;
+    if (mode == SIMFS_VERIFY_NEVER ||
+        (mode == SIMFS_VERIFY_ONCE && (mount->context->verifiedBlocks[block / 8] & (0x80 >> (block % 8))) != 0))
+        return true;
+
+    if (simfsBlockChecksum(&mount->volume->block[block]) != mount->volume->checksum[block]) {
+        simfsStatsCount(SIMFS_CHECKSUM_ERRORS_COUNTER, 1);
+        return false;
     }
-    if(listElement == NULL)
+    simfsSetBit((unsigned char *) mount->context->verifiedBlocks, block);
+    return true;
+}
+
+/*
+ * Sets when reads check the checksums of the blocks they copy out; SIMFS_VERIFY_ONCE after mounting, which catches
+ * damage done to the volume file while it was not mounted at a bit test per block once the block is verified.
+ */
+SIMFS_ERROR simfsSetVerifyMode(SIMFS_MOUNT *mount, SIMFS_VERIFY_MODE mode) {
+    if (mode != SIMFS_VERIFY_ALWAYS && mode != SIMFS_VERIFY_ONCE && mode != SIMFS_VERIFY_NEVER)
         return SIMFS_NOT_FOUND_ERROR;
-    if(matchedDescriptor.type == FOLDER_CONTENT_TYPE && matchedDescriptor.size > 0)
-        return SIMFS_NOT_EMPTY_ERROR;
-    unsigned char mask = 0200; //bitmask representing owners ability to write to file
-    if((mask & matchedDescriptor.accessRights) != mask)
-        return SIMFS_ACCESS_ERROR;
 
-    prevListElement->next = listElement->next; //remove from conflict resolution list
-    simfsFlipBit(simfsContext->bitvector, listElement->nodeReference);
-    strcpy(simfsVolume->bitvector, simfsContext->bitvector);
+    pthread_mutex_lock(&mount->context->directoryLock);
+    mount->context->verifyMode = mode;
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
     return SIMFS_NO_ERROR;
+}
 
-    //SIMFS_INDEX_TYPE currentDirectoryIndex = simfsContext->processControlBlocks->currentWorkingDirectory;
-//    SIMFS_BLOCK_TYPE currentDirectory = simfsVolume->block[simfs];
-//    size_t numberOfFilesInDirectory = currentDirectory.content.fileDescriptor.size;
-//    SIMFS_INDEX_TYPE *indexedFiles;
+//////////////////////////////////////////////////////////////////////////
 //
-//    char *nameWithPath;
-//    strcpy(nameWithPath, currentDirectory.content.fileDescriptor.name);
-//    strcat(nameWithPath, fileName); //creates filename with path prepended
+// block deduplication
 //
-//    if (numberOfFilesInDirectory == 0)
-//        return SIMFS_NOT_FOUND_ERROR;
+// On a volume with SIMFS_VOLUME_DEDUPLICATED, a write looks up every data block it is about to store in a
+// fingerprint index and references a block with the same type and content instead of allocating a new one. The
+// fingerprint of a block is its checksum, so the index costs no hashing of its own; blocks whose fingerprints
+// match are compared in full. Each indexed block counts the index entries that point to it and is freed with the
+// last of them. Blocks are never changed in place - a write replaces all blocks of a file - so a file that is
+// rewritten copies on write by dropping its references to the shared blocks. The defragmenter leaves files with
+// shared blocks where they are.
 //
-//    indexedFiles = simfsVolume->block[currentDirectory.content.fileDescriptor.block_ref].content.index;
-//    for (int i = 0; i <= numberOfFilesInDirectory; i++) {
-//        if (i == numberOfFilesInDirectory) {
-//            return SIMFS_NOT_FOUND_ERROR;
-//        }
-//        SIMFS_BLOCK_TYPE currentFileToCheck = simfsVolume->block[indexedFiles[i]];
-//        char *nameToCheck = currentFileToCheck.content.fileDescriptor.name;
-//        if (namesAreSame(nameToCheck, nameWithPath)) {
-//            if ((mask & currentFileToCheck.content.fileDescriptor.accessRights) != mask)
-//                return SIMFS_ACCESS_ERROR;
-//            if (currentFileToCheck.content.fileDescriptor.type == FOLDER_CONTENT_TYPE &&
-//                currentFileToCheck.content.fileDescriptor.size > 0) {
-//                return SIMFS_NOT_EMPTY_ERROR;
-//            } else { //this is the case where we have an empty folder or a file that we have permission to delete
-//                simfsFlipBit(simfsContext->bitvector, indexedFiles[i]); //flip the bit to the node reference
-//                simfsFlipBit(simfsContext->bitvector,
-//                             currentFileToCheck.content.fileDescriptor.block_ref); //flip bit to the reference node;
+// The index is kept in memory only and rebuilt from the index chains of the files on mounting. It is protected
+// by sharingLock rather than directoryLock, because deleted files release their blocks without directoryLock.
 //
-//                //flip bit for each item if the data takes more than one item
-//                numberOfFilesInDirectory = currentFileToCheck.content.fileDescriptor.size;
-//                currentFileToCheck = simfsVolume->block[currentFileToCheck.content.fileDescriptor.block_ref];
-//                for (int i = 0; i < numberOfFilesInDirectory; i++) {
-//                    simfsFlipBit(simfsContext->bitvector, currentFileToCheck.content.index[i]);
-//                }
-//            }
-//        }
-//    }
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Adds a block to the chain of its fingerprint with the given number of references. The caller holds sharingLock.
+ */
+static void simfsDedupLink(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block, unsigned int references) {
+    SIMFS_DEDUP_TYPE *dedup = mount->context->dedup;
+    SIMFS_INDEX_TYPE *bucket = &dedup->bucket[mount->volume->checksum[block] & (SIMFS_DEDUP_BUCKETS - 1)];
 
+    dedup->next[block] = *bucket;
+    *bucket = block;
+    dedup->references[block] = references;
+    dedup->numberOfBlocks++;
 }
 
-//////////////////////////////////////////////////////////////////////////
+/*
+ * Removes a block from the chain of its fingerprint. The caller holds sharingLock.
+ */
+static void simfsDedupUnlink(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block) {
+    SIMFS_DEDUP_TYPE *dedup = mount->context->dedup;
+    SIMFS_INDEX_TYPE *link = &dedup->bucket[mount->volume->checksum[block] & (SIMFS_DEDUP_BUCKETS - 1)];
+
+    while (*link != block)
+        link = &dedup->next[*link];
+    *link = dedup->next[block];
+    dedup->references[block] = 0;
+    dedup->numberOfBlocks--;
+}
 
 /*
- * Finds the file in the in-memory directory and obtains the information about the file from the file descriptor
- * block referenced from the directory.
+ * Releases a fingerprint index; NULL is ignored.
+ */
+static void simfsDedupFree(SIMFS_DEDUP_TYPE *dedup) {
+    if (dedup == NULL)
+        return;
+
+    free(dedup->next);
+    free(dedup->references);
+    free(dedup);
+}
+
+/*
+ * Builds the fingerprint index from the data blocks of all files, including deleted files whose blocks have not
+ * been released yet, but not the versions of descriptors kept for snapshots. The caller holds sharingLock and
+ * directoryLock, unless the volume is being mounted.
+ */
+static SIMFS_ERROR simfsDedupBuild(SIMFS_MOUNT *mount) {
+    SIMFS_DEDUP_TYPE *dedup = malloc(sizeof(SIMFS_DEDUP_TYPE));
+    if (dedup == NULL)
+        return SIMFS_ALLOC_ERROR;
+    dedup->next = malloc(simfsVolumeBlocks(mount->volume) * sizeof(SIMFS_INDEX_TYPE));
+    dedup->references = calloc(simfsVolumeBlocks(mount->volume), sizeof(unsigned int));
+    if (dedup->next == NULL || dedup->references == NULL) {
+        simfsDedupFree(dedup);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    for (size_t i = 0; i < SIMFS_DEDUP_BUCKETS; i++)
+        dedup->bucket[i] = SIMFS_INVALID_INDEX;
+    dedup->numberOfReferences = 0;
+    dedup->numberOfBlocks = 0;
+    mount->context->dedup = dedup;
+
+    for (size_t block = 0; block < simfsVolumeBlocks(mount->volume); block++) {
+        if (((unsigned char) mount->context->bitvector[block / 8] & (0x80 >> (block % 8))) == 0 ||
+            mount->volume->block[block].type != FILE_CONTENT_TYPE || !SIMFS_BLOCK_IS_LIVE(mount->volume, block))
+            continue;
+
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[block].content.fileDescriptor;
+        SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+        size_t numberOfEntries = SIMFS_DATA_BLOCKS(descriptor);
+        for (size_t i = 0; i < numberOfEntries; i++) {
+            if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+                indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+            SIMFS_INDEX_TYPE dataBlock = mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+            if (dataBlock == SIMFS_HOLE || mount->volume->block[dataBlock].type == UNWRITTEN_CONTENT_TYPE)
+                continue;
+            if (dedup->references[dataBlock] == 0)
+                simfsDedupLink(mount, dataBlock, 1);
+            else
+                dedup->references[dataBlock]++;
+            dedup->numberOfReferences++;
+        }
+    }
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Looks for a data block with the type and the SIMFS_DATA_SIZE bytes of data of candidate and adds a reference
+ * to it. The caller holds directoryLock.
  *
- * If the file is not found, then it returns SIMFS_NOT_FOUND_ERROR
+ * Returns the block, or SIMFS_INVALID_INDEX if there is none.
  */
-SIMFS_ERROR simfsGetFileInfo(SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer) {
-    unsigned long hashedName = hash(fileName);
-    SIMFS_DIR_ENT *currentDirectory = simfsContext->directory[hashedName];
-    while (currentDirectory != NULL) {
-        if (strcmp(simfsVolume->block[currentDirectory->nodeReference].content.fileDescriptor.name, fileName) == 0) {
-            infoBuffer = &(simfsVolume->block[currentDirectory->nodeReference].content.fileDescriptor);
-            return SIMFS_NO_ERROR;
+static SIMFS_INDEX_TYPE simfsDedupShare(SIMFS_MOUNT *mount, SIMFS_BLOCK_TYPE *candidate) {
+    unsigned int fingerprint = simfsBlockChecksum(candidate);
+
+    pthread_mutex_lock(&mount->context->sharingLock);
+    SIMFS_DEDUP_TYPE *dedup = mount->context->dedup;
+    SIMFS_INDEX_TYPE block = dedup->bucket[fingerprint & (SIMFS_DEDUP_BUCKETS - 1)];
+    for (; block != SIMFS_INVALID_INDEX; block = dedup->next[block]) {
+        if (mount->volume->checksum[block] == fingerprint && mount->volume->block[block].type == candidate->type &&
+            memcmp(mount->volume->block[block].content.data, candidate->content.data, SIMFS_DATA_SIZE) == 0) {
+            dedup->references[block]++;
+            dedup->numberOfReferences++;
+            break;
         }
-        currentDirectory = (currentDirectory->next);
     }
+    pthread_mutex_unlock(&mount->context->sharingLock);
 
-    return SIMFS_NOT_FOUND_ERROR;
+    return block;
 }
 
-//////////////////////////////////////////////////////////////////////////
+/*
+ * Adds a newly written data block to the index with one reference. The caller holds directoryLock.
+ */
+static void simfsDedupAdd(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block) {
+    pthread_mutex_lock(&mount->context->sharingLock);
+    simfsDedupLink(mount, block, 1);
+    mount->context->dedup->numberOfReferences++;
+    pthread_mutex_unlock(&mount->context->sharingLock);
+}
 
 /*
- * Hashes the name and searches for it in the in-memory directory. If the file does not exist,
- * the SIMFS_NOT_FOUND_ERROR is returned.
- *
- * Otherwise:
- *    - checks the per-process open file table for the process, and if the file has already been opened
- *      it returns the index of the openFileTable with the entry of the file through the parameter fileHandle, and
- *      returns SIMFS_DUPLICATE_ERROR as the return value
- *
- *    - otherwise, checks if there is a global entry for the file, and if so, then:
- *       - it increases the reference count for this file
- *
- *       - otherwise, it creates an entry in the global open file table for the file copying the information
- *         from the file descriptor block referenced from the entry for this file in the directory
+ * Drops a reference to a data block. The caller holds sharingLock.
+ *
+ * Returns true if the block is to be freed: it was the last reference, or the block is not in the index.
+ */
+static bool simfsDedupRelease(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block) {
+    SIMFS_DEDUP_TYPE *dedup = mount->context->dedup;
+    if (dedup == NULL || dedup->references[block] == 0)
+        return true;
+
+    dedup->numberOfReferences--;
+    if (dedup->references[block] > 1) {
+        dedup->references[block]--;
+        return false;
+    }
+    simfsDedupUnlink(mount, block);
+    return true;
+}
+
+/*
+ * Tells whether a file shares any of its data blocks. The caller holds sharingLock.
+ */
+static bool simfsDedupIsShared(SIMFS_MOUNT *mount, SIMFS_FILE_DESCRIPTOR_TYPE *descriptor) {
+    SIMFS_DEDUP_TYPE *dedup = mount->context->dedup;
+    SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+    size_t numberOfEntries = SIMFS_DATA_BLOCKS(descriptor);
+
+    for (size_t i = 0; dedup != NULL && i < numberOfEntries; i++) {
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        SIMFS_INDEX_TYPE dataBlock = mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (dataBlock != SIMFS_HOLE && dedup->references[dataBlock] > 1)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Moves the index entry of a data block to a copy of it with the same fingerprint. The caller holds sharingLock.
+ */
+static void simfsDedupMove(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE from, SIMFS_INDEX_TYPE to) {
+    SIMFS_DEDUP_TYPE *dedup = mount->context->dedup;
+    if (dedup == NULL || dedup->references[from] == 0)
+        return;
+
+    unsigned int references = dedup->references[from];
+    simfsDedupUnlink(mount, from);
+    simfsDedupLink(mount, to, references);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// copy on write for snapshots
+//
+// Writers call simfsSnapshotPreserve() for every descriptor and folder index block before they change it, under
+// directoryLock; a block that no snapshot holds is changed in place as before. Blocks leave the tree through
+// simfsSnapshotRelease(), which keeps the ones that a snapshot holds. The generation of a deleted file is the one
+// in which it was removed from the directory, not the one in which epoch reclamation releases its blocks later.
+//
+// The snapshot table and the generation change under both directoryLock and sharingLock, so either lock is enough
+// to read them: writers hold directoryLock, and the reclamation of deleted files holds sharingLock.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Tells whether a snapshot holds the current version of a block of the live tree. The caller holds directoryLock.
+ */
+static bool simfsSnapshotIsHeld(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block) {
+    return simfsSnapshotHolds(mount->volume, mount->volume->life[block].birth, 0);
+}
+
+/*
+ * Copies a block of the live tree that is about to change in place to a new block if a snapshot holds its current
+ * version; the copy keeps that version for the snapshots, and the block starts a new one. The caller holds
+ * directoryLock.
+ *
+ * Returns false if there is no free block for the copy.
+ */
+static bool simfsSnapshotPreserve(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block) {
+    if (!simfsSnapshotIsHeld(mount, block))
+        return true;
+
+    SIMFS_VOLUME *volume = mount->volume;
+    SIMFS_INDEX_TYPE copy = simfsAllocateBlock(mount, block);
+    if (copy == SIMFS_INVALID_INDEX)
+        return false;
+
+    volume->block[copy] = volume->block[block];
+    volume->checksum[copy] = volume->checksum[block];
+    volume->life[copy].birth = volume->life[block].birth;
+    volume->life[copy].death = volume->generation;
+    volume->life[copy].origin = block;
+    volume->life[block].birth = volume->generation;
+    simfsStatsCount(SIMFS_BLOCKS_PRESERVED_COUNTER, 1);
+
+    return true;
+}
+
+/*
+ * Decides the fate of a block that leaves the tree in the given generation: a block whose version a snapshot holds
+ * keeps its content and only ends its life. The caller holds directoryLock or sharingLock.
+ *
+ * Returns true if the block is to be freed.
+ */
+static bool simfsSnapshotRelease(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block, unsigned int generation) {
+    SIMFS_BLOCK_LIFE_TYPE *life = &mount->volume->life[block];
+    if (!simfsSnapshotHolds(mount->volume, life->birth, generation))
+        return true;
+
+    life->death = generation;
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// in-memory directory
+//
+// Every entry is keyed on the block of the descriptor of the folder of its file and the name of the file in that
+// folder, and holds a copy of the name, so a lookup goes from the entry of the root down one name of the path at a
+// time and never reads a descriptor block; the keys of the content of a folder do not change when it moves.
+//
+// Readers call simfsDirectoryLookup() inside an epoch and never take a lock; the only atomic operations on
+// their path are acquire loads of the table and of the list links. Writers hold directoryLock, publish new
+// entries at the head of the list with a release store, and retire unlinked entries together with the
+// descriptor block they reference, so that a reader never follows an entry to a block that has been reused.
+//
+// The table starts with SIMFS_DIRECTORY_INITIAL_SIZE slots and doubles when it holds more entries than slots
+// (halves when it is less than an eighth full). Resizing builds a complete new table with copies of the entries,
+// publishes it, and retires the old table, so readers that are still walking the old one are not disturbed.
+//
+// On a lazy mount the directory starts with the root folder alone. The children of a folder are added the first
+// time a path goes through it (see simfsDirectoryFault()), and then the entry of the folder is marked loaded with a
+// release store, so a reader that sees the mark finds the children.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Allocates an empty directory table; size must be a power of two.
+ */
+static SIMFS_DIRECTORY *simfsDirectoryAlloc(size_t size) {
+    SIMFS_DIRECTORY *directory = malloc(sizeof(SIMFS_DIRECTORY) + size * sizeof(_Atomic(SIMFS_DIR_ENT *)));
+    if (directory == NULL)
+        return NULL;
+
+    directory->size = size;
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&directory->slot[i], NULL);
+
+    return directory;
+}
+
+/*
+ * Frees a directory table and all entries linked from it.
+ */
+static void simfsDirectoryFree(SIMFS_DIRECTORY *directory) {
+    for (size_t i = 0; i < directory->size; i++) {
+        SIMFS_DIR_ENT *entry = atomic_load_explicit(&directory->slot[i], memory_order_relaxed);
+        while (entry != NULL) {
+            SIMFS_DIR_ENT *next = atomic_load_explicit(&entry->next, memory_order_relaxed);
+            free(entry);
+            entry = next;
+        }
+    }
+
+    free(directory);
+}
+
+static void simfsReclaimDirectory(void *object, void *arg) {
+    simfsDirectoryFree(object);
+}
+
+/*
+ * Returns the hash of the key of an entry: the block of the descriptor of the folder, and the name of length bytes
+ * in it.
+ */
+static inline unsigned long simfsEntryHash(SIMFS_INDEX_TYPE parent, const char *name, size_t length) {
+    unsigned long nameHash = 5381;
+    for (size_t i = 0; i < length; i++)
+        nameHash = ((nameHash << 5) + nameHash) ^ (unsigned char) name[i];
+
+    return nameHash ^ (unsigned long) (SIMFS_INDEX_TYPE) (parent + 1) * 0x9e3779b97f4a7c15UL;
+}
+
+/*
+ * Returns the slot for a name hash; the upper bits are folded in because the table size is a power of two.
+ */
+static inline _Atomic(SIMFS_DIR_ENT *) *simfsDirectorySlot(SIMFS_DIRECTORY *directory, unsigned long nameHash) {
+    return &directory->slot[(nameHash ^ (nameHash >> 17)) & (directory->size - 1)];
+}
+
+/*
+ * Tells whether the descriptor is in a subtree that simfsDeleteTree() detached and has not withdrawn yet, by
+ * following its parents. The caller holds directoryLock.
+ */
+static bool simfsDirectoryIsDetached(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex) {
+    if (mount->context->detachedTrees == NULL)
+        return false;
+
+    for (SIMFS_INDEX_TYPE block = descriptorIndex; block != SIMFS_INVALID_INDEX;
+         block = mount->volume->block[block].content.fileDescriptor.parent) {
+        for (SIMFS_DETACHED_TREE_TYPE *tree = mount->context->detachedTrees; tree != NULL; tree = tree->next) {
+            if (tree->root == block)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Finds the entry for the name of length bytes in the folder with the descriptor in parent. Must be called inside
+ * simfsEpochEnter()/Exit(), or with directoryLock held.
+ */
+static SIMFS_DIR_ENT *simfsDirectoryFind(SIMFS_DIRECTORY *directory, SIMFS_INDEX_TYPE parent, const char *name,
+                                         size_t length) {
+    unsigned long nameHash = simfsEntryHash(parent, name, length);
+
+    SIMFS_DIR_ENT *entry = atomic_load_explicit(simfsDirectorySlot(directory, nameHash), memory_order_acquire);
+    unsigned int chainLength = 0;
+    while (entry != NULL) {
+        chainLength++;
+        if (entry->nameHash == nameHash && entry->parent == parent && strncmp(entry->name, name, length) == 0 &&
+            entry->name[length] == '\0')
+            break;
+        entry = atomic_load_explicit(&entry->next, memory_order_acquire);
+    }
+
+    simfsStatsChainLength(chainLength);
+    return entry;
+}
+
+/*
+ * Finds the directory entry for a name with the full path, one name of the path at a time from the root; a path
+ * with an empty name in it is not found, and neither is anything in a subtree that simfsDeleteTree() detached,
+ * since the entry of its root is gone. Must be called inside simfsEpochEnter()/Exit(), or with directoryLock held.
+ */
+static SIMFS_DIR_ENT *simfsDirectoryLookup(SIMFS_MOUNT *mount, char *nameWithPath) {
+    if (nameWithPath[0] != '/')
+        return NULL;
+
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_acquire);
+    SIMFS_DIR_ENT *entry = simfsDirectoryFind(directory, SIMFS_INVALID_INDEX, "/", 1);
+    for (char *name = nameWithPath + 1; entry != NULL && *name != '\0';) {
+        size_t length = strcspn(name, "/");
+        entry = length > 0 ? simfsDirectoryFind(directory, entry->nodeReference, name, length) : NULL;
+        name += length;
+        if (*name == '/' && *++name == '\0')
+            entry = NULL; // a trailing separator names nothing
+    }
+
+    return entry;
+}
+
+/*
+ * Finds the directory entry that references the descriptor, under the name and in the folder that the descriptor
+ * holds, also in a detached subtree. The caller holds directoryLock.
+ */
+static SIMFS_DIR_ENT *simfsDirectoryFindDescriptor(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    unsigned long nameHash = simfsEntryHash(descriptor->parent, descriptor->name,
+                                            strnlen(descriptor->name, SIMFS_MAX_NAME_LENGTH));
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+
+    SIMFS_DIR_ENT *entry = atomic_load_explicit(simfsDirectorySlot(directory, nameHash), memory_order_relaxed);
+    while (entry != NULL && entry->nodeReference != descriptorIndex)
+        entry = atomic_load_explicit(&entry->next, memory_order_relaxed);
+
+    return entry;
+}
+
+/*
+ * Builds a table of newSize slots with copies of the entries of the directory, pointing each copy and its folder
+ * to their places in the relocation map if one is given. The caller holds directoryLock.
+ *
+ * Returns NULL if there is no memory.
+ */
+static SIMFS_DIRECTORY *simfsDirectoryCopy(SIMFS_MOUNT *mount, size_t newSize, const SIMFS_INDEX_TYPE *relocation) {
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+    SIMFS_DIRECTORY *newDirectory = simfsDirectoryAlloc(newSize);
+    if (newDirectory == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < directory->size; i++) {
+        SIMFS_DIR_ENT *entry = atomic_load_explicit(&directory->slot[i], memory_order_relaxed);
+        for (; entry != NULL; entry = atomic_load_explicit(&entry->next, memory_order_relaxed)) {
+            size_t length = strlen(entry->name);
+            SIMFS_DIR_ENT *copy = malloc(sizeof(SIMFS_DIR_ENT) + length + 1);
+            if (copy == NULL) {
+                simfsDirectoryFree(newDirectory);
+                return NULL;
+            }
+            copy->nodeReference = relocation != NULL ? relocation[entry->nodeReference] : entry->nodeReference;
+            copy->parent = relocation != NULL && entry->parent != SIMFS_INVALID_INDEX ? relocation[entry->parent] :
+                           entry->parent;
+            copy->nameHash = relocation != NULL ? simfsEntryHash(copy->parent, entry->name, length) : entry->nameHash;
+            memcpy(copy->name, entry->name, length + 1);
+            _Atomic(SIMFS_DIR_ENT *) *slot = simfsDirectorySlot(newDirectory, copy->nameHash);
+            atomic_init(&copy->loaded, atomic_load_explicit(&entry->loaded, memory_order_relaxed));
+            atomic_init(&copy->next, atomic_load_explicit(slot, memory_order_relaxed));
+            atomic_store_explicit(slot, copy, memory_order_relaxed);
+        }
+    }
+
+    return newDirectory;
+}
+
+/*
+ * Makes a table built by simfsDirectoryCopy() the directory and retires the old one. The caller holds
+ * directoryLock.
+ */
+static void simfsDirectoryPublish(SIMFS_MOUNT *mount, SIMFS_DIRECTORY *newDirectory) {
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+
+    atomic_store_explicit(&mount->context->directory, newDirectory, memory_order_release);
+    simfsEpochRetire(directory, simfsReclaimDirectory, NULL);
+}
+
+/*
+ * Replaces the directory table with one of newSize slots. The caller holds directoryLock.
+ *
+ * If there is no memory for the new table the old one is kept; it only gets slower.
+ */
+static void simfsDirectoryResize(SIMFS_MOUNT *mount, size_t newSize) {
+    SIMFS_DIRECTORY *newDirectory = simfsDirectoryCopy(mount, newSize, NULL);
+    if (newDirectory != NULL)
+        simfsDirectoryPublish(mount, newDirectory);
+}
+
+/*
+ * Reclaims an unlinked directory entry and the blocks of the file it referenced once no reader can see them.
+ */
+static void simfsReclaimDirEnt(void *object, void *arg) {
+    SIMFS_DIR_ENT *entry = object;
+    SIMFS_MOUNT *mount = arg;
+
+    simfsReleaseFileBlocks(mount, entry->nodeReference, entry->generation);
+    free(entry);
+}
+
+/*
+ * Unlinks the entry from the conflict resolution list of its slot and retires it with reclaim. The caller holds
+ * directoryLock.
+ */
+static void simfsDirectoryUnlink(SIMFS_MOUNT *mount, SIMFS_DIR_ENT *entry, SIMFS_RECLAIM_FUNCTION reclaim) {
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+    _Atomic(SIMFS_DIR_ENT *) *link = simfsDirectorySlot(directory, entry->nameHash);
+
+    SIMFS_DIR_ENT *current = atomic_load_explicit(link, memory_order_relaxed);
+    while (current != entry) {
+        link = &current->next;
+        current = atomic_load_explicit(link, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(link, atomic_load_explicit(&entry->next, memory_order_relaxed), memory_order_release);
+    mount->context->directoryNameBytes -= strlen(entry->name) + 1;
+    entry->generation = mount->volume->generation;
+    simfsEpochRetire(entry, reclaim, mount);
+
+    if (--mount->context->numberOfDirectoryEntries < directory->size / 8 &&
+        directory->size > SIMFS_DIRECTORY_INITIAL_SIZE)
+        simfsDirectoryResize(mount, directory->size / 2);
+}
+
+/*
+ * Unlinks the entry from the directory; the blocks of its file are freed when the entry is reclaimed. The caller
+ * holds directoryLock.
+ */
+static void simfsDirectoryRemove(SIMFS_MOUNT *mount, SIMFS_DIR_ENT *entry) {
+    simfsDirectoryUnlink(mount, entry, simfsReclaimDirEnt);
+}
+
+/*
+ * Reclaims an unlinked directory entry whose file is freed by someone else.
+ */
+static void simfsReclaimDirEntOnly(void *object, void *arg) {
+    free(object);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// descriptor sequences
+//
+// Readers copy file descriptors without directoryLock, so every block has a sequence count for the descriptor in
+// it. A writer, holding directoryLock, makes the count odd before it changes a descriptor that readers can reach
+// and even again once the descriptor is consistent. A reader keeps its copy only if the count was even before the
+// copy and unchanged after it, so the copy is the descriptor as it stood between two changes, never a mix of both;
+// it waits out a change in progress. A change is not nested in another change of the same descriptor.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Starts a change of the descriptor in the block descriptorIndex. The caller holds directoryLock.
+ */
+static void simfsDescriptorChangeBegin(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex) {
+    atomic_fetch_add_explicit(&mount->context->descriptorSequences[descriptorIndex], 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); // the count is odd before any part of the change is seen
+}
+
+/*
+ * Ends a change of the descriptor in the block descriptorIndex. The caller holds directoryLock.
+ */
+static void simfsDescriptorChangeEnd(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex) {
+    atomic_fetch_add_explicit(&mount->context->descriptorSequences[descriptorIndex], 1, memory_order_release);
+}
+
+/*
+ * Copies the descriptor in the block descriptorIndex into copy, as it stands between two changes. The caller is in
+ * an epoch, so the block is not reclaimed during the copy.
+ */
+static void simfsDescriptorCopy(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex,
+                                SIMFS_FILE_DESCRIPTOR_TYPE *copy) {
+    _Atomic unsigned int *sequence = &mount->context->descriptorSequences[descriptorIndex];
+    for (;;) {
+        unsigned int before = atomic_load_explicit(sequence, memory_order_acquire);
+        if (before % 2 == 0) {
+            memcpy(copy, &mount->volume->block[descriptorIndex].content.fileDescriptor, sizeof(*copy));
+            atomic_thread_fence(memory_order_acquire); // the copy is complete before the count is read again
+            if (atomic_load_explicit(sequence, memory_order_relaxed) == before)
+                return;
+        }
+        sched_yield(); // a write of a large file keeps its descriptor changing for a while
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// folder index chains
+//
+// The children of a folder are referenced from a chain of index blocks. The first SIMFS_INDEX_ENTRIES_PER_BLOCK
+// slots of an index block point to file descriptor blocks, and the last slot links to the next index block.
+// The size of the folder descriptor is the number of children, so the k-th child is in the slot
+// k % SIMFS_INDEX_ENTRIES_PER_BLOCK of the (k / SIMFS_INDEX_ENTRIES_PER_BLOCK)-th index block.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns the index block of a folder that holds the slot for the child number position; for a file, the one that
+ * holds the entry of its data block number position.
+ */
+static SIMFS_INDEX_TYPE simfsIndexBlockForPosition(SIMFS_MOUNT *mount, SIMFS_FILE_DESCRIPTOR_TYPE *folder, size_t position) {
+    SIMFS_INDEX_TYPE indexBlock = folder->block_ref;
+    for (size_t i = 0; i < position / SIMFS_INDEX_ENTRIES_PER_BLOCK; i++)
+        indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+
+    return indexBlock;
+}
+
+/*
+ * Adds a reference to the child descriptor at the end of the index chain of the folder, extending
+ * the chain with a new index block if the last one is full.
+ */
+static SIMFS_ERROR simfsIndexAppend(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex, SIMFS_INDEX_TYPE childIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = &mount->volume->block[folderIndex].content.fileDescriptor;
+    size_t position = folder->size;
+
+    // the folder and its last index block, which gets the entry or the link to a new one, change in place
+    SIMFS_INDEX_TYPE lastBlock = simfsIndexBlockForPosition(mount, folder, position > 0 ? position - 1 : 0);
+    if (!simfsSnapshotPreserve(mount, folderIndex) || !simfsSnapshotPreserve(mount, lastBlock))
+        return SIMFS_ALLOC_ERROR;
+
+    if (position > 0 && position % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0) {
+        SIMFS_INDEX_TYPE newBlock = simfsAllocateBlock(mount, lastBlock);
+        if (newBlock == SIMFS_INVALID_INDEX)
+            return SIMFS_ALLOC_ERROR;
+        mount->volume->block[newBlock].type = INDEX_CONTENT_TYPE;
+        mount->volume->block[lastBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK] = newBlock;
+    }
+
+    SIMFS_INDEX_TYPE indexBlock = simfsIndexBlockForPosition(mount, folder, position);
+    mount->volume->block[indexBlock].content.index[position % SIMFS_INDEX_ENTRIES_PER_BLOCK] = childIndex;
+    simfsDescriptorChangeBegin(mount, folderIndex);
+    folder->size++;
+    simfsDescriptorChangeEnd(mount, folderIndex);
+    if (position > 0 && position % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+        simfsChecksumUpdate(mount, lastBlock);
+    simfsChecksumUpdate(mount, indexBlock);
+    simfsChecksumUpdate(mount, folderIndex);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Removes the reference to the child descriptor from the index chain of the folder by moving the last
+ * reference into its slot; an index block that becomes empty is freed, except for the first one.
+ *
+ * Returns SIMFS_ALLOC_ERROR, leaving the folder as it was, if a block held by a snapshot cannot be preserved.
+ */
+static SIMFS_ERROR simfsIndexRemove(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex, SIMFS_INDEX_TYPE childIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = &mount->volume->block[folderIndex].content.fileDescriptor;
+    size_t last = folder->size - 1;
+
+    SIMFS_INDEX_TYPE indexBlock = folder->block_ref;
+    for (size_t i = 0; i < folder->size; i++) {
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK] == childIndex) {
+            if (!simfsSnapshotPreserve(mount, folderIndex) || !simfsSnapshotPreserve(mount, indexBlock))
+                return SIMFS_ALLOC_ERROR;
+            SIMFS_INDEX_TYPE lastBlock = simfsIndexBlockForPosition(mount, folder, last);
+            mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK] =
+                    mount->volume->block[lastBlock].content.index[last % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+            if (last > 0 && last % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0 &&
+                simfsSnapshotRelease(mount, lastBlock, mount->volume->generation)) {
+                mount->volume->block[lastBlock].type = INVALID_CONTENT_TYPE;
+                simfsReleaseBlock(mount, lastBlock);
+            }
+            simfsDescriptorChangeBegin(mount, folderIndex);
+            folder->size--;
+            simfsDescriptorChangeEnd(mount, folderIndex);
+            simfsChecksumUpdate(mount, indexBlock);
+            simfsChecksumUpdate(mount, folderIndex);
+            return SIMFS_NO_ERROR;
+        }
+    }
+
+    return SIMFS_NOT_FOUND_ERROR;
+}
+
+/*
+ * Puts the reference to newChild in the slot of the reference to oldChild in the index chain of the folder, so the
+ * size of the folder and the order of its children stay as they are.
+ *
+ * Returns SIMFS_NOT_FOUND_ERROR if the folder has no such child, and SIMFS_ALLOC_ERROR, leaving the folder as it
+ * was, if a block held by a snapshot cannot be preserved.
+ */
+static SIMFS_ERROR simfsIndexReplace(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex, SIMFS_INDEX_TYPE oldChild,
+                                     SIMFS_INDEX_TYPE newChild) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = &mount->volume->block[folderIndex].content.fileDescriptor;
+
+    SIMFS_INDEX_TYPE indexBlock = folder->block_ref;
+    for (size_t i = 0; i < folder->size; i++) {
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK] == oldChild) {
+            if (!simfsSnapshotPreserve(mount, indexBlock))
+                return SIMFS_ALLOC_ERROR;
+            mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK] = newChild;
+            simfsChecksumUpdate(mount, indexBlock);
+            return SIMFS_NO_ERROR;
+        }
+    }
+
+    return SIMFS_NOT_FOUND_ERROR;
+}
+
+/*
+ * Returns the number of index blocks of a chain with numberOfEntries entries; a chain has at least one.
+ */
+static size_t simfsIndexChainBlocks(size_t numberOfEntries) {
+    return numberOfEntries > 0 ? (numberOfEntries + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK :
+           1;
+}
+
+/*
+ * Adds the references to count child descriptors at the end of the index chain of the folder, walking the chain
+ * once. The chain grows by the blocks in newBlocks, which has simfsIndexChainBlocks() of the new size less that of
+ * the old size of them, allocated by the caller.
+ *
+ * Returns SIMFS_ALLOC_ERROR, leaving the folder as it was, if a block held by a snapshot cannot be preserved.
+ */
+static SIMFS_ERROR simfsIndexAppendMany(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex,
+                                        const SIMFS_INDEX_TYPE *children, size_t count,
+                                        const SIMFS_INDEX_TYPE *newBlocks) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = &mount->volume->block[folderIndex].content.fileDescriptor;
+    size_t position = folder->size;
+
+    SIMFS_INDEX_TYPE indexBlock = simfsIndexBlockForPosition(mount, folder, position > 0 ? position - 1 : 0);
+    if (!simfsSnapshotPreserve(mount, folderIndex) || !simfsSnapshotPreserve(mount, indexBlock))
+        return SIMFS_ALLOC_ERROR;
+
+    for (size_t i = 0; i < count; i++, position++) {
+        if (position > 0 && position % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0) {
+            SIMFS_INDEX_TYPE newBlock = *newBlocks++;
+            mount->volume->block[newBlock].type = INDEX_CONTENT_TYPE;
+            mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK] = newBlock;
+            simfsChecksumUpdate(mount, indexBlock);
+            indexBlock = newBlock;
+        }
+        mount->volume->block[indexBlock].content.index[position % SIMFS_INDEX_ENTRIES_PER_BLOCK] = children[i];
+    }
+    simfsDescriptorChangeBegin(mount, folderIndex);
+    folder->size = position;
+    simfsDescriptorChangeEnd(mount, folderIndex);
+    simfsChecksumUpdate(mount, indexBlock);
+    simfsChecksumUpdate(mount, folderIndex);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Removes the references to the count child descriptors in children, sorted by block, from the index chain of the
+ * folder in one walk: the references that stay move up in order, and the index blocks left empty at the end are
+ * freed, except for the first one.
+ *
+ * Returns SIMFS_ALLOC_ERROR, leaving the folder as it was, if a block held by a snapshot cannot be preserved.
+ */
+static SIMFS_ERROR simfsIndexRemoveMany(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex,
+                                        const SIMFS_INDEX_TYPE *children, size_t count) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = &mount->volume->block[folderIndex].content.fileDescriptor;
+    size_t size = folder->size;
+    if (!simfsSnapshotPreserve(mount, folderIndex))
+        return SIMFS_ALLOC_ERROR;
+
+    // the block with the first reference to remove and all blocks after it change in place
+    SIMFS_INDEX_TYPE indexBlock = folder->block_ref;
+    SIMFS_INDEX_TYPE firstChanged = SIMFS_INVALID_INDEX;
+    size_t firstPosition = size;
+    for (size_t i = 0; i < size; i++) {
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0) {
+            indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+            if (firstChanged != SIMFS_INVALID_INDEX && !simfsSnapshotPreserve(mount, indexBlock))
+                return SIMFS_ALLOC_ERROR;
+        }
+        SIMFS_INDEX_TYPE child = mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (firstChanged == SIMFS_INVALID_INDEX &&
+            bsearch(&child, children, count, sizeof(SIMFS_INDEX_TYPE), simfsCompareIndices) != NULL) {
+            firstChanged = indexBlock;
+            firstPosition = i - i % SIMFS_INDEX_ENTRIES_PER_BLOCK;
+            if (!simfsSnapshotPreserve(mount, indexBlock))
+                return SIMFS_ALLOC_ERROR;
+        }
+    }
+    if (firstChanged == SIMFS_INVALID_INDEX)
+        return SIMFS_NO_ERROR;
+
+    // the write position never passes the read position, so the links ahead are intact
+    SIMFS_INDEX_TYPE readBlock = firstChanged, writeBlock = firstChanged;
+    size_t kept = firstPosition;
+    for (size_t i = firstPosition; i < size; i++) {
+        if (i > firstPosition && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            readBlock = mount->volume->block[readBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        SIMFS_INDEX_TYPE child = mount->volume->block[readBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (bsearch(&child, children, count, sizeof(SIMFS_INDEX_TYPE), simfsCompareIndices) != NULL)
+            continue;
+        if (kept > firstPosition && kept % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            writeBlock = mount->volume->block[writeBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        mount->volume->block[writeBlock].content.index[kept++ % SIMFS_INDEX_ENTRIES_PER_BLOCK] = child;
+    }
+
+    size_t keptBlocks = simfsIndexChainBlocks(kept);
+    size_t chainBlocks = simfsIndexChainBlocks(size);
+    indexBlock = firstChanged;
+    for (size_t block = firstPosition / SIMFS_INDEX_ENTRIES_PER_BLOCK; block < chainBlocks; block++) {
+        SIMFS_INDEX_TYPE nextBlock = block + 1 < chainBlocks ?
+                                     mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK] :
+                                     SIMFS_INVALID_INDEX;
+        if (block < keptBlocks)
+            simfsChecksumUpdate(mount, indexBlock);
+        else if (simfsSnapshotRelease(mount, indexBlock, mount->volume->generation)) {
+            mount->volume->block[indexBlock].type = INVALID_CONTENT_TYPE;
+            simfsReleaseBlock(mount, indexBlock);
+        }
+        indexBlock = nextBlock;
+    }
+    simfsDescriptorChangeBegin(mount, folderIndex);
+    folder->size = kept;
+    simfsDescriptorChangeEnd(mount, folderIndex);
+    simfsChecksumUpdate(mount, folderIndex);
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// online defragmentation
+//
+// The defragmenter moves the blocks of a file - every index block followed by the data blocks it references, the
+// order in which a read visits them - or the index chain of a folder into one run of free blocks. The copy is
+// complete before the descriptor is switched over to it with a single store, and the old blocks are freed after
+// that. All of it happens under directoryLock, which every reader and writer of file content and index chains
+// holds as well, so no operation sees a file half moved. Descriptor blocks stay where they are, because the
+// directory, the open file tables, and the index chains of the parent folders refer to them.
+//
+// The files are found through the in-memory directory, which holds exactly the files that have not been deleted;
+// the blocks of deleted files are freed by epoch reclamation without directoryLock and must not be touched. Files
+// that a snapshot holds stay where they are as well, since moving them would keep both copies.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Finds length free blocks in a row, searching from the block start to the end of the blocks in service and then
+ * from the beginning of the volume. The caller holds directoryLock, so no block can be allocated before it takes
+ * the run; blocks are still freed concurrently, and the lock of each group keeps its bytes of the bitvector stable
+ * while they are searched.
+ *
+ * Returns SIMFS_INVALID_INDEX if there is no such run.
+ */
+static SIMFS_INDEX_TYPE simfsFindFreeRun(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE start, size_t length) {
+    unsigned char *bitvector = (unsigned char *) mount->context->bitvector;
+    SIMFS_INDEX_TYPE runStart = SIMFS_INVALID_INDEX;
+    size_t numberOfBlocks = simfsVolumeBlocks(mount->volume);
+    if (start >= numberOfBlocks)
+        start = 0;
+
+    for (unsigned int pass = 0; pass < 2 && runStart == SIMFS_INVALID_INDEX; pass++) {
+        size_t from = pass == 0 ? start : 0;
+        size_t to = pass == 0 ? numberOfBlocks : start;
+        size_t freeRun = 0;
+        for (size_t block = from; block < to && runStart == SIMFS_INVALID_INDEX;) {
+            SIMFS_ALLOCATION_GROUP_TYPE *allocationGroup =
+                    &mount->context->allocationGroups[block / SIMFS_BLOCKS_PER_ALLOCATION_GROUP];
+            size_t groupEnd = (block / SIMFS_BLOCKS_PER_ALLOCATION_GROUP + 1) * SIMFS_BLOCKS_PER_ALLOCATION_GROUP;
+            groupEnd = groupEnd < to ? groupEnd : to;
+
+            pthread_mutex_lock(&allocationGroup->lock);
+            for (; block < groupEnd; block++) {
+                if (bitvector[block / 8] & (0x80 >> (block % 8))) {
+                    freeRun = 0;
+                } else if (++freeRun == length) {
+                    runStart = (SIMFS_INDEX_TYPE) (block + 1 - length);
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&allocationGroup->lock);
+        }
+    }
+
+    return runStart;
+}
+
+/*
+ * Moves the blocks of the file or folder in the block descriptorIndex to one run of free blocks if they form more
+ * than one extent. The caller holds directoryLock.
+ *
+ * Returns the number of blocks moved; 0 if the blocks are contiguous already or there is no run large enough.
+ */
+static size_t simfsDefragmentFile(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    if (simfsFileExtents(mount->volume, descriptorIndex) <= 1 || simfsSnapshotIsHeld(mount, descriptorIndex) ||
+        simfsSnapshotIsHeld(mount, descriptor->block_ref))
+        return 0;
+
+    bool isFile = descriptor->type == FILE_CONTENT_TYPE;
+    if (isFile) { // a shared block would have to stay where the other references expect it
+        pthread_mutex_lock(&mount->context->sharingLock);
+        bool isShared = simfsDedupIsShared(mount, descriptor);
+        pthread_mutex_unlock(&mount->context->sharingLock);
+        if (isShared)
+            return 0;
+    }
+    size_t numberOfEntries = isFile ? SIMFS_DATA_BLOCKS(descriptor) : descriptor->size;
+    size_t numberOfIndexBlocks = numberOfEntries == 0 ? 1 :
+                                 (numberOfEntries + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK;
+    size_t numberOfBlocks = numberOfIndexBlocks +
+                            (isFile ? numberOfEntries - simfsFileHoles(mount->volume, descriptorIndex) : 0);
+
+    SIMFS_INDEX_TYPE first = simfsFindFreeRun(mount, descriptorIndex + 1, numberOfBlocks);
+    if (first == SIMFS_INVALID_INDEX)
+        return 0;
+    for (size_t i = 0; i < numberOfBlocks; i++) {
+        SIMFS_INDEX_TYPE block = simfsAllocateBlock(mount, first + i);
+        if (block != first + i) { // cannot happen while directoryLock is held; give back what was taken
+            if (block != SIMFS_INVALID_INDEX)
+                simfsReleaseBlock(mount, block);
+            while (i-- > 0)
+                simfsReleaseBlock(mount, first + i);
+            return 0;
+        }
+    }
+
+    // copy the blocks into the run in the order of a read, pointing the copied index blocks to the copies; holes
+    // stay holes in the copies
+    SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+    SIMFS_INDEX_TYPE target = first;
+    for (size_t i = 0; i < numberOfIndexBlocks; i++) {
+        SIMFS_INDEX_TYPE newIndexBlock = target++;
+        SIMFS_INDEX_TYPE *index = mount->volume->block[indexBlock].content.index;
+        mount->volume->block[newIndexBlock] = mount->volume->block[indexBlock];
+
+        for (size_t j = 0; isFile && j < SIMFS_INDEX_ENTRIES_PER_BLOCK &&
+                           i * SIMFS_INDEX_ENTRIES_PER_BLOCK + j < numberOfEntries; j++) {
+            if (index[j] == SIMFS_HOLE)
+                continue;
+            mount->volume->block[target] = mount->volume->block[index[j]];
+            mount->volume->block[newIndexBlock].content.index[j] = target++;
+        }
+        if (i + 1 < numberOfIndexBlocks)
+            mount->volume->block[newIndexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK] = target;
+        indexBlock = index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+    }
+
+    for (size_t i = 0; i < numberOfBlocks; i++)
+        simfsChecksumUpdate(mount, first + i);
+
+    SIMFS_INDEX_TYPE oldChain = descriptor->block_ref;
+    simfsDescriptorChangeBegin(mount, descriptorIndex);
+    descriptor->block_ref = first;
+    simfsDescriptorChangeEnd(mount, descriptorIndex);
+    simfsChecksumUpdate(mount, descriptorIndex);
+    pthread_mutex_lock(&mount->context->sharingLock);
+    SIMFS_INDEX_TYPE oldIndexBlock = oldChain;
+    SIMFS_INDEX_TYPE newIndexBlock = first;
+    for (size_t i = 0; isFile && i < numberOfEntries; i++) { // the copies take over the entries in the index
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0) {
+            oldIndexBlock = mount->volume->block[oldIndexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+            newIndexBlock = mount->volume->block[newIndexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        }
+        SIMFS_INDEX_TYPE dataBlock = mount->volume->block[oldIndexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (dataBlock != SIMFS_HOLE)
+            simfsDedupMove(mount, dataBlock,
+                           mount->volume->block[newIndexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK]);
+    }
+    simfsReleaseIndexChain(mount, oldChain, isFile ? numberOfEntries : descriptor->size, isFile,
+                           mount->volume->generation);
+    pthread_mutex_unlock(&mount->context->sharingLock);
+
+    return numberOfBlocks;
+}
+
+/*
+ * Defragments files and folders, continuing where the previous call stopped, until maxBlocks blocks were moved or
+ * every file was examined once. directoryLock is released every SIMFS_DEFRAGMENT_SLOTS_PER_LOCK directory slots,
+ * so that other operations are not held up by a long pass.
+ *
+ * Returns the number of blocks moved; a file is never moved partially, so the number may exceed maxBlocks.
+ */
+size_t simfsDefragment(SIMFS_MOUNT *mount, size_t maxBlocks) {
+    size_t movedBlocks = 0;
+    if (mount->context->readOnly)
+        return 0;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+    for (size_t examined = 0; examined < directory->size && movedBlocks < maxBlocks; examined++) {
+        if (examined > 0 && examined % SIMFS_DEFRAGMENT_SLOTS_PER_LOCK == 0) {
+            pthread_mutex_unlock(&mount->context->directoryLock);
+            pthread_mutex_lock(&mount->context->directoryLock);
+            // the directory may have been resized in between; the cursor then just moves on in the new one
+            directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+        }
+
+        if (mount->context->defragmentCursor >= directory->size)
+            mount->context->defragmentCursor = 0;
+        size_t slot = mount->context->defragmentCursor++;
+
+        SIMFS_DIR_ENT *entry = atomic_load_explicit(&directory->slot[slot], memory_order_relaxed);
+        for (; entry != NULL; entry = atomic_load_explicit(&entry->next, memory_order_relaxed)) {
+            // the chains of a detached subtree stay as they are while its deletion walks them
+            if (!simfsDirectoryIsDetached(mount, entry->nodeReference))
+                movedBlocks += simfsDefragmentFile(mount, entry->nodeReference);
+        }
+    }
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    return movedBlocks;
+}
+
+/*
+ * Body of the background defragmenter. After moving n blocks it sleeps n / defragmentRate seconds, and after a
+ * pass over the whole volume that moved nothing it sleeps SIMFS_DEFRAGMENT_IDLE_SECONDS.
+ */
+static void *simfsDefragmentThread(void *arg) {
+    SIMFS_MOUNT *mount = arg;
+    SIMFS_CONTEXT_TYPE *context = mount->context;
+
+    pthread_mutex_lock(&context->defragmentLock);
+    while (context->defragmentRunning) {
+        pthread_mutex_unlock(&context->defragmentLock);
+        size_t movedBlocks = simfsDefragment(mount, SIMFS_DEFRAGMENT_BATCH_BLOCKS);
+        pthread_mutex_lock(&context->defragmentLock);
+
+        struct timespec wakeUp;
+        clock_gettime(CLOCK_REALTIME, &wakeUp);
+        if (movedBlocks == 0)
+            wakeUp.tv_sec += SIMFS_DEFRAGMENT_IDLE_SECONDS;
+        else {
+            unsigned long nanoseconds = movedBlocks * 1000000000UL / context->defragmentRate;
+            nanoseconds += wakeUp.tv_nsec;
+            wakeUp.tv_sec += nanoseconds / 1000000000UL;
+            wakeUp.tv_nsec = nanoseconds % 1000000000UL;
+        }
+        while (context->defragmentRunning &&
+               pthread_cond_timedwait(&context->defragmentCondition, &context->defragmentLock, &wakeUp) == 0);
+    }
+    pthread_mutex_unlock(&context->defragmentLock);
+
+    return NULL;
+}
+
+/*
+ * Starts a background thread that defragments the volume while it is in use, moving at most blocksPerSecond blocks
+ * per second. Returns SIMFS_DUPLICATE_ERROR if the defragmenter of the mount is running already, and
+ * SIMFS_ACCESS_ERROR if the mount is read-only.
+ */
+SIMFS_ERROR simfsDefragmentStart(SIMFS_MOUNT *mount, unsigned int blocksPerSecond) {
+    if (blocksPerSecond == 0)
+        return SIMFS_ALLOC_ERROR;
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    pthread_mutex_lock(&mount->context->defragmentLock);
+    if (mount->context->defragmentRunning)
+        error = SIMFS_DUPLICATE_ERROR;
+    else {
+        mount->context->defragmentRate = blocksPerSecond;
+        mount->context->defragmentRunning = true;
+        if (pthread_create(&mount->context->defragmentThread, NULL, simfsDefragmentThread, mount) != 0) {
+            mount->context->defragmentRunning = false;
+            error = SIMFS_ALLOC_ERROR;
+        }
+    }
+    pthread_mutex_unlock(&mount->context->defragmentLock);
+
+    return error;
+}
+
+/*
+ * Stops the background defragmenter and waits until it is gone; a file being moved is finished first.
+ * Returns SIMFS_NOT_FOUND_ERROR if it was not running.
+ */
+SIMFS_ERROR simfsDefragmentStop(SIMFS_MOUNT *mount) {
+    pthread_mutex_lock(&mount->context->defragmentLock);
+    bool running = mount->context->defragmentRunning;
+    mount->context->defragmentRunning = false;
+    pthread_cond_signal(&mount->context->defragmentCondition);
+    pthread_mutex_unlock(&mount->context->defragmentLock);
+
+    if (!running)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    pthread_join(mount->context->defragmentThread, NULL);
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// process control blocks and open file tables
+//
+// The global open file table is a set of chunks of SIMFS_OPEN_FILE_CHUNK_SIZE entries; a chunk is allocated when
+// an entry in it is first needed and freed when its last file is closed. The table of a process starts in the
+// SIMFS_INLINE_OPEN_FILES_PER_PROCESS slots inside its control block and moves to a heap array that doubles as
+// needed, up to SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS. Everything here is protected by openFileLock.
+//
+//////////////////////////////////////////////////////////////////////////
+
+static SIMFS_PROCESS_CONTROL_BLOCK_TYPE *simfsFindProcessControlBlock(SIMFS_MOUNT *mount, pid_t pid) {
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = mount->context->processControlBlocks;
+    while (pcb != NULL && pcb->pid != pid)
+        pcb = pcb->next;
+
+    return pcb;
+}
+
+/*
+ * Creates a process control block with the root of the volume as the working directory and no open files.
+ */
+static SIMFS_PROCESS_CONTROL_BLOCK_TYPE *simfsAddProcessControlBlock(SIMFS_MOUNT *mount, pid_t pid) {
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = calloc(1, sizeof(SIMFS_PROCESS_CONTROL_BLOCK_TYPE));
+    if (pcb == NULL)
+        return NULL;
+
+    pcb->pid = pid;
+    pcb->numberOfOpenFiles = 0;
+    pcb->capacity = SIMFS_INLINE_OPEN_FILES_PER_PROCESS;
+    pcb->currentWorkingDirectory = mount->volume->superblock.attr.rootNodeIndex;
+    pcb->openFileTable = pcb->inlineOpenFileTable;
+    pcb->next = mount->context->processControlBlocks;
+    mount->context->processControlBlocks = pcb;
+
+    return pcb;
+}
+
+static void simfsFreeProcessControlBlock(SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb) {
+    for (int i = 0; i < pcb->capacity; i++)
+        free(pcb->openFileTable[i].listing);
+    if (pcb->openFileTable != pcb->inlineOpenFileTable)
+        free(pcb->openFileTable);
+    free(pcb);
+}
+
+static void simfsRemoveProcessControlBlock(SIMFS_MOUNT *mount, SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb) {
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE **link = &mount->context->processControlBlocks;
+    while (*link != pcb)
+        link = &(*link)->next;
+
+    *link = pcb->next;
+    simfsFreeProcessControlBlock(pcb);
+}
+
+/*
+ * Returns a free slot of the per-process open file table, growing the table if it is full, or -1.
+ */
+static int simfsFindFreeProcessSlot(SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb) {
+    for (int i = 0; i < pcb->capacity; i++) {
+        if (pcb->openFileTable[i].globalEntry == NULL)
+            return i;
+    }
+
+    if (pcb->capacity >= SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS)
+        return -1;
+
+    int newCapacity = pcb->capacity * 2 < SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS ?
+                      pcb->capacity * 2 : SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS;
+    SIMFS_PER_PROCESS_OPEN_FILE_TYPE *newTable = calloc(newCapacity, sizeof(SIMFS_PER_PROCESS_OPEN_FILE_TYPE));
+    if (newTable == NULL)
+        return -1;
+
+    memcpy(newTable, pcb->openFileTable, pcb->capacity * sizeof(SIMFS_PER_PROCESS_OPEN_FILE_TYPE));
+    if (pcb->openFileTable != pcb->inlineOpenFileTable)
+        free(pcb->openFileTable);
+    pcb->openFileTable = newTable;
+
+    int freeSlot = pcb->capacity;
+    pcb->capacity = newCapacity;
+    return freeSlot;
+}
+
+/*
+ * Returns the entry of the per-process open file table for the handle, or NULL if the process has no file
+ * open under that handle.
+ */
+static SIMFS_PER_PROCESS_OPEN_FILE_TYPE *simfsFindOpenFile(SIMFS_MOUNT *mount, pid_t pid,
+                                                           SIMFS_FILE_HANDLE_TYPE fileHandle) {
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsFindProcessControlBlock(mount, pid);
+    if (pcb == NULL || fileHandle < 0 || fileHandle >= pcb->capacity ||
+        pcb->openFileTable[fileHandle].globalEntry == NULL)
+        return NULL;
+
+    return &pcb->openFileTable[fileHandle];
+}
+
+/*
+ * Finds the entry of the global open file table for the file with the descriptor in the given block.
+ */
+static SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *simfsFindGlobalEntry(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex) {
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES / SIMFS_OPEN_FILE_CHUNK_SIZE; i++) {
+        SIMFS_OPEN_FILE_CHUNK_TYPE *chunk = mount->context->globalOpenFileTable[i];
+        if (chunk == NULL || chunk->numberOfEntriesInUse == 0)
+            continue;
+        for (int j = 0; j < SIMFS_OPEN_FILE_CHUNK_SIZE; j++) {
+            if (chunk->entry[j].type != INVALID_CONTENT_TYPE && chunk->entry[j].fileDescriptor == descriptorIndex)
+                return &chunk->entry[j];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Takes an unused entry of the global open file table, allocating a chunk if all allocated chunks are full.
+ */
+static SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *simfsAllocGlobalEntry(SIMFS_MOUNT *mount) {
+    int freeChunk = -1;
+
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES / SIMFS_OPEN_FILE_CHUNK_SIZE; i++) {
+        SIMFS_OPEN_FILE_CHUNK_TYPE *chunk = mount->context->globalOpenFileTable[i];
+        if (chunk == NULL) {
+            if (freeChunk < 0)
+                freeChunk = i;
+            continue;
+        }
+        if (chunk->numberOfEntriesInUse == SIMFS_OPEN_FILE_CHUNK_SIZE)
+            continue;
+        for (int j = 0; j < SIMFS_OPEN_FILE_CHUNK_SIZE; j++) {
+            if (chunk->entry[j].type == INVALID_CONTENT_TYPE) {
+                chunk->numberOfEntriesInUse++;
+                return &chunk->entry[j];
+            }
+        }
+    }
+
+    if (freeChunk < 0)
+        return NULL;
+
+    SIMFS_OPEN_FILE_CHUNK_TYPE *chunk = malloc(sizeof(SIMFS_OPEN_FILE_CHUNK_TYPE));
+    if (chunk == NULL)
+        return NULL;
+
+    for (int j = 0; j < SIMFS_OPEN_FILE_CHUNK_SIZE; j++)
+        chunk->entry[j].type = INVALID_CONTENT_TYPE;
+    chunk->numberOfEntriesInUse = 1;
+    mount->context->globalOpenFileTable[freeChunk] = chunk;
+
+    return &chunk->entry[0];
+}
+
+/*
+ * Marks an entry of the global open file table as unused, and frees its chunk if that was the last entry in use.
+ */
+static void simfsReleaseGlobalEntry(SIMFS_MOUNT *mount, SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry) {
+    globalEntry->type = INVALID_CONTENT_TYPE;
+
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES / SIMFS_OPEN_FILE_CHUNK_SIZE; i++) {
+        SIMFS_OPEN_FILE_CHUNK_TYPE *chunk = mount->context->globalOpenFileTable[i];
+        if (chunk != NULL && globalEntry >= chunk->entry && globalEntry < chunk->entry + SIMFS_OPEN_FILE_CHUNK_SIZE) {
+            if (--chunk->numberOfEntriesInUse == 0) {
+                free(chunk);
+                mount->context->globalOpenFileTable[i] = NULL;
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Finds the descriptor block of the file that the calling process has open under the handle, and checks the
+ * owner access bits in mask against the rights the file was opened with. The caller holds directoryLock, so
+ * the file cannot be deleted until it is done.
+ */
+static SIMFS_ERROR simfsFindOpenFileDescriptor(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, mode_t mask,
+                                               SIMFS_INDEX_TYPE *descriptorIndex) {
+    struct fuse_context *context = simfs_debug_get_context();
+    pid_t pid = context->pid;
+    free(context);
+
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    pthread_mutex_lock(&mount->context->openFileLock);
+    SIMFS_PER_PROCESS_OPEN_FILE_TYPE *openFile = simfsFindOpenFile(mount, pid, fileHandle);
+    if (openFile == NULL || openFile->globalEntry->type == INVALID_CONTENT_TYPE ||
+        openFile->globalEntry->fileDescriptor == SIMFS_DELETED_FILE)
+        error = SIMFS_NOT_FOUND_ERROR;
+    else if ((openFile->accessRights & mask) != mask)
+        error = SIMFS_ACCESS_ERROR;
+    else
+        *descriptorIndex = openFile->globalEntry->fileDescriptor;
+    pthread_mutex_unlock(&mount->context->openFileLock);
+
+    // a file in a detached subtree that is not walked yet is still attached to its entry
+    if (error == SIMFS_NO_ERROR && *descriptorIndex != SIMFS_STATS_FILE &&
+        simfsDirectoryIsDetached(mount, *descriptorIndex))
+        error = SIMFS_NOT_FOUND_ERROR;
+
+    return error;
+}
+
+/*
+ * Copies the size and the times of a descriptor to the global open file table entry of the file, if it is open.
+ */
+static void simfsUpdateGlobalEntry(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+
+    pthread_mutex_lock(&mount->context->openFileLock);
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsFindGlobalEntry(mount, descriptorIndex);
+    if (globalEntry != NULL) {
+        globalEntry->size = descriptor->size;
+        globalEntry->lastAccessTime = descriptor->lastAccessTime;
+        globalEntry->lastModificationTime = descriptor->lastModificationTime;
+    }
+    pthread_mutex_unlock(&mount->context->openFileLock);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// path names
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Looks up the current working directory of the calling process; processes without a process control block
+ * work in the root of the volume.
+ */
+static SIMFS_INDEX_TYPE simfsCurrentWorkingDirectory(SIMFS_MOUNT *mount) {
+    SIMFS_INDEX_TYPE workingDirectory = mount->volume->superblock.attr.rootNodeIndex;
+
+    struct fuse_context *context = simfs_debug_get_context();
+    pthread_mutex_lock(&mount->context->openFileLock);
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsFindProcessControlBlock(mount, context->pid);
+    if (pcb != NULL)
+        workingDirectory = pcb->currentWorkingDirectory;
+    pthread_mutex_unlock(&mount->context->openFileLock);
+    free(context);
+
+    return workingDirectory;
+}
+
+/*
+ * Builds the name with the full path; names starting with '/' are already complete, other names are relative to
+ * the current working directory of the process, whose path is rebuilt from its parents under directoryLock.
+ *
+ * Returns false if the result does not fit in SIMFS_NAME_TYPE, or if a name on the path is empty.
+ */
+static bool simfsResolvePath(SIMFS_MOUNT *mount, char *fileName, SIMFS_NAME_TYPE nameWithPath) {
+    SIMFS_NAME_TYPE directoryName = "";
+    if (fileName[0] != '/') {
+        SIMFS_INDEX_TYPE workingDirectory = simfsCurrentWorkingDirectory(mount);
+        bool found = true;
+        if (workingDirectory == mount->volume->superblock.attr.rootNodeIndex)
+            strcpy(directoryName, "/");
+        else {
+            pthread_mutex_lock(&mount->context->directoryLock);
+            found = simfsFilePath(mount->volume, workingDirectory, directoryName);
+            pthread_mutex_unlock(&mount->context->directoryLock);
+        }
+        if (!found)
+            return false;
+    }
+
+    bool isRoot = namesAreSame(directoryName, "/");
+    size_t length = strlen(directoryName) + (directoryName[0] == '\0' || isRoot ? 0 : 1) + strlen(fileName);
+    if (length >= SIMFS_MAX_NAME_LENGTH)
+        return false;
+
+    strcpy(nameWithPath, directoryName);
+    if (directoryName[0] != '\0' && !isRoot)
+        strcat(nameWithPath, "/");
+    strcat(nameWithPath, fileName);
+
+    // every name on the path is that of a file in a folder, so none of them is empty
+    return strstr(nameWithPath, "//") == NULL && (length == 1 || nameWithPath[length - 1] != '/');
+}
+
+/*
+ * Copies the path of the folder that holds the file with the full path nameWithPath.
+ */
+static void simfsParentPath(char *nameWithPath, SIMFS_NAME_TYPE parentPath) {
+    strcpy(parentPath, nameWithPath);
+
+    char *lastSeparator = strrchr(parentPath, '/');
+    if (lastSeparator == parentPath)
+        parentPath[1] = '\0'; // the parent is the root
+    else
+        *lastSeparator = '\0';
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// volume images
+//
+// The size of the image of a volume follows from its superblock: the part of SIMFS_VOLUME before the arrays comes
+// first, then the bitvector, the blocks, their checksums, and their lives, each for the blocks of the volume. An
+// image in memory is a mapping, of the volume file for a lazy mount and anonymous otherwise, so the pages of the
+// blocks that were never used are not even touched. simfsResizeVolume() puts the volume in an image of its new size.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Sets layout to the places of the arrays in the image of a volume with numberOfBlocks blocks. A group has a whole
+ * number of bytes of the bitvector, so the arrays after it stay aligned.
+ *
+ * Returns false if numberOfBlocks is not a whole number of allocation groups, if a block would have a reserved
+ * reference, or if the size of the image would overflow.
+ */
+bool simfsVolumeLayout(size_t numberOfBlocks, SIMFS_VOLUME_LAYOUT_TYPE *layout) {
+    size_t bytesPerBlock = sizeof(SIMFS_BLOCK_TYPE) + sizeof(unsigned int) + sizeof(SIMFS_BLOCK_LIFE_TYPE) + 1;
+    if (numberOfBlocks == 0 || numberOfBlocks % SIMFS_BLOCKS_PER_ALLOCATION_GROUP != 0 ||
+        numberOfBlocks > SIMFS_MAX_NUMBER_OF_BLOCKS ||
+        numberOfBlocks > (SIZE_MAX - offsetof(SIMFS_VOLUME, bitvector)) / bytesPerBlock)
+        return false;
+
+    layout->bitvector = offsetof(SIMFS_VOLUME, bitvector);
+    layout->block = layout->bitvector + numberOfBlocks / 8;
+    layout->checksum = layout->block + numberOfBlocks * sizeof(SIMFS_BLOCK_TYPE);
+    layout->life = layout->checksum + numberOfBlocks * sizeof(unsigned int);
+    layout->size = layout->life + numberOfBlocks * sizeof(SIMFS_BLOCK_LIFE_TYPE);
+    return true;
+}
+
+/*
+ * Returns an anonymous mapping of size bytes, which reads as zeros, or NULL if there is no memory.
+ */
+static void *simfsMapImage(size_t size) {
+    void *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return image != MAP_FAILED ? image : NULL;
+}
+
+/*
+ * Points the arrays of the volume into image, laid out for numberOfBlocks blocks.
+ */
+static void simfsVolumeSetImage(SIMFS_VOLUME *volume, void *image, size_t numberOfBlocks) {
+    SIMFS_VOLUME_LAYOUT_TYPE layout;
+    simfsVolumeLayout(numberOfBlocks, &layout);
+
+    volume->bitvector = (char *) image + layout.bitvector;
+    volume->block = (SIMFS_BLOCK_TYPE *) ((char *) image + layout.block);
+    volume->checksum = (unsigned int *) ((char *) image + layout.checksum);
+    volume->life = (SIMFS_BLOCK_LIFE_TYPE *) ((char *) image + layout.life);
+    volume->image = image;
+    volume->imageSize = layout.size;
+}
+
+/*
+ * Returns a volume of numberOfBlocks blocks that is all zeros but for the size in its superblock, or NULL if that
+ * is not the size of a volume or if there is no memory. It is freed with simfsVolumeFree().
+ */
+SIMFS_VOLUME *simfsVolumeAlloc(size_t numberOfBlocks) {
+    SIMFS_VOLUME_LAYOUT_TYPE layout;
+    if (!simfsVolumeLayout(numberOfBlocks, &layout))
+        return NULL;
+
+    SIMFS_VOLUME *volume = calloc(1, sizeof(SIMFS_VOLUME));
+    void *image = simfsMapImage(layout.size);
+    if (volume == NULL || image == NULL) {
+        free(volume);
+        if (image != NULL)
+            munmap(image, layout.size);
+        return NULL;
+    }
+
+    volume->superblock.attr.numberOfBlocks = (SIMFS_INDEX_TYPE) numberOfBlocks;
+    simfsVolumeSetImage(volume, image, numberOfBlocks);
+    return volume;
+}
+
+/*
+ * Returns a copy of a volume, which must not change meanwhile, or NULL if there is no memory.
+ */
+SIMFS_VOLUME *simfsVolumeCopy(SIMFS_VOLUME *volume) {
+    SIMFS_VOLUME *copy = simfsVolumeAlloc(simfsVolumeBlocks(volume));
+    if (copy == NULL)
+        return NULL;
+
+    size_t arrays = offsetof(SIMFS_VOLUME, bitvector);
+    memcpy(copy, volume, arrays);
+    memcpy((char *) copy->image + arrays, (char *) volume->image + arrays, volume->imageSize - arrays);
+    return copy;
+}
+
+/*
+ * Reads the volume in file into a new volume of the size its superblock gives.
+ *
+ * Returns SIMFS_READ_ERROR if the superblock does not give the size of a volume or if the file is not as long as
+ * that size makes the image, and SIMFS_ALLOC_ERROR if there is no memory.
+ */
+SIMFS_ERROR simfsVolumeRead(FILE *file, SIMFS_VOLUME **volume) {
+    SIMFS_VOLUME header;
+    size_t arrays = offsetof(SIMFS_VOLUME, bitvector);
+    SIMFS_VOLUME_LAYOUT_TYPE layout;
+    if (fread(&header, 1, arrays, file) != arrays ||
+        !simfsVolumeLayout(header.superblock.attr.numberOfBlocks, &layout))
+        return SIMFS_READ_ERROR;
+
+    SIMFS_VOLUME *image = simfsVolumeAlloc(header.superblock.attr.numberOfBlocks);
+    if (image == NULL)
+        return SIMFS_ALLOC_ERROR;
+    memcpy(image, &header, arrays);
+    if (fread((char *) image->image + arrays, 1, layout.size - arrays, file) != layout.size - arrays ||
+        fgetc(file) != EOF) {
+        simfsVolumeFree(image);
+        return SIMFS_READ_ERROR;
+    }
+
+    *volume = image;
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Writes the image of a volume to file; returns false if it could not be written.
+ */
+bool simfsVolumeWrite(FILE *file, SIMFS_VOLUME *volume) {
+    memcpy(volume->image, volume, offsetof(SIMFS_VOLUME, bitvector));
+    return fwrite(volume->image, 1, volume->imageSize, file) == volume->imageSize;
+}
+
+/*
+ * Releases a volume and its image.
+ */
+void simfsVolumeFree(SIMFS_VOLUME *volume) {
+    if (volume == NULL)
+        return;
+
+    munmap(volume->image, volume->imageSize);
+    free(volume);
+}
+
+/*
+ * Writes length bytes from buffer at offset in file; returns false if they could not be written.
+ */
+static bool simfsWriteVolumeFile(FILE *file, size_t offset, void *buffer, size_t length) {
+    return fseek(file, (long) offset, SEEK_SET) == 0 && fwrite(buffer, 1, length, file) == length;
+}
+
+/*
+ * Creates the volume file of a new file system of numberOfBlocks blocks with an empty root folder.
+ *
+ * The file is extended to its full size with ftruncate(), which leaves it sparse, and only the parts of a new volume
+ * that are not zero are written: the superblock, the first byte of the bitvector, the two blocks of the root folder,
+ * and their checksums and lives. The rest reads back as zeros, which is a free block, an empty snapshot slot, and
+ * an unused life, so neither the time nor the memory this takes grows with the size of the volume.
+ *
+ * Returns SIMFS_WRITE_ERROR if numberOfBlocks is not the size of a volume (see simfsVolumeLayout()) or if the
+ * file cannot be written, and SIMFS_ALLOC_ERROR if it cannot be created.
+ */
+SIMFS_ERROR simfsCreateFileSystem(char *simfsFileName, size_t numberOfBlocks) {
+    SIMFS_VOLUME_LAYOUT_TYPE layout;
+    if (!simfsVolumeLayout(numberOfBlocks, &layout))
+        return SIMFS_WRITE_ERROR;
+
+    FILE *file = fopen(simfsFileName, "wb");
+    if (file == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    // initialize the superblock
+
+    SIMFS_SUPERBLOCK_TYPE superblock;
+    memset(&superblock, 0, sizeof(superblock));
+    superblock.attr.rootNodeIndex = 0;
+    superblock.attr.blockSize = SIMFS_BLOCK_SIZE;
+    superblock.attr.indexSize = sizeof(SIMFS_INDEX_TYPE);
+    superblock.attr.numberOfBlocks = (SIMFS_INDEX_TYPE) numberOfBlocks;
+    superblock.attr.flags = SIMFS_VOLUME_FOLDER_NAMES;
+
+    // initialize the blocks holding the root folder
+
+    SIMFS_BLOCK_TYPE block[2];
+    memset(block, 0, sizeof(block));
+
+    // initialize the root folder
+
+    block[0].type = FOLDER_CONTENT_TYPE;
+    block[0].content.fileDescriptor.type = FOLDER_CONTENT_TYPE;
+    block[0].content.fileDescriptor.parent = SIMFS_INVALID_INDEX;
+    strcpy(block[0].content.fileDescriptor.name, "/");
+    block[0].content.fileDescriptor.accessRights = umask(00000);
+    block[0].content.fileDescriptor.owner = 0; // arbitrarily simulated
+    block[0].content.fileDescriptor.size = 0;
+
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    block[0].content.fileDescriptor.creationTime = time.tv_sec;
+    block[0].content.fileDescriptor.lastAccessTime = time.tv_sec;
+    block[0].content.fileDescriptor.lastModificationTime = time.tv_sec;
+
+    // initialize the index block of the root folder
+
+    // first, point from the root file descriptor to the index block
+    block[0].content.fileDescriptor.block_ref = 1;
+
+    block[1].type = INDEX_CONTENT_TYPE;
+
+    // both blocks live from the first generation on
+    unsigned int generation = 1;
+    SIMFS_BLOCK_LIFE_TYPE life[2];
+    memset(life, 0, sizeof(life));
+    unsigned int checksum[2];
+    for (SIMFS_INDEX_TYPE index = 0; index < 2; index++) {
+        life[index].birth = generation;
+        life[index].origin = index;
+        checksum[index] = simfsBlockChecksum(&block[index]);
+    }
+
+    // indicate that the blocks #0 and #1 are allocated
+    unsigned char bitvector = 0xC0; // 0xC0 is 11000000 in binary (showing the root block and root's index block taken)
+
+    unsigned int mapChecksum = simfsNewVolumeMapChecksum(&superblock, generation, life, 2);
+
+    bool written = ftruncate(fileno(file), (off_t) layout.size) == 0 &&
+                   simfsWriteVolumeFile(file, offsetof(SIMFS_VOLUME, superblock), &superblock, sizeof(superblock)) &&
+                   simfsWriteVolumeFile(file, offsetof(SIMFS_VOLUME, mapChecksum), &mapChecksum, sizeof(mapChecksum)) &&
+                   simfsWriteVolumeFile(file, offsetof(SIMFS_VOLUME, generation), &generation, sizeof(generation)) &&
+                   simfsWriteVolumeFile(file, layout.bitvector, &bitvector, sizeof(bitvector)) &&
+                   simfsWriteVolumeFile(file, layout.block, block, sizeof(block)) &&
+                   simfsWriteVolumeFile(file, layout.checksum, checksum, sizeof(checksum)) &&
+                   simfsWriteVolumeFile(file, layout.life, life, sizeof(life));
+
+    if (fclose(file) != 0 || !written)
+        return SIMFS_WRITE_ERROR;
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Maps the volume file fileName copy-on-write as the image of a new volume: its pages are read from the file as they
+ * are first touched, and the changes stay in memory until unmounting writes the image back.
+ *
+ * Returns SIMFS_ALLOC_ERROR if the file cannot be opened or mapped, and SIMFS_READ_ERROR if its superblock does not
+ * give the size of a volume or if it is not as long as that size makes the image.
+ */
+static SIMFS_ERROR simfsMapVolume(char *fileName, SIMFS_VOLUME **volume) {
+    int descriptor = open(fileName, O_RDONLY);
+    if (descriptor < 0)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    SIMFS_VOLUME header;
+    size_t arrays = offsetof(SIMFS_VOLUME, bitvector);
+    SIMFS_VOLUME_LAYOUT_TYPE layout;
+    struct stat status;
+    if (pread(descriptor, &header, arrays, 0) != (ssize_t) arrays ||
+        !simfsVolumeLayout(header.superblock.attr.numberOfBlocks, &layout) || fstat(descriptor, &status) != 0 ||
+        status.st_size != (off_t) layout.size)
+        error = SIMFS_READ_ERROR; // the pages past the end of the file could not be touched
+    else if ((*volume = calloc(1, sizeof(SIMFS_VOLUME))) == NULL)
+        error = SIMFS_ALLOC_ERROR;
+    else {
+        void *mapping = mmap(NULL, layout.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            free(*volume);
+            error = SIMFS_ALLOC_ERROR;
+        } else {
+            memcpy(*volume, &header, arrays);
+            simfsVolumeSetImage(*volume, mapping, header.superblock.attr.numberOfBlocks);
+            (*volume)->mapsFile = true;
+        }
+    }
+    close(descriptor);
+
+    return error;
+}
+
+/*
+ * Allocates a mount of volume, which it owns from then on, for the volume file fileName with an empty directory, and
+ * initializes its locks. A lazy mount loads the folders as they are first used.
+ *
+ * Returns NULL if there is no memory.
+ */
+static SIMFS_MOUNT *simfsAllocMount(char *fileName, SIMFS_VOLUME *volume, bool lazy) {
+    SIMFS_MOUNT *mount = calloc(1, sizeof(SIMFS_MOUNT));
+    if (mount == NULL) {
+        simfsVolumeFree(volume);
+        return NULL;
+    }
+
+    mount->fileName = strdup(fileName);
+    mount->context = malloc(sizeof(SIMFS_CONTEXT_TYPE));
+    mount->volume = volume;
+    mount->lazy = lazy;
+    if (mount->fileName == NULL || mount->context == NULL) {
+        free(mount->context); // nothing is set up in it yet
+        mount->context = NULL;
+        simfsFreeMount(mount);
+        return NULL;
+    }
+
+    memset(mount->context, 0, sizeof(SIMFS_CONTEXT_TYPE));
+    atomic_init(&mount->context->directory, simfsDirectoryAlloc(SIMFS_DIRECTORY_INITIAL_SIZE));
+    pthread_mutex_init(&mount->context->directoryLock, NULL);
+    pthread_rwlockattr_t resizeLockAttributes; // a resize is not starved by a stream of writes
+    pthread_rwlockattr_init(&resizeLockAttributes);
+    pthread_rwlockattr_setkind_np(&resizeLockAttributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&mount->context->resizeLock, &resizeLockAttributes);
+    pthread_rwlockattr_destroy(&resizeLockAttributes);
+    pthread_mutex_init(&mount->context->openFileLock, NULL);
+    pthread_mutex_init(&mount->context->defragmentLock, NULL);
+    pthread_cond_init(&mount->context->defragmentCondition, NULL);
+    pthread_mutex_init(&mount->context->sharingLock, NULL);
+    pthread_mutex_init(&mount->context->deletionLock, NULL);
+    pthread_cond_init(&mount->context->deletionCondition, NULL);
+    mount->context->processControlBlocks = NULL;
+    mount->context->verifyMode = SIMFS_VERIFY_ONCE;
+    SIMFS_BLOCK_ARRAYS_TYPE arrays;
+    if (atomic_load_explicit(&mount->context->directory, memory_order_relaxed) == NULL ||
+        !simfsBlockArraysAlloc(&arrays, simfsVolumeBlocks(volume), false)) {
+        simfsFreeMount(mount);
+        return NULL;
+    }
+    simfsSwapBlockArrays(mount->context, &arrays);
+
+    return mount;
+}
+
+/*
+ * Sets up the context of a mount for the volume image loaded into it: the bitvector and the allocation groups, the
+ * directory of all files, and the deduplication index. A lazy mount only puts the root folder in the directory.
+ */
+static SIMFS_ERROR simfsLoadMount(SIMFS_MOUNT *mount) {
+    memcpy(mount->context->bitvector, mount->volume->bitvector, simfsVolumeBlocks(mount->volume) / 8);
+    simfsInitAllocationGroups(mount);
+    SIMFS_INDEX_TYPE rootIndex = mount->volume->superblock.attr.rootNodeIndex;
+    SIMFS_ERROR error = simfsChecksumVerify(mount, rootIndex) ? SIMFS_NO_ERROR : SIMFS_READ_ERROR;
+    if (error == SIMFS_NO_ERROR)
+        error = addFileDescriptorToList(mount, rootIndex);
+    if (error == SIMFS_NO_ERROR && !mount->lazy)
+        error = hashFileSystem(mount, rootIndex);
+    if (error == SIMFS_NO_ERROR && !mount->context->readOnly &&
+        (mount->volume->superblock.attr.flags & SIMFS_VOLUME_DEDUPLICATED) != 0)
+        error = simfsDedupBuild(mount);
+
+    return error;
+}
+
+/*
+ * Loads the file system from a disk and constructs in-memory directory of all files is the system.
+ *
+ * Starting with the file system root (pointed to from the superblock) traverses the hierarachy of directories
+ * and adds en entry for each folder or file to the directory by hashing the name and adding a directory
+ * entry node to the conflict resolution list for that entry. If the entry is NULL, the new node will be
+ * the only element of that list.
+ *
+ * The function sets the current working directory to refer to the block holding the root of the volume. This will
+ * be changed as the user navigates the file system hierarchy.
+ *
+ * A lazy mount maps the file instead of reading it, and checks the superblock, the bitvector, and the root folder,
+ * which is all the directory starts with; the rest is read and checked as simfsDirectoryFault() loads folders. A
+ * deduplicated volume still reads all of its files to build the fingerprint index.
+ *
+ * A volume whose superblock records another block size or width of block references, or a size that the length of
+ * its file does not match, is not mounted; it returns SIMFS_READ_ERROR.
+ */
+
+static SIMFS_ERROR simfsMount(char *simfsFileName, bool lazy, SIMFS_MOUNT **mountHandle) {
+    SIMFS_VOLUME *volume = NULL;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (lazy)
+        error = simfsMapVolume(simfsFileName, &volume);
+    else {
+        FILE *file = fopen(simfsFileName, "rb");
+        if (file == NULL)
+            return SIMFS_ALLOC_ERROR;
+
+        error = simfsVolumeRead(file, &volume);
+        fclose(file);
+    }
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_MOUNT *mount = simfsAllocMount(simfsFileName, volume, lazy);
+    if (mount == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    //Mounting System into memory
+    SIMFS_SUPERBLOCK_TYPE *superblock = &mount->volume->superblock;
+    if (superblock->attr.blockSize != SIMFS_BLOCK_SIZE || superblock->attr.indexSize != sizeof(SIMFS_INDEX_TYPE) ||
+        (superblock->attr.flags & SIMFS_VOLUME_FOLDER_NAMES) == 0) {
+        simfsFreeMount(mount); // laid out by a build with other blocks, block references or descriptors
+        return SIMFS_READ_ERROR;
+    }
+    if (simfsMapChecksum(mount->volume) != mount->volume->mapChecksum) {
+        simfsStatsCount(SIMFS_CHECKSUM_ERRORS_COUNTER, 1);
+        simfsFreeMount(mount);
+        return SIMFS_READ_ERROR;
+    }
+    error = simfsLoadMount(mount);
+    if (error != SIMFS_NO_ERROR) {
+        simfsFreeMount(mount);
+        return error;
+    }
+
+    *mountHandle = mount;
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsMountFileSystem(char *simfsFileName, SIMFS_MOUNT **mountHandle) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsMount(simfsFileName, false, mountHandle);
+    simfsStatsFinish(SIMFS_MOUNT_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_MOUNT_OPERATION, simfsFileName, 0, start, error);
+    return error;
+}
+
+/*
+ * Mounts the file system like simfsMountFileSystem(), but without reading the volume: the blocks are read as they
+ * are first used, and the folders are added to the directory when a path first goes through them. The time and
+ * memory it takes do not grow with the number of files. Unmounting writes the whole volume back as usual.
+ */
+SIMFS_ERROR simfsMountFileSystemLazy(char *simfsFileName, SIMFS_MOUNT **mountHandle) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsMount(simfsFileName, true, mountHandle);
+    simfsStatsFinish(SIMFS_MOUNT_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_MOUNT_OPERATION, simfsFileName, 0, start, error);
+    return error;
+}
+
+//does a depth first recursive search of all the files in the system and hashes the information into memory
+//the index blocks and the descriptors are checked against their checksums on the way; SIMFS_READ_ERROR if one fails,
+//or if a descriptor does not name the folder as its parent
+//on a lazy mount only the children of the folder are hashed, leaving out those that an earlier failed call added
+SIMFS_ERROR hashFileSystem(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = &mount->volume->block[folderIndex].content.fileDescriptor;
+    SIMFS_INDEX_TYPE indexBlock = folder->block_ref;
+
+    for (size_t i = 0; i < folder->size; i++) {
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0 && !simfsChecksumVerify(mount, indexBlock))
+            return SIMFS_READ_ERROR;
+
+        SIMFS_INDEX_TYPE fileIndex = mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (!simfsChecksumVerify(mount, fileIndex) ||
+            mount->volume->block[fileIndex].content.fileDescriptor.parent != folderIndex)
+            return SIMFS_READ_ERROR;
+        if (mount->lazy) {
+            if (simfsDirectoryFindDescriptor(mount, fileIndex) != NULL)
+                continue;
+        } else if (mount->volume->block[fileIndex].type == FOLDER_CONTENT_TYPE) {
+            SIMFS_ERROR error = hashFileSystem(mount, fileIndex);
+            if (error != SIMFS_NO_ERROR)
+                return error;
+        }
+        if (addFileDescriptorToList(mount, fileIndex) != SIMFS_NO_ERROR)
+            return SIMFS_ALLOC_ERROR;
+    }
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Publishes a new directory entry for the descriptor, under the name and in the folder that it holds, at the head
+ * of the conflict resolution list for the key, growing the table when it holds more entries than slots. The caller
+ * holds directoryLock (or is mounting, when there are no readers yet).
+ */
+static SIMFS_ERROR simfsDirectoryAdd(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex, bool loaded) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    size_t length = strnlen(descriptor->name, SIMFS_MAX_NAME_LENGTH - 1);
+    SIMFS_DIR_ENT *newEntry = (SIMFS_DIR_ENT *) malloc(sizeof(SIMFS_DIR_ENT) + length + 1);
+    if (newEntry == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    newEntry->nodeReference = descriptorIndex;
+    newEntry->parent = descriptor->parent;
+    newEntry->nameHash = simfsEntryHash(descriptor->parent, descriptor->name, length);
+    memcpy(newEntry->name, descriptor->name, length);
+    newEntry->name[length] = '\0';
+    atomic_init(&newEntry->loaded, loaded);
+    mount->context->directoryNameBytes += length + 1;
+
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+    _Atomic(SIMFS_DIR_ENT *) *conflictResList = simfsDirectorySlot(directory, newEntry->nameHash);
+    atomic_init(&newEntry->next, atomic_load_explicit(conflictResList, memory_order_relaxed));
+    atomic_store_explicit(conflictResList, newEntry, memory_order_release);
+
+    if (++mount->context->numberOfDirectoryEntries > directory->size)
+        simfsDirectoryResize(mount, directory->size * 2);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Adds the descriptor to the directory; on a lazy mount, the entry of a folder that is not empty is not loaded yet.
+ */
+SIMFS_ERROR addFileDescriptorToList(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex) {
+    SIMFS_BLOCK_TYPE *descriptorBlock = &mount->volume->block[descriptorIndex];
+
+    return simfsDirectoryAdd(mount, descriptorIndex, !mount->lazy || descriptorBlock->type != FOLDER_CONTENT_TYPE ||
+                                                     descriptorBlock->content.fileDescriptor.size == 0);
+}
+
+/*
+ * Adds the children of the folder of the entry to the directory unless they are there already, and marks it
+ * loaded. The caller holds directoryLock.
+ */
+static SIMFS_ERROR simfsDirectoryLoad(SIMFS_MOUNT *mount, SIMFS_DIR_ENT *entry) {
+    if (atomic_load_explicit(&entry->loaded, memory_order_relaxed))
+        return SIMFS_NO_ERROR;
+
+    SIMFS_ERROR error = hashFileSystem(mount, entry->nodeReference);
+    if (error == SIMFS_NO_ERROR)
+        atomic_store_explicit(&entry->loaded, true, memory_order_release);
+
+    return error;
+}
+
+/*
+ * On a lazy mount, loads every folder on the path of the name with the full path nameWithPath into the directory,
+ * from the root down, so that the name and its parent are found as on a mount that loaded the whole tree. A
+ * folder that is loaded already costs a lookup; the walk ends at a folder that does not exist, so that the lookups
+ * that follow fail as they would otherwise.
+ *
+ * Returns SIMFS_READ_ERROR if a block of a folder on the path fails its checksum, and SIMFS_ALLOC_ERROR if there
+ * is no memory for the entries.
+ */
+static SIMFS_ERROR simfsDirectoryFault(SIMFS_MOUNT *mount, char *nameWithPath) {
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    SIMFS_NAME_TYPE folderPath;
+
+    for (size_t end = 0; mount->lazy && error == SIMFS_NO_ERROR && nameWithPath[end] != '\0'; end++) {
+        if (nameWithPath[end] != '/')
+            continue;
+        size_t length = end > 0 ? end : 1; // the root is the folder before the first separator
+        memcpy(folderPath, nameWithPath, length);
+        folderPath[length] = '\0';
+
+        simfsEpochEnter();
+        SIMFS_DIR_ENT *entry = simfsDirectoryLookup(mount, folderPath);
+        bool loaded = entry != NULL && atomic_load_explicit(&entry->loaded, memory_order_acquire);
+        simfsEpochExit();
+        if (entry == NULL)
+            break;
+        if (loaded)
+            continue;
+
+        pthread_mutex_lock(&mount->context->directoryLock);
+        entry = simfsDirectoryLookup(mount, folderPath);
+        if (entry != NULL)
+            error = simfsDirectoryLoad(mount, entry);
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        if (entry == NULL)
+            break;
+    }
+
+    return error;
+}
+
+/*
+ * On a lazy mount, loads the folder in the block folderIndex and all folders below it into the directory. The
+ * caller holds directoryLock.
+ */
+static SIMFS_ERROR simfsDirectoryFaultTree(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = &mount->volume->block[folderIndex].content.fileDescriptor;
+    SIMFS_DIR_ENT *entry = simfsDirectoryFindDescriptor(mount, folderIndex);
+    SIMFS_ERROR error = entry != NULL ? simfsDirectoryLoad(mount, entry) : SIMFS_READ_ERROR;
+
+    SIMFS_INDEX_TYPE indexBlock = folder->block_ref;
+    for (size_t i = 0; error == SIMFS_NO_ERROR && i < folder->size; i++) {
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        SIMFS_INDEX_TYPE childIndex = mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (mount->volume->block[childIndex].type == FOLDER_CONTENT_TYPE)
+            error = simfsDirectoryFaultTree(mount, childIndex);
+    }
+
+    return error;
+}
+
+/*
+ * Saves the file system to a disk and de-allocates the memory; a read-only mount is not saved.
+ *
+ * Assumes that all synchronization has been done.
+ *
+ */
+static SIMFS_ERROR simfsUmount(SIMFS_MOUNT *mount) {
+    simfsDefragmentStop(mount);
+    if (mount->context->readOnly) { // a snapshot is saved with the volume it was taken of
+        simfsFreeMount(mount);
+        return SIMFS_NO_ERROR;
+    }
+
+    FILE *file = fopen(mount->fileName, mount->volume->mapsFile ? "r+b" : "wb"); // the mapping reads from the file
+    if (file == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    simfsTreeDeletionsWait(mount); // deleted subtrees and files give their blocks back before the bitvector is saved
+    simfsEpochSynchronize();
+    mount->volume->mapChecksum = simfsMapChecksum(mount->volume);
+
+    simfsVolumeWrite(file, mount->volume);
+    fclose(file);
+
+    simfsFreeMount(mount);
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsUmountFileSystem(SIMFS_MOUNT *mount) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsUmount(mount);
+    simfsStatsFinish(SIMFS_UMOUNT_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_UMOUNT_OPERATION, NULL, 0, start, error); // the mount is gone
+    return error;
+}
+
+/*
+ * Releases all memory of a mount. The directory and the locks are only torn down if the context was set up.
+ */
+static void simfsFreeMount(SIMFS_MOUNT *mount) {
+    if (mount->context != NULL && mount->volume != NULL) {
+        SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+        if (directory != NULL)
+            simfsDirectoryFree(directory);
+
+        for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES / SIMFS_OPEN_FILE_CHUNK_SIZE; i++)
+            free(mount->context->globalOpenFileTable[i]);
+
+        while (mount->context->processControlBlocks != NULL) {
+            SIMFS_PROCESS_CONTROL_BLOCK_TYPE *next = mount->context->processControlBlocks->next;
+            simfsFreeProcessControlBlock(mount->context->processControlBlocks);
+            mount->context->processControlBlocks = next;
+        }
+
+        pthread_mutex_destroy(&mount->context->directoryLock);
+        pthread_rwlock_destroy(&mount->context->resizeLock);
+        pthread_mutex_destroy(&mount->context->openFileLock);
+        pthread_mutex_destroy(&mount->context->defragmentLock);
+        pthread_cond_destroy(&mount->context->defragmentCondition);
+        pthread_mutex_destroy(&mount->context->sharingLock);
+        pthread_mutex_destroy(&mount->context->deletionLock);
+        pthread_cond_destroy(&mount->context->deletionCondition);
+        SIMFS_BLOCK_ARRAYS_TYPE arrays;
+        memset(&arrays, 0, sizeof(arrays));
+        simfsSwapBlockArrays(mount->context, &arrays);
+        simfsBlockArraysFree(&arrays);
+        simfsDedupFree(mount->context->dedup);
+    }
+
+    simfsVolumeFree(mount->volume);
+    free(mount->context);
+    free(mount->fileName);
+    free(mount);
+}
+
+/*
+ * Reports how much memory the mount uses, broken down by subsystem.
+ */
+SIMFS_ERROR simfsGetMemoryUsage(SIMFS_MOUNT *mount, SIMFS_MEMORY_USAGE_TYPE *usage) {
+    memset(usage, 0, sizeof(SIMFS_MEMORY_USAGE_TYPE));
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+    usage->directory = sizeof(SIMFS_DIRECTORY) + directory->size * sizeof(_Atomic(SIMFS_DIR_ENT *)) +
+                       mount->context->numberOfDirectoryEntries * sizeof(SIMFS_DIR_ENT) +
+                       mount->context->directoryNameBytes;
+    size_t numberOfBlocks = simfsVolumeBlocks(mount->volume);
+    usage->context = numberOfBlocks / 8 * 2 + numberOfBlocks * sizeof(_Atomic unsigned int) +
+                     mount->context->numberOfAllocationGroups * sizeof(SIMFS_ALLOCATION_GROUP_TYPE);
+    if (mount->context->dedup != NULL)
+        usage->context += sizeof(SIMFS_DEDUP_TYPE) + numberOfBlocks * (sizeof(SIMFS_INDEX_TYPE) + sizeof(unsigned int));
+    usage->volume = sizeof(SIMFS_VOLUME) + mount->volume->imageSize;
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    pthread_mutex_lock(&mount->context->openFileLock);
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES / SIMFS_OPEN_FILE_CHUNK_SIZE; i++) {
+        if (mount->context->globalOpenFileTable[i] != NULL)
+            usage->openFiles += sizeof(SIMFS_OPEN_FILE_CHUNK_TYPE);
+    }
+    for (SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = mount->context->processControlBlocks; pcb != NULL; pcb = pcb->next) {
+        usage->processes += sizeof(SIMFS_PROCESS_CONTROL_BLOCK_TYPE);
+        if (pcb->openFileTable != pcb->inlineOpenFileTable)
+            usage->processes += pcb->capacity * sizeof(SIMFS_PER_PROCESS_OPEN_FILE_TYPE);
+        for (int i = 0; i < pcb->capacity; i++) {
+            if (pcb->openFileTable[i].listing != NULL)
+                usage->processes += sizeof(SIMFS_FOLDER_LISTING_TYPE) +
+                                    pcb->openFileTable[i].listing->numberOfChildren * sizeof(SIMFS_INDEX_TYPE);
+        }
+    }
+    pthread_mutex_unlock(&mount->context->openFileLock);
+
+    usage->context += sizeof(SIMFS_MOUNT) + sizeof(SIMFS_CONTEXT_TYPE) + strlen(mount->fileName) + 1;
+    usage->total = usage->directory + usage->openFiles + usage->processes + usage->context + usage->volume;
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns the text of the virtual stats file in a buffer allocated with malloc(), or NULL if there is no memory.
+ */
+static char *simfsStatsFileContent(void) {
+    SIMFS_STATS_TYPE stats;
+    simfsGetStats(&stats);
+    return simfsFormatStats(&stats);
+}
+
+/*
+ * Fills in a descriptor for the virtual stats file: a read-only file owned by root whose size is the length of
+ * the statistics at the time of the call.
+ */
+static SIMFS_ERROR simfsStatsFileDescriptor(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor) {
+    char *content = simfsStatsFileContent();
+    if (content == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    memset(descriptor, 0, sizeof(SIMFS_FILE_DESCRIPTOR_TYPE));
+    descriptor->type = FILE_CONTENT_TYPE;
+    strcpy(descriptor->name, strrchr(SIMFS_STATS_FILE_NAME, '/') + 1);
+    time(&descriptor->creationTime);
+    descriptor->lastAccessTime = descriptor->creationTime;
+    descriptor->lastModificationTime = descriptor->creationTime;
+    descriptor->accessRights = 0444;
+    descriptor->owner = 0;
+    descriptor->size = strlen(content);
+    descriptor->storedSize = descriptor->size;
+    descriptor->block_ref = SIMFS_INVALID_INDEX;
+
+    free(content);
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Fills in the descriptor of a new, empty file or folder with the last name of the path nameWithPath, owned by the
+ * user of the context. The caller sets the folder, the flags and the index block of a folder.
+ */
+static void simfsNewDescriptor(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, char *nameWithPath, SIMFS_CONTENT_TYPE type) {
+    memset(descriptor, 0, sizeof(SIMFS_FILE_DESCRIPTOR_TYPE));
+    time(&descriptor->creationTime);
+    descriptor->lastAccessTime = descriptor->creationTime;
+    descriptor->lastModificationTime = descriptor->creationTime;
+    descriptor->size = 0; //always initialize to 0 which means empty file/folder(may change in the future)
+    // 0  Owner | Group | ALL
+    //    RWE   | RWE   | RWE
+    unsigned short allAccessRights = 0777;
+
+    descriptor->accessRights = allAccessRights;
+    struct fuse_context *context = simfs_debug_get_context();
+    descriptor->owner = context->uid;
+    free(context);
+    strcpy(descriptor->name, strrchr(nameWithPath, '/') + 1);
+    descriptor->type = type;
+    descriptor->parent = SIMFS_INVALID_INDEX;
+    descriptor->block_ref = SIMFS_INVALID_INDEX;
+}
+
+/*
+ * Depending on the type parameter the function creates a file or a folder in the current directory
+ * of the process. If the process does not have an entry in the processControlBlock, then the root directory
+ * is assumed to be its current working directory. A name starting with '/' is taken as the full path, and the
+ * file is created in the folder named by the path.
+ *
+ * Hashes the file name and check if the file with such name already exists in the in-memory directory.
+ * If it is then it return SIMFS_DUPLICATE_ERROR. The check runs without a lock first, so that failing creates do not
+ * contend with writers, and is repeated under the directory lock before the file is added.
+ * Otherwise:
+ *    - finds an available block in the storage using the in-memory bitvector and flips the bit to indicate
+ *      that the block is taken
+ *    - initializes a local buffer for the file descriptor block with the block type depending on the parameter type
+ *      (i.e., folder or file)
+ *    - creates an entry in the conflict resolution list for the corresponding in-memory directory entry
+ *    - copies the local buffer to the disk block that was found to be free
+ *    - copies the in-memory bitvector to the bitevector blocks on the simulated disk
+ *
+ *  The access rights and the the owner are taken from the context (umask and uid correspondingly).
+ *
+ *  On a read-only mount, such as a snapshot, the function returns SIMFS_ACCESS_ERROR.
+ *
+ */
+static SIMFS_ERROR simfsCreate(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type) {
+    SIMFS_NAME_TYPE nameWithPath;
+    SIMFS_NAME_TYPE parentPath;
+
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+    if (!simfsResolvePath(mount, fileName, nameWithPath)) //creates filename with path prepended
+        return SIMFS_ALLOC_ERROR;
+    if (namesAreSame(nameWithPath, SIMFS_STATS_FILE_NAME))
+        return SIMFS_DUPLICATE_ERROR;
+    simfsParentPath(nameWithPath, parentPath);
+    SIMFS_ERROR error = simfsDirectoryFault(mount, nameWithPath);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    simfsEpochEnter();
+    bool isDuplicate = simfsDirectoryLookup(mount, nameWithPath) != NULL;
+    simfsEpochExit();
+    if (isDuplicate)
+        return SIMFS_DUPLICATE_ERROR;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE descriptorBuffer;
+    simfsNewDescriptor(&descriptorBuffer, nameWithPath, type);
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_DIR_ENT *parentEntry = simfsDirectoryLookup(mount, parentPath);
+    if (simfsDirectoryLookup(mount, nameWithPath) != NULL)
+        error = SIMFS_DUPLICATE_ERROR;
+    else if (parentEntry == NULL || mount->volume->block[parentEntry->nodeReference].type != FOLDER_CONTENT_TYPE)
+        error = SIMFS_NOT_FOUND_ERROR;
+    if (error != SIMFS_NO_ERROR) {
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        return error;
+    }
+    descriptorBuffer.parent = parentEntry->nodeReference;
+    if (type == FILE_CONTENT_TYPE && (mount->volume->superblock.attr.flags & SIMFS_VOLUME_COMPRESSED) != 0)
+        descriptorBuffer.flags = SIMFS_FILE_COMPRESSED;
+
+    SIMFS_INDEX_TYPE descriptorIndex = simfsAllocateBlock(mount, SIMFS_INVALID_INDEX);
+    SIMFS_INDEX_TYPE indexBlock = SIMFS_INVALID_INDEX;
+    if (descriptorIndex != SIMFS_INVALID_INDEX && type == FOLDER_CONTENT_TYPE) {
+        indexBlock = simfsAllocateBlock(mount, descriptorIndex);
+        if (indexBlock == SIMFS_INVALID_INDEX) {
+            simfsReleaseBlock(mount, descriptorIndex);
+            descriptorIndex = SIMFS_INVALID_INDEX;
+        } else {
+            mount->volume->block[indexBlock].type = INDEX_CONTENT_TYPE;
+            simfsChecksumUpdate(mount, indexBlock);
+            descriptorBuffer.block_ref = indexBlock;
+        }
+    }
+    if (descriptorIndex == SIMFS_INVALID_INDEX ||
+        simfsIndexAppend(mount, parentEntry->nodeReference, descriptorIndex) != SIMFS_NO_ERROR) {
+        if (indexBlock != SIMFS_INVALID_INDEX)
+            simfsReleaseBlock(mount, indexBlock);
+        if (descriptorIndex != SIMFS_INVALID_INDEX)
+            simfsReleaseBlock(mount, descriptorIndex);
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    // the descriptor block is complete before the entry that makes it visible to readers is published
+    mount->volume->block[descriptorIndex].type = type;
+    mount->volume->block[descriptorIndex].content.fileDescriptor = descriptorBuffer;
+    simfsChecksumUpdate(mount, descriptorIndex);
+    if (addFileDescriptorToList(mount, descriptorIndex) != SIMFS_NO_ERROR) {
+        simfsIndexRemove(mount, parentEntry->nodeReference, descriptorIndex); // preserved by the append already
+        mount->volume->block[descriptorIndex].type = INVALID_CONTENT_TYPE;
+        if (indexBlock != SIMFS_INVALID_INDEX)
+            simfsReleaseBlock(mount, indexBlock);
+        simfsReleaseBlock(mount, descriptorIndex);
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsCreateFile(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsCreate(mount, fileName, type);
+    simfsStatsFinish(SIMFS_CREATE_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_CREATE_OPERATION, fileName, 0, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Deletes a file from the file system.
+ *
+ * Hashes the file name and check if the file is in the directory. If not, then it returns SIMFS_NOT_FOUND_ERROR.
+ * Otherwise:
+ *    - finds the reference to the file descriptor block
+ *    - if the referenced block is a folder that is not empty, then returns SIMFS_NOT_EMPTY_ERROR.
+ *    - Otherwise: 
+ *       - checks if the process owner can delete this file or folder; if not, it returns SIMFS_ACCESS_ERROR.
+ *       - Otherwise:
+ *          - removes the reference to the file from the index chain of its folder; if the folder is held by a
+ *            snapshot and there is no block left to preserve it, then it returns SIMFS_ALLOC_ERROR
+ *          - detaches the file from its entry in the global open file table, if it is open, so that reads and
+ *            writes through the remaining handles fail
+ *          - clears the entry in the folder by removing the corresponding node in the list associated with
+ *            the slot for this file
+ *          - retires the node; once no lookup can still see it, all blocks belonging to the file and the
+ *            reference block are freed in the in-memory bitvector and the modified bitvector bytes are copied
+ *            to the bitvector blocks on the simulated disk
+ *
+ * On a read-only mount, such as a snapshot, the function returns SIMFS_ACCESS_ERROR.
+ */
+static SIMFS_ERROR simfsDelete(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName) {
+    SIMFS_NAME_TYPE nameWithPath;
+    SIMFS_NAME_TYPE parentPath;
+
+    if (!simfsResolvePath(mount, fileName, nameWithPath))
+        return SIMFS_NOT_FOUND_ERROR;
+    if (namesAreSame(nameWithPath, SIMFS_STATS_FILE_NAME) || mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+    simfsParentPath(nameWithPath, parentPath);
+    SIMFS_ERROR error = simfsDirectoryFault(mount, nameWithPath);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_DIR_ENT *listElement = simfsDirectoryLookup(mount, nameWithPath);
+    SIMFS_FILE_DESCRIPTOR_TYPE *matchedDescriptor = NULL;
+    unsigned char mask = 0200; //bitmask representing owners ability to write to file
+
+    if (listElement == NULL || listElement->nodeReference == mount->volume->superblock.attr.rootNodeIndex)
+        error = SIMFS_NOT_FOUND_ERROR;
+    else {
+        matchedDescriptor = &mount->volume->block[listElement->nodeReference].content.fileDescriptor;
+        if (matchedDescriptor->type == FOLDER_CONTENT_TYPE && matchedDescriptor->size > 0)
+            error = SIMFS_NOT_EMPTY_ERROR;
+        else if ((mask & matchedDescriptor->accessRights) != mask)
+            error = SIMFS_ACCESS_ERROR;
+    }
+
+    if (error == SIMFS_NO_ERROR)
+        error = simfsIndexRemove(mount, simfsDirectoryLookup(mount, parentPath)->nodeReference,
+                                 listElement->nodeReference);
+    if (error == SIMFS_NO_ERROR) {
+        pthread_mutex_lock(&mount->context->openFileLock);
+        SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsFindGlobalEntry(mount, listElement->nodeReference);
+        if (globalEntry != NULL)
+            globalEntry->fileDescriptor = SIMFS_DELETED_FILE; // the descriptor block is reused after reclamation
+        pthread_mutex_unlock(&mount->context->openFileLock);
+
+        simfsDirectoryRemove(mount, listElement); //remove from conflict resolution list
+    }
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+    return error;
+}
+
+SIMFS_ERROR simfsDeleteFile(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsDelete(mount, fileName);
+    simfsStatsFinish(SIMFS_DELETE_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_DELETE_OPERATION, fileName, 0, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// batch creation and deletion
+//
+// simfsCreateFiles() and simfsDeleteFiles() have the effect of simfsCreateFile() or simfsDeleteFile() on each name
+// of a batch, with directoryLock taken once for all of them. The names are sorted by their folder and then by name,
+// so the names in one folder come together, a folder comes before the folders in it, and a name given twice comes
+// right after itself and is dropped: it gets the outcome of its first occurrence. The folder of a run of names is
+// looked up once, and each name in it with a single probe of the directory. A batch of creations takes all the
+// blocks it needs in one pass over the allocation groups, copying the changed bytes of the bitvector to the
+// simulated disk once per group, grows the directory at most once, fills the descriptors of a folder from one
+// template, and appends to the index chain of each folder in one walk. A batch of deletions removes the names in a
+// folder from its index chain in one walk, going through the folders from the deepest up, so a folder deleted
+// together with its content is empty by the time its own name comes; it detaches their handles in one pass over the
+// global open file table, and their blocks are freed together, with the releases batched.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct simfs_batch_entry_type {
+    SIMFS_NAME_TYPE nameWithPath;
+    SIMFS_NAME_TYPE parentPath;
+    size_t position; // of the name in the batch
+    SIMFS_INDEX_TYPE descriptorIndex;
+    SIMFS_ERROR error;
+    bool repeated; // the name of the entry before it; dropped, and given the error of that entry at the end
+} SIMFS_BATCH_ENTRY_TYPE;
+
+/*
+ * Descriptors of the files that a batch deleted from one folder, whose blocks are freed together once no reader can
+ * see them.
+ */
+typedef struct simfs_batch_release_type {
+    SIMFS_MOUNT *mount;
+    unsigned int generation; // in which the files left the tree
+    size_t numberOfDescriptors;
+    SIMFS_INDEX_TYPE descriptors[];
+} SIMFS_BATCH_RELEASE_TYPE;
+
+/*
+ * Orders the entries of a batch by folder, then by name, then by position.
+ */
+static int simfsCompareBatchEntries(const void *first, const void *second) {
+    const SIMFS_BATCH_ENTRY_TYPE *a = first, *b = second;
+    int order = strcmp(a->parentPath, b->parentPath);
+    if (order == 0)
+        order = strcmp(a->nameWithPath, b->nameWithPath);
+
+    return order != 0 ? order : (a->position > b->position) - (a->position < b->position);
+}
+
+/*
+ * Returns the end of the run of entries from start on that are in the same folder.
+ */
+static size_t simfsBatchFolderEnd(SIMFS_BATCH_ENTRY_TYPE *entries, size_t numberOfFiles, size_t start) {
+    size_t end = start + 1;
+    while (end < numberOfFiles && namesAreSame(entries[end].parentPath, entries[start].parentPath))
+        end++;
+
+    return end;
+}
+
+/*
+ * Resolves the names of a batch into entries sorted with simfsCompareBatchEntries(). A name that cannot be resolved
+ * gets unresolvedError, and a name that was given before is marked repeated. On a lazy mount, the folders on the
+ * path of each folder of the names are loaded, once per folder.
+ *
+ * Returns NULL if there is no memory.
+ */
+static SIMFS_BATCH_ENTRY_TYPE *simfsBatchPrepare(SIMFS_MOUNT *mount, char **fileNames, size_t numberOfFiles,
+                                                 SIMFS_ERROR unresolvedError) {
+    SIMFS_BATCH_ENTRY_TYPE *entries = malloc(numberOfFiles * sizeof(SIMFS_BATCH_ENTRY_TYPE));
+    if (entries == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < numberOfFiles; i++) {
+        entries[i].position = i;
+        entries[i].descriptorIndex = SIMFS_INVALID_INDEX;
+        entries[i].error = SIMFS_NO_ERROR;
+        entries[i].repeated = false;
+        if (simfsResolvePath(mount, fileNames[i], entries[i].nameWithPath))
+            simfsParentPath(entries[i].nameWithPath, entries[i].parentPath);
+        else {
+            entries[i].error = unresolvedError;
+            entries[i].nameWithPath[0] = entries[i].parentPath[0] = '\0';
+        }
+    }
+    bool sorted = true;
+    for (size_t i = 1; sorted && i < numberOfFiles; i++)
+        sorted = simfsCompareBatchEntries(&entries[i - 1], &entries[i]) < 0;
+    if (!sorted) // the names of a checkout mostly come in order already
+        qsort(entries, numberOfFiles, sizeof(SIMFS_BATCH_ENTRY_TYPE), simfsCompareBatchEntries);
+
+    SIMFS_ERROR folderError = SIMFS_NO_ERROR;
+    for (size_t i = 0; i < numberOfFiles; i++) {
+        if (entries[i].error != SIMFS_NO_ERROR)
+            continue;
+        if (i > 0 && namesAreSame(entries[i].nameWithPath, entries[i - 1].nameWithPath))
+            entries[i].repeated = true;
+        else if (i == 0 || !namesAreSame(entries[i].parentPath, entries[i - 1].parentPath))
+            entries[i].error = folderError = simfsDirectoryFault(mount, entries[i].nameWithPath);
+        else
+            entries[i].error = folderError;
+    }
+
+    return entries;
+}
+
+/*
+ * Frees the blocks of the files that a batch deleted from one folder, with the releases batched, so that a group of
+ * the bitvector is locked once for up to SIMFS_RELEASE_BATCH_BLOCKS blocks.
+ */
+static void simfsReclaimBatchRelease(void *object, void *arg) {
+    SIMFS_BATCH_RELEASE_TYPE *release = object;
+    SIMFS_RELEASE_BATCH_TYPE batch = {.mount = release->mount, .numberOfBlocks = 0};
+    SIMFS_RELEASE_BATCH_TYPE *outerBatch = simfsReleaseBatch; // should the thread batch releases of its own
+
+    simfsReleaseBatch = &batch;
+    for (size_t i = 0; i < release->numberOfDescriptors; i++)
+        simfsReleaseFileBlocks(release->mount, release->descriptors[i], release->generation);
+    simfsReleaseBatchFlush(&batch);
+    simfsReleaseBatch = outerBatch;
+    free(release);
+}
+
+/*
+ * Finds the directory entry for the name of a batch entry in the folder with the descriptor in parent, with one
+ * probe of the directory. The caller holds directoryLock.
+ */
+static SIMFS_DIR_ENT *simfsBatchLookup(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE parent, SIMFS_BATCH_ENTRY_TYPE *entry) {
+    char *name = strrchr(entry->nameWithPath, '/') + 1;
+    if (name[0] == '\0') // the root, which is in no folder
+        return simfsDirectoryLookup(mount, entry->nameWithPath);
+
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+    return simfsDirectoryFind(directory, parent, name, strlen(name));
+}
+
+/*
+ * Counts and traces every name of a batch as an operation started at start, copies the errors of the entries to
+ * errors, if given, in the order of the names, and frees the entries. A repeated name gets the error of its first
+ * occurrence.
+ *
+ * Returns the error of the first name that failed, or SIMFS_NO_ERROR.
+ */
+static SIMFS_ERROR simfsBatchFinish(SIMFS_BATCH_ENTRY_TYPE *entries, size_t numberOfFiles, char **fileNames,
+                                    SIMFS_ERROR *errors, SIMFS_OPERATION_TYPE operation, unsigned long start) {
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    size_t firstFailed = numberOfFiles;
+
+    for (size_t i = 0; i < numberOfFiles; i++) {
+        size_t position = entries[i].position;
+        if (entries[i].repeated)
+            entries[i].error = entries[i - 1].error;
+        if (errors != NULL)
+            errors[position] = entries[i].error;
+        if (entries[i].error != SIMFS_NO_ERROR && position < firstFailed) {
+            firstFailed = position;
+            error = entries[i].error;
+        }
+        simfsStatsFinish(operation, start, entries[i].error);
+        simfsTraceOperation(operation, fileNames[position], 0, start, entries[i].error);
+    }
+
+    free(entries);
+    return error;
+}
+
+/*
+ * Fails every name of a batch with error, counting and tracing them.
+ */
+static SIMFS_ERROR simfsBatchFail(size_t numberOfFiles, char **fileNames, SIMFS_ERROR *errors,
+                                  SIMFS_OPERATION_TYPE operation, unsigned long start, SIMFS_ERROR error) {
+    for (size_t i = 0; i < numberOfFiles; i++) {
+        if (errors != NULL)
+            errors[i] = error;
+        simfsStatsFinish(operation, start, error);
+        simfsTraceOperation(operation, fileNames[i], 0, start, error);
+    }
+
+    return error;
+}
+
+/*
+ * Finds the entry of a batch for the folder with the full path folderPath that is to be created as well.
+ */
+static SIMFS_BATCH_ENTRY_TYPE *simfsBatchFind(SIMFS_BATCH_ENTRY_TYPE *entries, size_t numberOfFiles,
+                                              char *folderPath) {
+    SIMFS_BATCH_ENTRY_TYPE key;
+    strcpy(key.nameWithPath, folderPath);
+    simfsParentPath(key.nameWithPath, key.parentPath);
+    key.position = 0; // the first entry with the name is the one that is not repeated
+
+    size_t low = 0, high = numberOfFiles;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (simfsCompareBatchEntries(&entries[middle], &key) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low < numberOfFiles && namesAreSame(entries[low].nameWithPath, folderPath) ? &entries[low] : NULL;
+}
+
+/*
+ * Creates files or folders, depending on type, with the names in fileNames, as simfsCreateFile() does for each
+ * of them; a name may be in a folder created by the same batch. A name given more than once is created once. If
+ * errors is not NULL, it gets the error of every name, in the order of the names, the same for every occurrence.
+ *
+ * Under directoryLock:
+ *    - checks every name, with the folders before their content
+ *    - takes the descriptor blocks, the first index blocks of new folders and the blocks that extend the index
+ *      chains of the folders in one pass over the allocation groups
+ *    - grows the in-memory directory to fit all new entries at once
+ *    - for every folder, fills in the descriptors of the new files in it from one template and appends them to its
+ *      index chain in one walk, then adds them to the directory
+ *
+ * Returns the error of the first name that failed, or SIMFS_NO_ERROR. If the volume does not have the blocks for
+ * the whole batch, no file is created and every name that could have been gets SIMFS_ALLOC_ERROR.
+ */
+SIMFS_ERROR simfsCreateFiles(SIMFS_MOUNT *mount, char **fileNames, size_t numberOfFiles, SIMFS_CONTENT_TYPE type,
+                             SIMFS_ERROR *errors) {
+    unsigned long start = simfsStatsStart();
+    if (mount->context->readOnly)
+        return simfsBatchFail(numberOfFiles, fileNames, errors, SIMFS_CREATE_OPERATION, start, SIMFS_ACCESS_ERROR);
+    if (numberOfFiles == 0)
+        return SIMFS_NO_ERROR;
+
+    SIMFS_BATCH_ENTRY_TYPE *entries = simfsBatchPrepare(mount, fileNames, numberOfFiles, SIMFS_ALLOC_ERROR);
+    SIMFS_INDEX_TYPE *children = malloc(numberOfFiles * sizeof(SIMFS_INDEX_TYPE));
+    if (entries == NULL || children == NULL) {
+        free(entries);
+        free(children);
+        return simfsBatchFail(numberOfFiles, fileNames, errors, SIMFS_CREATE_OPERATION, start, SIMFS_ALLOC_ERROR);
+    }
+    size_t blocksPerFile = type == FOLDER_CONTENT_TYPE ? 2 : 1;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    size_t numberOfBlocks = 0, numberOfNewFiles = 0;
+    for (size_t first = 0, end; first < numberOfFiles; first = end) {
+        end = simfsBatchFolderEnd(entries, numberOfFiles, first);
+        SIMFS_DIR_ENT *parentEntry = simfsDirectoryLookup(mount, entries[first].parentPath);
+        SIMFS_BATCH_ENTRY_TYPE *newParent = parentEntry == NULL ?
+                                            simfsBatchFind(entries, numberOfFiles, entries[first].parentPath) : NULL;
+        bool parentIsFolder = parentEntry != NULL ?
+                              mount->volume->block[parentEntry->nodeReference].type == FOLDER_CONTENT_TYPE :
+                              newParent != NULL && newParent->error == SIMFS_NO_ERROR && type == FOLDER_CONTENT_TYPE;
+
+        size_t count = 0;
+        for (size_t i = first; i < end; i++) {
+            if (entries[i].error != SIMFS_NO_ERROR || entries[i].repeated)
+                continue;
+            if (namesAreSame(entries[i].nameWithPath, SIMFS_STATS_FILE_NAME) ||
+                (parentEntry != NULL && simfsBatchLookup(mount, parentEntry->nodeReference, &entries[i]) != NULL))
+                entries[i].error = SIMFS_DUPLICATE_ERROR;
+            else if (!parentIsFolder)
+                entries[i].error = SIMFS_NOT_FOUND_ERROR;
+            else
+                count++;
+        }
+        if (count > 0) {
+            size_t size = parentEntry != NULL ?
+                          mount->volume->block[parentEntry->nodeReference].content.fileDescriptor.size : 0;
+            numberOfBlocks += count * blocksPerFile + simfsIndexChainBlocks(size + count) - simfsIndexChainBlocks(size);
+            numberOfNewFiles += count;
+        }
+    }
+
+    SIMFS_INDEX_TYPE *blocks = numberOfBlocks > 0 ? malloc(numberOfBlocks * sizeof(SIMFS_INDEX_TYPE)) : NULL;
+    if (numberOfBlocks > 0 && (blocks == NULL || !simfsAllocateBlocks(mount, numberOfBlocks, blocks))) {
+        for (size_t i = 0; i < numberOfFiles; i++) {
+            if (entries[i].error == SIMFS_NO_ERROR)
+                entries[i].error = SIMFS_ALLOC_ERROR;
+        }
+        numberOfBlocks = numberOfNewFiles = 0;
+    }
+
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+    size_t directorySize = directory->size;
+    while (mount->context->numberOfDirectoryEntries + numberOfNewFiles > directorySize)
+        directorySize *= 2;
+    if (directorySize != directory->size)
+        simfsDirectoryResize(mount, directorySize);
+
+    size_t used = 0;
+    for (size_t first = 0, end; first < numberOfFiles && used < numberOfBlocks; first = end) {
+        end = simfsBatchFolderEnd(entries, numberOfFiles, first);
+        SIMFS_DIR_ENT *parentEntry = simfsDirectoryLookup(mount, entries[first].parentPath);
+        SIMFS_FILE_DESCRIPTOR_TYPE template; // all but the name of the descriptors of the new files in the folder
+        if (parentEntry != NULL) {
+            simfsNewDescriptor(&template, "/", type);
+            template.parent = parentEntry->nodeReference;
+            if (type == FILE_CONTENT_TYPE && (mount->volume->superblock.attr.flags & SIMFS_VOLUME_COMPRESSED) != 0)
+                template.flags = SIMFS_FILE_COMPRESSED;
+        }
+
+        size_t count = 0;
+        for (size_t i = first; i < end; i++) {
+            if (entries[i].error != SIMFS_NO_ERROR || entries[i].repeated)
+                continue;
+            if (parentEntry == NULL) { // the new folder for it could not be created
+                entries[i].error = SIMFS_NOT_FOUND_ERROR;
+                continue;
+            }
+            SIMFS_INDEX_TYPE descriptorIndex = blocks[used++];
+            SIMFS_BLOCK_TYPE *descriptorBlock = &mount->volume->block[descriptorIndex];
+            descriptorBlock->content.fileDescriptor = template;
+            strcpy(descriptorBlock->content.fileDescriptor.name, strrchr(entries[i].nameWithPath, '/') + 1);
+            if (type == FOLDER_CONTENT_TYPE) {
+                SIMFS_INDEX_TYPE indexBlock = blocks[used++];
+                mount->volume->block[indexBlock].type = INDEX_CONTENT_TYPE;
+                simfsChecksumUpdate(mount, indexBlock);
+                descriptorBlock->content.fileDescriptor.block_ref = indexBlock;
+            }
+            descriptorBlock->type = type;
+            simfsChecksumUpdate(mount, descriptorIndex);
+            entries[i].descriptorIndex = descriptorIndex;
+            children[count++] = descriptorIndex;
+        }
+        if (count == 0)
+            continue;
+
+        SIMFS_INDEX_TYPE parentIndex = parentEntry->nodeReference;
+        size_t size = mount->volume->block[parentIndex].content.fileDescriptor.size;
+        size_t chainBlocks = simfsIndexChainBlocks(size + count) - simfsIndexChainBlocks(size);
+        if (simfsIndexAppendMany(mount, parentIndex, children, count, blocks + used) != SIMFS_NO_ERROR) {
+            for (size_t i = 0; i < chainBlocks; i++)
+                simfsReleaseBlock(mount, blocks[used + i]);
+            for (size_t i = first; i < end; i++) {
+                SIMFS_INDEX_TYPE descriptorIndex = entries[i].descriptorIndex;
+                if (descriptorIndex == SIMFS_INVALID_INDEX)
+                    continue;
+                if (type == FOLDER_CONTENT_TYPE)
+                    simfsReleaseBlock(mount, mount->volume->block[descriptorIndex].content.fileDescriptor.block_ref);
+                mount->volume->block[descriptorIndex].type = INVALID_CONTENT_TYPE;
+                simfsReleaseBlock(mount, descriptorIndex);
+                entries[i].descriptorIndex = SIMFS_INVALID_INDEX;
+                entries[i].error = SIMFS_ALLOC_ERROR;
+            }
+        }
+        used += chainBlocks;
+
+        for (size_t i = first; i < end; i++) {
+            SIMFS_INDEX_TYPE descriptorIndex = entries[i].descriptorIndex;
+            if (descriptorIndex == SIMFS_INVALID_INDEX ||
+                addFileDescriptorToList(mount, descriptorIndex) == SIMFS_NO_ERROR)
+                continue;
+            simfsIndexRemove(mount, parentIndex, descriptorIndex); // preserved by the append already
+            if (type == FOLDER_CONTENT_TYPE)
+                simfsReleaseBlock(mount, mount->volume->block[descriptorIndex].content.fileDescriptor.block_ref);
+            mount->volume->block[descriptorIndex].type = INVALID_CONTENT_TYPE;
+            simfsReleaseBlock(mount, descriptorIndex);
+            entries[i].error = SIMFS_ALLOC_ERROR;
+        }
+    }
+    for (size_t i = used; i < numberOfBlocks; i++) // kept for the content of folders that could not be created
+        simfsReleaseBlock(mount, blocks[i]);
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    free(blocks);
+    free(children);
+    return simfsBatchFinish(entries, numberOfFiles, fileNames, errors, SIMFS_CREATE_OPERATION, start);
+}
+
+/*
+ * Deletes the files and folders with the names in fileNames, as simfsDeleteFile() does for each of them; a folder
+ * is empty for the batch if the batch deletes all of its content. A name given more than once is deleted once. If
+ * errors is not NULL, it gets the error of every name, in the order of the names, the same for every occurrence.
+ *
+ * Under directoryLock, going through the folders of the names from the deepest up:
+ *    - checks every name in the folder as simfsDeleteFile() does
+ *    - removes the references to all of them from the index chain of the folder in one walk; if the folder is
+ *      held by a snapshot and there is no block left to preserve it, then they all get SIMFS_ALLOC_ERROR
+ *    - detaches them in one pass over the global open file table and removes them from the directory; their
+ *      blocks are freed together once no lookup can still see them
+ *
+ * Returns the error of the first name that failed, or SIMFS_NO_ERROR.
+ */
+SIMFS_ERROR simfsDeleteFiles(SIMFS_MOUNT *mount, char **fileNames, size_t numberOfFiles, SIMFS_ERROR *errors) {
+    unsigned long start = simfsStatsStart();
+    if (mount->context->readOnly)
+        return simfsBatchFail(numberOfFiles, fileNames, errors, SIMFS_DELETE_OPERATION, start, SIMFS_ACCESS_ERROR);
+    if (numberOfFiles == 0)
+        return SIMFS_NO_ERROR;
+
+    SIMFS_BATCH_ENTRY_TYPE *entries = simfsBatchPrepare(mount, fileNames, numberOfFiles, SIMFS_NOT_FOUND_ERROR);
+    SIMFS_INDEX_TYPE *children = malloc(numberOfFiles * sizeof(SIMFS_INDEX_TYPE));
+    if (entries == NULL || children == NULL) {
+        free(entries);
+        free(children);
+        return simfsBatchFail(numberOfFiles, fileNames, errors, SIMFS_DELETE_OPERATION, start, SIMFS_ALLOC_ERROR);
+    }
+    unsigned char mask = 0200; //bitmask representing owners ability to write to file
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    for (size_t end = numberOfFiles, first; end > 0; end = first) {
+        first = end - 1;
+        while (first > 0 && namesAreSame(entries[first - 1].parentPath, entries[end - 1].parentPath))
+            first--;
+
+        SIMFS_DIR_ENT *parentEntry = simfsDirectoryLookup(mount, entries[first].parentPath);
+        SIMFS_INDEX_TYPE parentIndex = parentEntry != NULL ? parentEntry->nodeReference : SIMFS_INVALID_INDEX;
+        size_t count = 0;
+        for (size_t i = first; i < end; i++) {
+            if (entries[i].error != SIMFS_NO_ERROR || entries[i].repeated)
+                continue;
+            SIMFS_DIR_ENT *listElement = parentEntry != NULL ? simfsBatchLookup(mount, parentIndex, &entries[i]) : NULL;
+            if (namesAreSame(entries[i].nameWithPath, SIMFS_STATS_FILE_NAME))
+                entries[i].error = SIMFS_ACCESS_ERROR;
+            else if (listElement == NULL || listElement->nodeReference == mount->volume->superblock.attr.rootNodeIndex)
+                entries[i].error = SIMFS_NOT_FOUND_ERROR;
+            else {
+                SIMFS_FILE_DESCRIPTOR_TYPE *descriptor =
+                        &mount->volume->block[listElement->nodeReference].content.fileDescriptor;
+                if (descriptor->type == FOLDER_CONTENT_TYPE && descriptor->size > 0)
+                    entries[i].error = SIMFS_NOT_EMPTY_ERROR;
+                else if ((mask & descriptor->accessRights) != mask)
+                    entries[i].error = SIMFS_ACCESS_ERROR;
+                else {
+                    entries[i].descriptorIndex = listElement->nodeReference;
+                    children[count++] = listElement->nodeReference;
+                }
+            }
+        }
+        if (count == 0)
+            continue;
+
+        qsort(children, count, sizeof(SIMFS_INDEX_TYPE), simfsCompareIndices);
+        if (simfsIndexRemoveMany(mount, parentIndex, children, count) != SIMFS_NO_ERROR) {
+            for (size_t i = first; i < end; i++) {
+                if (entries[i].descriptorIndex != SIMFS_INVALID_INDEX)
+                    entries[i].error = SIMFS_ALLOC_ERROR;
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&mount->context->openFileLock);
+        for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES / SIMFS_OPEN_FILE_CHUNK_SIZE; i++) {
+            SIMFS_OPEN_FILE_CHUNK_TYPE *chunk = mount->context->globalOpenFileTable[i];
+            for (int j = 0; chunk != NULL && chunk->numberOfEntriesInUse > 0 && j < SIMFS_OPEN_FILE_CHUNK_SIZE; j++) {
+                if (chunk->entry[j].type != INVALID_CONTENT_TYPE &&
+                    bsearch(&chunk->entry[j].fileDescriptor, children, count, sizeof(SIMFS_INDEX_TYPE),
+                            simfsCompareIndices) != NULL)
+                    chunk->entry[j].fileDescriptor = SIMFS_DELETED_FILE; // the block is reused after reclamation
+            }
+        }
+        pthread_mutex_unlock(&mount->context->openFileLock);
+
+        // looked up again, as a removal may shrink the table; without the memory to free the blocks together, every
+        // entry frees the blocks of its file
+        SIMFS_BATCH_RELEASE_TYPE *release = malloc(sizeof(SIMFS_BATCH_RELEASE_TYPE) + count * sizeof(SIMFS_INDEX_TYPE));
+        for (size_t i = first; i < end; i++) {
+            if (entries[i].descriptorIndex != SIMFS_INVALID_INDEX)
+                simfsDirectoryUnlink(mount, simfsBatchLookup(mount, parentIndex, &entries[i]),
+                                     release != NULL ? simfsReclaimDirEntOnly : simfsReclaimDirEnt);
+        }
+        if (release != NULL) {
+            release->mount = mount;
+            release->generation = mount->volume->generation;
+            release->numberOfDescriptors = count;
+            memcpy(release->descriptors, children, count * sizeof(SIMFS_INDEX_TYPE));
+            simfsEpochRetire(release, simfsReclaimBatchRelease, NULL);
+        }
+    }
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    free(children);
+    return simfsBatchFinish(entries, numberOfFiles, fileNames, errors, SIMFS_DELETE_OPERATION, start);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// recursive deletion
+//
+// simfsDeleteTree() detaches a file or a folder with everything in it under directoryLock in constant time, but for
+// the reference from its parent: it unlinks the entry of the root of the subtree, which leaves no path to the
+// entries below it that are still linked, since those are keyed on the folders of the subtree, and publishes the
+// subtree as a SIMFS_DETACHED_TREE_TYPE, so that the handles of the files in it fail. A detacher thread then walks
+// the subtree, SIMFS_TREE_DELETION_CHUNK descriptors per hold of directoryLock, unlinks their entries and detaches
+// their handles, and withdraws the subtree. A folder created under the path in the meantime has another block, so
+// the names in it have other keys.
+//
+// The blocks are freed afterwards by worker threads, which share the descriptors of the subtree in chunks of
+// SIMFS_TREE_DELETION_CHUNK and batch their releases, so a group of the bitvector is locked once for up to
+// SIMFS_RELEASE_BATCH_BLOCKS blocks. The workers start freeing once no reader can still see the subtree, and take
+// no lock but sharingLock and the group locks; unmounting and resizing the volume wait for them.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct simfs_tree_deletion_type {
+    SIMFS_MOUNT *mount;
+    SIMFS_DETACHED_TREE_TYPE detachedTree; // in detachedTrees of the context until the walk is done
+    SIMFS_INDEX_TYPE *descriptors; // of the subtree, folders before their content
+    size_t numberOfDescriptors;
+    size_t capacity; // of descriptors
+    size_t walked; // descriptors whose entries are unlinked and whose children are in descriptors
+    unsigned char *inSubtree; // bitmap of the walked descriptors
+    size_t numberOfBlocks; // of the volume, and of inSubtree, which no resize changes until the subtree is freed
+    _Atomic size_t next; // first descriptor that no worker has claimed yet
+    _Atomic unsigned int workers; // still running; the last one frees the deletion
+    unsigned int generation; // in which the subtree left the tree
+} SIMFS_TREE_DELETION_TYPE;
+
+/*
+ * Waits until the blocks of all subtrees deleted with simfsDeleteTree() have been freed.
+ */
+static void simfsTreeDeletionsWait(SIMFS_MOUNT *mount) {
+    pthread_mutex_lock(&mount->context->deletionLock);
+    while (mount->context->pendingDeletions > 0)
+        pthread_cond_wait(&mount->context->deletionCondition, &mount->context->deletionLock);
+    pthread_mutex_unlock(&mount->context->deletionLock);
+}
+
+/*
+ * Tells whether subtrees deleted with simfsDeleteTree() are still being detached or freed.
+ */
+static bool simfsTreeDeletionsPending(SIMFS_MOUNT *mount) {
+    pthread_mutex_lock(&mount->context->deletionLock);
+    bool pending = mount->context->pendingDeletions > 0;
+    pthread_mutex_unlock(&mount->context->deletionLock);
+
+    return pending;
+}
+
+/*
+ * Body of a worker of a tree deletion. Frees the files and folders in the chunks of descriptors it claims, with its
+ * releases batched. The last worker to finish frees the deletion and wakes up those waiting for it.
+ */
+static void *simfsTreeDeletionWorker(void *arg) {
+    SIMFS_TREE_DELETION_TYPE *deletion = arg;
+    SIMFS_MOUNT *mount = deletion->mount;
+    SIMFS_RELEASE_BATCH_TYPE batch = {.mount = mount, .numberOfBlocks = 0};
+
+    simfsEpochSynchronize(); // readers that found a name in the subtree, or the subtree itself, are gone
+    simfsReleaseBatch = &batch;
+    for (;;) {
+        size_t first = atomic_fetch_add_explicit(&deletion->next, SIMFS_TREE_DELETION_CHUNK, memory_order_relaxed);
+        if (first >= deletion->numberOfDescriptors)
+            break;
+        size_t end = first + SIMFS_TREE_DELETION_CHUNK < deletion->numberOfDescriptors ?
+                     first + SIMFS_TREE_DELETION_CHUNK : deletion->numberOfDescriptors;
+        for (size_t i = first; i < end; i++)
+            simfsReleaseFileBlocks(mount, deletion->descriptors[i], deletion->generation);
+    }
+    simfsReleaseBatchFlush(&batch);
+    simfsReleaseBatch = NULL;
+
+    if (atomic_fetch_sub_explicit(&deletion->workers, 1, memory_order_acq_rel) == 1) {
+        free(deletion->descriptors);
+        free(deletion);
+        pthread_mutex_lock(&mount->context->deletionLock);
+        if (--mount->context->pendingDeletions == 0)
+            pthread_cond_broadcast(&mount->context->deletionCondition);
+        pthread_mutex_unlock(&mount->context->deletionLock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Starts the workers of a tree deletion, one per online CPU up to one per chunk of descriptors. If no worker can be
+ * started, the calling thread does the work.
+ */
+static void simfsTreeDeletionStart(SIMFS_TREE_DELETION_TYPE *deletion) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t numberOfWorkers = (deletion->numberOfDescriptors + SIMFS_TREE_DELETION_CHUNK - 1) /
+                             SIMFS_TREE_DELETION_CHUNK;
+    if (cpus > 0 && numberOfWorkers > (size_t) cpus)
+        numberOfWorkers = cpus;
+    else if (cpus <= 0)
+        numberOfWorkers = 1;
+
+    atomic_init(&deletion->workers, (unsigned int) numberOfWorkers);
+    unsigned int notStarted = 0;
+    for (size_t i = 0; i < numberOfWorkers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, simfsTreeDeletionWorker, deletion) == 0)
+            pthread_detach(thread);
+        else
+            notStarted++;
+    }
+    if (notStarted > 0) { // the caller stands in for all of them
+        atomic_fetch_sub_explicit(&deletion->workers, notStarted - 1, memory_order_acq_rel);
+        simfsTreeDeletionWorker(deletion);
+    }
+}
+
+/*
+ * Walks up to SIMFS_TREE_DELETION_CHUNK descriptors of a detached subtree: unlinks their directory entries, queues
+ * the children of folders, and detaches the handles of the files walked so far. Returns false if there is no
+ * memory to queue the children of a folder; the walk goes on from that folder the next time. The caller holds
+ * directoryLock.
+ */
+static bool simfsTreeDeletionWalk(SIMFS_MOUNT *mount, SIMFS_TREE_DELETION_TYPE *deletion) {
+    bool queued = true;
+    for (size_t walked = 0; queued && walked < SIMFS_TREE_DELETION_CHUNK &&
+                            deletion->walked < deletion->numberOfDescriptors; walked++) {
+        SIMFS_INDEX_TYPE descriptorIndex = deletion->descriptors[deletion->walked];
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+        size_t numberOfChildren = descriptor->type == FOLDER_CONTENT_TYPE ? descriptor->size : 0;
+        if (deletion->numberOfDescriptors + numberOfChildren > deletion->capacity) {
+            size_t capacity = deletion->numberOfDescriptors + numberOfChildren > 2 * deletion->capacity ?
+                              deletion->numberOfDescriptors + numberOfChildren : 2 * deletion->capacity;
+            SIMFS_INDEX_TYPE *grown = realloc(deletion->descriptors, capacity * sizeof(SIMFS_INDEX_TYPE));
+            if (grown == NULL) {
+                queued = false;
+                continue;
+            }
+            deletion->descriptors = grown;
+            deletion->capacity = capacity;
+        }
+
+        SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+        for (size_t i = 0; i < numberOfChildren; i++) {
+            if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+                indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+            deletion->descriptors[deletion->numberOfDescriptors++] =
+                    mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        }
+
+        // the entry of the root of the subtree is unlinked already; the content of a folder that a lazy mount did
+        // not load has none
+        SIMFS_DIR_ENT *entry = deletion->walked > 0 ? simfsDirectoryFindDescriptor(mount, descriptorIndex) : NULL;
+        if (entry != NULL)
+            simfsDirectoryUnlink(mount, entry, simfsReclaimDirEntOnly);
+        simfsSetBit(deletion->inSubtree, descriptorIndex);
+        deletion->walked++;
+    }
+
+    pthread_mutex_lock(&mount->context->openFileLock);
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES / SIMFS_OPEN_FILE_CHUNK_SIZE; i++) {
+        SIMFS_OPEN_FILE_CHUNK_TYPE *chunk = mount->context->globalOpenFileTable[i];
+        for (int j = 0; chunk != NULL && j < SIMFS_OPEN_FILE_CHUNK_SIZE; j++) {
+            SIMFS_INDEX_TYPE descriptorIndex = chunk->entry[j].fileDescriptor;
+            if (chunk->entry[j].type != INVALID_CONTENT_TYPE && descriptorIndex < deletion->numberOfBlocks &&
+                (deletion->inSubtree[descriptorIndex / 8] & (0x80 >> (descriptorIndex % 8))) != 0)
+                chunk->entry[j].fileDescriptor = SIMFS_DELETED_FILE; // the descriptor block is reused after reclamation
+        }
+    }
+    pthread_mutex_unlock(&mount->context->openFileLock);
+
+    return queued;
+}
+
+/*
+ * Body of the detacher of a tree deletion. Walks the subtree a chunk at a time under directoryLock, withdraws it
+ * from detachedTrees once none of its entries is linked and none of its handles attached, and starts the workers
+ * that free its blocks.
+ */
+static void *simfsTreeDeletionDetach(void *arg) {
+    SIMFS_TREE_DELETION_TYPE *deletion = arg;
+    SIMFS_MOUNT *mount = deletion->mount;
+
+    while (deletion->walked < deletion->numberOfDescriptors) {
+        pthread_mutex_lock(&mount->context->directoryLock);
+        bool queued = simfsTreeDeletionWalk(mount, deletion);
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        if (!queued)
+            sched_yield(); // until there is memory for the children of the next folder
+    }
+    free(deletion->inSubtree);
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+    SIMFS_DETACHED_TREE_TYPE **link = &mount->context->detachedTrees;
+    while (*link != &deletion->detachedTree)
+        link = &(*link)->next;
+    *link = deletion->detachedTree.next;
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    simfsTreeDeletionStart(deletion);
+    return NULL;
+}
+
+/*
+ * Deletes a file, or a folder with everything in it, and returns as soon as the subtree is detached: no name in it
+ * is found any more, reads and writes through the remaining handles of its files fail, and its entries are
+ * unlinked and its blocks freed in the background.
+ *
+ * Under directoryLock, in constant time but for the walk of the index chain of the parent:
+ *    - allocates the bitmap of the walked descriptors for the size the volume has then; a resize waits for the
+ *      deletion, so that size holds until the subtree is freed; if there is no memory, it returns SIMFS_ALLOC_ERROR
+ *    - checks that the process owner can delete the root of the subtree; if not, it returns SIMFS_ACCESS_ERROR
+ *    - removes the reference to the root of the subtree from the index chain of its folder; if the folder is held
+ *      by a snapshot and there is no block left to preserve it, then it returns SIMFS_ALLOC_ERROR
+ *    - unlinks the entry of the root, detaches it from its entry in the global open file table, and publishes the
+ *      subtree in detachedTrees
+ * Then it starts the detacher of the subtree.
+ *
+ * Returns SIMFS_NOT_FOUND_ERROR if there is no such file, or for the root. On a read-only mount, such as a
+ * snapshot, the function returns SIMFS_ACCESS_ERROR.
+ */
+static SIMFS_ERROR simfsDeleteSubtree(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName) {
+    SIMFS_NAME_TYPE nameWithPath;
+    SIMFS_NAME_TYPE parentPath;
+
+    if (!simfsResolvePath(mount, fileName, nameWithPath))
+        return SIMFS_NOT_FOUND_ERROR;
+    if (namesAreSame(nameWithPath, SIMFS_STATS_FILE_NAME) || mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+    simfsParentPath(nameWithPath, parentPath);
+    SIMFS_ERROR error = simfsDirectoryFault(mount, nameWithPath);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_TREE_DELETION_TYPE *deletion = malloc(sizeof(SIMFS_TREE_DELETION_TYPE));
+    SIMFS_INDEX_TYPE *descriptors = malloc(SIMFS_TREE_DELETION_CHUNK * sizeof(SIMFS_INDEX_TYPE));
+    if (deletion == NULL || descriptors == NULL) {
+        free(deletion);
+        free(descriptors);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    // a resize takes directoryLock and waits for pending deletions, so the volume keeps this size until the subtree
+    // is freed
+    size_t numberOfBlocks = simfsVolumeBlocks(mount->volume);
+    unsigned char *inSubtree = calloc(numberOfBlocks / 8, 1);
+    SIMFS_DIR_ENT *listElement = simfsDirectoryLookup(mount, nameWithPath);
+    unsigned char mask = 0200; //bitmask representing owners ability to write to file
+    if (inSubtree == NULL)
+        error = SIMFS_ALLOC_ERROR;
+    else if (listElement == NULL || listElement->nodeReference == mount->volume->superblock.attr.rootNodeIndex)
+        error = SIMFS_NOT_FOUND_ERROR;
+    else if ((mask & mount->volume->block[listElement->nodeReference].content.fileDescriptor.accessRights) != mask)
+        error = SIMFS_ACCESS_ERROR;
+    else
+        error = simfsIndexRemove(mount, simfsDirectoryLookup(mount, parentPath)->nodeReference,
+                                 listElement->nodeReference);
+    if (error != SIMFS_NO_ERROR) {
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        free(deletion);
+        free(descriptors);
+        free(inSubtree);
+        return error;
+    }
+
+    SIMFS_INDEX_TYPE rootIndex = listElement->nodeReference;
+    pthread_mutex_lock(&mount->context->openFileLock);
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsFindGlobalEntry(mount, rootIndex);
+    if (globalEntry != NULL)
+        globalEntry->fileDescriptor = SIMFS_DELETED_FILE; // the descriptor block is reused after reclamation
+    pthread_mutex_unlock(&mount->context->openFileLock);
+    simfsDirectoryUnlink(mount, listElement, simfsReclaimDirEntOnly);
+
+    deletion->mount = mount;
+    deletion->detachedTree.root = rootIndex;
+    deletion->detachedTree.next = mount->context->detachedTrees;
+    mount->context->detachedTrees = &deletion->detachedTree;
+    deletion->descriptors = descriptors;
+    deletion->descriptors[0] = rootIndex;
+    deletion->numberOfDescriptors = 1;
+    deletion->capacity = SIMFS_TREE_DELETION_CHUNK;
+    deletion->walked = 0;
+    deletion->inSubtree = inSubtree;
+    deletion->numberOfBlocks = numberOfBlocks;
+    atomic_init(&deletion->next, 0);
+    deletion->generation = mount->volume->generation;
+    pthread_mutex_lock(&mount->context->deletionLock);
+    mount->context->pendingDeletions++;
+    pthread_mutex_unlock(&mount->context->deletionLock);
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, simfsTreeDeletionDetach, deletion) == 0)
+        pthread_detach(thread);
+    else
+        simfsTreeDeletionDetach(deletion); // the caller detaches the subtree itself
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsDeleteTree(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsDeleteSubtree(mount, fileName);
+    simfsStatsFinish(SIMFS_DELETE_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_DELETE_OPERATION, fileName, 0, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// renaming
+//
+// A descriptor holds the name of its file in its folder and the block of the descriptor of the folder, and the
+// directory keys the entries on the same two, so a renamed file keeps its descriptor block and only the name and
+// the folder in it change. Renaming a folder costs as little as renaming a file, whatever is in it: the entries of
+// its content are keyed on its block, which does not move. The entry for the new name is published before the
+// entries for the old name and for the file it replaces are unlinked, so a lookup of the new name finds one file or
+// the other, and the handles and working directories of the renamed files stay as they are.
+//
+// A folder only moves to a longer name if the names with the full path of all the files in it still fit into
+// SIMFS_NAME_TYPE; that walk of its subtree is the one part of a rename that grows with the content of a folder.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns whether the names of all files in the subtree of the folder in the block folderIndex fit into room
+ * characters once appended to the path of the folder, each with a '/' before it. The caller holds directoryLock.
+ */
+static bool simfsSubtreeNamesFit(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex, size_t room) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = &mount->volume->block[folderIndex].content.fileDescriptor;
+    SIMFS_INDEX_TYPE indexBlock = folder->block_ref;
+
+    for (size_t i = 0; i < folder->size; i++) {
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        SIMFS_INDEX_TYPE child = mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        size_t length = strlen(mount->volume->block[child].content.fileDescriptor.name) + 1;
+        if (length > room || (mount->volume->block[child].type == FOLDER_CONTENT_TYPE &&
+                              !simfsSubtreeNamesFit(mount, child, room - length)))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Renames the file or folder oldName to newName, which may be in another folder. If a file named newName exists,
+ * it is replaced: a file by a file, and an empty folder by a folder.
+ *
+ * Under directoryLock, in constant time but for the walks of the index chains of the two folders:
+ *    - checks the names; the process owner must be able to delete the file and the one it replaces; a folder
+ *      that moves to a longer name walks its subtree to check that the names of its files still fit
+ *    - checks that enough free blocks are left to preserve every block that the rename changes for the snapshots,
+ *      so that nothing fails once the tree starts to change
+ *    - writes the new name and folder into the descriptor and adds the entry for the new name to the directory
+ *    - puts the descriptor into the slot of the file it replaces, or at the end of the chain of its new folder,
+ *      and takes it out of the chain of its old folder
+ *    - unlinks the entries for the old name and the replaced file, and detaches the replaced file from its entry
+ *      in the global open file table, if it is open
+ *
+ * Returns SIMFS_NOT_FOUND_ERROR if there is no file oldName, or no folder for newName; SIMFS_DUPLICATE_ERROR if
+ * newName is a file of the other type; SIMFS_NOT_EMPTY_ERROR if it is a folder that is not empty;
+ * SIMFS_ACCESS_ERROR if a folder would move into itself, or on a read-only mount; and SIMFS_ALLOC_ERROR if the new
+ * name, or the name with the full path of a file in the folder, is too long or there are not enough free blocks.
+ */
+static SIMFS_ERROR simfsMove(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE oldName, SIMFS_NAME_TYPE newName) {
+    SIMFS_NAME_TYPE oldPath, newPath, oldParentPath, newParentPath;
+
+    if (!simfsResolvePath(mount, oldName, oldPath))
+        return SIMFS_NOT_FOUND_ERROR;
+    if (!simfsResolvePath(mount, newName, newPath))
+        return SIMFS_ALLOC_ERROR;
+    size_t oldLength = strlen(oldPath);
+    if (namesAreSame(oldPath, SIMFS_STATS_FILE_NAME) || namesAreSame(newPath, SIMFS_STATS_FILE_NAME) ||
+        mount->context->readOnly || (strncmp(newPath, oldPath, oldLength) == 0 && newPath[oldLength] == '/'))
+        return SIMFS_ACCESS_ERROR;
+    simfsParentPath(oldPath, oldParentPath);
+    simfsParentPath(newPath, newParentPath);
+    SIMFS_ERROR error = simfsDirectoryFault(mount, oldPath);
+    if (error == SIMFS_NO_ERROR)
+        error = simfsDirectoryFault(mount, newPath);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_BLOCK_TYPE *blocks = mount->volume->block;
+    SIMFS_DIR_ENT *oldEntry = simfsDirectoryLookup(mount, oldPath);
+    SIMFS_DIR_ENT *newParentEntry = simfsDirectoryLookup(mount, newParentPath);
+    SIMFS_DIR_ENT *targetEntry = simfsDirectoryLookup(mount, newPath);
+    unsigned char mask = 0200; //bitmask representing owners ability to write to file
+    if (oldEntry == NULL || oldEntry->nodeReference == mount->volume->superblock.attr.rootNodeIndex ||
+        newParentEntry == NULL || blocks[newParentEntry->nodeReference].type != FOLDER_CONTENT_TYPE)
+        error = SIMFS_NOT_FOUND_ERROR;
+    else if ((mask & blocks[oldEntry->nodeReference].content.fileDescriptor.accessRights) != mask)
+        error = SIMFS_ACCESS_ERROR;
+    else if (targetEntry != NULL && targetEntry != oldEntry) {
+        SIMFS_FILE_DESCRIPTOR_TYPE *target = &blocks[targetEntry->nodeReference].content.fileDescriptor;
+        if (targetEntry->nodeReference == mount->volume->superblock.attr.rootNodeIndex)
+            error = SIMFS_ACCESS_ERROR;
+        else if (target->type != blocks[oldEntry->nodeReference].type)
+            error = SIMFS_DUPLICATE_ERROR;
+        else if (target->type == FOLDER_CONTENT_TYPE && target->size > 0)
+            error = SIMFS_NOT_EMPTY_ERROR;
+        else if ((mask & target->accessRights) != mask)
+            error = SIMFS_ACCESS_ERROR;
+    }
+    if (error == SIMFS_NO_ERROR && strlen(newPath) > oldLength &&
+        blocks[oldEntry->nodeReference].type == FOLDER_CONTENT_TYPE &&
+        !simfsSubtreeNamesFit(mount, oldEntry->nodeReference, SIMFS_MAX_NAME_LENGTH - 1 - strlen(newPath)))
+        error = SIMFS_ALLOC_ERROR;
+    SIMFS_INDEX_TYPE oldParent = oldEntry != NULL ? oldEntry->parent : SIMFS_INVALID_INDEX;
+    SIMFS_INDEX_TYPE newParent = newParentEntry != NULL ? newParentEntry->nodeReference : SIMFS_INVALID_INDEX;
+    // every block the rename changes may have to be preserved for a snapshot, and the chain of the new folder may
+    // grow by a block
+    if (error == SIMFS_NO_ERROR && targetEntry != oldEntry &&
+        (simfsNumberOfFreeBlocks(mount) < 4 + simfsIndexChainBlocks(blocks[oldParent].content.fileDescriptor.size) +
+                                          simfsIndexChainBlocks(blocks[newParent].content.fileDescriptor.size) ||
+         !simfsSnapshotPreserve(mount, oldEntry->nodeReference)))
+        error = SIMFS_ALLOC_ERROR;
+    if (error != SIMFS_NO_ERROR || targetEntry == oldEntry) { // renaming a file to its own name changes nothing
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        return error;
+    }
+    SIMFS_INDEX_TYPE moved = oldEntry->nodeReference;
+    SIMFS_INDEX_TYPE target = targetEntry != NULL ? targetEntry->nodeReference : SIMFS_INVALID_INDEX;
+    bool loaded = atomic_load_explicit(&oldEntry->loaded, memory_order_relaxed);
+
+    // the entries are found again by their keys, since adding or unlinking one may resize the table
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &blocks[moved].content.fileDescriptor;
+    SIMFS_NAME_TYPE oldComponent;
+    strcpy(oldComponent, descriptor->name);
+    simfsDescriptorChangeBegin(mount, moved);
+    strcpy(descriptor->name, strrchr(newPath, '/') + 1);
+    descriptor->parent = newParent;
+    simfsDescriptorChangeEnd(mount, moved);
+    simfsChecksumUpdate(mount, moved);
+    if (simfsDirectoryAdd(mount, moved, loaded) != SIMFS_NO_ERROR) {
+        simfsDescriptorChangeBegin(mount, moved);
+        strcpy(descriptor->name, oldComponent);
+        descriptor->parent = oldParent;
+        simfsDescriptorChangeEnd(mount, moved);
+        simfsChecksumUpdate(mount, moved);
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    // none of the changes to the tree fail, since the blocks to preserve were counted
+    if (target != SIMFS_INVALID_INDEX) {
+        simfsIndexReplace(mount, newParent, target, moved);
+        simfsIndexRemove(mount, oldParent, moved);
+    } else if (oldParent != newParent) {
+        simfsIndexAppend(mount, newParent, moved);
+        simfsIndexRemove(mount, oldParent, moved);
+    }
+
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+    simfsDirectoryUnlink(mount, simfsDirectoryFind(directory, oldParent, oldComponent, strlen(oldComponent)),
+                         simfsReclaimDirEntOnly);
+    if (target != SIMFS_INVALID_INDEX) {
+        simfsDirectoryRemove(mount, simfsDirectoryFindDescriptor(mount, target));
+        pthread_mutex_lock(&mount->context->openFileLock);
+        SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsFindGlobalEntry(mount, target);
+        if (globalEntry != NULL)
+            globalEntry->fileDescriptor = SIMFS_DELETED_FILE; // the descriptor block is reused after reclamation
+        pthread_mutex_unlock(&mount->context->openFileLock);
+    }
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsRename(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE oldName, SIMFS_NAME_TYPE newName) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsMove(mount, oldName, newName);
+    simfsStatsFinish(SIMFS_RENAME_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_RENAME_OPERATION, oldName, 0, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Finds the file in the in-memory directory and obtains the information about the file from the file descriptor
+ * block referenced from the directory; the name in it is the name with the full path.
+ *
+ * The lookup takes no lock; the descriptor block cannot be reused while the epoch is held, and the copy is the
+ * descriptor as it stood between two changes by writers (see simfsDescriptorCopy()), never a partly changed one.
+ *
+ * If the file is not found, then it returns SIMFS_NOT_FOUND_ERROR
+ */
+static SIMFS_ERROR simfsGetInfo(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer) {
+    SIMFS_NAME_TYPE nameWithPath;
+
+    if (!simfsResolvePath(mount, fileName, nameWithPath))
+        return SIMFS_NOT_FOUND_ERROR;
+    SIMFS_ERROR error;
+    if (namesAreSame(nameWithPath, SIMFS_STATS_FILE_NAME))
+        error = simfsStatsFileDescriptor(infoBuffer);
+    else if ((error = simfsDirectoryFault(mount, nameWithPath)) == SIMFS_NO_ERROR) {
+        simfsEpochEnter();
+        SIMFS_DIR_ENT *entry = simfsDirectoryLookup(mount, nameWithPath);
+        if (entry != NULL)
+            simfsDescriptorCopy(mount, entry->nodeReference, infoBuffer);
+        simfsEpochExit();
+        error = entry != NULL ? SIMFS_NO_ERROR : SIMFS_NOT_FOUND_ERROR;
+    }
+
+    if (error == SIMFS_NO_ERROR)
+        strcpy(infoBuffer->name, nameWithPath); // the descriptor holds the name in the folder
+    return error;
+}
+
+SIMFS_ERROR simfsGetFileInfo(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsGetInfo(mount, fileName, infoBuffer);
+    simfsStatsFinish(SIMFS_GET_FILE_INFO_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_GET_FILE_INFO_OPERATION, fileName, 0, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Hashes the name and searches for it in the in-memory directory. If the file does not exist,
+ * the SIMFS_NOT_FOUND_ERROR is returned.
+ *
+ * Otherwise:
+ *    - checks the per-process open file table for the process, and if the file has already been opened
+ *      it returns the index of the openFileTable with the entry of the file through the parameter fileHandle, and
+ *      returns SIMFS_DUPLICATE_ERROR as the return value
+ *
+ *    - otherwise, checks if there is a global entry for the file, and if so, then:
+ *       - it increases the reference count for this file
+ *
+ *       - otherwise, it creates an entry in the global open file table for the file copying the information
+ *         from the file descriptor block referenced from the entry for this file in the directory; the copy is
+ *         taken without a lock, as simfsGetFileInfo() takes it, so it is never a partly changed descriptor
  *
  *       - if the process does not have its process control block in the processControlBlocks list, then
  *         a file control block for the process is created and added to the list; the current working directory
  *         is initialized to the root of the volume and the number of the open files is initialized to 0
  *
- *       - if an entry for this file does not exits in the per-process open file table, the function finds an
- *         empty slot in the table and fills it with the information including the reference to the entry for
- *         this file in the global open file table.
+ *       - if an entry for this file does not exits in the per-process open file table, the function finds an
+ *         empty slot in the table and fills it with the information including the reference to the entry for
+ *         this file in the global open file table.
+ *
+ *       - returns the index to the new element of the per-process open file table through the parameter fileHandle
+ *         and SIMFS_NO_ERROR as the return value
+ *
+ * If there is no free slot for the file in either the global file table or in the per-process
+ * file table, or if there is any other allocation problem, then the function returns SIMFS_ALLOC_ERROR.
+ *
+ */
+static SIMFS_ERROR simfsOpen(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle) {
+    SIMFS_NAME_TYPE nameWithPath;
+
+    if (!simfsResolvePath(mount, fileName, nameWithPath))
+        return SIMFS_NOT_FOUND_ERROR;
+
+    struct fuse_context *context = simfs_debug_get_context();
+    pid_t pid = context->pid;
+    free(context);
+
+    SIMFS_INDEX_TYPE descriptorIndex;
+    SIMFS_FILE_DESCRIPTOR_TYPE descriptor;
+    if (namesAreSame(nameWithPath, SIMFS_STATS_FILE_NAME)) {
+        if (simfsStatsFileDescriptor(&descriptor) != SIMFS_NO_ERROR)
+            return SIMFS_ALLOC_ERROR;
+        descriptorIndex = SIMFS_STATS_FILE;
+    } else {
+        SIMFS_ERROR error = simfsDirectoryFault(mount, nameWithPath);
+        if (error != SIMFS_NO_ERROR)
+            return error;
+        simfsEpochEnter();
+        SIMFS_DIR_ENT *entry = simfsDirectoryLookup(mount, nameWithPath);
+        descriptorIndex = entry != NULL ? entry->nodeReference : SIMFS_INVALID_INDEX;
+        if (entry != NULL)
+            simfsDescriptorCopy(mount, descriptorIndex, &descriptor);
+        simfsEpochExit();
+        if (entry == NULL)
+            return SIMFS_NOT_FOUND_ERROR;
+    }
+
+    pthread_mutex_lock(&mount->context->openFileLock);
+    bool moved = false;
+    if (descriptorIndex != SIMFS_STATS_FILE) { // a shrink relocates the open files, and a rename unlinks the name
+        simfsEpochEnter();
+        SIMFS_DIR_ENT *entry = simfsDirectoryLookup(mount, nameWithPath);
+        moved = entry == NULL || entry->nodeReference != descriptorIndex ||
+                descriptorIndex >= simfsVolumeBlocks(mount->volume);
+        simfsEpochExit();
+    }
+    if (moved) {
+        // the descriptor was moved by a shrink of the volume, or renamed, after the lookup; look the file up again
+        pthread_mutex_unlock(&mount->context->openFileLock);
+        return simfsOpen(mount, fileName, fileHandle);
+    }
+
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsFindProcessControlBlock(mount, pid);
+    if (pcb != NULL) {
+        for (int i = 0; i < pcb->capacity; i++) {
+            if (pcb->openFileTable[i].globalEntry != NULL &&
+                pcb->openFileTable[i].globalEntry->fileDescriptor == descriptorIndex) {
+                pthread_mutex_unlock(&mount->context->openFileLock);
+                *fileHandle = i;
+                return SIMFS_DUPLICATE_ERROR;
+            }
+        }
+    }
+
+    bool newGlobalEntry = false;
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsFindGlobalEntry(mount, descriptorIndex);
+    if (globalEntry == NULL) {
+        globalEntry = simfsAllocGlobalEntry(mount);
+        if (globalEntry == NULL) {
+            pthread_mutex_unlock(&mount->context->openFileLock);
+            return SIMFS_ALLOC_ERROR;
+        }
+        newGlobalEntry = true;
+        globalEntry->type = descriptor.type;
+        globalEntry->fileDescriptor = descriptorIndex;
+        globalEntry->referenceCount = 0;
+        globalEntry->creationTime = descriptor.creationTime;
+        globalEntry->lastAccessTime = descriptor.lastAccessTime;
+        globalEntry->lastModificationTime = descriptor.lastModificationTime;
+        globalEntry->accessRights = descriptor.accessRights;
+        globalEntry->owner = descriptor.owner;
+        globalEntry->size = descriptor.size;
+    }
+
+    bool newProcess = pcb == NULL;
+    if (newProcess)
+        pcb = simfsAddProcessControlBlock(mount, pid);
+
+    int slot = pcb != NULL ? simfsFindFreeProcessSlot(pcb) : -1;
+    if (slot < 0) {
+        if (newGlobalEntry)
+            simfsReleaseGlobalEntry(mount, globalEntry);
+        if (newProcess && pcb != NULL)
+            simfsRemoveProcessControlBlock(mount, pcb);
+        pthread_mutex_unlock(&mount->context->openFileLock);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    globalEntry->referenceCount++;
+    pcb->openFileTable[slot].accessRights = descriptor.accessRights;
+    pcb->openFileTable[slot].globalEntry = globalEntry;
+    pcb->openFileTable[slot].listing = NULL;
+    pcb->numberOfOpenFiles++;
+
+    pthread_mutex_unlock(&mount->context->openFileLock);
+
+    *fileHandle = slot;
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsOpenFile(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsOpen(mount, fileName, fileHandle);
+    simfsStatsFinish(SIMFS_OPEN_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_OPEN_OPERATION, fileName, 0, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Gives simfsWrite() its next block: the next of the numberOfTaken blocks it took before directoryLock, whose life
+ * starts now, or once they are used up, a block allocated close after the goal. The caller holds directoryLock.
+ */
+static SIMFS_INDEX_TYPE simfsWriteNextBlock(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE *taken, size_t numberOfTaken,
+                                            size_t *numberOfUsed, SIMFS_INDEX_TYPE goal) {
+    if (*numberOfUsed == numberOfTaken)
+        return simfsAllocateBlock(mount, goal);
+
+    SIMFS_INDEX_TYPE block = taken[(*numberOfUsed)++];
+    simfsStartBlockLife(mount, block, mount->volume->generation);
+    return block;
+}
+
+/*
+ * Gives the blocks that simfsWrite() took but did not use, from first on, back to their groups, and lets a resize
+ * go ahead.
+ */
+static void simfsWriteGiveBack(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE *taken, size_t first, size_t numberOfTaken) {
+    for (size_t i = first; i < numberOfTaken; i++)
+        simfsReleaseBlock(mount, taken[i]);
+    pthread_rwlock_unlock(&mount->context->resizeLock);
+    free(taken);
+}
+
+/*
+ * The function replaces content of a file with new one pointed to by the parameter writeBuffer.
+ *
+ * Checks if the file handle points to a valid file descriptor of an open file. If the entry is invalid
+ * (e.g., if the reference to the global table is NULL, or if the entry in the global table is INVALID_CONTENT_TYPE),
+ * then it returns SIMFS_NOT_FOUND_ERROR.
+ *
+ * Otherwise, it checks the access rights for writing. If the process owner is not allowed to write to the file,
+ * or if the mount is read-only, then the function returns SIMFS_ACCESS_ERROR.
+ *
+ * Then, the functions calculates the space needed for the new content and checks if the write buffer can fit into
+ * the remaining free space in the file system. If not, then the SIMFS_ALLOC_ERROR is returned.
+ *
+ * Otherwise, the function removes all blocks currently held by this file, and then acquires new blocks as needed
+ * modifying bits in the in-memory bitvector as needed. The blocks that the content needs uncompressed are taken
+ * before directoryLock, so that writes to different files allocate in parallel, and those left over are given
+ * back; only when the volume has too few free blocks for that are they allocated under directoryLock. On a
+ * deduplicated volume, a data block with the same content as one that is stored already references that one
+ * instead. If a snapshot holds the file, its descriptor is preserved first and its blocks stay with the snapshot.
+ *
+ * It then copies the characters pointed to by the parameter writeBuffer (until '\0' but excluding it) to the
+ * new blocks that belong to the file; for a file with SIMFS_FILE_COMPRESSED, it copies them compressed by
+ * simfsCompress() if that makes them smaller. The function copies any modified block of the in-memory bitvector to
+ * the corresponding bitvector block on the disk.
+ *
+ * Finally, the file descriptor is modified to reflect the new size of the file, and the times of last modification
+ * and access.
+ *
+ * The function returns SIMFS_WRITE_ERROR in response to exception not specified earlier.
+ *
+ */
+static SIMFS_ERROR simfsWrite(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer) {
+    SIMFS_INDEX_TYPE descriptorIndex;
+    size_t size = strlen(writeBuffer);
+    char *compressed = NULL;
+    size_t storedSize = size;
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    // compressing the content or sharing its blocks only leaves some of the blocks taken here unused
+    size_t numberOfTaken = (size + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    numberOfTaken += (numberOfTaken + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK;
+    SIMFS_INDEX_TYPE *taken = numberOfTaken > 0 ? malloc(numberOfTaken * sizeof(SIMFS_INDEX_TYPE)) : NULL;
+    pthread_rwlock_rdlock(&mount->context->resizeLock);
+    if (taken != NULL && !simfsTakeBlocks(mount, numberOfTaken, taken, SIMFS_UNBORN_GENERATION)) {
+        free(taken);
+        taken = NULL;
+    }
+    if (taken == NULL)
+        numberOfTaken = 0;
+    size_t numberOfUsed = 0;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_ERROR error = simfsFindOpenFileDescriptor(mount, fileHandle, 0200, &descriptorIndex);
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = NULL;
+    if (error == SIMFS_NO_ERROR) {
+        descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+        if (descriptor->type != FILE_CONTENT_TYPE)
+            error = SIMFS_WRITE_ERROR;
+    }
+    if (error == SIMFS_NO_ERROR && (descriptor->flags & SIMFS_FILE_COMPRESSED) != 0) {
+        size_t compressedSize = simfsCompress(writeBuffer, size, &compressed);
+        if (compressed != NULL)
+            storedSize = compressedSize;
+    }
+    char *stored = compressed != NULL ? compressed : writeBuffer;
+    SIMFS_CONTENT_TYPE dataType = compressed != NULL ? COMPRESSED_CONTENT_TYPE : DATA_CONTENT_TYPE;
+    size_t numberOfDataBlocks = (storedSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    size_t numberOfIndexBlocks = (numberOfDataBlocks + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK;
+    if (error == SIMFS_NO_ERROR) {
+        // other writes take blocks without directoryLock, so an allocation below can still fail once the taken
+        // blocks run out; the blocks of a file that a snapshot holds are not freed by the write, and its descriptor
+        // takes one more
+        size_t heldDataBlocks = SIMFS_DATA_BLOCKS(descriptor) - simfsFileHoles(mount->volume, descriptorIndex);
+        size_t heldBlocks = heldDataBlocks + (heldDataBlocks + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) /
+                                             SIMFS_INDEX_ENTRIES_PER_BLOCK;
+        if (heldDataBlocks > 0 && simfsSnapshotIsHeld(mount, descriptor->block_ref))
+            heldBlocks = 0;
+        if (numberOfDataBlocks + numberOfIndexBlocks + simfsSnapshotIsHeld(mount, descriptorIndex) >
+            numberOfTaken + simfsNumberOfFreeBlocks(mount) + heldBlocks ||
+            !simfsSnapshotPreserve(mount, descriptorIndex))
+            error = SIMFS_ALLOC_ERROR;
+    }
+    if (error != SIMFS_NO_ERROR) {
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        simfsWriteGiveBack(mount, taken, 0, numberOfTaken);
+        free(compressed);
+        return error;
+    }
+
+    simfsDescriptorChangeBegin(mount, descriptorIndex);
+    simfsReleaseFileContent(mount, descriptor);
+
+    // each block is allocated right after the previous one where possible, so the content stays contiguous
+    bool isDeduplicated = mount->context->dedup != NULL;
+    SIMFS_BLOCK_TYPE candidate;
+    SIMFS_INDEX_TYPE goal = descriptorIndex;
+    SIMFS_INDEX_TYPE indexBlock = SIMFS_INVALID_INDEX;
+    for (size_t i = 0; i < numberOfDataBlocks && error == SIMFS_NO_ERROR; i++) {
+        SIMFS_INDEX_TYPE newIndexBlock = SIMFS_INVALID_INDEX;
+        if (i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0) {
+            newIndexBlock = simfsWriteNextBlock(mount, taken, numberOfTaken, &numberOfUsed, goal);
+            if (newIndexBlock == SIMFS_INVALID_INDEX) {
+                error = SIMFS_WRITE_ERROR;
+                break;
+            }
+            goal = newIndexBlock;
+        }
+
+        size_t offset = i * SIMFS_DATA_SIZE;
+        size_t length = storedSize - offset < SIMFS_DATA_SIZE ? storedSize - offset : SIMFS_DATA_SIZE;
+        SIMFS_INDEX_TYPE dataBlock = SIMFS_INVALID_INDEX;
+        if (isDeduplicated) { // the unused end of the block is zeroed, so that equal content compares equal
+            candidate.type = dataType;
+            memset(&candidate.content, 0, SIMFS_DATA_SIZE);
+            memcpy((char *) candidate.content.data, stored + offset, length);
+            dataBlock = simfsDedupShare(mount, &candidate);
+        }
+        bool isShared = dataBlock != SIMFS_INVALID_INDEX;
+        if (!isShared && (dataBlock = simfsWriteNextBlock(mount, taken, numberOfTaken, &numberOfUsed, goal)) ==
+                         SIMFS_INVALID_INDEX) {
+            if (newIndexBlock != SIMFS_INVALID_INDEX)
+                simfsReleaseBlock(mount, newIndexBlock);
+            error = SIMFS_WRITE_ERROR;
+            break;
+        }
+        if (!isShared)
+            goal = dataBlock;
+
+        if (newIndexBlock != SIMFS_INVALID_INDEX) {
+            mount->volume->block[newIndexBlock].type = INDEX_CONTENT_TYPE;
+            if (i == 0)
+                descriptor->block_ref = newIndexBlock;
+            else {
+                mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK] = newIndexBlock;
+                simfsChecksumUpdate(mount, indexBlock); // the previous index block is full
+            }
+            indexBlock = newIndexBlock;
+        }
+
+        if (isShared)
+            simfsStatsCount(SIMFS_BLOCKS_DEDUPLICATED_COUNTER, 1);
+        else if (isDeduplicated) {
+            mount->volume->block[dataBlock].type = dataType;
+            memcpy(mount->volume->block[dataBlock].content.data, candidate.content.data, SIMFS_DATA_SIZE);
+            simfsChecksumUpdate(mount, dataBlock);
+            simfsDedupAdd(mount, dataBlock);
+        } else {
+            mount->volume->block[dataBlock].type = dataType;
+            memcpy((char *) mount->volume->block[dataBlock].content.data, stored + offset, length);
+            simfsChecksumUpdate(mount, dataBlock);
+        }
+        mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK] = dataBlock;
+        descriptor->storedSize = offset + length; // the chain is consistent after every block
+    }
+
+    if (error != SIMFS_NO_ERROR)
+        simfsReleaseFileContent(mount, descriptor);
+    else {
+        if (numberOfDataBlocks > 0)
+            simfsChecksumUpdate(mount, indexBlock);
+        descriptor->size = size;
+        simfsStatsCount(SIMFS_BYTES_WRITTEN_COUNTER, size);
+    }
+
+    time(&descriptor->lastModificationTime);
+    descriptor->lastAccessTime = descriptor->lastModificationTime;
+    simfsDescriptorChangeEnd(mount, descriptorIndex);
+    simfsChecksumUpdate(mount, descriptorIndex);
+    simfsUpdateGlobalEntry(mount, descriptorIndex);
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+    simfsWriteGiveBack(mount, taken, numberOfUsed, numberOfTaken);
+
+    free(compressed);
+    return error;
+}
+
+SIMFS_ERROR simfsWriteFile(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsWrite(mount, fileHandle, writeBuffer);
+    simfsStatsFinish(SIMFS_WRITE_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_WRITE_OPERATION, NULL, fileHandle, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * The function returns the complete content of the file to the caller through the parameter readBuffer.
+ *
+ * Checks if the file handle points to a valid file descriptor of an open file. If the entry is invalid
+ * (e.g., if the reference to the global table is NULL, or if the entry in the global table is INVALID_CONTENT_TYPE),
+ * then it returns SIMFS_NOT_FOUND_ERROR.
+ *
+ * Otherwise, it checks the user's access right to read the file. If the process owner is not allowed to read the file,
+ * then the function returns SIMFS_ACCESS_ERROR.
+ *
+ * Otherwise, the function allocates memory sufficient to hold the read content with an appended end of string
+ * character; the pointer to newly allocated memory is passed back through the readBuffer parameter. All the content
+ * of the blocks is concatenated using the allocated space, and an end of string character is appended at the end of
+ * the concatenated content. Holes of a sparse file read as zeros, so its size is in the descriptor rather than
+ * where the string ends.
+ *
+ * Every block is checked against its checksum before it is copied, as set by simfsSetVerifyMode(); if one does not
+ * match, then it returns SIMFS_READ_ERROR.
+ *
+ * Compressed content is copied out as it is stored and expanded after directoryLock is released; if it does not
+ * expand to the size of the file, then the function returns SIMFS_READ_ERROR.
+ *
+ * The function returns SIMFS_READ_ERROR in response to exception not specified earlier.
+ *
+ */
+static SIMFS_ERROR simfsRead(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer) {
+    SIMFS_INDEX_TYPE descriptorIndex;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_ERROR error = simfsFindOpenFileDescriptor(mount, fileHandle, 0400, &descriptorIndex);
+    if (error == SIMFS_NO_ERROR && descriptorIndex == SIMFS_STATS_FILE) {
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        if ((*readBuffer = simfsStatsFileContent()) == NULL)
+            return SIMFS_ALLOC_ERROR;
+        simfsStatsCount(SIMFS_BYTES_READ_COUNTER, strlen(*readBuffer));
+        return SIMFS_NO_ERROR;
+    }
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = NULL;
+    if (error == SIMFS_NO_ERROR) {
+        descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+        if (descriptor->type != FILE_CONTENT_TYPE || !simfsChecksumVerify(mount, descriptorIndex))
+            error = SIMFS_READ_ERROR;
+    }
+    char *content = NULL;
+    char *stored = NULL;
+    if (error == SIMFS_NO_ERROR && ((content = malloc(descriptor->size + 1)) == NULL ||
+        (stored = descriptor->storedSize < descriptor->size ? malloc(descriptor->storedSize) : content) == NULL))
+        error = SIMFS_ALLOC_ERROR;
+    if (error != SIMFS_NO_ERROR) {
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        free(content);
+        return error;
+    }
+
+    size_t size = descriptor->size;
+    size_t storedSize = descriptor->storedSize < size ? descriptor->storedSize : size; // not the reserved blocks
+    SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+    for (size_t offset = 0, i = 0; offset < storedSize; offset += SIMFS_DATA_SIZE, i++) {
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0 && !simfsChecksumVerify(mount, indexBlock)) {
+            error = SIMFS_READ_ERROR;
+            break;
+        }
+        SIMFS_INDEX_TYPE dataBlock = mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        size_t length = storedSize - offset < SIMFS_DATA_SIZE ? storedSize - offset : SIMFS_DATA_SIZE;
+        if (dataBlock == SIMFS_HOLE) {
+            memset(stored + offset, 0, length);
+            continue;
+        }
+        if (!simfsChecksumVerify(mount, dataBlock)) {
+            error = SIMFS_READ_ERROR;
+            break;
+        }
+        memcpy(stored + offset, (char *) mount->volume->block[dataBlock].content.data, length);
+    }
+    if (error == SIMFS_NO_ERROR && !mount->context->readOnly && simfsSnapshotPreserve(mount, descriptorIndex)) {
+        time(&descriptor->lastAccessTime); // left as it is if there is no block to preserve the descriptor
+        simfsChecksumUpdate(mount, descriptorIndex);
+        simfsUpdateGlobalEntry(mount, descriptorIndex);
+    }
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    if (error == SIMFS_NO_ERROR && stored != content && !simfsDecompress(stored, storedSize, content, size))
+        error = SIMFS_READ_ERROR;
+    if (stored != content)
+        free(stored);
+    if (error != SIMFS_NO_ERROR) {
+        free(content);
+        return error;
+    }
+    content[size] = '\0';
+    simfsStatsCount(SIMFS_BYTES_READ_COUNTER, size);
+    simfsStatsCount(SIMFS_BLOCKS_READ_COUNTER, (storedSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE);
+
+    *readBuffer = content;
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsReadFile(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsRead(mount, fileHandle, readBuffer);
+    simfsStatsFinish(SIMFS_READ_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_READ_OPERATION, NULL, fileHandle, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Takes the children of the folder with the descriptor in folderIndex in ascending order of their descriptor blocks
+ * into a new listing, with one walk of its index chain and a sort. On a lazy mount, the children are loaded into the
+ * directory first, which simfsIsChild() finds them in.
+ *
+ * Returns SIMFS_READ_ERROR if a block of the index chain is damaged.
+ */
+static SIMFS_ERROR simfsTakeListing(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex,
+                                    SIMFS_FOLDER_LISTING_TYPE **listing) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = &mount->volume->block[folderIndex].content.fileDescriptor;
+    SIMFS_DIR_ENT *entry = simfsDirectoryFindDescriptor(mount, folderIndex);
+    SIMFS_ERROR error = entry != NULL ? simfsDirectoryLoad(mount, entry) : SIMFS_READ_ERROR;
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_FOLDER_LISTING_TYPE *children = malloc(sizeof(SIMFS_FOLDER_LISTING_TYPE) +
+                                                 folder->size * sizeof(SIMFS_INDEX_TYPE));
+    if (children == NULL)
+        return SIMFS_ALLOC_ERROR;
+    children->folder = folderIndex;
+    children->numberOfChildren = folder->size;
+
+    SIMFS_INDEX_TYPE indexBlock = folder->block_ref;
+    for (size_t i = 0; i < folder->size; i++) {
+        if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        if (i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0 && !simfsChecksumVerify(mount, indexBlock)) {
+            free(children);
+            return SIMFS_READ_ERROR;
+        }
+        children->children[i] = mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+    }
+    qsort(children->children, children->numberOfChildren, sizeof(SIMFS_INDEX_TYPE), simfsCompareIndices);
+
+    *listing = children;
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Tells whether the block still holds the descriptor of a child of the folder, which a child that was taken into
+ * a listing no longer does once it is deleted or moved to another folder: its directory entry is gone at once,
+ * while the block itself is only freed once no lookup can see it. The caller holds directoryLock.
+ */
+static bool simfsIsChild(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex, SIMFS_INDEX_TYPE block) {
+    if (mount->volume->block[block].type != FILE_CONTENT_TYPE &&
+        mount->volume->block[block].type != FOLDER_CONTENT_TYPE)
+        return false;
+
+    SIMFS_DIR_ENT *entry = simfsDirectoryFindDescriptor(mount, block);
+    return entry != NULL && entry->parent == folderIndex;
+}
+
+/*
+ * Lists up to bufferSize children of the folder open under the handle, going on from *cookie, into entries, with
+ * their names without the path of the folder and their types, or into descriptors, with copies of their
+ * descriptors; the other one is NULL. The children come in the order of their descriptor blocks, and *cookie is
+ * advanced past the last one listed.
+ *
+ * Under directoryLock, and openFileLock for the listing kept with the handle:
+ *    - takes the children of the folder into the listing of the handle when the cookie starts a listing, or the
+ *      handle has none or one of a folder that has since moved; this walks the index chain once and sorts it
+ *    - seeks to the cookie in the listing with a binary search, and copies the descriptors of the next bufferSize
+ *      children that have not been deleted since
+ *
+ * A whole listing of n children in batches of k is O(n log n + n) rather than a walk of the chain per batch.
+ *
+ * Returns SIMFS_READ_ERROR if the handle is not that of a folder or a block of the listing is damaged.
+ */
+static SIMFS_ERROR simfsReadFolder(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE folderHandle,
+                                   SIMFS_DIR_COOKIE_TYPE *cookie, SIMFS_FOLDER_ENTRY_TYPE *entries,
+                                   SIMFS_FILE_DESCRIPTOR_TYPE *descriptors, size_t bufferSize,
+                                   size_t *numberOfEntries) {
+    struct fuse_context *context = simfs_debug_get_context();
+    pid_t pid = context->pid;
+    free(context);
+
+    SIMFS_INDEX_TYPE folderIndex;
+    SIMFS_INDEX_TYPE lastListed = SIMFS_INVALID_INDEX;
+    size_t count = 0;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_ERROR error = simfsFindOpenFileDescriptor(mount, folderHandle, 0400, &folderIndex);
+    SIMFS_FILE_DESCRIPTOR_TYPE *folder = NULL;
+    if (error == SIMFS_NO_ERROR) {
+        folder = folderIndex != SIMFS_STATS_FILE ? &mount->volume->block[folderIndex].content.fileDescriptor : NULL;
+        if (folder == NULL || folder->type != FOLDER_CONTENT_TYPE || !simfsChecksumVerify(mount, folderIndex))
+            error = SIMFS_READ_ERROR;
+    }
+
+    pthread_mutex_lock(&mount->context->openFileLock);
+
+    SIMFS_PER_PROCESS_OPEN_FILE_TYPE *openFile = error == SIMFS_NO_ERROR ? simfsFindOpenFile(mount, pid, folderHandle)
+                                                                        : NULL;
+    if (openFile != NULL && (openFile->listing == NULL || openFile->listing->folder != folderIndex ||
+                             *cookie == SIMFS_DIR_COOKIE_START)) {
+        free(openFile->listing);
+        openFile->listing = NULL;
+        error = simfsTakeListing(mount, folderIndex, &openFile->listing);
+    }
+    SIMFS_FOLDER_LISTING_TYPE *listing = error == SIMFS_NO_ERROR ? openFile->listing : NULL;
+
+    size_t first = 0;
+    size_t last = listing != NULL ? listing->numberOfChildren : 0;
+    while (first < last) {
+        size_t middle = first + (last - first) / 2;
+        if (listing->children[middle] < *cookie)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    for (size_t i = first; listing != NULL && error == SIMFS_NO_ERROR && i < listing->numberOfChildren &&
+                           count < bufferSize; i++) {
+        SIMFS_INDEX_TYPE child = listing->children[i];
+        if (!simfsIsChild(mount, folderIndex, child))
+            continue;
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[child].content.fileDescriptor;
+        if (!simfsChecksumVerify(mount, child))
+            error = SIMFS_READ_ERROR;
+        else if (descriptors != NULL)
+            descriptors[count] = *descriptor;
+        else {
+            strcpy(entries[count].name, descriptor->name);
+            entries[count].type = descriptor->type;
+        }
+        count++;
+        lastListed = child;
+    }
+
+    pthread_mutex_unlock(&mount->context->openFileLock);
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    if (error == SIMFS_NO_ERROR) {
+        *numberOfEntries = count;
+        if (count > 0)
+            *cookie = lastListed + 1;
+    }
+    return error;
+}
+
+/*
+ * Lists the children of the folder open under folderHandle a batch at a time: fills up to bufferSize entries of
+ * buffer with their names and types, sets *numberOfEntries to the number filled in, and advances *cookie, which
+ * starts at SIMFS_DIR_COOKIE_START, past them. The listing is complete when fewer than bufferSize entries come back.
+ *
+ * A child that is in the folder for the whole listing is listed exactly once; one created or deleted while the
+ * listing goes on may or may not be.
+ *
+ * Returns SIMFS_NOT_FOUND_ERROR for a handle that is not open, SIMFS_ACCESS_ERROR if the folder was not opened for
+ * reading, and SIMFS_READ_ERROR if it is not a folder.
+ */
+SIMFS_ERROR simfsReadDir(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE folderHandle, SIMFS_DIR_COOKIE_TYPE *cookie,
+                         SIMFS_FOLDER_ENTRY_TYPE *buffer, size_t bufferSize, size_t *numberOfEntries) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsReadFolder(mount, folderHandle, cookie, buffer, NULL, bufferSize, numberOfEntries);
+    simfsStatsFinish(SIMFS_READ_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_READ_OPERATION, NULL, folderHandle, start, error);
+    return error;
+}
+
+/*
+ * Lists the children of a folder as simfsReadDir() does, with a copy of the descriptor of each child, which has
+ * its name in the folder and its attributes, in buffer.
+ */
+SIMFS_ERROR simfsReadDirPlus(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE folderHandle, SIMFS_DIR_COOKIE_TYPE *cookie,
+                             SIMFS_FILE_DESCRIPTOR_TYPE *buffer, size_t bufferSize, size_t *numberOfEntries) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsReadFolder(mount, folderHandle, cookie, NULL, buffer, bufferSize, numberOfEntries);
+    simfsStatsFinish(SIMFS_READ_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_READ_OPERATION, NULL, folderHandle, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Removes the entry for the file with the file handle provided as the parameter from the open file table
+ * for this process. It decreases the number of open files for in the process control block of this process, and
+ * if it becomes zero, then the process control block for this process is removed from the processControlBlocks list.
+ *
+ * Decreases the reference count in the global open file table, and if that number is 0, it also removes the entry
+ * for this file from the global open file table.
+ *
+ */
+
+static SIMFS_ERROR simfsClose(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle) {
+    struct fuse_context *context = simfs_debug_get_context();
+    pid_t pid = context->pid;
+    free(context);
+
+    pthread_mutex_lock(&mount->context->openFileLock);
+
+    SIMFS_PER_PROCESS_OPEN_FILE_TYPE *openFile = simfsFindOpenFile(mount, pid, fileHandle);
+    if (openFile == NULL) {
+        pthread_mutex_unlock(&mount->context->openFileLock);
+        return SIMFS_NOT_FOUND_ERROR;
+    }
+
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsFindProcessControlBlock(mount, pid);
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = openFile->globalEntry;
+    openFile->globalEntry = NULL;
+    free(openFile->listing);
+    openFile->listing = NULL;
+    if (--pcb->numberOfOpenFiles == 0)
+        simfsRemoveProcessControlBlock(mount, pcb);
+
+    if (--globalEntry->referenceCount == 0)
+        simfsReleaseGlobalEntry(mount, globalEntry);
+
+    pthread_mutex_unlock(&mount->context->openFileLock);
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsCloseFile(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsClose(mount, fileHandle);
+    simfsStatsFinish(SIMFS_CLOSE_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_CLOSE_OPERATION, NULL, fileHandle, start, error);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// sparse files
+//
+// An entry of the index chain of a file may be SIMFS_HOLE instead of a data block: that part of the file was never
+// written, or it was punched out, and it reads as zeros. A file grows by holes, so a file that is made large and
+// then written in a few places takes data blocks for those places only, and index blocks for its whole size.
+//
+// simfsWriteFileAt() and simfsPunchHole() change the data blocks in their range and nothing else. A data block that
+// no other file shares and no snapshot holds is written in place; any other is replaced by a new block, so that the
+// sharing files and the snapshots keep seeing their version. The descriptor and the index blocks on the way are
+// preserved for snapshots before they change. Content that is stored compressed cannot be changed by block and has
+// to be written as a whole with simfsWriteFile().
+//
+// simfsFallocate() reserves data blocks for the holes in a range up front, in one run of free blocks if there is
+// one. A reserved block has the type UNWRITTEN_CONTENT_TYPE and holds zeros; it is not in the deduplication index,
+// so the first write fills it in place on any volume, and a file written front to back through its reservation
+// keeps the layout of the run. Blocks reserved past the end of a file are entries of its index chain past its size,
+// which storedSize covers; they become part of the file as it grows, and truncating it to a smaller size frees
+// them.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Finds the descriptor of a file open for writing whose content can be changed by block. The caller holds
+ * directoryLock.
+ */
+static SIMFS_ERROR simfsFindSparseFile(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle,
+                                       SIMFS_INDEX_TYPE *descriptorIndex) {
+    SIMFS_ERROR error = simfsFindOpenFileDescriptor(mount, fileHandle, 0200, descriptorIndex);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[*descriptorIndex].content.fileDescriptor;
+    if (descriptor->type != FILE_CONTENT_TYPE || descriptor->storedSize < descriptor->size)
+        return SIMFS_WRITE_ERROR;
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Tells whether there are enough free blocks for a change of a file that makes it newSize bytes large and writes
+ * numberOfEntries entries from the entry first on, assuming that every block it touches has to be copied: the
+ * descriptor, the data blocks and their index blocks, and the last data block and index block of the file when it
+ * grows. The caller holds directoryLock, so no other writer takes the blocks before the change does.
+ */
+static bool simfsSparseHasSpace(SIMFS_MOUNT *mount, SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, size_t first,
+                                size_t numberOfEntries, size_t newSize) {
+    size_t oldIndexBlocks = (SIMFS_DATA_BLOCKS(descriptor) + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) /
+                            SIMFS_INDEX_ENTRIES_PER_BLOCK;
+    size_t newEntries = (newSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    size_t newIndexBlocks = (newEntries + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK;
+    size_t neededBlocks = 3 + (newIndexBlocks > oldIndexBlocks ? newIndexBlocks - oldIndexBlocks : 0);
+    if (numberOfEntries > 0)
+        neededBlocks += numberOfEntries + (first + numberOfEntries - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK -
+                        first / SIMFS_INDEX_ENTRIES_PER_BLOCK + 1;
+
+    return neededBlocks <= simfsNumberOfFreeBlocks(mount);
+}
+
+/*
+ * Frees a data block that an entry of a file no longer references, unless another entry shares it or a snapshot
+ * holds it. The caller holds directoryLock.
+ */
+static void simfsSparseRelease(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE block) {
+    if (block == SIMFS_HOLE)
+        return;
+
+    pthread_mutex_lock(&mount->context->sharingLock);
+    if (simfsDedupRelease(mount, block) && simfsSnapshotRelease(mount, block, mount->volume->generation)) {
+        mount->volume->block[block].type = INVALID_CONTENT_TYPE;
+        simfsReleaseBlock(mount, block);
+    }
+    pthread_mutex_unlock(&mount->context->sharingLock);
+}
+
+/*
+ * Copies the entry j of the index block indexBlock of a file into candidate as a data block whose first valid bytes
+ * belong to the file; the rest of the block, and all of a hole, is zero. The caller holds directoryLock.
+ *
+ * Returns false if the data block fails its checksum.
+ */
+static bool simfsSparseLoad(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE indexBlock, size_t j, size_t valid,
+                            SIMFS_BLOCK_TYPE *candidate) {
+    SIMFS_INDEX_TYPE block = mount->volume->block[indexBlock].content.index[j];
+
+    memset(candidate, 0, sizeof(SIMFS_BLOCK_TYPE));
+    candidate->type = DATA_CONTENT_TYPE;
+    if (block == SIMFS_HOLE)
+        return true;
+    if (!simfsChecksumVerify(mount, block))
+        return false;
+    memcpy(candidate->content.data, mount->volume->block[block].content.data,
+           valid < SIMFS_DATA_SIZE ? valid : SIMFS_DATA_SIZE);
+    return true;
+}
+
+/*
+ * Makes candidate the content of the entry j of the index block indexBlock of a file. The data block of the entry
+ * is written in place if nothing else refers to it; otherwise the entry gets a block with the same content on a
+ * deduplicated volume, or a new block near goal. The caller holds directoryLock, has preserved the index block,
+ * and updates its checksum.
+ *
+ * Returns the data block, or SIMFS_INVALID_INDEX if there is no free block.
+ */
+static SIMFS_INDEX_TYPE simfsSparseStore(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE indexBlock, size_t j,
+                                         SIMFS_BLOCK_TYPE *candidate, SIMFS_INDEX_TYPE goal) {
+    SIMFS_VOLUME *volume = mount->volume;
+    SIMFS_INDEX_TYPE oldBlock = volume->block[indexBlock].content.index[j];
+    bool isDeduplicated = mount->context->dedup != NULL;
+    bool isReserved = oldBlock != SIMFS_HOLE && volume->block[oldBlock].type == UNWRITTEN_CONTENT_TYPE;
+    if (oldBlock != SIMFS_HOLE && (isReserved || !isDeduplicated) && !simfsSnapshotIsHeld(mount, oldBlock)) {
+        volume->block[oldBlock] = *candidate;
+        simfsChecksumUpdate(mount, oldBlock);
+        if (isReserved && isDeduplicated)
+            simfsDedupAdd(mount, oldBlock);
+        return oldBlock;
+    }
+
+    SIMFS_INDEX_TYPE block = isDeduplicated ? simfsDedupShare(mount, candidate) : SIMFS_INVALID_INDEX;
+    if (block != SIMFS_INVALID_INDEX)
+        simfsStatsCount(SIMFS_BLOCKS_DEDUPLICATED_COUNTER, 1);
+    else {
+        if ((block = simfsAllocateBlock(mount, goal)) == SIMFS_INVALID_INDEX)
+            return SIMFS_INVALID_INDEX;
+        volume->block[block] = *candidate;
+        simfsChecksumUpdate(mount, block);
+        if (isDeduplicated)
+            simfsDedupAdd(mount, block);
+    }
+    volume->block[indexBlock].content.index[j] = block;
+    simfsSparseRelease(mount, oldBlock);
+
+    return block;
+}
+
+/*
+ * Extends the index chain of a file with holes until it covers newSize bytes; with keepSize, the size stays, and
+ * otherwise the file becomes newSize bytes large if it is smaller. The bytes of its data block at the old end past
+ * it are cleared first when it grows, since they become part of the file; the blocks reserved after that one hold
+ * zeros already. The caller holds directoryLock and has preserved the descriptor.
+ */
+static SIMFS_ERROR simfsSparseGrow(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex, size_t newSize,
+                                   bool keepSize) {
+    SIMFS_VOLUME *volume = mount->volume;
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &volume->block[descriptorIndex].content.fileDescriptor;
+    size_t oldEntries = SIMFS_DATA_BLOCKS(descriptor);
+    size_t newEntries = (newSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    SIMFS_INDEX_TYPE indexBlock = SIMFS_INVALID_INDEX;
+
+    if (!keepSize && newSize > descriptor->size && descriptor->size % SIMFS_DATA_SIZE != 0) {
+        size_t last = (descriptor->size - 1) / SIMFS_DATA_SIZE;
+        size_t j = last % SIMFS_INDEX_ENTRIES_PER_BLOCK;
+        indexBlock = simfsIndexBlockForPosition(mount, descriptor, last);
+        SIMFS_INDEX_TYPE lastBlock = volume->block[indexBlock].content.index[j];
+        if (lastBlock != SIMFS_HOLE && volume->block[lastBlock].type != UNWRITTEN_CONTENT_TYPE) {
+            SIMFS_BLOCK_TYPE candidate;
+            if (!simfsSnapshotPreserve(mount, indexBlock))
+                return SIMFS_ALLOC_ERROR;
+            if (!simfsSparseLoad(mount, indexBlock, j, descriptor->size % SIMFS_DATA_SIZE, &candidate))
+                return SIMFS_READ_ERROR;
+            lastBlock = simfsSparseStore(mount, indexBlock, j, &candidate, lastBlock);
+            simfsChecksumUpdate(mount, indexBlock);
+            if (lastBlock == SIMFS_INVALID_INDEX)
+                return SIMFS_ALLOC_ERROR;
+        }
+    }
+
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (newEntries > oldEntries && oldEntries > 0) {
+        indexBlock = simfsIndexBlockForPosition(mount, descriptor, oldEntries - 1);
+        if (!simfsSnapshotPreserve(mount, indexBlock))
+            return SIMFS_ALLOC_ERROR;
+    }
+    for (size_t i = oldEntries; i < newEntries; i++) {
+        if (i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0) {
+            SIMFS_INDEX_TYPE newIndexBlock = simfsAllocateBlock(mount, i == 0 ? descriptorIndex : indexBlock);
+            if (newIndexBlock == SIMFS_INVALID_INDEX) {
+                error = SIMFS_ALLOC_ERROR;
+                break;
+            }
+            volume->block[newIndexBlock].type = INDEX_CONTENT_TYPE;
+            if (i == 0)
+                descriptor->block_ref = newIndexBlock;
+            else {
+                volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK] = newIndexBlock;
+                simfsChecksumUpdate(mount, indexBlock);
+            }
+            indexBlock = newIndexBlock;
+        }
+        volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK] = SIMFS_HOLE;
+        descriptor->storedSize = (i + 1) * SIMFS_DATA_SIZE; // the chain is consistent, with holes past the end
+    }
+    if (newEntries > oldEntries && indexBlock != SIMFS_INVALID_INDEX)
+        simfsChecksumUpdate(mount, indexBlock);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    if (newSize > descriptor->storedSize)
+        descriptor->storedSize = newSize;
+    if (!keepSize && newSize > descriptor->size)
+        descriptor->size = newSize;
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Gives every hole among the entries first to last of a file a reserved block: zeros of the type
+ * UNWRITTEN_CONTENT_TYPE, taken from one run of free blocks if there is one and close to each other otherwise. The
+ * chain covers the entries. The caller holds directoryLock and has preserved the descriptor.
+ */
+static SIMFS_ERROR simfsSparseReserve(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex, size_t first,
+                                      size_t last) {
+    SIMFS_VOLUME *volume = mount->volume;
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &volume->block[descriptorIndex].content.fileDescriptor;
+    SIMFS_INDEX_TYPE indexBlock = simfsIndexBlockForPosition(mount, descriptor, first);
+
+    size_t numberOfHoles = 0;
+    for (size_t i = first; i <= last; i++) {
+        if (i > first && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+            indexBlock = volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        numberOfHoles += volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK] == SIMFS_HOLE;
+    }
+    if (numberOfHoles == 0)
+        return SIMFS_NO_ERROR;
+
+    indexBlock = simfsIndexBlockForPosition(mount, descriptor, first);
+    SIMFS_INDEX_TYPE goal = simfsFindFreeRun(mount, indexBlock, numberOfHoles);
+    if (goal == SIMFS_INVALID_INDEX)
+        goal = indexBlock;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    for (size_t i = first; i <= last; i++) {
+        size_t j = i % SIMFS_INDEX_ENTRIES_PER_BLOCK;
+        if (i > first && j == 0) {
+            simfsChecksumUpdate(mount, indexBlock);
+            indexBlock = volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        }
+        if ((i == first || j == 0) && !simfsSnapshotPreserve(mount, indexBlock)) {
+            error = SIMFS_ALLOC_ERROR;
+            break;
+        }
+        if (volume->block[indexBlock].content.index[j] != SIMFS_HOLE)
+            continue;
+
+        SIMFS_INDEX_TYPE block = simfsAllocateBlock(mount, goal);
+        if (block == SIMFS_INVALID_INDEX) {
+            error = SIMFS_ALLOC_ERROR;
+            break;
+        }
+        memset(&volume->block[block], 0, sizeof(SIMFS_BLOCK_TYPE));
+        volume->block[block].type = UNWRITTEN_CONTENT_TYPE;
+        simfsChecksumUpdate(mount, block);
+        volume->block[indexBlock].content.index[j] = block;
+        goal = block + 1;
+    }
+    simfsChecksumUpdate(mount, indexBlock);
+
+    return error;
+}
+
+/*
+ * Makes a file newSize bytes large, if it is larger, and frees its blocks past the new end. The caller holds
+ * directoryLock and has preserved the descriptor.
+ */
+static void simfsSparseShrink(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex, size_t newSize) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    if (newSize >= descriptor->size)
+        return;
+    if (newSize == 0) {
+        simfsReleaseFileContent(mount, descriptor);
+        return;
+    }
+
+    // the entries past the end stay in the last index block that is kept, but are not part of the file any more
+    size_t oldEntries = SIMFS_DATA_BLOCKS(descriptor);
+    size_t newEntries = (newSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    size_t keptIndexBlocks = (newEntries + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK;
+    SIMFS_INDEX_TYPE indexBlock = simfsIndexBlockForPosition(mount, descriptor, newEntries - 1);
+    SIMFS_INDEX_TYPE *index = mount->volume->block[indexBlock].content.index;
+    for (size_t i = newEntries; i < oldEntries && i < keptIndexBlocks * SIMFS_INDEX_ENTRIES_PER_BLOCK; i++)
+        simfsSparseRelease(mount, index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK]);
+    if (oldEntries > keptIndexBlocks * SIMFS_INDEX_ENTRIES_PER_BLOCK) {
+        pthread_mutex_lock(&mount->context->sharingLock);
+        simfsReleaseIndexChain(mount, index[SIMFS_INDEX_ENTRIES_PER_BLOCK],
+                               oldEntries - keptIndexBlocks * SIMFS_INDEX_ENTRIES_PER_BLOCK, true,
+                               mount->volume->generation);
+        pthread_mutex_unlock(&mount->context->sharingLock);
+    }
+
+    descriptor->size = descriptor->storedSize = newSize;
+}
+
+/*
+ * Writes or clears the bytes from offset to offset + length of a file whose size covers them: with buffer, they are
+ * copied from it; without, they become zeros, and data blocks that lie entirely in the range become holes. The
+ * caller holds directoryLock and has preserved the descriptor.
+ */
+static SIMFS_ERROR simfsSparseChange(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex, size_t offset,
+                                     char *buffer, size_t length) {
+    SIMFS_VOLUME *volume = mount->volume;
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &volume->block[descriptorIndex].content.fileDescriptor;
+    if (length == 0)
+        return SIMFS_NO_ERROR;
+
+    size_t end = offset + length;
+    size_t first = offset / SIMFS_DATA_SIZE;
+    size_t last = (end - 1) / SIMFS_DATA_SIZE;
+    SIMFS_INDEX_TYPE indexBlock = simfsIndexBlockForPosition(mount, descriptor, first);
+    SIMFS_INDEX_TYPE goal = indexBlock;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    for (size_t i = first; i <= last && error == SIMFS_NO_ERROR; i++) {
+        size_t j = i % SIMFS_INDEX_ENTRIES_PER_BLOCK;
+        if (i > first && j == 0) {
+            simfsChecksumUpdate(mount, indexBlock);
+            indexBlock = volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        }
+        if ((i == first || j == 0) && !simfsSnapshotPreserve(mount, indexBlock)) {
+            error = SIMFS_ALLOC_ERROR;
+            break;
+        }
+
+        SIMFS_INDEX_TYPE *index = volume->block[indexBlock].content.index;
+        size_t blockStart = i * SIMFS_DATA_SIZE;
+        size_t blockEnd = blockStart + SIMFS_DATA_SIZE < descriptor->size ? blockStart + SIMFS_DATA_SIZE :
+                          descriptor->size;
+        size_t from = offset > blockStart ? offset - blockStart : 0;
+        size_t to = (end < blockEnd ? end : blockEnd) - blockStart;
+        if (buffer == NULL && index[j] == SIMFS_HOLE)
+            continue;
+        if (buffer == NULL && from == 0 && to == blockEnd - blockStart) {
+            SIMFS_INDEX_TYPE oldBlock = index[j];
+            index[j] = SIMFS_HOLE;
+            simfsSparseRelease(mount, oldBlock);
+            continue;
+        }
+
+        SIMFS_BLOCK_TYPE candidate;
+        if (!simfsSparseLoad(mount, indexBlock, j, blockEnd - blockStart, &candidate)) {
+            error = SIMFS_READ_ERROR;
+            break;
+        }
+        if (buffer != NULL)
+            memcpy((char *) candidate.content.data + from, buffer + blockStart + from - offset, to - from);
+        else
+            memset((char *) candidate.content.data + from, 0, to - from);
+        if ((goal = simfsSparseStore(mount, indexBlock, j, &candidate, goal)) == SIMFS_INVALID_INDEX)
+            error = SIMFS_ALLOC_ERROR;
+    }
+    simfsChecksumUpdate(mount, indexBlock);
+
+    return error;
+}
+
+/*
+ * Ends a change of a file: sets the times of the last modification and access, and updates the checksum of the
+ * descriptor and the global open file table. The caller holds directoryLock.
+ */
+static void simfsSparseFinish(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+
+    time(&descriptor->lastModificationTime);
+    descriptor->lastAccessTime = descriptor->lastModificationTime;
+    simfsChecksumUpdate(mount, descriptorIndex);
+    simfsUpdateGlobalEntry(mount, descriptorIndex);
+}
+
+/*
+ * Writes length bytes from writeBuffer to the file with the file handle at offset, leaving the rest of the file as
+ * it is; the buffer may hold zeros. A file that is shorter grows to the end of the write, with a hole between its
+ * old end and offset; a write of no bytes leaves the size as it is.
+ *
+ * Returns SIMFS_NOT_FOUND_ERROR if the handle is not valid, SIMFS_ACCESS_ERROR if the file is not open for writing or
+ * the mount is read-only, SIMFS_WRITE_ERROR if it is a folder, its content is stored compressed, or the write would
+ * end past the largest size, and SIMFS_ALLOC_ERROR if there may not be enough free blocks for it; the file is not
+ * changed then.
+ */
+static SIMFS_ERROR simfsWriteAt(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset,
+                                char *writeBuffer, size_t length) {
+    SIMFS_INDEX_TYPE descriptorIndex = 0; // the descriptor below is only used without an error
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+    if (offset > SIZE_MAX - length)
+        return SIMFS_WRITE_ERROR;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_ERROR error = simfsFindSparseFile(mount, fileHandle, &descriptorIndex);
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    // an empty write changes nothing, not even the size of a file that ends before offset
+    size_t newSize = error == SIMFS_NO_ERROR && length > 0 && offset + length > descriptor->size ? offset + length : 0;
+    if (error == SIMFS_NO_ERROR &&
+        (!simfsSparseHasSpace(mount, descriptor, offset / SIMFS_DATA_SIZE,
+                              length > 0 ? (offset + length - 1) / SIMFS_DATA_SIZE - offset / SIMFS_DATA_SIZE + 1 : 0,
+                              newSize) || !simfsSnapshotPreserve(mount, descriptorIndex)))
+        error = SIMFS_ALLOC_ERROR;
+    bool changing = error == SIMFS_NO_ERROR;
+    if (changing) {
+        simfsDescriptorChangeBegin(mount, descriptorIndex);
+        error = simfsSparseGrow(mount, descriptorIndex, newSize, false);
+    }
+    if (error == SIMFS_NO_ERROR)
+        error = simfsSparseChange(mount, descriptorIndex, offset, writeBuffer, length);
+    if (error == SIMFS_NO_ERROR) {
+        simfsStatsCount(SIMFS_BYTES_WRITTEN_COUNTER, length);
+        simfsSparseFinish(mount, descriptorIndex);
+    }
+    if (changing)
+        simfsDescriptorChangeEnd(mount, descriptorIndex);
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+    return error;
+}
+
+SIMFS_ERROR simfsWriteFileAt(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, char *writeBuffer,
+                             size_t length) {
+    unsigned long start = simfsStatsStart();
+    SIMFS_ERROR error = simfsWriteAt(mount, fileHandle, offset, writeBuffer, length);
+    simfsStatsFinish(SIMFS_WRITE_OPERATION, start, error);
+    simfsTraceOperation(SIMFS_WRITE_OPERATION, NULL, fileHandle, start, error);
+    return error;
+}
+
+/*
+ * Sets the size of the file with the file handle: a larger size appends a hole, and a smaller one frees the blocks
+ * past the new end.
  *
- *       - returns the index to the new element of the per-process open file table through the parameter fileHandle
- *         and SIMFS_NO_ERROR as the return value
+ * Returns the errors of simfsWriteFileAt().
+ */
+SIMFS_ERROR simfsTruncateFile(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t size) {
+    SIMFS_INDEX_TYPE descriptorIndex = 0;
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_ERROR error = simfsFindSparseFile(mount, fileHandle, &descriptorIndex);
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    if (error == SIMFS_NO_ERROR && (!simfsSparseHasSpace(mount, descriptor, 0, 0, size) ||
+                                    !simfsSnapshotPreserve(mount, descriptorIndex)))
+        error = SIMFS_ALLOC_ERROR;
+    bool changing = error == SIMFS_NO_ERROR;
+    if (changing) {
+        simfsDescriptorChangeBegin(mount, descriptorIndex);
+        simfsSparseShrink(mount, descriptorIndex, size);
+        error = simfsSparseGrow(mount, descriptorIndex, size, false);
+    }
+    if (error == SIMFS_NO_ERROR)
+        simfsSparseFinish(mount, descriptorIndex);
+    if (changing)
+        simfsDescriptorChangeEnd(mount, descriptorIndex);
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+    return error;
+}
+
+/*
+ * Makes the length bytes at offset of the file with the file handle read as zeros and frees the data blocks that
+ * lie entirely in that range; the size of the file stays the same, and the part of the range past its end is
+ * ignored.
  *
- * If there is no free slot for the file in either the global file table or in the per-process
- * file table, or if there is any other allocation problem, then the function returns SIMFS_ALLOC_ERROR.
+ * Returns the errors of simfsWriteFileAt().
+ */
+SIMFS_ERROR simfsPunchHole(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, size_t length) {
+    SIMFS_INDEX_TYPE descriptorIndex = 0;
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_ERROR error = simfsFindSparseFile(mount, fileHandle, &descriptorIndex);
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    if (error == SIMFS_NO_ERROR) {
+        offset = offset < descriptor->size ? offset : descriptor->size;
+        length = length < descriptor->size - offset ? length : descriptor->size - offset;
+    }
+    // the two data blocks at the ends of the range may be copied, with their index blocks
+    if (error == SIMFS_NO_ERROR && length > 0 &&
+        (!simfsSparseHasSpace(mount, descriptor, offset / SIMFS_DATA_SIZE,
+                              (offset + length - 1) / SIMFS_DATA_SIZE - offset / SIMFS_DATA_SIZE + 1, 0) ||
+         !simfsSnapshotPreserve(mount, descriptorIndex)))
+        error = SIMFS_ALLOC_ERROR;
+    bool changing = error == SIMFS_NO_ERROR && length > 0;
+    if (changing) {
+        simfsDescriptorChangeBegin(mount, descriptorIndex);
+        error = simfsSparseChange(mount, descriptorIndex, offset, NULL, length);
+    }
+    if (changing && error == SIMFS_NO_ERROR)
+        simfsSparseFinish(mount, descriptorIndex);
+    if (changing)
+        simfsDescriptorChangeEnd(mount, descriptorIndex);
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+    return error;
+}
+
+/*
+ * Reserves data blocks for the length bytes at offset of the file with the file handle, so that writes there take
+ * no block from the allocator; the parts of the range that have blocks already keep them. The file grows to the
+ * end of the range, unless flags has SIMFS_FALLOCATE_KEEP_SIZE: then the blocks past its end are kept for the
+ * writes that extend it.
  *
+ * Returns the errors of simfsWriteFileAt(), and SIMFS_WRITE_ERROR for unknown flags.
  */
-SIMFS_ERROR simfsOpenFile(SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle) {
-    // TODO: implement
+SIMFS_ERROR simfsFallocate(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, size_t length,
+                           unsigned int flags) {
+    SIMFS_INDEX_TYPE descriptorIndex = 0;
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+    if ((flags & ~SIMFS_FALLOCATE_KEEP_SIZE) != 0 || offset > SIZE_MAX - length)
+        return SIMFS_WRITE_ERROR;
+    if (length == 0)
+        return SIMFS_NO_ERROR;
 
-    return SIMFS_NO_ERROR;
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_ERROR error = simfsFindSparseFile(mount, fileHandle, &descriptorIndex);
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    size_t first = offset / SIMFS_DATA_SIZE;
+    size_t last = (offset + length - 1) / SIMFS_DATA_SIZE;
+    if (error == SIMFS_NO_ERROR && (!simfsSparseHasSpace(mount, descriptor, first, last - first + 1, offset + length) ||
+                                    !simfsSnapshotPreserve(mount, descriptorIndex)))
+        error = SIMFS_ALLOC_ERROR;
+    bool changing = error == SIMFS_NO_ERROR;
+    if (changing) {
+        simfsDescriptorChangeBegin(mount, descriptorIndex);
+        error = simfsSparseGrow(mount, descriptorIndex, offset + length, (flags & SIMFS_FALLOCATE_KEEP_SIZE) != 0);
+    }
+    if (error == SIMFS_NO_ERROR)
+        error = simfsSparseReserve(mount, descriptorIndex, first, last);
+    if (error == SIMFS_NO_ERROR)
+        simfsSparseFinish(mount, descriptorIndex);
+    if (changing)
+        simfsDescriptorChangeEnd(mount, descriptorIndex);
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+    return error;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
 /*
- * The function replaces content of a file with new one pointed to by the parameter writeBuffer.
- *
- * Checks if the file handle points to a valid file descriptor of an open file. If the entry is invalid
- * (e.g., if the reference to the global table is NULL, or if the entry in the global table is INVALID_CONTENT_TYPE),
- * then it returns SIMFS_NOT_FOUND_ERROR.
- *
- * Otherwise, it checks the access rights for writing. If the process owner is not allowed to write to the file,
- * then the function returns SIMFS_ACCESS_ERROR.
- *
- * Then, the functions calculates the space needed for the new content and checks if the write buffer can fit into
- * the remaining free space in the file system. If not, then the SIMFS_ALLOC_ERROR is returned.
- *
- * Otherwise, the function removes all blocks currently held by this file, and then acquires new blocks as needed
- * modifying bits in the in-memory bitvector as needed.
+ * Sets whether the content of the file fileName is compressed from its next write on; the content it has now
+ * stays as it is stored until then.
  *
- * It then copies the characters pointed to by the parameter writeBuffer (until '\0' but excluding it) to the
- * new blocks that belong to the file. The function copies any modified block of the in-memory bitvector to
- * the corresponding bitvector block on the disk.
+ * Returns SIMFS_NOT_FOUND_ERROR if there is no such file, SIMFS_ACCESS_ERROR if the owner may not write it or the
+ * mount is read-only, SIMFS_WRITE_ERROR if it is a folder, and SIMFS_ALLOC_ERROR if the descriptor that a snapshot
+ * holds cannot be preserved.
+ */
+SIMFS_ERROR simfsSetFileCompression(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, bool compress) {
+    SIMFS_NAME_TYPE nameWithPath;
+
+    if (!simfsResolvePath(mount, fileName, nameWithPath))
+        return SIMFS_NOT_FOUND_ERROR;
+    if (namesAreSame(nameWithPath, SIMFS_STATS_FILE_NAME) || mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+    SIMFS_ERROR error = simfsDirectoryFault(mount, nameWithPath);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+
+    SIMFS_DIR_ENT *entry = simfsDirectoryLookup(mount, nameWithPath);
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = NULL;
+    if (entry == NULL)
+        error = SIMFS_NOT_FOUND_ERROR;
+    else {
+        descriptor = &mount->volume->block[entry->nodeReference].content.fileDescriptor;
+        if ((descriptor->accessRights & 0200) != 0200)
+            error = SIMFS_ACCESS_ERROR;
+        else if (descriptor->type != FILE_CONTENT_TYPE)
+            error = SIMFS_WRITE_ERROR;
+        else if (!simfsSnapshotPreserve(mount, entry->nodeReference))
+            error = SIMFS_ALLOC_ERROR;
+    }
+    if (error == SIMFS_NO_ERROR) {
+        simfsDescriptorChangeBegin(mount, entry->nodeReference);
+        if (compress)
+            descriptor->flags |= SIMFS_FILE_COMPRESSED;
+        else
+            descriptor->flags &= ~SIMFS_FILE_COMPRESSED;
+        simfsDescriptorChangeEnd(mount, entry->nodeReference);
+        simfsChecksumUpdate(mount, entry->nodeReference);
+    }
+
+    pthread_mutex_unlock(&mount->context->directoryLock);
+    return error;
+}
+
+/*
+ * Sets whether files created on the volume from now on are compressed; it is kept in the superblock.
  *
- * Finally, the file descriptor is modified to reflect the new size of the file, and the times of last modification
- * and access.
+ * Returns SIMFS_ACCESS_ERROR if the mount is read-only.
+ */
+SIMFS_ERROR simfsSetVolumeCompression(SIMFS_MOUNT *mount, bool compress) {
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+    if (compress)
+        mount->volume->superblock.attr.flags |= SIMFS_VOLUME_COMPRESSED;
+    else
+        mount->volume->superblock.attr.flags &= ~SIMFS_VOLUME_COMPRESSED;
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Makes the volume deduplicated: from now on, writes share data blocks with the same content. The data blocks
+ * stored already are indexed, but not merged. The setting is kept in the superblock and cannot be undone, since
+ * shared blocks may remain on the volume.
  *
- * The function returns SIMFS_WRITE_ERROR in response to exception not specified earlier.
+ * Returns SIMFS_ACCESS_ERROR if the mount is read-only.
+ */
+SIMFS_ERROR simfsEnableDeduplication(SIMFS_MOUNT *mount) {
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+    simfsEpochSynchronize(); // the descriptors that renamed files left behind would count as files
+    pthread_mutex_lock(&mount->context->sharingLock);
+    if (mount->context->dedup == NULL && (error = simfsDedupBuild(mount)) == SIMFS_NO_ERROR)
+        mount->volume->superblock.attr.flags |= SIMFS_VOLUME_DEDUPLICATED;
+    pthread_mutex_unlock(&mount->context->sharingLock);
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    return error;
+}
+
+/*
+ * Reports how many data block references of all files share how many blocks.
  *
+ * Returns SIMFS_NOT_FOUND_ERROR if the volume is not deduplicated.
  */
-SIMFS_ERROR simfsWriteFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer) {
-    // TODO: implement
+SIMFS_ERROR simfsGetDedupStats(SIMFS_MOUNT *mount, SIMFS_DEDUP_STATS_TYPE *stats) {
+    memset(stats, 0, sizeof(SIMFS_DEDUP_STATS_TYPE));
 
-    return SIMFS_NO_ERROR;
+    pthread_mutex_lock(&mount->context->sharingLock);
+    SIMFS_DEDUP_TYPE *dedup = mount->context->dedup;
+    if (dedup != NULL) {
+        stats->references = dedup->numberOfReferences;
+        stats->blocks = dedup->numberOfBlocks;
+        for (size_t block = 0; block < simfsVolumeBlocks(mount->volume); block++)
+            stats->sharedBlocks += dedup->references[block] > 1;
+    }
+    pthread_mutex_unlock(&mount->context->sharingLock);
+
+    stats->ratio = stats->blocks > 0 ? (double) stats->references / stats->blocks : 1.0;
+    return dedup != NULL ? SIMFS_NO_ERROR : SIMFS_NOT_FOUND_ERROR;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
 /*
- * The function returns the complete content of the file to the caller through the parameter readBuffer.
+ * Takes a snapshot of the volume as it is now and returns its number in snapshot. Nothing is copied at this
+ * point: the blocks of the live tree are preserved as they change later.
  *
- * Checks if the file handle points to a valid file descriptor of an open file. If the entry is invalid
- * (e.g., if the reference to the global table is NULL, or if the entry in the global table is INVALID_CONTENT_TYPE),
- * then it returns SIMFS_NOT_FOUND_ERROR.
- *
- * Otherwise, it checks the user's access right to read the file. If the process owner is not allowed to read the file,
- * then the function returns SIMFS_ACCESS_ERROR.
- *
- * Otherwise, the function allocates memory sufficient to hold the read content with an appended end of string
- * character; the pointer to newly allocated memory is passed back through the readBuffer parameter. All the content
- * of the blocks is concatenated using the allocated space, and an end of string character is appended at the end of
- * the concatenated content.
+ * Returns SIMFS_ALLOC_ERROR if the volume has SIMFS_MAX_SNAPSHOTS snapshots already, and SIMFS_ACCESS_ERROR if
+ * the mount is read-only.
+ */
+SIMFS_ERROR simfsCreateSnapshot(SIMFS_MOUNT *mount, unsigned int *snapshot) {
+    SIMFS_ERROR error = SIMFS_ALLOC_ERROR;
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+    pthread_mutex_lock(&mount->context->sharingLock);
+    SIMFS_VOLUME *volume = mount->volume;
+    SIMFS_SNAPSHOT_TYPE *slot = NULL;
+    for (size_t i = 0; slot == NULL && i < SIMFS_MAX_SNAPSHOTS; i++) {
+        if (volume->snapshot[i].generation == 0)
+            slot = &volume->snapshot[i];
+    }
+    if (slot != NULL) {
+        slot->generation = volume->generation;
+        slot->rootNodeIndex = volume->superblock.attr.rootNodeIndex;
+        time(&slot->creationTime);
+        *snapshot = volume->generation++;
+        error = SIMFS_NO_ERROR;
+    }
+    pthread_mutex_unlock(&mount->context->sharingLock);
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    return error;
+}
+
+/*
+ * Deletes a snapshot; the blocks that no other snapshot holds are freed.
  *
- * The function returns SIMFS_READ_ERROR in response to exception not specified earlier.
+ * Returns SIMFS_NOT_FOUND_ERROR if there is no such snapshot, and SIMFS_ACCESS_ERROR if the mount is read-only.
+ */
+SIMFS_ERROR simfsDeleteSnapshot(SIMFS_MOUNT *mount, unsigned int snapshot) {
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    pthread_mutex_lock(&mount->context->directoryLock);
+    pthread_mutex_lock(&mount->context->sharingLock);
+    SIMFS_VOLUME *volume = mount->volume;
+    SIMFS_SNAPSHOT_TYPE *slot = simfsSnapshotFind(volume, snapshot);
+    if (slot == NULL)
+        error = SIMFS_NOT_FOUND_ERROR;
+    else {
+        slot->generation = 0;
+        for (SIMFS_INDEX_TYPE block = 0; block < simfsVolumeBlocks(volume); block++) {
+            SIMFS_BLOCK_LIFE_TYPE *life = &volume->life[block];
+            if (life->death == 0 || simfsSnapshotHolds(volume, life->birth, life->death))
+                continue;
+            volume->block[block].type = INVALID_CONTENT_TYPE;
+            memset(life, 0, sizeof(SIMFS_BLOCK_LIFE_TYPE));
+            simfsReleaseBlock(mount, block);
+        }
+    }
+    pthread_mutex_unlock(&mount->context->sharingLock);
+    pthread_mutex_unlock(&mount->context->directoryLock);
+
+    return error;
+}
+
+/*
+ * Mounts a snapshot of a mounted volume read-only in snapshotMount; it is unmounted with simfsUmountFileSystem()
+ * before the volume is. The snapshot mount reads a view of the volume taken now, so it is not affected by
+ * later changes, and nothing is written back on unmounting.
  *
+ * Returns SIMFS_NOT_FOUND_ERROR if there is no such snapshot, SIMFS_READ_ERROR if it cannot be read, and
+ * SIMFS_ALLOC_ERROR if there is no memory for the view.
  */
-SIMFS_ERROR simfsReadFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer) {
-    // TODO: implement
+SIMFS_ERROR simfsMountSnapshot(SIMFS_MOUNT *mount, unsigned int snapshot, SIMFS_MOUNT **snapshotMount) {
+    pthread_mutex_lock(&mount->context->directoryLock);
+    pthread_mutex_lock(&mount->context->sharingLock);
+    SIMFS_VOLUME *volume = simfsVolumeAlloc(simfsVolumeBlocks(mount->volume));
+    SIMFS_ERROR error = volume != NULL ? simfsSnapshotView(mount->volume, snapshot, volume) : SIMFS_ALLOC_ERROR;
+    pthread_mutex_unlock(&mount->context->sharingLock);
+    pthread_mutex_unlock(&mount->context->directoryLock);
+    if (error != SIMFS_NO_ERROR) {
+        simfsVolumeFree(volume);
+        return error;
+    }
+
+    SIMFS_MOUNT *view = simfsAllocMount(mount->fileName, volume, false);
+    if (view == NULL)
+        return SIMFS_ALLOC_ERROR;
+    view->context->readOnly = true;
+    error = simfsLoadMount(view);
+    if (error != SIMFS_NO_ERROR) {
+        simfsFreeMount(view);
+        return error;
+    }
 
+    *snapshotMount = view;
     return SIMFS_NO_ERROR;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// volume resizing
+//
+// The size in the superblock is the number of blocks of the volume, a whole number of allocation groups, and the
+// image has room for exactly these (see simfsVolumeLayout()). A resize copies the volume into an image of the new
+// size and sets the length of the volume file to match: the file is extended before a grow, so that a grow that
+// cannot get the room changes nothing, and cut after a shrink. The blocks that a grow adds are free. Shrinking the
+// volume takes the groups past the new size out of service and moves their used blocks into the groups that stay
+// first, so no block is copied but the ones in the tail.
+//
+// A move is a copy of the block followed by rewriting every reference to it - the directory entries and their
+// keys, index chains, descriptors and their folders, the root folder, the open file tables and the working
+// directories - through a relocation map. Everything happens under directoryLock and sharingLock after the retired
+// directory entries are reclaimed, so the live tree is all that references a block. Lock-free readers copy
+// descriptors out of the image, so the old image is released only after an epoch, and a shrink waits for the
+// readers of the old directory before it drops the tail. A lazy mount stops mapping the volume file with its first
+// resize; its folders are all loaded by then or are read from the copy.
+// Volumes with snapshots are not shrunk, since the views of the snapshots expect blocks where they were.
+//
 //////////////////////////////////////////////////////////////////////////
 
 /*
- * Removes the entry for the file with the file handle provided as the parameter from the open file table
- * for this process. It decreases the number of open files for in the process control block of this process, and
- * if it becomes zero, then the process control block for this process is removed from the processControlBlocks list.
- *
- * Decreases the reference count in the global open file table, and if that number is 0, it also removes the entry
- * for this file from the global open file table.
+ * Sets the size of the volume and the free counts of all groups from it and the bitvector. The caller holds
+ * directoryLock; simfsOpen() reads the size under openFileLock.
+ */
+static void simfsSetVolumeBlocks(SIMFS_MOUNT *mount, size_t numberOfBlocks) {
+    pthread_mutex_lock(&mount->context->openFileLock);
+    mount->volume->superblock.attr.numberOfBlocks = (SIMFS_INDEX_TYPE) numberOfBlocks;
+    pthread_mutex_unlock(&mount->context->openFileLock);
+
+    for (unsigned int group = 0; group < mount->context->numberOfAllocationGroups; group++) {
+        SIMFS_ALLOCATION_GROUP_TYPE *allocationGroup = &mount->context->allocationGroups[group];
+
+        pthread_mutex_lock(&allocationGroup->lock);
+        atomic_store_explicit(&allocationGroup->freeBlocks, simfsGroupFreeBlocks(mount, group), memory_order_relaxed);
+        pthread_mutex_unlock(&allocationGroup->lock);
+    }
+}
+
+/*
+ * Counts the references from the live tree to every block: one for a descriptor and for each index block of its
+ * chain, and one for each index entry of a file that points to a data block. The caller holds directoryLock.
+ */
+static void simfsCountLiveReferences(SIMFS_MOUNT *mount, unsigned int *references) {
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+
+    for (size_t slot = 0; slot < directory->size; slot++) {
+        SIMFS_DIR_ENT *entry = atomic_load_explicit(&directory->slot[slot], memory_order_relaxed);
+        for (; entry != NULL; entry = atomic_load_explicit(&entry->next, memory_order_relaxed)) {
+            SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[entry->nodeReference].content.fileDescriptor;
+            bool isFile = descriptor->type == FILE_CONTENT_TYPE;
+            references[entry->nodeReference]++;
+            if (isFile && descriptor->storedSize == 0)
+                continue;
+
+            size_t numberOfEntries = isFile ? SIMFS_DATA_BLOCKS(descriptor) : descriptor->size;
+            SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+            for (size_t i = 0; i == 0 || i < numberOfEntries; i++) {
+                if (i > 0 && i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+                    indexBlock = mount->volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+                if (i % SIMFS_INDEX_ENTRIES_PER_BLOCK == 0)
+                    references[indexBlock]++;
+                SIMFS_INDEX_TYPE dataBlock =
+                        mount->volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK];
+                if (isFile && i < numberOfEntries && dataBlock != SIMFS_HOLE)
+                    references[dataBlock]++;
+            }
+        }
+    }
+}
+
+/*
+ * Points the folder and the chain of the descriptor in the block descriptorIndex, and the references in the chain,
+ * to the places that the relocation map gives, and recomputes the checksums of the blocks that changed. The caller
+ * holds directoryLock.
+ */
+static void simfsRelocateReferences(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex,
+                                    const SIMFS_INDEX_TYPE *relocation) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &mount->volume->block[descriptorIndex].content.fileDescriptor;
+    if (descriptor->parent != SIMFS_INVALID_INDEX && relocation[descriptor->parent] != descriptor->parent) {
+        simfsDescriptorChangeBegin(mount, descriptorIndex);
+        descriptor->parent = relocation[descriptor->parent];
+        simfsDescriptorChangeEnd(mount, descriptorIndex);
+        simfsChecksumUpdate(mount, descriptorIndex);
+    }
+    bool isFile = descriptor->type == FILE_CONTENT_TYPE;
+    if (isFile && descriptor->storedSize == 0)
+        return;
+
+    if (relocation[descriptor->block_ref] != descriptor->block_ref) {
+        simfsDescriptorChangeBegin(mount, descriptorIndex);
+        descriptor->block_ref = relocation[descriptor->block_ref];
+        simfsDescriptorChangeEnd(mount, descriptorIndex);
+        simfsChecksumUpdate(mount, descriptorIndex);
+    }
+
+    size_t numberOfEntries = isFile ? SIMFS_DATA_BLOCKS(descriptor) : descriptor->size;
+    size_t numberOfIndexBlocks = numberOfEntries == 0 ? 1 :
+                                 (numberOfEntries + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK;
+    SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+    for (size_t i = 0; i < numberOfIndexBlocks; i++) {
+        SIMFS_INDEX_TYPE *index = mount->volume->block[indexBlock].content.index;
+        bool changed = false;
+        for (size_t j = 0; j < SIMFS_INDEX_SIZE; j++) {
+            bool isEntry = j < SIMFS_INDEX_ENTRIES_PER_BLOCK ? i * SIMFS_INDEX_ENTRIES_PER_BLOCK + j < numberOfEntries :
+                           i + 1 < numberOfIndexBlocks;
+            if (!isEntry || index[j] == SIMFS_HOLE || relocation[index[j]] == index[j])
+                continue;
+            index[j] = relocation[index[j]];
+            changed = true;
+        }
+        if (changed)
+            simfsChecksumUpdate(mount, indexBlock);
+        indexBlock = index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+    }
+}
+
+/*
+ * Points the open file tables and the working directories to the places that the relocation map for numberOfBlocks
+ * blocks gives.
+ */
+static void simfsRelocateOpenFiles(SIMFS_MOUNT *mount, const SIMFS_INDEX_TYPE *relocation, size_t numberOfBlocks) {
+    pthread_mutex_lock(&mount->context->openFileLock);
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES / SIMFS_OPEN_FILE_CHUNK_SIZE; i++) {
+        SIMFS_OPEN_FILE_CHUNK_TYPE *chunk = mount->context->globalOpenFileTable[i];
+        for (int j = 0; chunk != NULL && j < SIMFS_OPEN_FILE_CHUNK_SIZE; j++) {
+            SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = &chunk->entry[j];
+            if (globalEntry->type != INVALID_CONTENT_TYPE && globalEntry->fileDescriptor < numberOfBlocks)
+                globalEntry->fileDescriptor = relocation[globalEntry->fileDescriptor];
+        }
+    }
+    for (SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = mount->context->processControlBlocks; pcb != NULL; pcb = pcb->next)
+        pcb->currentWorkingDirectory = relocation[pcb->currentWorkingDirectory];
+    pthread_mutex_unlock(&mount->context->openFileLock);
+}
+
+/*
+ * Moves the used blocks past numberOfBlocks into the blocks below it and takes the groups past it out of service.
+ * The caller holds directoryLock and sharingLock, and no retired directory entry is left.
  *
+ * Returns SIMFS_NOT_EMPTY_ERROR if the volume has snapshots, or if a used block in the tail is not referenced from
+ * the live tree alone, as the blocks of a deleted file that is still being released are; SIMFS_ALLOC_ERROR if the
+ * blocks that stay cannot take the used blocks of the tail, or if there is no memory.
  */
+static SIMFS_ERROR simfsShrinkVolume(SIMFS_MOUNT *mount, size_t numberOfBlocks) {
+    SIMFS_VOLUME *volume = mount->volume;
+    for (size_t i = 0; i < SIMFS_MAX_SNAPSHOTS; i++) {
+        if (volume->snapshot[i].generation != 0)
+            return SIMFS_NOT_EMPTY_ERROR;
+    }
+
+    size_t oldNumberOfBlocks = simfsVolumeBlocks(volume);
+    unsigned int *references = calloc(oldNumberOfBlocks, sizeof(unsigned int));
+    SIMFS_INDEX_TYPE *relocation = malloc(oldNumberOfBlocks * sizeof(SIMFS_INDEX_TYPE));
+    if (references == NULL || relocation == NULL) {
+        free(references);
+        free(relocation);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    // a block that a deleted file still shares has more references in the fingerprint index than in the live tree
+    simfsCountLiveReferences(mount, references);
+    SIMFS_DEDUP_TYPE *dedup = mount->context->dedup;
+    size_t tailBlocks = 0;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    for (size_t block = numberOfBlocks; block < oldNumberOfBlocks; block++) {
+        if (((unsigned char) mount->context->bitvector[block / 8] & (0x80 >> (block % 8))) == 0)
+            continue;
+        tailBlocks++;
+        if (references[block] == 0 ||
+            (dedup != NULL && dedup->references[block] != 0 && dedup->references[block] != references[block]))
+            error = SIMFS_NOT_EMPTY_ERROR;
+    }
+    size_t freeBlocks = 0;
+    for (unsigned int group = 0; group < numberOfBlocks / SIMFS_BLOCKS_PER_ALLOCATION_GROUP; group++)
+        freeBlocks += atomic_load_explicit(&mount->context->allocationGroups[group].freeBlocks, memory_order_relaxed);
+    if (error == SIMFS_NO_ERROR && tailBlocks > freeBlocks)
+        error = SIMFS_ALLOC_ERROR;
+    if (error != SIMFS_NO_ERROR) {
+        free(references);
+        free(relocation);
+        return error;
+    }
+
+    // take the tail out of service first, so that the copies land in the groups that stay
+    simfsSetVolumeBlocks(mount, numberOfBlocks);
+
+    SIMFS_INDEX_TYPE goal = SIMFS_INVALID_INDEX;
+    for (size_t block = 0; block < oldNumberOfBlocks; block++) {
+        relocation[block] = (SIMFS_INDEX_TYPE) block;
+        if (block < numberOfBlocks ||
+            ((unsigned char) mount->context->bitvector[block / 8] & (0x80 >> (block % 8))) == 0)
+            continue;
+        SIMFS_INDEX_TYPE copy = simfsAllocateBlock(mount, goal); // cannot fail; the free blocks were counted
+        volume->block[copy] = volume->block[block];
+        volume->checksum[copy] = volume->checksum[block];
+        if (mount->context->verifiedBlocks[block / 8] & (0x80 >> (block % 8)))
+            simfsSetBit((unsigned char *) mount->context->verifiedBlocks, copy);
+        else
+            simfsClearBit((unsigned char *) mount->context->verifiedBlocks, copy);
+        relocation[block] = copy;
+        goal = copy + 1;
+    }
+
+    SIMFS_DIRECTORY *directory = atomic_load_explicit(&mount->context->directory, memory_order_relaxed);
+    SIMFS_DIRECTORY *newDirectory = simfsDirectoryCopy(mount, directory->size, relocation);
+    if (newDirectory == NULL) { // give the copies back; nothing refers to them yet
+        for (size_t block = numberOfBlocks; block < oldNumberOfBlocks; block++) {
+            if (relocation[block] != block)
+                simfsReleaseBlock(mount, relocation[block]);
+        }
+        simfsSetVolumeBlocks(mount, oldNumberOfBlocks);
+        free(references);
+        free(relocation);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    for (size_t slot = 0; slot < newDirectory->size; slot++) {
+        SIMFS_DIR_ENT *entry = atomic_load_explicit(&newDirectory->slot[slot], memory_order_relaxed);
+        for (; entry != NULL; entry = atomic_load_explicit(&entry->next, memory_order_relaxed))
+            simfsRelocateReferences(mount, entry->nodeReference, relocation);
+    }
+    for (size_t block = numberOfBlocks; block < oldNumberOfBlocks; block++) {
+        if (relocation[block] != block)
+            simfsDedupMove(mount, (SIMFS_INDEX_TYPE) block, relocation[block]);
+    }
+    volume->superblock.attr.rootNodeIndex = relocation[volume->superblock.attr.rootNodeIndex];
+    simfsRelocateOpenFiles(mount, relocation, oldNumberOfBlocks);
+    simfsDirectoryPublish(mount, newDirectory);
 
-SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle) {
-    // TODO: implement
+    for (size_t block = numberOfBlocks; block < oldNumberOfBlocks; block++) {
+        if (relocation[block] != block)
+            simfsReleaseBlock(mount, (SIMFS_INDEX_TYPE) block);
+    }
+    simfsSetVolumeBlocks(mount, numberOfBlocks); // the released blocks are out of service
 
+    free(references);
+    free(relocation);
     return SIMFS_NO_ERROR;
 }
 
+/*
+ * Copies the volume into image, laid out for numberOfBlocks blocks, and the block arrays of the context into arrays,
+ * allocated for that many blocks, and puts both in use; the blocks that a grow adds go in service. arrays gets the
+ * old block arrays. The caller holds directoryLock and sharingLock, and releases the old image and arrays after an
+ * epoch.
+ */
+static void simfsReplaceImage(SIMFS_MOUNT *mount, void *image, size_t numberOfBlocks, SIMFS_BLOCK_ARRAYS_TYPE *arrays) {
+    SIMFS_VOLUME *volume = mount->volume;
+    SIMFS_CONTEXT_TYPE *context = mount->context;
+    size_t oldNumberOfBlocks = simfsVolumeBlocks(volume);
+    size_t copied = numberOfBlocks < oldNumberOfBlocks ? numberOfBlocks : oldNumberOfBlocks;
+    SIMFS_VOLUME_LAYOUT_TYPE layout;
+    simfsVolumeLayout(numberOfBlocks, &layout);
+
+    memcpy((char *) image + layout.bitvector, volume->bitvector, copied / 8);
+    memcpy((char *) image + layout.block, volume->block, copied * sizeof(SIMFS_BLOCK_TYPE));
+    memcpy((char *) image + layout.checksum, volume->checksum, copied * sizeof(unsigned int));
+    memcpy((char *) image + layout.life, volume->life, copied * sizeof(SIMFS_BLOCK_LIFE_TYPE));
+    simfsVolumeSetImage(volume, image, numberOfBlocks);
+    volume->mapsFile = false;
+
+    memcpy(arrays->bitvector, context->bitvector, copied / 8);
+    memcpy(arrays->verifiedBlocks, context->verifiedBlocks, copied / 8);
+    memcpy((void *) arrays->descriptorSequences, (void *) context->descriptorSequences,
+           copied * sizeof(_Atomic unsigned int)); // all even, as no writer is in a change
+    for (unsigned int group = 0; group < arrays->numberOfAllocationGroups && group < context->numberOfAllocationGroups;
+         group++)
+        arrays->allocationGroups[group].rotor = context->allocationGroups[group].rotor;
+    if (context->dedup != NULL) {
+        memcpy(arrays->dedupNext, context->dedup->next, copied * sizeof(SIMFS_INDEX_TYPE));
+        memcpy(arrays->dedupReferences, context->dedup->references, copied * sizeof(unsigned int));
+    }
+    simfsSwapBlockArrays(context, arrays);
+    simfsSetVolumeBlocks(mount, numberOfBlocks);
+}
+
+/*
+ * Changes the number of blocks of a mounted volume to numberOfBlocks, a whole number of allocation groups up to
+ * SIMFS_MAX_NUMBER_OF_BLOCKS, and the length of its volume file with it. The bitvector, the allocation groups, and
+ * the other arrays of the context with an entry per block are allocated anew for that size. Shrinking the volume
+ * moves the used blocks past the new size into the blocks that stay. Other operations wait while the volume is
+ * resized.
+ *
+ * Returns SIMFS_WRITE_ERROR for a size that simfsVolumeLayout() does not accept, or if the volume file cannot be
+ * extended, SIMFS_ACCESS_ERROR if the mount is read-only, SIMFS_NOT_EMPTY_ERROR if
+ * a shrink has to wait for the deletion of the snapshots or for deleted files to be released, and SIMFS_ALLOC_ERROR
+ * if the used blocks do not fit or if there is no memory for the new image. A resize waits until the subtrees
+ * deleted with simfsDeleteTree() have been freed.
+ */
+SIMFS_ERROR simfsResizeVolume(SIMFS_MOUNT *mount, size_t numberOfBlocks) {
+    SIMFS_VOLUME_LAYOUT_TYPE layout;
+    if (mount->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+    if (!simfsVolumeLayout(numberOfBlocks, &layout))
+        return SIMFS_WRITE_ERROR;
+
+    void *image = simfsMapImage(layout.size);
+    if (image == NULL)
+        return SIMFS_ALLOC_ERROR;
+    int descriptor = open(mount->fileName, O_WRONLY);
+    if (descriptor < 0) {
+        munmap(image, layout.size);
+        return SIMFS_WRITE_ERROR;
+    }
+
+    // writes give back or link the blocks they took without directoryLock before the bitvector is replaced; a tree
+    // deletion needs directoryLock until its subtree is detached, so it is waited for without holding it; no new one
+    // starts while the lock is held
+    pthread_rwlock_wrlock(&mount->context->resizeLock);
+    pthread_mutex_lock(&mount->context->directoryLock);
+    while (simfsTreeDeletionsPending(mount)) {
+        pthread_mutex_unlock(&mount->context->directoryLock);
+        simfsTreeDeletionsWait(mount);
+        pthread_mutex_lock(&mount->context->directoryLock);
+    }
+    // the fingerprint index is only set up under directoryLock, so it stays as it is now
+    SIMFS_BLOCK_ARRAYS_TYPE arrays;
+    SIMFS_ERROR error = simfsBlockArraysAlloc(&arrays, numberOfBlocks, mount->context->dedup != NULL) ?
+                        SIMFS_NO_ERROR : SIMFS_ALLOC_ERROR;
+    simfsEpochSynchronize(); // deleted files release their blocks
+    pthread_mutex_lock(&mount->context->sharingLock);
+    size_t oldNumberOfBlocks = simfsVolumeBlocks(mount->volume);
+    bool shrink = numberOfBlocks < oldNumberOfBlocks;
+    if (shrink && mount->lazy && error == SIMFS_NO_ERROR) // the moves rewrite references anywhere in the tree
+        error = simfsDirectoryFaultTree(mount, mount->volume->superblock.attr.rootNodeIndex);
+    if (shrink && error == SIMFS_NO_ERROR)
+        error = simfsShrinkVolume(mount, numberOfBlocks);
+    else if (!shrink && error == SIMFS_NO_ERROR && ftruncate(descriptor, (off_t) layout.size) != 0)
+        error = SIMFS_WRITE_ERROR;
+    if (shrink && error == SIMFS_NO_ERROR) { // readers of the old directory may still copy descriptors of the tail
+        pthread_mutex_unlock(&mount->context->sharingLock);
+        simfsEpochSynchronize();
+        pthread_mutex_lock(&mount->context->sharingLock);
+    }
+    void *oldImage = image;
+    size_t oldImageSize = layout.size;
+    if (error == SIMFS_NO_ERROR) {
+        oldImage = mount->volume->image;
+        oldImageSize = mount->volume->imageSize;
+        simfsReplaceImage(mount, image, numberOfBlocks, &arrays);
+    }
+    pthread_mutex_unlock(&mount->context->sharingLock);
+
+    simfsEpochSynchronize(); // lock-free readers leave the old image
+    munmap(oldImage, oldImageSize);
+    simfsBlockArraysFree(&arrays);
+    // the file is cut only once the image of a lazy mount does not map it; should this fail, unmounting rewrites it
+    if (shrink && error == SIMFS_NO_ERROR)
+        (void) !ftruncate(descriptor, (off_t) layout.size);
+    close(descriptor);
+    pthread_mutex_unlock(&mount->context->directoryLock);
+    pthread_rwlock_unlock(&mount->context->resizeLock);
+
+    return error;
+}
+
 //////////////////////////////////////////////////////////////////////////
 //
 // The following functions are provided only for testing without FUSE.
@@ -607,6 +5731,9 @@ SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle) {
  * Simulates FUSE context to get values for user ID, process ID, and umask through fuse_context
  */
 
+static _Thread_local pid_t simfsDebugPid = 0; // 0 while the identifiers are random
+static _Thread_local uid_t simfsDebugUid = 0;
+
 struct fuse_context *simfs_debug_get_context() {
 
     // TODO: replace its use with FUSE's fuse_get_context()
@@ -614,8 +5741,8 @@ struct fuse_context *simfs_debug_get_context() {
     struct fuse_context *context = malloc(sizeof(struct fuse_context));
 
     context->fuse = NULL;
-    context->uid = (uid_t) rand() % 10 + 1;
-    context->pid = (pid_t) rand() % 10 + 1;
+    context->uid = simfsDebugPid != 0 ? simfsDebugUid : (uid_t) rand() % 10 + 1;
+    context->pid = simfsDebugPid != 0 ? simfsDebugPid : (pid_t) rand() % 10 + 1;
     context->gid = (gid_t) rand() % 10 + 1;
     context->private_data = NULL;
     context->umask = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH; // can be changed as needed
@@ -623,6 +5750,15 @@ struct fuse_context *simfs_debug_get_context() {
     return context;
 }
 
+/*
+ * Makes the calling thread act as the given process and user in all following calls, so that it can use the file
+ * handles it opened. A pid of 0 goes back to random identifiers.
+ */
+void simfs_debug_set_context(pid_t pid, uid_t uid) {
+    simfsDebugPid = pid;
+    simfsDebugUid = uid;
+}
+
 char *simfsGenerateContent(int size) {
     size = (size <= 0 ? rand() % 1000 : size); // arbitrarily chosen as an example
 
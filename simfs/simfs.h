@@ -7,6 +7,9 @@
 #include <fuse.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -15,10 +18,11 @@
 //////////////////////////////////////////////////////////////////////////
 
 #define SIMFS_BLOCK_SIZE 16
-#define SIMFS_NUMBER_OF_BLOCKS 4096 // 2^16
+#define SIMFS_DEFAULT_NUMBER_OF_BLOCKS 4096 // the size of a volume that is not given one
 #define SIMFS_MAX_NAME_LENGTH 64
 #define SIMFS_DATA_SIZE 14 // SIMFS_BLOCK_SIZE - sizeof(SIMFS_NODE_TYPE)
-#define SIMFS_INDEX_SIZE 7 // two bytes => x0000 - xFFFF => 2^16 range
+#define SIMFS_INDEX_SIZE 7 // block references in an index block
+#define SIMFS_INDEX_ENTRIES_PER_BLOCK (SIMFS_INDEX_SIZE - 1) // the last index of an index block links to the next one
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -26,10 +30,20 @@
 //
 //////////////////////////////////////////////////////////////////////////
 
-#define SIMFS_DIRECTORY_SIZE 65551 // prime number for the size of the directory (it is larger than 2^16)
+#define SIMFS_DIRECTORY_INITIAL_SIZE 16 // slots in the directory of an empty volume; the directory doubles as needed
 #define SIMFS_MAX_NUMBER_OF_OPEN_FILES 1024
+#define SIMFS_OPEN_FILE_CHUNK_SIZE 32 // the global open file table is allocated in chunks of this many entries
 #define SIMFS_MAX_NUMBER_OF_PROCESSES 1024
 #define SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS 64
+#define SIMFS_INLINE_OPEN_FILES_PER_PROCESS 4 // slots in the process control block before its table goes to the heap
+#define SIMFS_BLOCKS_PER_ALLOCATION_GROUP 512 // each group owns this slice of the bitvector; a volume has whole groups
+#define SIMFS_DEFRAGMENT_BATCH_BLOCKS 64 // blocks the background defragmenter moves between two sleeps
+#define SIMFS_DEFRAGMENT_SLOTS_PER_LOCK 64 // directory slots the defragmenter examines per hold of directoryLock
+#define SIMFS_DEFRAGMENT_IDLE_SECONDS 1 // sleep of the background defragmenter after a pass that moved nothing
+#define SIMFS_TREE_DELETION_CHUNK 64 // descriptors a worker of simfsDeleteTree() frees per claim
+#define SIMFS_RELEASE_BATCH_BLOCKS 256 // freed blocks a worker collects before it updates the bitvector
+#define SIMFS_DEDUP_BUCKETS 1024 // chains of the fingerprint index of a deduplicated volume; a power of two
+#define SIMFS_MAX_SNAPSHOTS 16 // snapshots a volume can hold at the same time
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -42,25 +56,38 @@ typedef enum {
     FILE_CONTENT_TYPE,
     INDEX_CONTENT_TYPE,
     DATA_CONTENT_TYPE,
+    COMPRESSED_CONTENT_TYPE, // data block of a file whose content is stored compressed (see simfs_compress.c)
+    UNWRITTEN_CONTENT_TYPE, // data block reserved by simfsFallocate() and not written yet; holds zeros
     INVALID_CONTENT_TYPE
 } SIMFS_CONTENT_TYPE;
 
-typedef unsigned short SIMFS_INDEX_TYPE; // is used to index blocks in the file system
-#define SIMFS_INVALID_INDEX 0xFF
+typedef uint32_t SIMFS_INDEX_TYPE; // is used to index blocks in the file system; the superblock records its width
+#define SIMFS_INVALID_INDEX ((SIMFS_INDEX_TYPE) ~0) // references no block; past the end of any volume
+#define SIMFS_HOLE ((SIMFS_INDEX_TYPE) ~1) // index entry of a file for a part that has no data block; reads as zeros
+#define SIMFS_DELETED_FILE ((SIMFS_INDEX_TYPE) ~2) // descriptor reference of a deleted file in open file tables
+#define SIMFS_STATS_FILE ((SIMFS_INDEX_TYPE) ~3) // descriptor reference of the stats file in open file tables
+#define SIMFS_MAX_NUMBER_OF_BLOCKS ((size_t) SIMFS_STATS_FILE) // so that no block is one of the references above
 
 //
 // superblock starting block in the whole file system
 //
 // rootNodeIndex points to the block which is the root folder of the files system
-// numberOfBlock determines the size of the file system
+// numberOfBlock determines the size of the file system and of its image: a whole number of allocation groups up to
+// SIMFS_MAX_NUMBER_OF_BLOCKS; simfsResizeVolume() changes it
 // blockSize is the size of a single block of the file system
+// indexSize is the number of bytes of a block reference, sizeof(SIMFS_INDEX_TYPE); a volume is mounted only by a
+// build with the same width
+// flags holds the SIMFS_VOLUME_* settings of the file system; a volume is mounted only if it has
+// SIMFS_VOLUME_FOLDER_NAMES, the layout of the descriptors of this build
 //
 typedef union simfs_superblock_type { // size of the block with some unused part
     char spacer_dummy[SIMFS_BLOCK_SIZE]; // this makes the struct exactly one block
     struct attr {
         SIMFS_INDEX_TYPE rootNodeIndex; // should point to the first block after the last bitvector block
-        int numberOfBlocks;
-        int blockSize;
+        SIMFS_INDEX_TYPE numberOfBlocks;
+        unsigned short blockSize;
+        unsigned short indexSize;
+        int flags;
     } attr;
 } SIMFS_SUPERBLOCK_TYPE;
 
@@ -69,27 +96,72 @@ typedef union simfs_superblock_type { // size of the block with some unused part
 //
 //   for files:
 //       te size indicates the size of the file
+//       the stored size is the number of bytes held in its data blocks; it is smaller than the size if the content
+//           is stored compressed, and equal to it otherwise, holes included
 //       the block reference is initialized to SIMFS_INVALID_INDEX
 //           - it will point to an index block when the file has content
+//           - entries of the index chain of a sparse file may be SIMFS_HOLE
 //
 //   for directories:
 //       the size indicates the number of files or directories in this folder
 //       the block reference points to an index block that holds references to the file and folder blocks
 //
+//   the name is that of the file in its folder, and the parent is the descriptor block of the folder, so moving a
+//   folder changes its own descriptor only; the name with the full path is rebuilt by following the parents up to
+//   the root, whose name is "/" and which has no parent
+//
 typedef char SIMFS_NAME_TYPE[SIMFS_MAX_NAME_LENGTH]; // for folder and file names
 
 typedef struct simfs_file_descriptor_type {
     SIMFS_CONTENT_TYPE type; // folder or file
-    SIMFS_NAME_TYPE name;
+    SIMFS_INDEX_TYPE parent; // descriptor block of the folder; SIMFS_INVALID_INDEX for the root
+    SIMFS_NAME_TYPE name; // in the folder, without the path
     time_t creationTime; // creation time
     time_t lastAccessTime; // last access
     time_t lastModificationTime; // last modification
     mode_t accessRights; // access rights for the file
     uid_t owner; // owner ID
     size_t size; // capacity limited for this project to 2s^16
+    size_t storedSize; // bytes in the data blocks of a file; more than size if blocks are reserved past the end
+    unsigned int flags; // SIMFS_FILE_* settings of a file
     SIMFS_INDEX_TYPE block_ref; // reference to the data or index block
 } SIMFS_FILE_DESCRIPTOR_TYPE;
 
+#define SIMFS_VOLUME_COMPRESSED 0x1 // files created on the volume get SIMFS_FILE_COMPRESSED
+#define SIMFS_VOLUME_DEDUPLICATED 0x2 // data blocks with the same type and content may be referenced more than once
+#define SIMFS_VOLUME_FOLDER_NAMES 0x4 // descriptors hold the name in their folder and the folder; set on every volume
+#define SIMFS_FILE_COMPRESSED 0x1 // the content is compressed when it is written, if that makes it smaller
+#define SIMFS_FALLOCATE_KEEP_SIZE 0x1 // simfsFallocate() reserves blocks past the end without changing the size
+
+#define SIMFS_DATA_BLOCKS(descriptor) (((descriptor)->storedSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE)
+
+//
+// snapshot of a volume (see simfs_snapshot.c)
+//
+// a snapshot is the tree that was reachable from rootNodeIndex when the generation of the volume was generation
+//
+typedef struct simfs_snapshot_type {
+    unsigned int generation; // 0 if the slot is free
+    SIMFS_INDEX_TYPE rootNodeIndex;
+    time_t creationTime;
+} SIMFS_SNAPSHOT_TYPE;
+
+//
+// generations in which a version of a block belongs to a tree
+//
+// a block holds one version of the block origin from the generation birth up to, but not including, death; death
+// is 0 while the version is part of the live tree, which is always the case for blocks that are their own origin
+// and for all blocks of a volume without snapshots
+//
+typedef struct simfs_block_life_type {
+    unsigned int birth;
+    unsigned int death;
+    SIMFS_INDEX_TYPE origin;
+} SIMFS_BLOCK_LIFE_TYPE;
+
+#define SIMFS_BLOCK_IS_LIVE(volume, block) ((volume)->life[block].death == 0)
+#define SIMFS_UNBORN_GENERATION ((unsigned int) ~0) // birth of a block a write took but has not linked into a file yet
+
 //
 // a block for holding data
 //
@@ -111,19 +183,48 @@ typedef struct simfs_node_type {
 //
 // "physical" file system structure
 //
+// the image of a volume, in its file and in memory, is the part of SIMFS_VOLUME before bitvector followed by the
+// arrays it points to, each for superblock.attr.numberOfBlocks blocks (see simfsVolumeLayout()):
+//
 // superblock - one block
 //
-// bitvector - one bit per block ( (SIMFS_NUMBER_OF_BLOCKS/8 / SIMFS_BLOCK_SIZE) blocks )
+// map checksum - CRC32C of the superblock, the bitvector, and the snapshots (see simfs_checksum.c)
+//
+// snapshots - the generation of the live tree and the snapshots taken
 //
-// blocks (folder, file, data, or index) - SIMFS_NUMBER_OF_BLOCKS
+// bitvector - one bit per block
 //
+// blocks (folder, file, data, or index)
+//
+// checksums - CRC32C of every used block
+//
+// lives - the generations in which every used block was born and died
 //
 typedef struct simfs_volume {
     SIMFS_SUPERBLOCK_TYPE superblock;
-    char bitvector[SIMFS_NUMBER_OF_BLOCKS / 8]; //
-    SIMFS_BLOCK_TYPE block[SIMFS_NUMBER_OF_BLOCKS];
+    unsigned int mapChecksum; // of the superblock, the bitvector, and the snapshots; written on unmounting
+    unsigned int generation; // of the live tree; taking a snapshot starts a new one
+    SIMFS_SNAPSHOT_TYPE snapshot[SIMFS_MAX_SNAPSHOTS];
+    char *bitvector;
+    SIMFS_BLOCK_TYPE *block;
+    unsigned int *checksum; // of each used block; kept up to date as blocks are written
+    SIMFS_BLOCK_LIFE_TYPE *life; // of each used block
+    void *image; // a mapping that holds the arrays above; the part before them is copied in on writing
+    size_t imageSize;
+    bool mapsFile; // the image is a copy-on-write mapping of the volume file rather than anonymous memory
 } SIMFS_VOLUME;
 
+//
+// where the arrays of the image of a volume with a given number of blocks start, in bytes from its beginning
+//
+typedef struct simfs_volume_layout_type {
+    size_t bitvector;
+    size_t block;
+    size_t checksum;
+    size_t life;
+    size_t size; // of the whole image
+} SIMFS_VOLUME_LAYOUT_TYPE;
+
 //////////////////////////////////////////////////////////////////////////
 //
 // definitions for in-memory data structures supporting the file system
@@ -134,23 +235,40 @@ typedef struct simfs_volume {
 // file system directory
 //
 // directory entry in the conflict resolution linked list with the head in the hash table slot for
-// the corresponding name
+// the corresponding folder and name
+//
+// the links are atomic so that lookups can traverse the lists without a lock; writers publish new entries
+// with a release store and hand unlinked entries to simfsEpochRetire(); the key of an entry never changes, so a
+// rename publishes an entry with the new key and unlinks the old one
 //
 typedef struct simfs_dir_ent {
     SIMFS_INDEX_TYPE nodeReference; // points to the "physical" file descriptor node
-    struct simfs_dir_ent *next;
+    SIMFS_INDEX_TYPE parent; // descriptor block of the folder of the file; SIMFS_INVALID_INDEX for the root
+    unsigned long nameHash; // simfsEntryHash() of the folder and the name; compared before the name
+    unsigned int generation; // in which the file was deleted; set when the entry is retired
+    _Atomic(bool) loaded; // whether the children of a folder are in the directory; only false on lazy mounts
+    _Atomic(struct simfs_dir_ent *) next;
+    char name[]; // of the file in its folder; "/" for the root
 } SIMFS_DIR_ENT;
 
 //
 // directory implemented as a hash table
 //
-// slots are heads to resolution lists for conflicting names
+// slots are heads to resolution lists for conflicting names; the number of slots is a power of two that follows
+// the number of entries
 //
-typedef SIMFS_DIR_ENT *SIMFS_DIRECTORY[SIMFS_DIRECTORY_SIZE];
+typedef struct simfs_directory_type {
+    size_t size; // number of slots
+    _Atomic(SIMFS_DIR_ENT *) slot[];
+} SIMFS_DIRECTORY;
 
 //
 // global open file table
 //
+// when an open file is deleted, fileDescriptor is set to SIMFS_DELETED_FILE; the handles stay valid for closing,
+// but reads and writes through them fail
+//
+
 typedef struct simfs_open_file_global_type {
     SIMFS_CONTENT_TYPE type; // folder or file
     SIMFS_INDEX_TYPE fileDescriptor; // reference to the file descriptor node
@@ -163,6 +281,24 @@ typedef struct simfs_open_file_global_type {
     size_t size;
 } SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE;
 
+//
+// chunk of the global open file table; unused entries have the type INVALID_CONTENT_TYPE
+//
+typedef struct simfs_open_file_chunk_type {
+    unsigned short numberOfEntriesInUse; // the chunk is freed when this drops to 0
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE entry[SIMFS_OPEN_FILE_CHUNK_SIZE];
+} SIMFS_OPEN_FILE_CHUNK_TYPE;
+
+//
+// children of a folder in ascending order of their descriptor blocks, taken when a listing through a handle starts
+// and kept with the handle, so that every further batch seeks to its cookie with a binary search
+//
+typedef struct simfs_folder_listing_type {
+    SIMFS_INDEX_TYPE folder; // descriptor block of the folder when the children were taken
+    size_t numberOfChildren;
+    SIMFS_INDEX_TYPE children[];
+} SIMFS_FOLDER_LISTING_TYPE;
+
 //
 // per-process open file table
 //
@@ -171,26 +307,145 @@ typedef struct simfs_per_process_open_file_type // a node for a local list of op
 {
     mode_t accessRights; // access rights for this process
     SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry; // link to the entry for the file in the global table
+    SIMFS_FOLDER_LISTING_TYPE *listing; // of the folder open under the handle once it is listed; NULL before
 } SIMFS_PER_PROCESS_OPEN_FILE_TYPE;
 
+//
+// folder listings
+//
+// simfsReadDir() lists the children of a folder in the order of their descriptor blocks; the cookie is the block
+// that the next batch starts from, so it stays valid while children are created and deleted
+//
+typedef SIMFS_INDEX_TYPE SIMFS_DIR_COOKIE_TYPE;
+#define SIMFS_DIR_COOKIE_START 0 // the cookie that starts a listing
+
+typedef struct simfs_folder_entry_type {
+    SIMFS_NAME_TYPE name; // of the child, without the path of the folder
+    SIMFS_CONTENT_TYPE type;
+} SIMFS_FOLDER_ENTRY_TYPE;
+
 typedef struct simfs_process_control_block_type {
     pid_t pid; // process identifier
     int numberOfOpenFiles;
+    int capacity; // number of slots in openFileTable
     SIMFS_INDEX_TYPE currentWorkingDirectory; // current working directory; set to the root of the volume on mounting
-    SIMFS_PER_PROCESS_OPEN_FILE_TYPE openFileTable[SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS];
+    SIMFS_PER_PROCESS_OPEN_FILE_TYPE *openFileTable; // inlineOpenFileTable until the process needs more slots
+    SIMFS_PER_PROCESS_OPEN_FILE_TYPE inlineOpenFileTable[SIMFS_INLINE_OPEN_FILES_PER_PROCESS];
     struct simfs_process_control_block_type *next;
 } SIMFS_PROCESS_CONTROL_BLOCK_TYPE;
 
+//
+// allocation group
+//
+// the volume is partitioned into ranges of SIMFS_BLOCKS_PER_ALLOCATION_GROUP blocks; a group owns the
+// matching slice of both the in-memory and the on-disk bitvector, so allocations in different groups do not
+// contend; each group sits on its own cache line
+//
+typedef struct simfs_allocation_group_type {
+    _Alignas(64) pthread_mutex_t lock; // protects the bitvector slice of the group
+    _Atomic unsigned int freeBlocks; // read without the lock to skip exhausted groups
+    SIMFS_INDEX_TYPE rotor; // block after the last allocation in the group; next search without a goal starts here
+} SIMFS_ALLOCATION_GROUP_TYPE;
+
+//
+// when reads check the checksum of a block against its content
+//
+typedef enum {
+    SIMFS_VERIFY_ALWAYS, // on every read
+    SIMFS_VERIFY_ONCE, // on the first read after mounting, when the block comes in from the volume file
+    SIMFS_VERIFY_NEVER
+} SIMFS_VERIFY_MODE;
+
+//
+// fingerprint index of the data blocks of a deduplicated volume
+//
+// the fingerprint of a block is its checksum; the blocks of a bucket are chained through next
+//
+typedef struct simfs_dedup_type {
+    SIMFS_INDEX_TYPE bucket[SIMFS_DEDUP_BUCKETS]; // first block of the chain; SIMFS_INVALID_INDEX if empty
+    SIMFS_INDEX_TYPE *next; // for every block of the volume
+    unsigned int *references; // index entries that point to each block; 0 if not indexed
+    size_t numberOfReferences; // sum of references
+    size_t numberOfBlocks; // blocks in the index
+} SIMFS_DEDUP_TYPE;
+
+//
+// subtree that simfsDeleteTree() detached and whose directory entries are still being unlinked in the background;
+// no path leads into it any more, but the handles of its files are still attached to them
+//
+typedef struct simfs_detached_tree_type {
+    SIMFS_INDEX_TYPE root; // descriptor block of the root of the subtree; not reused before the subtree is withdrawn
+    struct simfs_detached_tree_type *next;
+} SIMFS_DETACHED_TREE_TYPE;
+
 /*
  * file system context
  */
 typedef struct simfs_context_type {
-    SIMFS_DIRECTORY directory; // the hashtable-based in-memory directory
-    char bitvector[SIMFS_NUMBER_OF_BLOCKS / 8]; // an in-memory copy of the bitvector of the simulated volume
-    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE globalOpenFileTable[SIMFS_MAX_NUMBER_OF_OPEN_FILES]; // in-memory
+    _Atomic(SIMFS_DIRECTORY *) directory; // the hashtable-based in-memory directory
+    size_t numberOfDirectoryEntries; // protected by directoryLock
+    size_t directoryNameBytes; // held by the names of the entries; protected by directoryLock
+    SIMFS_DETACHED_TREE_TYPE *detachedTrees; // protected by directoryLock
+    pthread_mutex_t directoryLock; // serializes writers of the directory; readers do not take it
+    pthread_rwlock_t resizeLock; // shared by writes holding blocks taken without directoryLock; before directoryLock
+    char *bitvector; // an in-memory copy of the bitvector of the simulated volume
+    SIMFS_ALLOCATION_GROUP_TYPE *allocationGroups; // locks for the bitvector
+    unsigned int numberOfAllocationGroups; // the groups of the blocks in service
+    SIMFS_OPEN_FILE_CHUNK_TYPE *globalOpenFileTable[SIMFS_MAX_NUMBER_OF_OPEN_FILES / SIMFS_OPEN_FILE_CHUNK_SIZE];
     SIMFS_PROCESS_CONTROL_BLOCK_TYPE *processControlBlocks;
+    pthread_mutex_t openFileLock; // protects the open file tables and the process control blocks
+    size_t defragmentCursor; // directory slot the defragmenter examines next; protected by directoryLock
+    pthread_mutex_t defragmentLock; // protects the state of the background defragmenter below
+    pthread_cond_t defragmentCondition; // signaled to stop the background defragmenter
+    pthread_t defragmentThread;
+    bool defragmentRunning;
+    unsigned int defragmentRate; // blocks the background defragmenter moves per second at most
+    SIMFS_VERIFY_MODE verifyMode; // when reads check the checksums of blocks
+    char *verifiedBlocks; // blocks checked or written since mounting; under directoryLock
+    _Atomic unsigned int *descriptorSequences; // per block; odd while a writer changes the descriptor in it
+    pthread_mutex_t sharingLock; // protects dedup, and the snapshots and lives of the volume; after directoryLock
+    SIMFS_DEDUP_TYPE *dedup; // NULL unless the volume is deduplicated; set under both directoryLock and sharingLock
+    bool readOnly; // set for snapshots; nothing on the volume changes and it is not saved on unmounting
+    pthread_mutex_t deletionLock; // protects the count of tree deletions below
+    pthread_cond_t deletionCondition; // signaled when a tree deletion has freed all of its blocks
+    unsigned int pendingDeletions; // detached subtrees whose blocks are being freed in the background
 } SIMFS_CONTEXT_TYPE;
 
+//
+// deduplication of a mounted volume
+//
+typedef struct simfs_dedup_stats_type {
+    size_t references; // data block references from the index chains of all files
+    size_t blocks; // data blocks they point to
+    size_t sharedBlocks; // data blocks referenced more than once
+    double ratio; // references per block; 1 without any sharing
+} SIMFS_DEDUP_STATS_TYPE;
+
+//
+// memory used by a mount, in bytes per subsystem
+//
+typedef struct simfs_memory_usage_type {
+    size_t directory; // hash table slots and entries
+    size_t openFiles; // chunks of the global open file table
+    size_t processes; // process control blocks and per-process open file tables that outgrew them
+    size_t context; // the mount and the context, with the arrays per block, the allocation groups, and the dedup index
+    size_t volume; // in-memory image of the volume
+    size_t total;
+} SIMFS_MEMORY_USAGE_TYPE;
+
+//
+// a mounted volume
+//
+// every file system function takes the mount it operates on, so one process can serve any number of volumes;
+// mounts share nothing but the epoch domain used for lock-free lookups
+//
+typedef struct simfs_mount_type {
+    SIMFS_CONTEXT_TYPE *context; // all in-memory information about the volume
+    SIMFS_VOLUME *volume; // the in-memory image of the volume
+    char *fileName; // the file the volume was loaded from; it is saved back there on unmounting
+    bool lazy; // the volume is mapped from the file rather than read, and folders are loaded on first access
+} SIMFS_MOUNT;
+
 //////////////////////////////////////////////////////////////////////////
 //
 // file system function declarations
@@ -209,36 +464,164 @@ typedef enum simfs_error {
 } SIMFS_ERROR;
 
 
-SIMFS_ERROR simfsCreateFile(SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type);
+SIMFS_ERROR simfsCreateFile(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type);
+
+SIMFS_ERROR simfsDeleteFile(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName);
+
+SIMFS_ERROR simfsCreateFiles(SIMFS_MOUNT *mount, char **fileNames, size_t numberOfFiles, SIMFS_CONTENT_TYPE type,
+                             SIMFS_ERROR *errors);
+
+SIMFS_ERROR simfsDeleteFiles(SIMFS_MOUNT *mount, char **fileNames, size_t numberOfFiles, SIMFS_ERROR *errors);
+
+SIMFS_ERROR simfsDeleteTree(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName);
+
+SIMFS_ERROR simfsRename(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE oldName, SIMFS_NAME_TYPE newName);
+
+SIMFS_ERROR simfsGetFileInfo(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer);
+
+SIMFS_ERROR simfsOpenFile(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle);
+
+SIMFS_ERROR simfsWriteFile(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer);
+
+SIMFS_ERROR simfsReadFile(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer);
+
+SIMFS_ERROR simfsReadDir(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE folderHandle, SIMFS_DIR_COOKIE_TYPE *cookie,
+                         SIMFS_FOLDER_ENTRY_TYPE *buffer, size_t bufferSize, size_t *numberOfEntries);
 
-SIMFS_ERROR simfsDeleteFile(SIMFS_NAME_TYPE fileName);
+SIMFS_ERROR simfsReadDirPlus(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE folderHandle, SIMFS_DIR_COOKIE_TYPE *cookie,
+                             SIMFS_FILE_DESCRIPTOR_TYPE *buffer, size_t bufferSize, size_t *numberOfEntries);
 
-SIMFS_ERROR simfsGetFileInfo(SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer);
+SIMFS_ERROR simfsCloseFile(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle);
 
-SIMFS_ERROR simfsOpenFile(SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle);
+SIMFS_ERROR simfsWriteFileAt(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, char *writeBuffer,
+                             size_t length);
 
-SIMFS_ERROR simfsWriteFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer);
+SIMFS_ERROR simfsTruncateFile(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t size);
 
-SIMFS_ERROR simfsReadFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer);
+SIMFS_ERROR simfsPunchHole(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, size_t length);
 
-SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle);
+SIMFS_ERROR simfsFallocate(SIMFS_MOUNT *mount, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, size_t length,
+                           unsigned int flags);
 
-SIMFS_ERROR simfsCreateFileSystem(char *simfsFileName);
-SIMFS_ERROR simfsUmountFileSystem(char *simfsFileName);
-SIMFS_ERROR simfsMountFileSystem(char *simfsFileName);
+SIMFS_ERROR simfsCreateFileSystem(char *simfsFileName, size_t numberOfBlocks);
+SIMFS_ERROR simfsUmountFileSystem(SIMFS_MOUNT *mount);
+SIMFS_ERROR simfsMountFileSystem(char *simfsFileName, SIMFS_MOUNT **mount);
+SIMFS_ERROR simfsMountFileSystemLazy(char *simfsFileName, SIMFS_MOUNT **mount);
+SIMFS_ERROR simfsGetMemoryUsage(SIMFS_MOUNT *mount, SIMFS_MEMORY_USAGE_TYPE *usage);
+size_t simfsDefragment(SIMFS_MOUNT *mount, size_t maxBlocks);
+SIMFS_ERROR simfsDefragmentStart(SIMFS_MOUNT *mount, unsigned int blocksPerSecond);
+SIMFS_ERROR simfsDefragmentStop(SIMFS_MOUNT *mount);
+SIMFS_ERROR simfsSetVerifyMode(SIMFS_MOUNT *mount, SIMFS_VERIFY_MODE mode);
+SIMFS_ERROR simfsSetFileCompression(SIMFS_MOUNT *mount, SIMFS_NAME_TYPE fileName, bool compress);
+SIMFS_ERROR simfsSetVolumeCompression(SIMFS_MOUNT *mount, bool compress);
+SIMFS_ERROR simfsEnableDeduplication(SIMFS_MOUNT *mount);
+SIMFS_ERROR simfsGetDedupStats(SIMFS_MOUNT *mount, SIMFS_DEDUP_STATS_TYPE *stats);
+SIMFS_ERROR simfsCreateSnapshot(SIMFS_MOUNT *mount, unsigned int *snapshot);
+SIMFS_ERROR simfsDeleteSnapshot(SIMFS_MOUNT *mount, unsigned int snapshot);
+SIMFS_ERROR simfsMountSnapshot(SIMFS_MOUNT *mount, unsigned int snapshot, SIMFS_MOUNT **snapshotMount);
+SIMFS_ERROR simfsResizeVolume(SIMFS_MOUNT *mount, size_t numberOfBlocks);
+bool simfsVolumeLayout(size_t numberOfBlocks, SIMFS_VOLUME_LAYOUT_TYPE *layout);
+SIMFS_VOLUME *simfsVolumeAlloc(size_t numberOfBlocks);
+SIMFS_VOLUME *simfsVolumeCopy(SIMFS_VOLUME *volume);
+SIMFS_ERROR simfsVolumeRead(FILE *file, SIMFS_VOLUME **volume);
+bool simfsVolumeWrite(FILE *file, SIMFS_VOLUME *volume);
+void simfsVolumeFree(SIMFS_VOLUME *volume);
 // ... other functions already in there
 unsigned long hash(unsigned char *str);
-void simfsFlipBit(unsigned char *bitvector, unsigned short bitIndex);
-void simfsSetBit(unsigned char *bitvector, unsigned short bitIndex);
-void simfsClearBit(unsigned char *bitvector, unsigned short bitIndex);
-unsigned short simfsFindFreeBlock(unsigned char *bitvector);
+void simfsFlipBit(unsigned char *bitvector, SIMFS_INDEX_TYPE bitIndex);
+void simfsSetBit(unsigned char *bitvector, SIMFS_INDEX_TYPE bitIndex);
+void simfsClearBit(unsigned char *bitvector, SIMFS_INDEX_TYPE bitIndex);
+SIMFS_INDEX_TYPE simfsFindFreeBlock(unsigned char *bitvector, size_t numberOfBlocks);
 
 
 //custom helper functions
-void hashFileSystem(SIMFS_BLOCK_TYPE currentBlock, size_t numberOfFiles);
-void addFileDescriptorToList(SIMFS_DIR_ENT *conflictResList, SIMFS_INDEX_TYPE descriptorIndex);
+SIMFS_ERROR hashFileSystem(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE folderIndex);
+SIMFS_ERROR addFileDescriptorToList(SIMFS_MOUNT *mount, SIMFS_INDEX_TYPE descriptorIndex);
 bool namesAreSame(char* name1, char* name2);
 
+//////////////////////////////////////////////////////////////////////////
+//
+// epoch-based reclamation (simfs_epoch.c)
+//
+// Lookups in the in-memory directory run inside simfsEpochEnter() / simfsEpochExit() and take no lock.
+// Anything a concurrent reader may still reference (directory entries, descriptor blocks) is retired
+// instead of freed, and reclaimed once all readers that could have seen it are gone.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef void (*SIMFS_RECLAIM_FUNCTION)(void *object, void *arg);
+
+void simfsEpochEnter(void);
+void simfsEpochExit(void);
+void simfsEpochRetire(void *object, SIMFS_RECLAIM_FUNCTION reclaim, void *arg);
+void simfsEpochSynchronize(void);
+
+//////////////////////////////////////////////////////////////////////////
+//
+// operation statistics (simfs_stats.c)
+//
+// Every public file system call records its latency in a per-thread histogram; block allocation, lookups, reads,
+// and writes add to per-thread counters. simfsGetStats() sums all threads of the process, over all mounts.
+// The same numbers can be read as text from the read-only file SIMFS_STATS_FILE_NAME of any mounted volume.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_STATS_FILE_NAME "/.simfs_stats"
+#define SIMFS_STATS_CHAIN_LENGTHS 16 // lookups that compared 0 .. 14 entries, and 15 or more
+
+typedef enum {
+    SIMFS_CREATE_OPERATION,
+    SIMFS_DELETE_OPERATION,
+    SIMFS_GET_FILE_INFO_OPERATION,
+    SIMFS_OPEN_OPERATION,
+    SIMFS_READ_OPERATION,
+    SIMFS_WRITE_OPERATION,
+    SIMFS_CLOSE_OPERATION,
+    SIMFS_MOUNT_OPERATION,
+    SIMFS_UMOUNT_OPERATION,
+    SIMFS_RENAME_OPERATION,
+    SIMFS_NUMBER_OF_OPERATIONS
+} SIMFS_OPERATION_TYPE;
+
+typedef enum {
+    SIMFS_BLOCKS_ALLOCATED_COUNTER,
+    SIMFS_BLOCKS_FREED_COUNTER,
+    SIMFS_BLOCKS_READ_COUNTER, // data blocks copied out by reads
+    SIMFS_BYTES_READ_COUNTER,
+    SIMFS_BYTES_WRITTEN_COUNTER,
+    SIMFS_CHECKSUM_ERRORS_COUNTER, // blocks whose checksum did not match on reading
+    SIMFS_BLOCKS_DEDUPLICATED_COUNTER, // data blocks that writes shared instead of allocating
+    SIMFS_BLOCKS_PRESERVED_COUNTER, // blocks copied before their first change after a snapshot
+    SIMFS_NUMBER_OF_COUNTERS
+} SIMFS_COUNTER_TYPE;
+
+typedef struct simfs_operation_stats_type {
+    unsigned long count; // calls, including failed ones
+    unsigned long errors; // calls that did not return SIMFS_NO_ERROR
+    double meanNanoseconds;
+    double p50Nanoseconds, p90Nanoseconds, p99Nanoseconds, p999Nanoseconds; // within 1/16 of the exact value
+    double maxNanoseconds;
+} SIMFS_OPERATION_STATS_TYPE;
+
+typedef struct simfs_stats_type {
+    SIMFS_OPERATION_STATS_TYPE operations[SIMFS_NUMBER_OF_OPERATIONS];
+    unsigned long counter[SIMFS_NUMBER_OF_COUNTERS];
+    unsigned long chainLength[SIMFS_STATS_CHAIN_LENGTHS]; // lookups by the number of directory entries compared
+} SIMFS_STATS_TYPE;
+
+SIMFS_ERROR simfsGetStats(SIMFS_STATS_TYPE *stats);
+char *simfsFormatStats(SIMFS_STATS_TYPE *stats);
+const char *simfsOperationName(SIMFS_OPERATION_TYPE operation);
+double simfsStatsNanosecondsPerTick(void);
+
+extern _Thread_local unsigned int simfsBlocksTouched; // blocks allocated, freed, or read by the current operation
+
+unsigned long simfsStatsTicks(void);
+unsigned long simfsStatsStart(void);
+void simfsStatsFinish(SIMFS_OPERATION_TYPE operation, unsigned long start, SIMFS_ERROR error);
+void simfsStatsCount(SIMFS_COUNTER_TYPE counter, unsigned long value);
+void simfsStatsChainLength(unsigned int length);
+
 /*
  * The following functions can be used to simulate FUSE context's user and process identifiers for testing.
  *
@@ -246,6 +629,184 @@ bool namesAreSame(char* name1, char* name2);
  */
 
 struct fuse_context *simfs_debug_get_context(); // follows FUSE naming convention
+void simfs_debug_set_context(pid_t pid, uid_t uid); // fixes the identifiers for the calling thread; pid 0 resets
 char *simfsGenerateContent(int size);
 
+//////////////////////////////////////////////////////////////////////////
+//
+// operation tracing (simfs_trace.c)
+//
+// While tracing is enabled, every public file system call appends an event to a ring buffer of the calling
+// thread; the oldest events are overwritten. simfsTraceDump() saves the events of all threads to a file that
+// simfs_tracedump converts to Chrome trace_event JSON or perf script text. With tracing disabled, a call pays
+// for one relaxed load of simfsTraceEnabled.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_TRACE_RING_SIZE 4096 // events per thread; a power of two
+#define SIMFS_TRACE_FILE_MAGIC "SIMFSTR1"
+
+//
+// an event as saved by simfsTraceDump(); the file is a header followed by numberOfEvents events
+//
+typedef struct simfs_trace_file_header_type {
+    char magic[8]; // SIMFS_TRACE_FILE_MAGIC
+    unsigned long numberOfEvents;
+} SIMFS_TRACE_FILE_HEADER_TYPE;
+
+typedef struct simfs_trace_file_event_type {
+    unsigned int thread; // number of the ring buffer, stable for the life of a thread
+    unsigned char operation; // SIMFS_OPERATION_TYPE
+    unsigned char error; // SIMFS_ERROR returned by the call
+    unsigned short reserved;
+    unsigned int blocksTouched;
+    unsigned long object; // hash of the name for calls that take a name, the file handle for the others
+    double startMicroseconds; // since the first traced event in the file
+    double durationMicroseconds;
+} SIMFS_TRACE_FILE_EVENT_TYPE;
+
+extern atomic_bool simfsTraceEnabled;
+
+#define simfsTraceOperation(operation, name, handle, start, error) do { \
+    if (atomic_load_explicit(&simfsTraceEnabled, memory_order_relaxed)) \
+        simfsTraceRecord(operation, name, handle, start, error); \
+} while (0)
+
+void simfsTraceEnable(bool enable);
+void simfsTraceRecord(SIMFS_OPERATION_TYPE operation, char *name, long handle, unsigned long start, SIMFS_ERROR error);
+SIMFS_ERROR simfsTraceDump(char *traceFileName);
+
+//////////////////////////////////////////////////////////////////////////
+//
+// block checksums (simfs_checksum.c)
+//
+// Every used block of a volume has a CRC32C checksum, updated whenever the file system changes the block, and
+// the superblock, the bitvector, and the snapshots have one that is written on unmounting. Mounting checks the superblock, the
+// bitvector, and the folders and descriptors it loads; reads check the blocks they copy out as set by
+// simfsSetVerifyMode(). A mismatch fails the call with SIMFS_READ_ERROR; simfs_fsck --repair recomputes the
+// checksums of what it keeps.
+//
+//////////////////////////////////////////////////////////////////////////
+
+unsigned int simfsCrc32c(unsigned int crc, const void *buffer, size_t length);
+bool simfsCrc32cIsAccelerated(void);
+unsigned int simfsBlockChecksum(SIMFS_BLOCK_TYPE *block);
+unsigned int simfsMapChecksum(SIMFS_VOLUME *volume);
+unsigned int simfsNewVolumeMapChecksum(SIMFS_SUPERBLOCK_TYPE *superblock, unsigned int generation,
+                                       SIMFS_BLOCK_LIFE_TYPE *life, size_t numberOfUsedBlocks);
+void simfsChecksumVolume(SIMFS_VOLUME *volume);
+
+//////////////////////////////////////////////////////////////////////////
+//
+// data compression (simfs_compress.c)
+//
+// Files with SIMFS_FILE_COMPRESSED have their content compressed on writing, extent by extent, with a fast
+// LZ77 codec; their data blocks are of the type COMPRESSED_CONTENT_TYPE and hold storedSize bytes of compressed
+// content. Reads copy the compressed content out and expand it after releasing directoryLock. Content that does
+// not get smaller is stored as it is in blocks of the type DATA_CONTENT_TYPE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_COMPRESSION_EXTENT_SIZE 4096 // bytes of content compressed independently; at most 65535
+
+size_t simfsCompress(const char *content, size_t size, char **stored);
+bool simfsDecompress(const char *stored, size_t storedSize, char *content, size_t size);
+
+//////////////////////////////////////////////////////////////////////////
+//
+// volume snapshots (simfs_snapshot.c)
+//
+// simfsCreateSnapshot() records the root folder and the generation of the live tree of a volume in constant time.
+// From then on, descriptors and folder index chains that the snapshot holds are copied before they change, and
+// blocks it holds are kept when the live tree lets go of them. simfsMountSnapshot() mounts the tree of a snapshot
+// read-only; the snapshots are saved with the volume.
+//
+//////////////////////////////////////////////////////////////////////////
+
+bool simfsSnapshotHolds(SIMFS_VOLUME *volume, unsigned int birth, unsigned int death);
+SIMFS_SNAPSHOT_TYPE *simfsSnapshotFind(SIMFS_VOLUME *volume, unsigned int generation);
+SIMFS_ERROR simfsSnapshotView(SIMFS_VOLUME *volume, unsigned int generation, SIMFS_VOLUME *view);
+
+//////////////////////////////////////////////////////////////////////////
+//
+// volume analysis (simfs_analysis.c)
+//
+// simfsAnalyzeVolume() walks the bitvector, the blocks, and the index chains of every file to measure how
+// fragmented a volume is. The block range is split among threads that scan their slices independently; runs of
+// free blocks that cross slice boundaries are joined when the partial results are merged. The scan takes no
+// locks, so the volume must not change while it runs.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_ANALYSIS_BUCKETS 13 // power-of-two buckets: 1, 2 - 3, 4 - 7, ..., 4096 or more
+#define SIMFS_ANALYSIS_MIN_BLOCKS_PER_THREAD 512 // slices smaller than this are not worth a thread
+
+typedef struct simfs_analysis_type {
+    size_t usedBlocks;
+    size_t freeBlocks;
+    size_t snapshotBlocks; // used blocks that are kept only for snapshots; the counts below cover the live tree
+    size_t numberOfSnapshots;
+    size_t blocksByType[INVALID_CONTENT_TYPE + 1]; // used blocks by type; INVALID_CONTENT_TYPE counts used but untyped
+    size_t numberOfFolders;
+    size_t numberOfFiles;
+    size_t numberOfEmptyFiles; // files without data blocks
+    size_t numberOfDataReferences; // data block references of all files; more than the data blocks if some are shared
+    size_t numberOfHoles; // index entries of sparse files without a data block
+    size_t numberOfFragmentedFiles; // files whose blocks form more than one extent (see simfsFileExtents())
+    size_t numberOfExtents; // extents of all files
+    size_t maxExtents; // extents of the most fragmented file
+    size_t extentsHistogram[SIMFS_ANALYSIS_BUCKETS]; // files with data blocks by their number of extents
+    size_t numberOfFreeRuns; // maximal runs of free blocks
+    size_t largestFreeRun;
+    size_t freeRunHistogram[SIMFS_ANALYSIS_BUCKETS]; // free runs by their length
+} SIMFS_ANALYSIS_TYPE;
+
+SIMFS_ERROR simfsAnalyzeVolume(SIMFS_VOLUME *volume, unsigned int numberOfThreads, SIMFS_ANALYSIS_TYPE *analysis);
+size_t simfsVolumeBlocks(SIMFS_VOLUME *volume);
+size_t simfsFileExtents(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE descriptorIndex);
+bool simfsFilePath(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE descriptorIndex, SIMFS_NAME_TYPE nameWithPath);
+size_t simfsFileHoles(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE descriptorIndex);
+unsigned int simfsAnalysisBucket(size_t value);
+unsigned int simfsScanThreads(unsigned int numberOfThreads, size_t numberOfBlocks);
+void simfsScanInParallel(void *slices, size_t sliceSize, unsigned int numberOfSlices, void *(*scan)(void *));
+
+//////////////////////////////////////////////////////////////////////////
+//
+// volume check and repair (simfs_check.c)
+//
+// simfsCheckVolume() counts the references to every block from the superblock, the index chains, and the folders,
+// in parallel like simfsAnalyzeVolume(), and compares the blocks reachable from the root folder with the stored
+// bitvector; the blocks kept for snapshots are accounted for by their lives, and every snapshot is checked through
+// its view. simfsRepairVolume() rebuilds a consistent volume from the root folder: files are truncated at their
+// first bad reference, bad entries are dropped from folders, snapshots that cannot be read are dropped, whatever is
+// not reachable or held any more is freed, and the bitvector is rewritten to match.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct simfs_check_type {
+    size_t badSuperblock; // 1 if the superblock does not describe a volume of this build or has no root folder
+    size_t orphanedBlocks; // used in the bitvector, but not reachable from the root folder
+    size_t unmarkedBlocks; // reachable from the root folder, but free in the bitvector
+    size_t doublyReferencedBlocks; // reachable through more than one reference
+    size_t outOfRangeReferences; // references past the last block of the volume
+    size_t invalidIndexReferences; // references equal to SIMFS_INVALID_INDEX where a block is expected
+    size_t wrongTypeReferences; // other references to a block of the wrong type, or to one kept only for snapshots
+    size_t wrongParents; // descriptors whose parent is not the folder that references them
+    size_t checksumMismatches; // used blocks, and the superblock with the bitvector, that fail their checksum
+    size_t badSnapshots; // snapshots whose view cannot be built or does not check clean
+} SIMFS_CHECK_TYPE;
+
+typedef struct simfs_repair_type {
+    size_t truncatedFiles; // files cut short at their first bad reference
+    size_t droppedEntries; // bad references removed from folders
+    size_t reparentedFiles; // descriptors pointed to the folder that references them
+    size_t freedBlocks; // used blocks that were not reachable any more
+    size_t markedBlocks; // reachable blocks that were free in the bitvector
+    size_t droppedSnapshots; // snapshots that could not be read
+} SIMFS_REPAIR_TYPE;
+
+SIMFS_ERROR simfsCheckVolume(SIMFS_VOLUME *volume, unsigned int numberOfThreads, SIMFS_CHECK_TYPE *check);
+bool simfsCheckIsClean(SIMFS_CHECK_TYPE *check);
+SIMFS_ERROR simfsRepairVolume(SIMFS_VOLUME *volume, SIMFS_REPAIR_TYPE *repair);
+
 #endif
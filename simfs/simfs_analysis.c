@@ -0,0 +1,311 @@
+#include "simfs.h"
+
+#include <unistd.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// volume analysis
+//
+// Every thread scans a contiguous slice of the blocks into its own SIMFS_ANALYSIS_TYPE. A free run that touches
+// either end of a slice may continue in the neighbouring slice, so it is not recorded by the thread; the thread
+// reports the lengths of its leading and trailing free runs instead, and the merge joins them in slice order.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct simfs_analysis_slice_type {
+    SIMFS_VOLUME *volume;
+    size_t firstBlock;
+    size_t lastBlock; // one past the last block of the slice
+    SIMFS_ANALYSIS_TYPE analysis; // everything but the free runs touching the ends of the slice
+    size_t leadingFreeRun; // free blocks at the start of the slice; the whole slice if it has no used block
+    size_t trailingFreeRun; // free blocks at the end of the slice, if it has a used block
+} SIMFS_ANALYSIS_SLICE_TYPE;
+
+static inline bool simfsAnalysisBlockIsUsed(SIMFS_VOLUME *volume, size_t block) {
+    return ((unsigned char) volume->bitvector[block / 8] & (0x80 >> (block % 8))) != 0;
+}
+
+/*
+ * Returns the histogram bucket of a value: floor(log2(value)), capped at the last bucket.
+ */
+unsigned int simfsAnalysisBucket(size_t value) {
+    unsigned int bucket = 0;
+    while (value > 1 && bucket < SIMFS_ANALYSIS_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void simfsAnalysisFreeRun(SIMFS_ANALYSIS_TYPE *analysis, size_t length) {
+    analysis->numberOfFreeRuns++;
+    analysis->freeRunHistogram[simfsAnalysisBucket(length)]++;
+    if (length > analysis->largestFreeRun)
+        analysis->largestFreeRun = length;
+}
+
+/*
+ * Returns the number of blocks of a volume, which the arrays of its image hold: a whole number of allocation groups
+ * up to SIMFS_MAX_NUMBER_OF_BLOCKS (see simfsVolumeLayout() and simfsResizeVolume()).
+ */
+size_t simfsVolumeBlocks(SIMFS_VOLUME *volume) {
+    return (size_t) volume->superblock.attr.numberOfBlocks;
+}
+
+/*
+ * Builds the name with the full path of the file with the descriptor in descriptorIndex from the names in the
+ * descriptors of its folders, following their parents up to the root.
+ *
+ * Returns false if the name does not fit in SIMFS_NAME_TYPE, which it may not after a folder on the path was
+ * renamed, or if a parent is not a folder in service, as in a damaged tree.
+ */
+bool simfsFilePath(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE descriptorIndex, SIMFS_NAME_TYPE nameWithPath) {
+    char path[SIMFS_MAX_NAME_LENGTH];
+    size_t start = SIMFS_MAX_NAME_LENGTH - 1; // the path is built from its end
+    path[start] = '\0';
+
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &volume->block[descriptorIndex].content.fileDescriptor;
+    while (descriptor->parent != SIMFS_INVALID_INDEX) {
+        size_t length = strnlen(descriptor->name, SIMFS_MAX_NAME_LENGTH);
+        if (length + 1 > start || descriptor->parent >= simfsVolumeBlocks(volume) ||
+            volume->block[descriptor->parent].type != FOLDER_CONTENT_TYPE)
+            return false;
+        start -= length;
+        memcpy(path + start, descriptor->name, length);
+        path[--start] = '/';
+        descriptor = &volume->block[descriptor->parent].content.fileDescriptor;
+    }
+    if (path[start] == '\0')
+        path[--start] = '/'; // the root itself
+
+    memcpy(nameWithPath, path + start, SIMFS_MAX_NAME_LENGTH - start);
+    return true;
+}
+
+/*
+ * Returns the number of extents - maximal runs of consecutive blocks - that the blocks of a file or a folder form in
+ * the order a read visits them: for a file every index block followed by the data blocks it references, for a
+ * folder its index blocks. Files without blocks have no extents, and holes do not end one.
+ *
+ * The walk stops at a reference outside of the volume, so a damaged chain is counted up to the damage.
+ */
+size_t simfsFileExtents(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE descriptorIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &volume->block[descriptorIndex].content.fileDescriptor;
+    bool isFile = descriptor->type == FILE_CONTENT_TYPE;
+    if ((!isFile && descriptor->type != FOLDER_CONTENT_TYPE) || (isFile && descriptor->storedSize == 0))
+        return 0;
+
+    size_t numberOfEntries = isFile ? SIMFS_DATA_BLOCKS(descriptor) : descriptor->size;
+    size_t numberOfIndexBlocks = numberOfEntries == 0 ? 1 :
+                                 (numberOfEntries + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK;
+    SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+    size_t numberOfBlocks = simfsVolumeBlocks(volume);
+    size_t extents = 0;
+    size_t previous = SIMFS_INVALID_INDEX;
+
+    for (size_t i = 0; i < numberOfIndexBlocks && indexBlock < numberOfBlocks; i++) {
+        extents += indexBlock != previous + 1;
+        previous = indexBlock;
+
+        SIMFS_INDEX_TYPE *index = volume->block[indexBlock].content.index;
+        for (size_t j = 0; isFile && j < SIMFS_INDEX_ENTRIES_PER_BLOCK &&
+                           i * SIMFS_INDEX_ENTRIES_PER_BLOCK + j < numberOfEntries; j++) {
+            if (index[j] == SIMFS_HOLE)
+                continue;
+            if (index[j] >= numberOfBlocks)
+                return extents;
+            extents += index[j] != previous + 1;
+            previous = index[j];
+        }
+        indexBlock = index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+    }
+
+    return extents;
+}
+
+/*
+ * Returns the number of index entries of a file that are holes; 0 for a folder or a file that is not sparse.
+ *
+ * The walk stops at a link outside of the volume, like simfsFileExtents().
+ */
+size_t simfsFileHoles(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE descriptorIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &volume->block[descriptorIndex].content.fileDescriptor;
+    if (descriptor->type != FILE_CONTENT_TYPE)
+        return 0;
+
+    size_t numberOfEntries = SIMFS_DATA_BLOCKS(descriptor);
+    SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+    size_t holes = 0;
+    for (size_t i = 0; i < numberOfEntries && indexBlock < simfsVolumeBlocks(volume); i++) {
+        holes += volume->block[indexBlock].content.index[i % SIMFS_INDEX_ENTRIES_PER_BLOCK] == SIMFS_HOLE;
+        if (i % SIMFS_INDEX_ENTRIES_PER_BLOCK == SIMFS_INDEX_ENTRIES_PER_BLOCK - 1)
+            indexBlock = volume->block[indexBlock].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+    }
+
+    return holes;
+}
+
+static void *simfsAnalyzeSlice(void *arg) {
+    SIMFS_ANALYSIS_SLICE_TYPE *slice = arg;
+    SIMFS_ANALYSIS_TYPE *analysis = &slice->analysis;
+    SIMFS_VOLUME *volume = slice->volume;
+    size_t freeRun = 0;
+    bool sawUsedBlock = false;
+
+    for (size_t block = slice->firstBlock; block < slice->lastBlock; block++) {
+        if (!simfsAnalysisBlockIsUsed(volume, block)) {
+            analysis->freeBlocks++;
+            freeRun++;
+            continue;
+        }
+
+        if (!sawUsedBlock)
+            slice->leadingFreeRun = freeRun;
+        else if (freeRun > 0)
+            simfsAnalysisFreeRun(analysis, freeRun);
+        sawUsedBlock = true;
+        freeRun = 0;
+
+        analysis->usedBlocks++;
+        if (!SIMFS_BLOCK_IS_LIVE(volume, block)) { // an older version that only snapshots hold
+            analysis->snapshotBlocks++;
+            continue;
+        }
+        SIMFS_CONTENT_TYPE type = volume->block[block].type;
+        if (type > INVALID_CONTENT_TYPE)
+            type = INVALID_CONTENT_TYPE;
+        analysis->blocksByType[type]++;
+
+        if (type == FOLDER_CONTENT_TYPE)
+            analysis->numberOfFolders++;
+        else if (type == FILE_CONTENT_TYPE) {
+            analysis->numberOfFiles++;
+            size_t holes = simfsFileHoles(volume, block);
+            analysis->numberOfHoles += holes;
+            analysis->numberOfDataReferences += SIMFS_DATA_BLOCKS(&volume->block[block].content.fileDescriptor) - holes;
+            size_t extents = simfsFileExtents(volume, block);
+            if (extents == 0) {
+                analysis->numberOfEmptyFiles++;
+                continue;
+            }
+            analysis->numberOfExtents += extents;
+            analysis->extentsHistogram[simfsAnalysisBucket(extents)]++;
+            if (extents > 1)
+                analysis->numberOfFragmentedFiles++;
+            if (extents > analysis->maxExtents)
+                analysis->maxExtents = extents;
+        }
+    }
+
+    if (sawUsedBlock)
+        slice->trailingFreeRun = freeRun;
+    else
+        slice->leadingFreeRun = freeRun;
+
+    return NULL;
+}
+
+/*
+ * Returns the number of threads a scan of numberOfBlocks blocks uses when numberOfThreads are asked for; 0 asks for
+ * one per online CPU. Every thread gets at least SIMFS_ANALYSIS_MIN_BLOCKS_PER_THREAD blocks.
+ */
+unsigned int simfsScanThreads(unsigned int numberOfThreads, size_t numberOfBlocks) {
+    if (numberOfThreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        numberOfThreads = cpus > 0 ? (unsigned int) cpus : 1;
+    }
+    if (numberOfThreads > numberOfBlocks / SIMFS_ANALYSIS_MIN_BLOCKS_PER_THREAD)
+        numberOfThreads = (unsigned int) (numberOfBlocks / SIMFS_ANALYSIS_MIN_BLOCKS_PER_THREAD);
+
+    return numberOfThreads > 0 ? numberOfThreads : 1;
+}
+
+/*
+ * Runs scan() on each of numberOfSlices slices of sliceSize bytes, one thread per slice. The calling thread takes
+ * the first slice, and any slice whose thread could not be started.
+ */
+void simfsScanInParallel(void *slices, size_t sliceSize, unsigned int numberOfSlices, void *(*scan)(void *)) {
+    pthread_t *threads = calloc(numberOfSlices, sizeof(pthread_t));
+    bool *started = calloc(numberOfSlices, sizeof(bool));
+
+    for (unsigned int i = 1; threads != NULL && started != NULL && i < numberOfSlices; i++)
+        started[i] = pthread_create(&threads[i], NULL, scan, (char *) slices + i * sliceSize) == 0;
+    scan(slices);
+    for (unsigned int i = 1; i < numberOfSlices; i++) {
+        if (started != NULL && started[i])
+            pthread_join(threads[i], NULL);
+        else
+            scan((char *) slices + i * sliceSize);
+    }
+
+    free(threads);
+    free(started);
+}
+
+/*
+ * Analyzes the allocation map and the files of a volume, using up to numberOfThreads threads; 0 uses one thread
+ * per online CPU. Only the blocks in service are counted.
+ *
+ * For a mounted volume, pass mount->volume and make sure that no operation runs on the mount during the call.
+ */
+SIMFS_ERROR simfsAnalyzeVolume(SIMFS_VOLUME *volume, unsigned int numberOfThreads, SIMFS_ANALYSIS_TYPE *analysis) {
+    if (volume == NULL || analysis == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    size_t numberOfBlocks = simfsVolumeBlocks(volume);
+    numberOfThreads = simfsScanThreads(numberOfThreads, numberOfBlocks);
+    SIMFS_ANALYSIS_SLICE_TYPE *slices = calloc(numberOfThreads, sizeof(SIMFS_ANALYSIS_SLICE_TYPE));
+    if (slices == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    for (unsigned int i = 0; i < numberOfThreads; i++) {
+        slices[i].volume = volume;
+        slices[i].firstBlock = numberOfBlocks * i / numberOfThreads;
+        slices[i].lastBlock = numberOfBlocks * (i + 1) / numberOfThreads;
+    }
+    simfsScanInParallel(slices, sizeof(SIMFS_ANALYSIS_SLICE_TYPE), numberOfThreads, simfsAnalyzeSlice);
+
+    memset(analysis, 0, sizeof(SIMFS_ANALYSIS_TYPE));
+    size_t openFreeRun = 0; // free run that reaches the end of the slices merged so far
+    for (unsigned int i = 0; i < numberOfThreads; i++) {
+        SIMFS_ANALYSIS_SLICE_TYPE *slice = &slices[i];
+        SIMFS_ANALYSIS_TYPE *part = &slice->analysis;
+
+        analysis->usedBlocks += part->usedBlocks;
+        analysis->freeBlocks += part->freeBlocks;
+        analysis->snapshotBlocks += part->snapshotBlocks;
+        for (int type = 0; type <= INVALID_CONTENT_TYPE; type++)
+            analysis->blocksByType[type] += part->blocksByType[type];
+        analysis->numberOfFolders += part->numberOfFolders;
+        analysis->numberOfFiles += part->numberOfFiles;
+        analysis->numberOfEmptyFiles += part->numberOfEmptyFiles;
+        analysis->numberOfFragmentedFiles += part->numberOfFragmentedFiles;
+        analysis->numberOfDataReferences += part->numberOfDataReferences;
+        analysis->numberOfHoles += part->numberOfHoles;
+        analysis->numberOfExtents += part->numberOfExtents;
+        if (part->maxExtents > analysis->maxExtents)
+            analysis->maxExtents = part->maxExtents;
+        analysis->numberOfFreeRuns += part->numberOfFreeRuns;
+        if (part->largestFreeRun > analysis->largestFreeRun)
+            analysis->largestFreeRun = part->largestFreeRun;
+        for (int bucket = 0; bucket < SIMFS_ANALYSIS_BUCKETS; bucket++) {
+            analysis->extentsHistogram[bucket] += part->extentsHistogram[bucket];
+            analysis->freeRunHistogram[bucket] += part->freeRunHistogram[bucket];
+        }
+
+        if (part->usedBlocks == 0) { // the whole slice is free
+            openFreeRun += slice->leadingFreeRun;
+            continue;
+        }
+        if (openFreeRun + slice->leadingFreeRun > 0)
+            simfsAnalysisFreeRun(analysis, openFreeRun + slice->leadingFreeRun);
+        openFreeRun = slice->trailingFreeRun;
+    }
+    if (openFreeRun > 0)
+        simfsAnalysisFreeRun(analysis, openFreeRun);
+    for (size_t i = 0; i < SIMFS_MAX_SNAPSHOTS; i++)
+        analysis->numberOfSnapshots += volume->snapshot[i].generation != 0;
+
+    free(slices);
+    return SIMFS_NO_ERROR;
+}
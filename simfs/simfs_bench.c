@@ -0,0 +1,655 @@
+#include "simfs.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+//
+// micro-benchmarks for the core primitives and the file system calls
+//
+// Every benchmark runs a number of warmup samples that are thrown away, followed by the measured samples. A
+// sample times a batch of operations and records the mean time per operation in the batch, so that cheap
+// primitives are not dominated by the cost of reading the clock. The report lists the mean, the minimum,
+// percentiles and the maximum of the samples in nanoseconds per operation.
+//
+// usage: simfs_bench [--json] [--samples N] [--warmup N]
+//
+// --json prints the results as a JSON document instead of a table, for comparing runs
+//
+
+#define SIMFS_BENCH_FILE_NAME "simfsBench.dta"
+#define SIMFS_BENCH_NUMBER_OF_FILES 1000
+#define SIMFS_BENCH_NUMBER_OF_CHURN_FILES 16
+#define SIMFS_BENCH_BATCH_SIZE 100 // operations per sample for the file system calls
+#define SIMFS_BENCH_PRIMITIVE_BATCH_SIZE 10000 // operations per sample for hash and the bit functions
+#define SIMFS_BENCH_SECONDS 0.5 // duration of each concurrent lookup run
+#define SIMFS_BENCH_CHECKOUT_SIZE 1000 // files in one folder for the per-call against batch comparison
+#define SIMFS_BENCH_LISTING_BATCH_SIZE 16 // children per simfsReadDir call when the checkout folder is listed
+#define SIMFS_BENCH_READ_SIZE 4000 // bytes in the file that the read benches read
+#define SIMFS_BENCH_WRITE_SIZE 1000 // bytes each concurrent writer writes to its own file per call
+#define SIMFS_BENCH_MAX_RESULTS 32
+#define SIMFS_BENCH_MAX_THROUGHPUTS 4
+
+typedef struct simfs_bench_result_type {
+    char name[48];
+    int batchSize;
+    double mean, min, p50, p90, p99, max; // nanoseconds per operation
+} SIMFS_BENCH_RESULT_TYPE;
+
+typedef struct simfs_bench_throughput_type {
+    int numberOfReaders;
+    double lookupsPerSecond;
+    double updatesPerSecond;
+} SIMFS_BENCH_THROUGHPUT_TYPE;
+
+typedef struct simfs_bench_write_throughput_type {
+    int numberOfWriters;
+    double writesPerSecond;
+} SIMFS_BENCH_WRITE_THROUGHPUT_TYPE;
+
+//
+// setup and teardown are not timed and run around every sample; operation runs batchSize times per sample
+//
+typedef struct simfs_bench_type {
+    const char *name;
+    int batchSize;
+    void (*setup)(void);
+    void (*operation)(int i);
+    void (*teardown)(void);
+    int filesPerOperation; // an operation on many files counts as one operation per file; 0 for a single file
+} SIMFS_BENCH_TYPE;
+
+static int benchNumberOfSamples = 50;
+static int benchNumberOfWarmups = 5;
+
+static SIMFS_BENCH_RESULT_TYPE benchResults[SIMFS_BENCH_MAX_RESULTS];
+static int benchNumberOfResults = 0;
+static SIMFS_BENCH_THROUGHPUT_TYPE benchThroughputs[SIMFS_BENCH_MAX_THROUGHPUTS];
+static int benchNumberOfThroughputs = 0;
+static SIMFS_BENCH_WRITE_THROUGHPUT_TYPE benchWriteThroughputs[SIMFS_BENCH_MAX_THROUGHPUTS];
+static int benchNumberOfWriteThroughputs = 0;
+
+static atomic_bool benchRunning;
+static SIMFS_MOUNT *benchMount;
+static unsigned char benchBitvector[SIMFS_DEFAULT_NUMBER_OF_BLOCKS / 8];
+static double benchFillLevel;
+static SIMFS_NAME_TYPE benchNames[SIMFS_BENCH_BATCH_SIZE];
+static char *benchCheckoutNames[SIMFS_BENCH_CHECKOUT_SIZE];
+static SIMFS_FILE_HANDLE_TYPE benchCheckoutHandle;
+static SIMFS_FILE_HANDLE_TYPE benchReadHandle;
+static char *benchWriteContent;
+static volatile unsigned long benchSink; // keeps the compiler from dropping the measured work
+
+static double benchNow(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void benchFail(const char *what) {
+    fprintf(stderr, "simfs_bench: %s failed\n", what);
+    exit(EXIT_FAILURE);
+}
+
+static int benchCompareSamples(const void *a, const void *b) {
+    double difference = *(const double *) a - *(const double *) b;
+    return (difference > 0) - (difference < 0);
+}
+
+static double benchPercentile(double *sortedSamples, double percentile) {
+    return sortedSamples[(int) (percentile / 100.0 * (benchNumberOfSamples - 1) + 0.5)];
+}
+
+static void benchRun(SIMFS_BENCH_TYPE *bench) {
+    int numberOfOperations = bench->batchSize * (bench->filesPerOperation > 0 ? bench->filesPerOperation : 1);
+    double *samples = malloc(benchNumberOfSamples * sizeof(double));
+    if (samples == NULL)
+        benchFail("malloc");
+
+    for (int sample = -benchNumberOfWarmups; sample < benchNumberOfSamples; sample++) {
+        if (bench->setup != NULL)
+            bench->setup();
+
+        double start = benchNow();
+        for (int i = 0; i < bench->batchSize; i++)
+            bench->operation(i);
+        double elapsed = benchNow() - start;
+
+        if (bench->teardown != NULL)
+            bench->teardown();
+        if (sample >= 0)
+            samples[sample] = elapsed * 1e9 / numberOfOperations;
+    }
+
+    qsort(samples, benchNumberOfSamples, sizeof(double), benchCompareSamples);
+
+    SIMFS_BENCH_RESULT_TYPE *result = &benchResults[benchNumberOfResults++];
+    snprintf(result->name, sizeof(result->name), "%s", bench->name);
+    result->batchSize = numberOfOperations;
+    result->mean = 0;
+    for (int i = 0; i < benchNumberOfSamples; i++)
+        result->mean += samples[i] / benchNumberOfSamples;
+    result->min = samples[0];
+    result->p50 = benchPercentile(samples, 50);
+    result->p90 = benchPercentile(samples, 90);
+    result->p99 = benchPercentile(samples, 99);
+    result->max = samples[benchNumberOfSamples - 1];
+
+    free(samples);
+}
+
+//
+// primitives
+//
+
+static void benchHash(int i) {
+    benchSink += hash((unsigned char *) benchNames[i % SIMFS_BENCH_BATCH_SIZE]);
+}
+
+//
+// the first benchFillLevel of the blocks are taken, which is what the first-fit search sees on an aged volume
+//
+static void benchFillBitvector(void) {
+    memset(benchBitvector, 0, sizeof(benchBitvector));
+    int usedBlocks = (int) (benchFillLevel * (SIMFS_DEFAULT_NUMBER_OF_BLOCKS - 1));
+    for (int i = 0; i < usedBlocks; i++)
+        simfsSetBit(benchBitvector, (SIMFS_INDEX_TYPE) i);
+}
+
+static void benchFindFreeBlock(int i) {
+    benchSink += simfsFindFreeBlock(benchBitvector, SIMFS_DEFAULT_NUMBER_OF_BLOCKS);
+}
+
+static void benchFlipBit(int i) {
+    simfsFlipBit(benchBitvector, (SIMFS_INDEX_TYPE) (i % SIMFS_DEFAULT_NUMBER_OF_BLOCKS));
+}
+
+static void benchSetBit(int i) {
+    simfsSetBit(benchBitvector, (SIMFS_INDEX_TYPE) (i % SIMFS_DEFAULT_NUMBER_OF_BLOCKS));
+}
+
+static void benchClearBit(int i) {
+    simfsClearBit(benchBitvector, (SIMFS_INDEX_TYPE) (i % SIMFS_DEFAULT_NUMBER_OF_BLOCKS));
+}
+
+//
+// file system calls
+//
+
+static void benchCreate(int i) {
+    if (simfsCreateFile(benchMount, benchNames[i], FILE_CONTENT_TYPE) != SIMFS_NO_ERROR)
+        benchFail("simfsCreateFile");
+}
+
+static void benchDelete(int i) {
+    if (simfsDeleteFile(benchMount, benchNames[i]) != SIMFS_NO_ERROR)
+        benchFail("simfsDeleteFile");
+}
+
+static void benchCreateBatch(void) {
+    for (int i = 0; i < SIMFS_BENCH_BATCH_SIZE; i++)
+        benchCreate(i);
+}
+
+static void benchDeleteBatch(void) {
+    for (int i = 0; i < SIMFS_BENCH_BATCH_SIZE; i++)
+        benchDelete(i);
+    simfsEpochSynchronize(); // the blocks of the deleted files are free again before the next sample
+}
+
+static void benchCheckoutCreate(int i) {
+    if (simfsCreateFile(benchMount, benchCheckoutNames[i], FILE_CONTENT_TYPE) != SIMFS_NO_ERROR)
+        benchFail("simfsCreateFile");
+}
+
+static void benchCheckoutDelete(int i) {
+    if (simfsDeleteFile(benchMount, benchCheckoutNames[i]) != SIMFS_NO_ERROR)
+        benchFail("simfsDeleteFile");
+}
+
+static void benchCheckoutCreateFiles(int i) {
+    if (simfsCreateFiles(benchMount, benchCheckoutNames, SIMFS_BENCH_CHECKOUT_SIZE, FILE_CONTENT_TYPE, NULL) !=
+        SIMFS_NO_ERROR)
+        benchFail("simfsCreateFiles");
+}
+
+static void benchCheckoutDeleteFiles(int i) {
+    if (simfsDeleteFiles(benchMount, benchCheckoutNames, SIMFS_BENCH_CHECKOUT_SIZE, NULL) != SIMFS_NO_ERROR)
+        benchFail("simfsDeleteFiles");
+}
+
+static void benchCheckoutSetup(void) {
+    benchCheckoutCreateFiles(0);
+}
+
+static void benchCheckoutTeardown(void) {
+    benchCheckoutDeleteFiles(0);
+    simfsEpochSynchronize();
+}
+
+static void benchCheckoutList(int i) {
+    SIMFS_FOLDER_ENTRY_TYPE entries[SIMFS_BENCH_LISTING_BATCH_SIZE];
+    SIMFS_DIR_COOKIE_TYPE cookie = SIMFS_DIR_COOKIE_START;
+    size_t numberOfEntries, listed = 0;
+
+    do {
+        if (simfsReadDir(benchMount, benchCheckoutHandle, &cookie, entries, SIMFS_BENCH_LISTING_BATCH_SIZE,
+                         &numberOfEntries) != SIMFS_NO_ERROR)
+            benchFail("simfsReadDir");
+        listed += numberOfEntries;
+    } while (numberOfEntries == SIMFS_BENCH_LISTING_BATCH_SIZE);
+    if (listed != SIMFS_BENCH_CHECKOUT_SIZE)
+        benchFail("simfsReadDir");
+}
+
+static void benchLookup(int i) {
+    SIMFS_NAME_TYPE name;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+
+    snprintf(name, sizeof(name), "/bench%04d", (i * 7919) % SIMFS_BENCH_NUMBER_OF_FILES);
+    if (simfsGetFileInfo(benchMount, name, &info) != SIMFS_NO_ERROR)
+        benchFail("simfsGetFileInfo");
+}
+
+static void benchRead(int i) {
+    char *content = NULL;
+
+    if (simfsReadFile(benchMount, benchReadHandle, &content) != SIMFS_NO_ERROR)
+        benchFail("simfsReadFile");
+    benchSink += content[0];
+    free(content);
+}
+
+static void benchVerifyAlways(void) {
+    simfsSetVerifyMode(benchMount, SIMFS_VERIFY_ALWAYS);
+}
+
+static void benchVerifyOnce(void) {
+    simfsSetVerifyMode(benchMount, SIMFS_VERIFY_ONCE);
+}
+
+static void benchVerifyNever(void) {
+    simfsSetVerifyMode(benchMount, SIMFS_VERIFY_NEVER);
+}
+
+static void benchMountVolume(int i) {
+    if (simfsMountFileSystem(SIMFS_BENCH_FILE_NAME, &benchMount) != SIMFS_NO_ERROR)
+        benchFail("simfsMountFileSystem");
+}
+
+static void benchUnmountVolume(int i) {
+    if (simfsUmountFileSystem(benchMount) != SIMFS_NO_ERROR)
+        benchFail("simfsUmountFileSystem");
+}
+
+static void benchMountBeforeSample(void) {
+    benchMountVolume(0);
+}
+
+static void benchUnmountAfterSample(void) {
+    benchUnmountVolume(0);
+}
+
+//
+// lookup throughput with a concurrent writer
+//
+// readers call simfsGetFileInfo on random existing names while one writer keeps creating and deleting other
+// files in the same folder
+//
+
+static void *benchLookupThread(void *arg) {
+    unsigned long *lookups = arg;
+    unsigned int seed = (unsigned int) (uintptr_t) arg;
+    SIMFS_NAME_TYPE name;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+
+    while (atomic_load_explicit(&benchRunning, memory_order_relaxed)) {
+        snprintf(name, sizeof(name), "/bench%04d", rand_r(&seed) % SIMFS_BENCH_NUMBER_OF_FILES);
+        if (simfsGetFileInfo(benchMount, name, &info) != SIMFS_NO_ERROR) {
+            fprintf(stderr, "lookup of %s failed\n", name);
+            exit(EXIT_FAILURE);
+        }
+        (*lookups)++;
+    }
+
+    return NULL;
+}
+
+static void *benchWriterThread(void *arg) {
+    unsigned long *updates = arg;
+    SIMFS_NAME_TYPE name;
+
+    for (int i = 0; atomic_load_explicit(&benchRunning, memory_order_relaxed); i++) {
+        snprintf(name, sizeof(name), "/churn%02d", i % SIMFS_BENCH_NUMBER_OF_CHURN_FILES);
+        if (simfsCreateFile(benchMount, name, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR)
+            (*updates)++;
+        snprintf(name, sizeof(name), "/churn%02d", (i + SIMFS_BENCH_NUMBER_OF_CHURN_FILES / 2) %
+                                                   SIMFS_BENCH_NUMBER_OF_CHURN_FILES);
+        if (simfsDeleteFile(benchMount, name) == SIMFS_NO_ERROR)
+            (*updates)++;
+    }
+
+    return NULL;
+}
+
+static void benchLookups(int numberOfReaders) {
+    pthread_t readers[numberOfReaders];
+    unsigned long lookups[numberOfReaders][8]; // one cache line per reader
+    pthread_t writer;
+    unsigned long updates = 0;
+
+    atomic_store(&benchRunning, true);
+    for (int i = 0; i < numberOfReaders; i++) {
+        lookups[i][0] = 0;
+        pthread_create(&readers[i], NULL, benchLookupThread, lookups[i]);
+    }
+    pthread_create(&writer, NULL, benchWriterThread, &updates);
+
+    double start = benchNow();
+    struct timespec duration = {(time_t) SIMFS_BENCH_SECONDS,
+                                (long) ((SIMFS_BENCH_SECONDS - (time_t) SIMFS_BENCH_SECONDS) * 1e9)};
+    nanosleep(&duration, NULL);
+    atomic_store(&benchRunning, false);
+
+    unsigned long totalLookups = 0;
+    for (int i = 0; i < numberOfReaders; i++) {
+        pthread_join(readers[i], NULL);
+        totalLookups += lookups[i][0];
+    }
+    pthread_join(writer, NULL);
+    double elapsed = benchNow() - start;
+
+    SIMFS_BENCH_THROUGHPUT_TYPE *throughput = &benchThroughputs[benchNumberOfThroughputs++];
+    throughput->numberOfReaders = numberOfReaders;
+    throughput->lookupsPerSecond = totalLookups / elapsed;
+    throughput->updatesPerSecond = updates / elapsed;
+}
+
+//
+// write throughput
+//
+// every writer rewrites a file of its own with SIMFS_BENCH_WRITE_SIZE bytes as a process of its own; the writes
+// take their blocks from the allocation groups before directoryLock and only link them under it
+//
+
+static void *benchFileWriterThread(void *arg) {
+    unsigned long *writes = arg;
+    int writer = (int) writes[1];
+    SIMFS_NAME_TYPE name;
+    SIMFS_FILE_HANDLE_TYPE handle;
+
+    snprintf(name, sizeof(name), "/write%02d", writer);
+    simfs_debug_set_context(2 + writer, 1);
+    if (simfsOpenFile(benchMount, name, &handle) != SIMFS_NO_ERROR)
+        benchFail("simfsOpenFile");
+    while (atomic_load_explicit(&benchRunning, memory_order_relaxed)) {
+        if (simfsWriteFile(benchMount, handle, benchWriteContent) != SIMFS_NO_ERROR) {
+            fprintf(stderr, "write of %s failed\n", name);
+            exit(EXIT_FAILURE);
+        }
+        (*writes)++;
+    }
+    if (simfsCloseFile(benchMount, handle) != SIMFS_NO_ERROR)
+        benchFail("simfsCloseFile");
+
+    return NULL;
+}
+
+static void benchWrites(int numberOfWriters) {
+    pthread_t writers[numberOfWriters];
+    unsigned long writes[numberOfWriters][8]; // one cache line per writer
+
+    atomic_store(&benchRunning, true);
+    for (int i = 0; i < numberOfWriters; i++) {
+        writes[i][0] = 0;
+        writes[i][1] = i;
+        pthread_create(&writers[i], NULL, benchFileWriterThread, writes[i]);
+    }
+
+    double start = benchNow();
+    struct timespec duration = {(time_t) SIMFS_BENCH_SECONDS,
+                                (long) ((SIMFS_BENCH_SECONDS - (time_t) SIMFS_BENCH_SECONDS) * 1e9)};
+    nanosleep(&duration, NULL);
+    atomic_store(&benchRunning, false);
+
+    unsigned long totalWrites = 0;
+    for (int i = 0; i < numberOfWriters; i++) {
+        pthread_join(writers[i], NULL);
+        totalWrites += writes[i][0];
+    }
+    double elapsed = benchNow() - start;
+
+    SIMFS_BENCH_WRITE_THROUGHPUT_TYPE *throughput = &benchWriteThroughputs[benchNumberOfWriteThroughputs++];
+    throughput->numberOfWriters = numberOfWriters;
+    throughput->writesPerSecond = totalWrites / elapsed;
+}
+
+//
+// reports
+//
+
+static void benchPrintTable(void) {
+    printf("%-28s %6s %10s %10s %10s %10s %10s %10s\n", "benchmark (ns/op)", "batch", "mean", "min", "p50", "p90",
+           "p99", "max");
+    for (int i = 0; i < benchNumberOfResults; i++) {
+        SIMFS_BENCH_RESULT_TYPE *result = &benchResults[i];
+        printf("%-28s %6d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", result->name, result->batchSize,
+               result->mean, result->min, result->p50, result->p90, result->p99, result->max);
+    }
+
+    for (int i = 0; i < benchNumberOfThroughputs; i++) {
+        SIMFS_BENCH_THROUGHPUT_TYPE *throughput = &benchThroughputs[i];
+        printf("lookup: %2d readers + 1 writer: %12.0f lookups/s (%8.0f lookups/s per reader), %8.0f updates/s\n",
+               throughput->numberOfReaders, throughput->lookupsPerSecond,
+               throughput->lookupsPerSecond / throughput->numberOfReaders, throughput->updatesPerSecond);
+    }
+
+    for (int i = 0; i < benchNumberOfWriteThroughputs; i++) {
+        SIMFS_BENCH_WRITE_THROUGHPUT_TYPE *throughput = &benchWriteThroughputs[i];
+        printf("write: %2d writers: %12.0f writes/s (%8.0f writes/s per writer)\n", throughput->numberOfWriters,
+               throughput->writesPerSecond, throughput->writesPerSecond / throughput->numberOfWriters);
+    }
+}
+
+static void benchPrintJson(void) {
+    printf("{\n  \"samples\": %d,\n  \"warmup\": %d,\n  \"benchmarks\": [\n", benchNumberOfSamples,
+           benchNumberOfWarmups);
+    for (int i = 0; i < benchNumberOfResults; i++) {
+        SIMFS_BENCH_RESULT_TYPE *result = &benchResults[i];
+        printf("    {\"name\": \"%s\", \"unit\": \"ns/op\", \"batch\": %d, \"mean\": %.2f, \"min\": %.2f, "
+               "\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f}%s\n", result->name, result->batchSize,
+               result->mean, result->min, result->p50, result->p90, result->p99, result->max,
+               i + 1 < benchNumberOfResults ? "," : "");
+    }
+    printf("  ],\n  \"concurrent_lookups\": [\n");
+    for (int i = 0; i < benchNumberOfThroughputs; i++) {
+        SIMFS_BENCH_THROUGHPUT_TYPE *throughput = &benchThroughputs[i];
+        printf("    {\"readers\": %d, \"lookups_per_second\": %.0f, \"updates_per_second\": %.0f}%s\n",
+               throughput->numberOfReaders, throughput->lookupsPerSecond, throughput->updatesPerSecond,
+               i + 1 < benchNumberOfThroughputs ? "," : "");
+    }
+    printf("  ],\n  \"concurrent_writes\": [\n");
+    for (int i = 0; i < benchNumberOfWriteThroughputs; i++) {
+        SIMFS_BENCH_WRITE_THROUGHPUT_TYPE *throughput = &benchWriteThroughputs[i];
+        printf("    {\"writers\": %d, \"writes_per_second\": %.0f}%s\n", throughput->numberOfWriters,
+               throughput->writesPerSecond, i + 1 < benchNumberOfWriteThroughputs ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    SIMFS_NAME_TYPE name;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+            benchNumberOfSamples = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            benchNumberOfWarmups = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [--json] [--samples N] [--warmup N]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (benchNumberOfSamples < 1 || benchNumberOfWarmups < 0) {
+        fprintf(stderr, "%s: need at least one sample and no negative warmup\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    srand(1); // the same random identities and contents in every run
+
+    for (int i = 0; i < SIMFS_BENCH_BATCH_SIZE; i++)
+        snprintf(benchNames[i], sizeof(benchNames[i]), "/batch%03d", i);
+
+    SIMFS_BENCH_TYPE hashBench = {"hash", SIMFS_BENCH_PRIMITIVE_BATCH_SIZE, NULL, benchHash, NULL};
+    benchRun(&hashBench);
+
+    double fillLevels[] = {0.0, 0.5, 0.9, 0.99};
+    for (int i = 0; i < sizeof(fillLevels) / sizeof(fillLevels[0]); i++) {
+        char benchName[48];
+        snprintf(benchName, sizeof(benchName), "simfsFindFreeBlock/%d%%", (int) (fillLevels[i] * 100));
+        benchFillLevel = fillLevels[i];
+        SIMFS_BENCH_TYPE findBench = {benchName, SIMFS_BENCH_PRIMITIVE_BATCH_SIZE, benchFillBitvector,
+                                      benchFindFreeBlock, NULL};
+        benchRun(&findBench);
+    }
+
+    SIMFS_BENCH_TYPE bitBenches[] = {
+            {"simfsFlipBit",  SIMFS_BENCH_PRIMITIVE_BATCH_SIZE, NULL, benchFlipBit,  NULL},
+            {"simfsSetBit",   SIMFS_BENCH_PRIMITIVE_BATCH_SIZE, NULL, benchSetBit,   NULL},
+            {"simfsClearBit", SIMFS_BENCH_PRIMITIVE_BATCH_SIZE, NULL, benchClearBit, NULL},
+    };
+    for (int i = 0; i < sizeof(bitBenches) / sizeof(bitBenches[0]); i++)
+        benchRun(&bitBenches[i]);
+
+    if (simfsCreateFileSystem(SIMFS_BENCH_FILE_NAME, SIMFS_DEFAULT_NUMBER_OF_BLOCKS) != SIMFS_NO_ERROR)
+        benchFail("simfsCreateFileSystem");
+    benchMountVolume(0);
+    for (int i = 0; i < SIMFS_BENCH_NUMBER_OF_FILES; i++) {
+        snprintf(name, sizeof(name), "/bench%04d", i);
+        if (simfsCreateFile(benchMount, name, FILE_CONTENT_TYPE) != SIMFS_NO_ERROR)
+            benchFail("simfsCreateFile");
+    }
+
+    SIMFS_BENCH_TYPE callBenches[] = {
+            {"simfsCreateFile",  SIMFS_BENCH_BATCH_SIZE, NULL,             benchCreate, benchDeleteBatch},
+            {"simfsDeleteFile",  SIMFS_BENCH_BATCH_SIZE, benchCreateBatch, benchDelete, simfsEpochSynchronize},
+            {"simfsGetFileInfo", SIMFS_BENCH_BATCH_SIZE, NULL,             benchLookup, NULL},
+    };
+    for (int i = 0; i < sizeof(callBenches) / sizeof(callBenches[0]); i++)
+        benchRun(&callBenches[i]);
+
+    // one file of SIMFS_BENCH_READ_SIZE bytes is read whole in each verify mode; in SIMFS_VERIFY_ONCE its blocks
+    // were verified when they were written
+
+    SIMFS_NAME_TYPE readName = "/read";
+    simfs_debug_set_context(1, 1);
+    char *readContent = simfsGenerateContent(SIMFS_BENCH_READ_SIZE);
+    if (readContent == NULL || simfsCreateFile(benchMount, readName, FILE_CONTENT_TYPE) != SIMFS_NO_ERROR ||
+        simfsOpenFile(benchMount, readName, &benchReadHandle) != SIMFS_NO_ERROR ||
+        simfsWriteFile(benchMount, benchReadHandle, readContent) != SIMFS_NO_ERROR)
+        benchFail("simfsWriteFile");
+    free(readContent);
+
+    SIMFS_BENCH_TYPE readBenches[] = {
+            {"simfsReadFile/always", SIMFS_BENCH_BATCH_SIZE, benchVerifyAlways, benchRead, NULL},
+            {"simfsReadFile/once",   SIMFS_BENCH_BATCH_SIZE, benchVerifyOnce,   benchRead, NULL},
+            {"simfsReadFile/never",  SIMFS_BENCH_BATCH_SIZE, benchVerifyNever,  benchRead, NULL},
+    };
+    for (int i = 0; i < sizeof(readBenches) / sizeof(readBenches[0]); i++)
+        benchRun(&readBenches[i]);
+    benchVerifyOnce();
+
+    if (simfsCloseFile(benchMount, benchReadHandle) != SIMFS_NO_ERROR ||
+        simfsDeleteFile(benchMount, readName) != SIMFS_NO_ERROR)
+        benchFail("simfsDeleteFile");
+    simfs_debug_set_context(0, 0);
+
+    // SIMFS_BENCH_CHECKOUT_SIZE files are created in and deleted from an empty folder, one call per file against
+    // one call for all of them
+
+    SIMFS_NAME_TYPE checkoutName = "/checkout";
+    simfs_debug_set_context(1, 1);
+    if (simfsCreateFile(benchMount, checkoutName, FOLDER_CONTENT_TYPE) != SIMFS_NO_ERROR)
+        benchFail("simfsCreateFile");
+    for (int i = 0; i < SIMFS_BENCH_CHECKOUT_SIZE; i++) {
+        snprintf(name, sizeof(name), "/checkout/file%04d", i);
+        if ((benchCheckoutNames[i] = strdup(name)) == NULL)
+            benchFail("strdup");
+    }
+
+    SIMFS_BENCH_TYPE checkoutBenches[] = {
+            {"simfsCreateFile/checkout",  SIMFS_BENCH_CHECKOUT_SIZE, NULL, benchCheckoutCreate, benchCheckoutTeardown},
+            {"simfsCreateFiles/checkout", 1, NULL, benchCheckoutCreateFiles, benchCheckoutTeardown,
+             SIMFS_BENCH_CHECKOUT_SIZE},
+            {"simfsDeleteFile/checkout",  SIMFS_BENCH_CHECKOUT_SIZE, benchCheckoutSetup, benchCheckoutDelete,
+             simfsEpochSynchronize},
+            {"simfsDeleteFiles/checkout", 1, benchCheckoutSetup, benchCheckoutDeleteFiles, simfsEpochSynchronize,
+             SIMFS_BENCH_CHECKOUT_SIZE},
+    };
+    for (int i = 0; i < sizeof(checkoutBenches) / sizeof(checkoutBenches[0]); i++)
+        benchRun(&checkoutBenches[i]);
+
+    // the same folder is listed whole in batches of SIMFS_BENCH_LISTING_BATCH_SIZE, in ns per child
+
+    benchCheckoutSetup();
+    if (simfsOpenFile(benchMount, checkoutName, &benchCheckoutHandle) != SIMFS_NO_ERROR)
+        benchFail("simfsOpenFile");
+    SIMFS_BENCH_TYPE listBench = {"simfsReadDir/checkout", 1, NULL, benchCheckoutList, NULL,
+                                  SIMFS_BENCH_CHECKOUT_SIZE};
+    benchRun(&listBench);
+    if (simfsCloseFile(benchMount, benchCheckoutHandle) != SIMFS_NO_ERROR)
+        benchFail("simfsCloseFile");
+    benchCheckoutTeardown();
+
+    for (int i = 0; i < SIMFS_BENCH_CHECKOUT_SIZE; i++)
+        free(benchCheckoutNames[i]);
+    if (simfsDeleteFile(benchMount, checkoutName) != SIMFS_NO_ERROR)
+        benchFail("simfsDeleteFile");
+    simfs_debug_set_context(0, 0);
+
+    benchLookups(1);
+    benchLookups(8);
+    benchLookups(32);
+
+    // each writer has a file of its own, which every process may write
+
+    simfs_debug_set_context(1, 1);
+    int writerCounts[] = {1, 2, 4, 8};
+    int maxWriters = writerCounts[sizeof(writerCounts) / sizeof(writerCounts[0]) - 1];
+    if ((benchWriteContent = simfsGenerateContent(SIMFS_BENCH_WRITE_SIZE)) == NULL)
+        benchFail("simfsGenerateContent");
+    for (int i = 0; i < maxWriters; i++) {
+        snprintf(name, sizeof(name), "/write%02d", i);
+        if (simfsCreateFile(benchMount, name, FILE_CONTENT_TYPE) != SIMFS_NO_ERROR)
+            benchFail("simfsCreateFile");
+    }
+    for (int i = 0; i < sizeof(writerCounts) / sizeof(writerCounts[0]); i++)
+        benchWrites(writerCounts[i]);
+    for (int i = 0; i < maxWriters; i++) {
+        snprintf(name, sizeof(name), "/write%02d", i);
+        if (simfsDeleteFile(benchMount, name) != SIMFS_NO_ERROR)
+            benchFail("simfsDeleteFile");
+    }
+    free(benchWriteContent);
+    simfs_debug_set_context(0, 0);
+
+    benchUnmountVolume(0);
+
+    // a volume with SIMFS_BENCH_NUMBER_OF_FILES files is mounted and unmounted once per sample
+
+    SIMFS_BENCH_TYPE mountBenches[] = {
+            {"simfsMountFileSystem",  1, NULL,                   benchMountVolume,   benchUnmountAfterSample},
+            {"simfsUmountFileSystem", 1, benchMountBeforeSample, benchUnmountVolume, NULL},
+    };
+    for (int i = 0; i < sizeof(mountBenches) / sizeof(mountBenches[0]); i++)
+        benchRun(&mountBenches[i]);
+
+    if (json)
+        benchPrintJson();
+    else
+        benchPrintTable();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,544 @@
+#include "simfs.h"
+
+//////////////////////////////////////////////////////////////////////////
+//
+// volume check
+//
+// The check runs in three passes:
+//
+//   references  every thread checks the checksums of the used blocks in its slice of the volume, walks the index
+//               chains of the files and folders among them, and counts each valid reference in a shared array of
+//               atomic counters
+//   orphans     descriptors that nothing references, other than the root folder, are orphans; the references
+//               from their chains are taken back, which can make more descriptors orphans (sequential)
+//   compare     every thread compares the counts of its slice with the bitvector
+//
+// Only the live tree is walked: a block that no reference of it reaches may be used if a snapshot holds it, as
+// its life tells. Each snapshot is then checked the same way through its view. References past the last block of
+// the volume (see simfsVolumeBlocks()) are out of range.
+//
+// Blocks kept alive only by a cycle of folders that is not reachable from the root are not found this way;
+// simfsRepairVolume() frees them, because it starts from the root.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef void (*SIMFS_CHECK_VISIT_FUNCTION)(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE reference, void *arg);
+
+typedef struct simfs_check_slice_type {
+    SIMFS_VOLUME *volume;
+    _Atomic unsigned int *references;
+    size_t firstBlock;
+    size_t lastBlock; // one past the last block of the slice
+    SIMFS_CHECK_TYPE check;
+} SIMFS_CHECK_SLICE_TYPE;
+
+static inline bool simfsCheckBlockIsUsed(SIMFS_VOLUME *volume, size_t block) {
+    return ((unsigned char) volume->bitvector[block / 8] & (0x80 >> (block % 8))) != 0;
+}
+
+static inline bool simfsCheckIsDescriptor(SIMFS_VOLUME *volume, size_t block) {
+    return volume->block[block].type == FILE_CONTENT_TYPE || volume->block[block].type == FOLDER_CONTENT_TYPE;
+}
+
+/*
+ * Tells whether a block may have more than one reference: a data block of a deduplicated volume.
+ */
+static inline bool simfsCheckMayBeShared(SIMFS_VOLUME *volume, size_t block) {
+    return (volume->superblock.attr.flags & SIMFS_VOLUME_DEDUPLICATED) != 0 &&
+           (volume->block[block].type == DATA_CONTENT_TYPE || volume->block[block].type == COMPRESSED_CONTENT_TYPE);
+}
+
+/*
+ * Tells whether a reference points into the blocks in service to a live block of the expected type;
+ * FOLDER_CONTENT_TYPE expects any descriptor, and DATA_CONTENT_TYPE a reserved block as well. Bad references are
+ * counted in check, unless it is NULL.
+ */
+static bool simfsCheckReference(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE reference, SIMFS_CONTENT_TYPE expected,
+                                SIMFS_CHECK_TYPE *check) {
+    if (reference >= simfsVolumeBlocks(volume)) {
+        if (check != NULL && reference == SIMFS_INVALID_INDEX)
+            check->invalidIndexReferences++;
+        else if (check != NULL)
+            check->outOfRangeReferences++;
+        return false;
+    }
+
+    SIMFS_CONTENT_TYPE type = volume->block[reference].type;
+    bool matches = (expected == FOLDER_CONTENT_TYPE ? simfsCheckIsDescriptor(volume, reference) :
+                    type == expected || (expected == DATA_CONTENT_TYPE && type == UNWRITTEN_CONTENT_TYPE)) &&
+                   SIMFS_BLOCK_IS_LIVE(volume, reference);
+    if (!matches && check != NULL)
+        check->wrongTypeReferences++;
+
+    return matches;
+}
+
+/*
+ * Returns the number of index blocks of the chain of a descriptor; a damaged size cannot make a walk longer than
+ * the volume.
+ */
+static size_t simfsCheckIndexBlocks(SIMFS_VOLUME *volume, size_t numberOfEntries) {
+    size_t numberOfIndexBlocks = numberOfEntries == 0 ? 1 :
+                                 (numberOfEntries + SIMFS_INDEX_ENTRIES_PER_BLOCK - 1) / SIMFS_INDEX_ENTRIES_PER_BLOCK;
+
+    return numberOfIndexBlocks < simfsVolumeBlocks(volume) ? numberOfIndexBlocks : simfsVolumeBlocks(volume);
+}
+
+/*
+ * Calls visit() for every valid reference from the descriptor in the block descriptorIndex: its index blocks and
+ * the data blocks of a file or the children of a folder. Holes of a file that is not stored compressed are valid
+ * entries without a reference, and a child whose parent is not the folder counts as a wrong parent. The walk ends
+ * at the first bad link between index blocks.
+ */
+static void simfsCheckWalk(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE descriptorIndex, SIMFS_CHECK_TYPE *check,
+                           SIMFS_CHECK_VISIT_FUNCTION visit, void *arg) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &volume->block[descriptorIndex].content.fileDescriptor;
+    bool isFile = volume->block[descriptorIndex].type == FILE_CONTENT_TYPE;
+    if (isFile && descriptor->storedSize == 0)
+        return;
+
+    size_t numberOfEntries = isFile ? SIMFS_DATA_BLOCKS(descriptor) : descriptor->size;
+    size_t numberOfIndexBlocks = simfsCheckIndexBlocks(volume, numberOfEntries);
+    SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+    SIMFS_CONTENT_TYPE entryType = !isFile ? FOLDER_CONTENT_TYPE :
+                                   descriptor->storedSize < descriptor->size ? COMPRESSED_CONTENT_TYPE : DATA_CONTENT_TYPE;
+
+    for (size_t i = 0; i < numberOfIndexBlocks; i++) {
+        if (!simfsCheckReference(volume, indexBlock, INDEX_CONTENT_TYPE, check))
+            return;
+        visit(volume, indexBlock, arg);
+
+        SIMFS_INDEX_TYPE *index = volume->block[indexBlock].content.index;
+        for (size_t j = 0; j < SIMFS_INDEX_ENTRIES_PER_BLOCK && i * SIMFS_INDEX_ENTRIES_PER_BLOCK + j < numberOfEntries;
+             j++) {
+            if (entryType == DATA_CONTENT_TYPE && index[j] == SIMFS_HOLE)
+                continue;
+            if (!simfsCheckReference(volume, index[j], entryType, check))
+                continue;
+            if (!isFile && check != NULL && volume->block[index[j]].content.fileDescriptor.parent != descriptorIndex)
+                check->wrongParents++;
+            visit(volume, index[j], arg);
+        }
+        indexBlock = index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+    }
+}
+
+static void simfsCheckCountReference(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE reference, void *arg) {
+    atomic_fetch_add_explicit(&((_Atomic unsigned int *) arg)[reference], 1, memory_order_relaxed);
+}
+
+static void *simfsCheckReferencesSlice(void *arg) {
+    SIMFS_CHECK_SLICE_TYPE *slice = arg;
+
+    for (size_t block = slice->firstBlock; block < slice->lastBlock; block++) {
+        if (!simfsCheckBlockIsUsed(slice->volume, block))
+            continue;
+        if (simfsBlockChecksum(&slice->volume->block[block]) != slice->volume->checksum[block])
+            slice->check.checksumMismatches++;
+        if (simfsCheckIsDescriptor(slice->volume, block) && SIMFS_BLOCK_IS_LIVE(slice->volume, block))
+            simfsCheckWalk(slice->volume, block, &slice->check, simfsCheckCountReference, slice->references);
+    }
+
+    return NULL;
+}
+
+static void *simfsCheckCompareSlice(void *arg) {
+    SIMFS_CHECK_SLICE_TYPE *slice = arg;
+
+    for (size_t block = slice->firstBlock; block < slice->lastBlock; block++) {
+        unsigned int references = atomic_load_explicit(&slice->references[block], memory_order_relaxed);
+        bool used = simfsCheckBlockIsUsed(slice->volume, block);
+        SIMFS_BLOCK_LIFE_TYPE *life = &slice->volume->life[block];
+        if (used && references == 0 &&
+            (life->death == 0 || !simfsSnapshotHolds(slice->volume, life->birth, life->death)))
+            slice->check.orphanedBlocks++;
+        else if (!used && references > 0)
+            slice->check.unmarkedBlocks++;
+        if (references > 1 && !simfsCheckMayBeShared(slice->volume, block))
+            slice->check.doublyReferencedBlocks++;
+    }
+
+    return NULL;
+}
+
+typedef struct simfs_check_orphans_type {
+    _Atomic unsigned int *references;
+    SIMFS_INDEX_TYPE *orphans;
+    size_t numberOfOrphans;
+} SIMFS_CHECK_ORPHANS_TYPE;
+
+static void simfsCheckDropReference(SIMFS_VOLUME *volume, SIMFS_INDEX_TYPE reference, void *arg) {
+    SIMFS_CHECK_ORPHANS_TYPE *orphans = arg;
+
+    if (atomic_fetch_sub_explicit(&orphans->references[reference], 1, memory_order_relaxed) == 1 &&
+        simfsCheckBlockIsUsed(volume, reference) && simfsCheckIsDescriptor(volume, reference) &&
+        SIMFS_BLOCK_IS_LIVE(volume, reference))
+        orphans->orphans[orphans->numberOfOrphans++] = reference;
+}
+
+/*
+ * Returns true if the superblock describes a volume of this build, with its block size, width of block references
+ * and layout of descriptors, with a root folder. Its size is right, since the image was read by it.
+ */
+static bool simfsCheckSuperblock(SIMFS_VOLUME *volume) {
+    SIMFS_INDEX_TYPE root = volume->superblock.attr.rootNodeIndex;
+
+    return volume->superblock.attr.blockSize == SIMFS_BLOCK_SIZE &&
+           volume->superblock.attr.indexSize == sizeof(SIMFS_INDEX_TYPE) &&
+           (volume->superblock.attr.flags & SIMFS_VOLUME_FOLDER_NAMES) != 0 && root < simfsVolumeBlocks(volume) &&
+           volume->block[root].type == FOLDER_CONTENT_TYPE && SIMFS_BLOCK_IS_LIVE(volume, root);
+}
+
+/*
+ * Tells in isClean whether the snapshot with the given generation can be read: its view can be built and checks
+ * clean.
+ */
+static SIMFS_ERROR simfsCheckSnapshot(SIMFS_VOLUME *volume, unsigned int generation, unsigned int numberOfThreads,
+                                      bool *isClean) {
+    SIMFS_VOLUME *view = simfsVolumeAlloc(simfsVolumeBlocks(volume));
+    if (view == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_CHECK_TYPE check;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    *isClean = false;
+    if (simfsSnapshotView(volume, generation, view) == SIMFS_NO_ERROR &&
+        (error = simfsCheckVolume(view, numberOfThreads, &check)) == SIMFS_NO_ERROR)
+        *isClean = simfsCheckIsClean(&check);
+
+    simfsVolumeFree(view);
+    return error;
+}
+
+/*
+ * Checks the consistency of a volume that is not mounted, using up to numberOfThreads threads; 0 uses one thread
+ * per online CPU.
+ */
+SIMFS_ERROR simfsCheckVolume(SIMFS_VOLUME *volume, unsigned int numberOfThreads, SIMFS_CHECK_TYPE *check) {
+    size_t numberOfBlocks = simfsVolumeBlocks(volume);
+    numberOfThreads = simfsScanThreads(numberOfThreads, numberOfBlocks);
+    SIMFS_CHECK_SLICE_TYPE *slices = calloc(numberOfThreads, sizeof(SIMFS_CHECK_SLICE_TYPE));
+    _Atomic unsigned int *references = calloc(numberOfBlocks, sizeof(_Atomic unsigned int));
+    SIMFS_CHECK_ORPHANS_TYPE orphans = {references, malloc(numberOfBlocks * sizeof(SIMFS_INDEX_TYPE)), 0};
+    if (slices == NULL || references == NULL || orphans.orphans == NULL) {
+        free(slices);
+        free(references);
+        free(orphans.orphans);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    memset(check, 0, sizeof(SIMFS_CHECK_TYPE));
+    bool hasRoot = simfsCheckSuperblock(volume);
+    SIMFS_INDEX_TYPE root = volume->superblock.attr.rootNodeIndex;
+    if (hasRoot)
+        atomic_store_explicit(&references[root], 1, memory_order_relaxed); // referenced from the superblock
+    else
+        check->badSuperblock = 1;
+    if (hasRoot && volume->block[root].content.fileDescriptor.parent != SIMFS_INVALID_INDEX)
+        check->wrongParents++;
+    if (simfsMapChecksum(volume) != volume->mapChecksum)
+        check->checksumMismatches++;
+
+    for (unsigned int i = 0; i < numberOfThreads; i++) {
+        slices[i].volume = volume;
+        slices[i].references = references;
+        slices[i].firstBlock = numberOfBlocks * i / numberOfThreads;
+        slices[i].lastBlock = numberOfBlocks * (i + 1) / numberOfThreads;
+    }
+    simfsScanInParallel(slices, sizeof(SIMFS_CHECK_SLICE_TYPE), numberOfThreads, simfsCheckReferencesSlice);
+
+    for (size_t block = 0; block < numberOfBlocks; block++) {
+        if (atomic_load_explicit(&references[block], memory_order_relaxed) == 0 &&
+            simfsCheckBlockIsUsed(volume, block) && simfsCheckIsDescriptor(volume, block) &&
+            SIMFS_BLOCK_IS_LIVE(volume, block))
+            orphans.orphans[orphans.numberOfOrphans++] = block;
+    }
+    while (orphans.numberOfOrphans > 0)
+        simfsCheckWalk(volume, orphans.orphans[--orphans.numberOfOrphans], NULL, simfsCheckDropReference, &orphans);
+
+    simfsScanInParallel(slices, sizeof(SIMFS_CHECK_SLICE_TYPE), numberOfThreads, simfsCheckCompareSlice);
+
+    for (unsigned int i = 0; i < numberOfThreads; i++) {
+        check->orphanedBlocks += slices[i].check.orphanedBlocks;
+        check->unmarkedBlocks += slices[i].check.unmarkedBlocks;
+        check->doublyReferencedBlocks += slices[i].check.doublyReferencedBlocks;
+        check->outOfRangeReferences += slices[i].check.outOfRangeReferences;
+        check->invalidIndexReferences += slices[i].check.invalidIndexReferences;
+        check->wrongTypeReferences += slices[i].check.wrongTypeReferences;
+        check->wrongParents += slices[i].check.wrongParents;
+        check->checksumMismatches += slices[i].check.checksumMismatches;
+    }
+
+    free(slices);
+    free(references);
+    free(orphans.orphans);
+
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    for (size_t i = 0; i < SIMFS_MAX_SNAPSHOTS && error == SIMFS_NO_ERROR; i++) {
+        bool isClean = true;
+        if (volume->snapshot[i].generation != 0)
+            error = simfsCheckSnapshot(volume, volume->snapshot[i].generation, numberOfThreads, &isClean);
+        check->badSnapshots += !isClean;
+    }
+
+    return error;
+}
+
+/*
+ * Tells whether a check found nothing wrong.
+ */
+bool simfsCheckIsClean(SIMFS_CHECK_TYPE *check) {
+    return check->badSuperblock == 0 && check->orphanedBlocks == 0 && check->unmarkedBlocks == 0 &&
+           check->doublyReferencedBlocks == 0 && check->outOfRangeReferences == 0 &&
+           check->invalidIndexReferences == 0 && check->wrongTypeReferences == 0 && check->wrongParents == 0 &&
+           check->checksumMismatches == 0 && check->badSnapshots == 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// volume repair
+//
+// The repair walks the tree breadth first from the root folder and claims every block it reaches. A reference is
+// good if it points into the volume to an unclaimed block of the right type; the first bad reference of a file
+// truncates it (a compressed file is emptied, as its content cannot be cut at a block), and bad references of a
+// folder are dropped from its index chain. Afterwards exactly the claimed
+// blocks are used, so the bitvector is rewritten from the claims. Running sequentially keeps "first come, first
+// served" for doubly referenced blocks well defined: the file closer to the root keeps the block. Data blocks of a
+// deduplicated volume may be claimed more than once. The checksums of the blocks that are kept are recomputed, so a
+// block whose content was damaged is accepted as it is now.
+//
+// Snapshots whose view does not check clean are dropped first. The blocks that the live tree does not claim any
+// more end their life, and those that the remaining snapshots hold are kept.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct simfs_repair_state_type {
+    SIMFS_VOLUME *volume;
+    unsigned int *claimed; // references kept to each block; more than one only for shared data blocks
+    SIMFS_INDEX_TYPE *queue; // descriptors to repair, in breadth first order
+    size_t head, tail;
+    SIMFS_INDEX_TYPE *chain; // the good index blocks of the folder being repaired
+    SIMFS_INDEX_TYPE *children; // the good children of the folder being repaired
+    SIMFS_INDEX_TYPE *homeless; // folders left without an index block
+    size_t numberOfHomeless;
+    SIMFS_REPAIR_TYPE *repair;
+} SIMFS_REPAIR_STATE_TYPE;
+
+static bool simfsRepairClaim(SIMFS_REPAIR_STATE_TYPE *state, SIMFS_INDEX_TYPE reference, SIMFS_CONTENT_TYPE expected) {
+    if (!simfsCheckReference(state->volume, reference, expected, NULL) ||
+        (state->claimed[reference] > 0 && !simfsCheckMayBeShared(state->volume, reference)))
+        return false;
+
+    state->claimed[reference]++;
+    return true;
+}
+
+static void simfsRepairFile(SIMFS_REPAIR_STATE_TYPE *state, SIMFS_INDEX_TYPE descriptorIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &state->volume->block[descriptorIndex].content.fileDescriptor;
+    if (descriptor->storedSize == 0)
+        return;
+
+    size_t numberOfEntries = SIMFS_DATA_BLOCKS(descriptor);
+    size_t numberOfIndexBlocks = simfsCheckIndexBlocks(state->volume, numberOfEntries);
+    SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+    bool isCompressed = descriptor->storedSize < descriptor->size;
+    size_t goodEntries = 0;
+    bool isDamaged = false;
+
+    for (size_t i = 0; i < numberOfIndexBlocks && !isDamaged; i++) {
+        if (!simfsRepairClaim(state, indexBlock, INDEX_CONTENT_TYPE))
+            break;
+
+        SIMFS_INDEX_TYPE *index = state->volume->block[indexBlock].content.index;
+        for (size_t j = 0; j < SIMFS_INDEX_ENTRIES_PER_BLOCK && goodEntries < numberOfEntries; j++) {
+            if (!isCompressed && index[j] == SIMFS_HOLE) {
+                goodEntries++;
+                continue;
+            }
+            if (!simfsRepairClaim(state, index[j], isCompressed ? COMPRESSED_CONTENT_TYPE : DATA_CONTENT_TYPE)) {
+                if (j == 0) // an index block without data is not needed
+                    state->claimed[indexBlock]--;
+                isDamaged = true;
+                break;
+            }
+            goodEntries++;
+        }
+        indexBlock = index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+    }
+
+    if (goodEntries < numberOfEntries && isCompressed) {
+        // compressed content cannot be cut at a block; the file is emptied and the blocks claimed for it given back
+        indexBlock = descriptor->block_ref;
+        for (size_t remaining = goodEntries; remaining > 0;) {
+            SIMFS_INDEX_TYPE *index = state->volume->block[indexBlock].content.index;
+            state->claimed[indexBlock]--;
+            for (size_t j = 0; j < SIMFS_INDEX_ENTRIES_PER_BLOCK && remaining > 0; j++, remaining--)
+                state->claimed[index[j]]--;
+            indexBlock = index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+        }
+        goodEntries = 0;
+    }
+    if (goodEntries < numberOfEntries) {
+        state->repair->truncatedFiles++;
+        descriptor->size = descriptor->storedSize = goodEntries * SIMFS_DATA_SIZE;
+        if (goodEntries == 0)
+            descriptor->block_ref = SIMFS_INVALID_INDEX;
+    }
+}
+
+static void simfsRepairFolder(SIMFS_REPAIR_STATE_TYPE *state, SIMFS_INDEX_TYPE descriptorIndex) {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &state->volume->block[descriptorIndex].content.fileDescriptor;
+    size_t numberOfEntries = descriptor->size;
+    size_t numberOfIndexBlocks = simfsCheckIndexBlocks(state->volume, numberOfEntries);
+    SIMFS_INDEX_TYPE indexBlock = descriptor->block_ref;
+    size_t chainLength = 0;
+    size_t numberOfChildren = 0;
+    size_t dropped = 0;
+
+    for (size_t i = 0; i < numberOfIndexBlocks; i++) {
+        if (!simfsRepairClaim(state, indexBlock, INDEX_CONTENT_TYPE)) {
+            dropped += numberOfEntries - i * SIMFS_INDEX_ENTRIES_PER_BLOCK;
+            break;
+        }
+        state->chain[chainLength++] = indexBlock;
+
+        SIMFS_INDEX_TYPE *index = state->volume->block[indexBlock].content.index;
+        for (size_t j = 0; j < SIMFS_INDEX_ENTRIES_PER_BLOCK && i * SIMFS_INDEX_ENTRIES_PER_BLOCK + j < numberOfEntries;
+             j++) {
+            if (simfsRepairClaim(state, index[j], FOLDER_CONTENT_TYPE)) {
+                SIMFS_FILE_DESCRIPTOR_TYPE *child = &state->volume->block[index[j]].content.fileDescriptor;
+                if (child->parent != descriptorIndex) {
+                    child->parent = descriptorIndex;
+                    state->repair->reparentedFiles++;
+                }
+                state->children[numberOfChildren++] = index[j];
+                state->queue[state->tail++] = index[j];
+            } else
+                dropped++;
+        }
+        indexBlock = index[SIMFS_INDEX_ENTRIES_PER_BLOCK];
+    }
+
+    if (dropped == 0 && chainLength > 0)
+        return;
+
+    state->repair->droppedEntries += dropped;
+    descriptor->size = numberOfChildren;
+    if (chainLength == 0) {
+        state->homeless[state->numberOfHomeless++] = descriptorIndex;
+        return;
+    }
+
+    // pack the good children into the first index blocks of the chain and let go of the others
+    size_t neededIndexBlocks = simfsCheckIndexBlocks(state->volume, numberOfChildren);
+    for (size_t k = 0; k < numberOfChildren; k++)
+        state->volume->block[state->chain[k / SIMFS_INDEX_ENTRIES_PER_BLOCK]].content.index[k %
+                SIMFS_INDEX_ENTRIES_PER_BLOCK] = state->children[k];
+    for (size_t k = 0; k + 1 < neededIndexBlocks; k++)
+        state->volume->block[state->chain[k]].content.index[SIMFS_INDEX_ENTRIES_PER_BLOCK] = state->chain[k + 1];
+    for (size_t k = neededIndexBlocks; k < chainLength; k++)
+        state->claimed[state->chain[k]]--;
+}
+
+/*
+ * Makes a volume that is not mounted consistent, keeping everything that can be reached from the root folder
+ * through good references, and the snapshots that can be read. Returns SIMFS_READ_ERROR, without changing the
+ * volume, if the superblock is bad, and SIMFS_ALLOC_ERROR if a folder lost its index chain and no block is left
+ * for a new one.
+ */
+SIMFS_ERROR simfsRepairVolume(SIMFS_VOLUME *volume, SIMFS_REPAIR_TYPE *repair) {
+    memset(repair, 0, sizeof(SIMFS_REPAIR_TYPE));
+    if (!simfsCheckSuperblock(volume))
+        return SIMFS_READ_ERROR;
+
+    size_t numberOfBlocks = simfsVolumeBlocks(volume);
+    SIMFS_REPAIR_STATE_TYPE state = {
+            .volume = volume,
+            .claimed = calloc(numberOfBlocks, sizeof(unsigned int)),
+            .queue = malloc(numberOfBlocks * sizeof(SIMFS_INDEX_TYPE)),
+            .chain = malloc(numberOfBlocks * sizeof(SIMFS_INDEX_TYPE)),
+            .children = malloc(numberOfBlocks * sizeof(SIMFS_INDEX_TYPE)),
+            .homeless = malloc(numberOfBlocks * sizeof(SIMFS_INDEX_TYPE)),
+            .repair = repair
+    };
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (state.claimed == NULL || state.queue == NULL || state.chain == NULL || state.children == NULL ||
+        state.homeless == NULL)
+        error = SIMFS_ALLOC_ERROR;
+
+    for (size_t i = 0; i < SIMFS_MAX_SNAPSHOTS && error == SIMFS_NO_ERROR; i++) {
+        bool isClean = true;
+        if (volume->snapshot[i].generation != 0)
+            error = simfsCheckSnapshot(volume, volume->snapshot[i].generation, 1, &isClean);
+        if (!isClean) {
+            volume->snapshot[i].generation = 0;
+            repair->droppedSnapshots++;
+        }
+    }
+
+    if (error == SIMFS_NO_ERROR) {
+        SIMFS_INDEX_TYPE root = volume->superblock.attr.rootNodeIndex;
+        if (volume->block[root].content.fileDescriptor.parent != SIMFS_INVALID_INDEX) {
+            volume->block[root].content.fileDescriptor.parent = SIMFS_INVALID_INDEX;
+            repair->reparentedFiles++;
+        }
+        state.claimed[root] = 1;
+        state.queue[state.tail++] = root;
+        while (state.head < state.tail) {
+            SIMFS_INDEX_TYPE descriptorIndex = state.queue[state.head++];
+            if (volume->block[descriptorIndex].type == FILE_CONTENT_TYPE)
+                simfsRepairFile(&state, descriptorIndex);
+            else
+                simfsRepairFolder(&state, descriptorIndex);
+        }
+
+        // a folder always has an index block; the blocks that are not claimed now are free unless a snapshot holds them
+        for (size_t i = 0, block = 0; i < state.numberOfHomeless; i++) {
+            while (block < numberOfBlocks && (state.claimed[block] || (simfsCheckBlockIsUsed(volume, block) &&
+                   simfsSnapshotHolds(volume, volume->life[block].birth, volume->life[block].death))))
+                block++;
+            SIMFS_FILE_DESCRIPTOR_TYPE *folder = &volume->block[state.homeless[i]].content.fileDescriptor;
+            if (block == numberOfBlocks) { // every block is claimed by files closer to the root
+                error = SIMFS_ALLOC_ERROR;
+                break;
+            }
+            state.claimed[block] = 1;
+            volume->block[block].type = INDEX_CONTENT_TYPE;
+            volume->life[block].birth = volume->generation;
+            folder->block_ref = (SIMFS_INDEX_TYPE) block;
+        }
+
+        for (size_t block = 0; block < numberOfBlocks; block++) {
+            bool used = simfsCheckBlockIsUsed(volume, block);
+            SIMFS_BLOCK_LIFE_TYPE *life = &volume->life[block];
+            if (state.claimed[block]) {
+                if (!used) {
+                    simfsSetBit((unsigned char *) volume->bitvector, block);
+                    life->birth = volume->generation;
+                    repair->markedBlocks++;
+                }
+                life->death = 0;
+                life->origin = (SIMFS_INDEX_TYPE) block;
+                continue;
+            }
+            if (used && life->death == 0)
+                life->death = volume->generation;
+            if (used && simfsSnapshotHolds(volume, life->birth, life->death))
+                continue;
+            if (used) {
+                simfsClearBit((unsigned char *) volume->bitvector, block);
+                repair->freedBlocks++;
+            }
+            volume->block[block].type = INVALID_CONTENT_TYPE;
+            memset(life, 0, sizeof(SIMFS_BLOCK_LIFE_TYPE));
+        }
+        simfsChecksumVolume(volume);
+    }
+
+    free(state.claimed);
+    free(state.queue);
+    free(state.chain);
+    free(state.children);
+    free(state.homeless);
+    return error;
+}
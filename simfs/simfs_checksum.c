@@ -0,0 +1,220 @@
+#include "simfs.h"
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//
+// block checksums
+//
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78) as used by iSCSI, ext4, and btrfs. On x86-64 processors
+// with SSE4.2 the crc32 instruction takes eight bytes at a time; elsewhere a table takes one byte at a time.
+// The choice is made by the first call, which replaces the function behind simfsBlockChecksum() and
+// simfsCrc32c() with the one for the processor, so later calls go straight to it.
+//
+// A block is checksummed over the part of its content that its type gives meaning to, so that a data or an index
+// block costs a few instructions; the rest of the union is not covered. Different types start the CRC from
+// different values, so a changed type changes the checksum as well.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_CRC32C_POLYNOMIAL 0x82F63B78
+
+typedef unsigned int (*SIMFS_CRC32C_FUNCTION)(unsigned int crc, const unsigned char *buffer, size_t length);
+
+static unsigned int simfsCrc32cResolve(unsigned int crc, const unsigned char *buffer, size_t length);
+
+static pthread_once_t simfsChecksumOnce = PTHREAD_ONCE_INIT;
+static unsigned int simfsCrc32cTable[256];
+static bool simfsCrc32cHardware = false;
+static _Atomic(SIMFS_CRC32C_FUNCTION) simfsCrc32cFunction = simfsCrc32cResolve; // takes and returns inverted crcs
+
+static void simfsChecksumInit(void) {
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ SIMFS_CRC32C_POLYNOMIAL : crc >> 1;
+        simfsCrc32cTable[i] = crc;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    simfsCrc32cHardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static unsigned int simfsCrc32cSoftware(unsigned int crc, const unsigned char *buffer, size_t length) {
+    while (length-- > 0)
+        crc = simfsCrc32cTable[(crc ^ *buffer++) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static unsigned int simfsCrc32cHardwareLoop(unsigned int crc, const unsigned char *buffer, size_t length) {
+    unsigned long long crc64 = crc;
+    for (; length >= 8; buffer += 8, length -= 8) {
+        unsigned long long word;
+        memcpy(&word, buffer, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (unsigned int) crc64;
+    if (length >= 4) {
+        unsigned int word;
+        memcpy(&word, buffer, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        buffer += 4;
+        length -= 4;
+    }
+    if (length >= 2) { // the tail of a data or an index block
+        unsigned short halfWord;
+        memcpy(&halfWord, buffer, sizeof(halfWord));
+        crc = _mm_crc32_u16(crc, halfWord);
+        buffer += 2;
+        length -= 2;
+    }
+    if (length > 0)
+        crc = _mm_crc32_u8(crc, *buffer);
+
+    return crc;
+}
+#endif
+
+static unsigned int simfsCrc32cResolve(unsigned int crc, const unsigned char *buffer, size_t length) {
+    pthread_once(&simfsChecksumOnce, simfsChecksumInit);
+
+    SIMFS_CRC32C_FUNCTION function = simfsCrc32cSoftware;
+#if defined(__x86_64__)
+    if (simfsCrc32cHardware)
+        function = simfsCrc32cHardwareLoop;
+#endif
+    atomic_store_explicit(&simfsCrc32cFunction, function, memory_order_relaxed);
+    return function(crc, buffer, length);
+}
+
+/*
+ * Continues the CRC32C crc of preceding bytes over length more bytes; start with crc 0.
+ */
+unsigned int simfsCrc32c(unsigned int crc, const void *buffer, size_t length) {
+    return ~atomic_load_explicit(&simfsCrc32cFunction, memory_order_relaxed)(~crc, buffer, length);
+}
+
+/*
+ * Tells whether simfsCrc32c() uses the crc32 instruction.
+ */
+bool simfsCrc32cIsAccelerated(void) {
+    pthread_once(&simfsChecksumOnce, simfsChecksumInit);
+
+    return simfsCrc32cHardware;
+}
+
+/*
+ * Returns the checksum of a block: the CRC32C of the descriptor, the index, or the data it holds, started from
+ * its type instead of 0.
+ */
+unsigned int simfsBlockChecksum(SIMFS_BLOCK_TYPE *block) {
+    size_t length = 0;
+    switch (block->type) {
+        case FOLDER_CONTENT_TYPE:
+        case FILE_CONTENT_TYPE:
+            length = sizeof(SIMFS_FILE_DESCRIPTOR_TYPE);
+            break;
+        case INDEX_CONTENT_TYPE:
+            length = sizeof(block->content.index);
+            break;
+        case DATA_CONTENT_TYPE:
+        case COMPRESSED_CONTENT_TYPE:
+            length = SIMFS_DATA_SIZE;
+            break;
+        default:
+            break;
+    }
+
+    // seeding the CRC with the type covers it without a pass over the padding between the type and the content
+    return simfsCrc32c(block->type, &block->content, length);
+}
+
+/*
+ * Continues crc over the snapshot table of a volume, field by field.
+ */
+static unsigned int simfsSnapshotsChecksum(unsigned int crc, SIMFS_SNAPSHOT_TYPE *snapshots) {
+    for (size_t i = 0; i < SIMFS_MAX_SNAPSHOTS; i++) {
+        SIMFS_SNAPSHOT_TYPE *snapshot = &snapshots[i];
+        crc = simfsCrc32c(crc, &snapshot->generation, sizeof(snapshot->generation));
+        crc = simfsCrc32c(crc, &snapshot->rootNodeIndex, sizeof(snapshot->rootNodeIndex));
+        crc = simfsCrc32c(crc, &snapshot->creationTime, sizeof(snapshot->creationTime));
+    }
+
+    return crc;
+}
+
+/*
+ * Continues crc over the life of a used block, field by field.
+ */
+static unsigned int simfsLifeChecksum(unsigned int crc, SIMFS_BLOCK_LIFE_TYPE *life) {
+    crc = simfsCrc32c(crc, &life->birth, sizeof(life->birth));
+    crc = simfsCrc32c(crc, &life->death, sizeof(life->death));
+    return simfsCrc32c(crc, &life->origin, sizeof(life->origin));
+}
+
+/*
+ * Returns the checksum of the superblock, the bitvector, and the snapshots of a volume: its generation, the
+ * snapshot table, and the lives of the used blocks. The fields are taken one by one, leaving out the padding.
+ */
+unsigned int simfsMapChecksum(SIMFS_VOLUME *volume) {
+    size_t numberOfBlocks = simfsVolumeBlocks(volume);
+    unsigned int crc = simfsCrc32c(simfsCrc32c(0, &volume->superblock, sizeof(volume->superblock)), volume->bitvector,
+                                   numberOfBlocks / 8);
+
+    crc = simfsCrc32c(crc, &volume->generation, sizeof(volume->generation));
+    crc = simfsSnapshotsChecksum(crc, volume->snapshot);
+    for (size_t block = 0; block < numberOfBlocks; block++) {
+        if (((unsigned char) volume->bitvector[block / 8] & (0x80 >> (block % 8))) != 0)
+            crc = simfsLifeChecksum(crc, &volume->life[block]);
+    }
+
+    return crc;
+}
+
+/*
+ * Returns what simfsMapChecksum() would return for a new volume without building its image: the superblock is
+ * superblock, the first numberOfUsedBlocks blocks are the used ones, with the lives in life, and there are no
+ * snapshots. The bitvector is hashed a chunk at a time from a small buffer, so the memory used does not grow with
+ * the volume; numberOfUsedBlocks must fit in the first chunk.
+ */
+unsigned int simfsNewVolumeMapChecksum(SIMFS_SUPERBLOCK_TYPE *superblock, unsigned int generation,
+                                       SIMFS_BLOCK_LIFE_TYPE *life, size_t numberOfUsedBlocks) {
+    unsigned char chunk[512] = {0};
+    for (size_t block = 0; block < numberOfUsedBlocks; block++)
+        simfsSetBit(chunk, block);
+
+    unsigned int crc = simfsCrc32c(0, superblock, sizeof(*superblock));
+    size_t bitvectorSize = superblock->attr.numberOfBlocks / 8;
+    for (size_t offset = 0; offset < bitvectorSize; offset += sizeof(chunk)) {
+        size_t length = bitvectorSize - offset;
+        crc = simfsCrc32c(crc, chunk, length < sizeof(chunk) ? length : sizeof(chunk));
+        if (offset == 0)
+            memset(chunk, 0, sizeof(chunk));
+    }
+
+    crc = simfsCrc32c(crc, &generation, sizeof(generation));
+    SIMFS_SNAPSHOT_TYPE snapshots[SIMFS_MAX_SNAPSHOTS] = {{0}};
+    crc = simfsSnapshotsChecksum(crc, snapshots);
+    for (size_t block = 0; block < numberOfUsedBlocks; block++)
+        crc = simfsLifeChecksum(crc, &life[block]);
+
+    return crc;
+}
+
+/*
+ * Recomputes the checksums of the superblock, the bitvector, the snapshots, and all used blocks of a volume that is
+ * not mounted.
+ */
+void simfsChecksumVolume(SIMFS_VOLUME *volume) {
+    for (size_t block = 0; block < simfsVolumeBlocks(volume); block++) {
+        if (((unsigned char) volume->bitvector[block / 8] & (0x80 >> (block % 8))) != 0)
+            volume->checksum[block] = simfsBlockChecksum(&volume->block[block]);
+    }
+    volume->mapChecksum = simfsMapChecksum(volume);
+}
@@ -0,0 +1,254 @@
+#include "simfs.h"
+
+//////////////////////////////////////////////////////////////////////////
+//
+// data compression
+//
+// The content of a compressed file is cut into extents of SIMFS_COMPRESSION_EXTENT_SIZE bytes that are compressed
+// independently, so a damaged or an incompressible extent affects nothing else. Each extent is stored as a
+// two-byte little-endian length followed by that many bytes of compressed data; a length of 0 means that the
+// extent did not shrink and is stored as it is. The blocks of a file hold this stream instead of its content.
+//
+// The codec is a byte-oriented LZ77 in the format of an LZ4 block: a sequence is a token whose high nibble is the
+// number of literals and whose low nibble is the length of the match minus SIMFS_COMPRESSION_MIN_MATCH (15 in
+// either continues in bytes of up to 255), the literals, and a two-byte offset back to the match. The last
+// sequence has literals only. Matches are found through a hash table of the last position of every four-byte
+// prefix, which keeps compression to one pass; decompression is copying only, with every length checked against
+// both buffers.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_COMPRESSION_MIN_MATCH 4
+#define SIMFS_COMPRESSION_LAST_LITERALS 5 // a match ends at least this many bytes before the end of an extent
+#define SIMFS_COMPRESSION_HASH_BITS 12
+
+static unsigned int simfsCompressionRead32(const unsigned char *buffer) {
+    unsigned int value;
+    memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+static unsigned int simfsCompressionHash(unsigned int sequence) {
+    return (sequence * 2654435761U) >> (32 - SIMFS_COMPRESSION_HASH_BITS);
+}
+
+/*
+ * Writes a length that did not fit in its nibble as bytes of 255 and a last byte below 255.
+ */
+static unsigned char *simfsCompressionPutLength(unsigned char *output, size_t length) {
+    for (; length >= 255; length -= 255)
+        *output++ = 255;
+    *output++ = (unsigned char) length;
+    return output;
+}
+
+/*
+ * Appends a sequence of the literals from anchor to match and, unless matchLength is 0, a match of matchLength bytes
+ * offset bytes back. Returns the end of the output, or NULL if it would pass limit.
+ */
+static unsigned char *simfsCompressionPutSequence(unsigned char *output, unsigned char *limit,
+                                                  const unsigned char *anchor, size_t literals,
+                                                  size_t offset, size_t matchLength) {
+    if ((size_t) (limit - output) < 1 + literals / 255 + 1 + literals + 2 + matchLength / 255 + 1)
+        return NULL;
+
+    unsigned char *token = output++;
+    *token = (literals < 15 ? literals : 15) << 4;
+    if (literals >= 15)
+        output = simfsCompressionPutLength(output, literals - 15);
+    memcpy(output, anchor, literals);
+    output += literals;
+
+    if (matchLength > 0) {
+        *output++ = offset & 0xFF;
+        *output++ = offset >> 8;
+        matchLength -= SIMFS_COMPRESSION_MIN_MATCH;
+        *token |= matchLength < 15 ? matchLength : 15;
+        if (matchLength >= 15)
+            output = simfsCompressionPutLength(output, matchLength - 15);
+    }
+    return output;
+}
+
+/*
+ * Compresses an extent of size bytes into at most capacity bytes of output.
+ *
+ * Returns the size of the compressed extent, or 0 if it does not fit in capacity.
+ */
+static size_t simfsCompressExtent(const unsigned char *source, size_t size, unsigned char *output, size_t capacity) {
+    unsigned short table[1 << SIMFS_COMPRESSION_HASH_BITS] = {0};
+    unsigned char *outputStart = output;
+    unsigned char *outputLimit = output + capacity;
+    size_t anchor = 0;
+    size_t position = 0;
+    size_t matchLimit = size > SIMFS_COMPRESSION_LAST_LITERALS ? size - SIMFS_COMPRESSION_LAST_LITERALS : 0;
+
+    while (position + SIMFS_COMPRESSION_MIN_MATCH <= matchLimit) {
+        unsigned int sequence = simfsCompressionRead32(source + position);
+        unsigned int hash = simfsCompressionHash(sequence);
+        size_t candidate = table[hash];
+        table[hash] = (unsigned short) position;
+        if (candidate >= position || simfsCompressionRead32(source + candidate) != sequence) {
+            position += 1 + ((position - anchor) >> 6); // skip faster through data that does not compress
+            continue;
+        }
+
+        size_t length = SIMFS_COMPRESSION_MIN_MATCH;
+        while (position + length < matchLimit && source[candidate + length] == source[position + length])
+            length++;
+        while (position > anchor && candidate > 0 && source[position - 1] == source[candidate - 1]) {
+            position--;
+            candidate--;
+            length++;
+        }
+
+        output = simfsCompressionPutSequence(output, outputLimit, source + anchor, position - anchor,
+                                             position - candidate, length);
+        if (output == NULL)
+            return 0;
+        position += length;
+        anchor = position;
+        if (position >= 2 && position + SIMFS_COMPRESSION_MIN_MATCH <= matchLimit)
+            table[simfsCompressionHash(simfsCompressionRead32(source + position - 2))] = (unsigned short) (position - 2);
+    }
+
+    output = simfsCompressionPutSequence(output, outputLimit, source + anchor, size - anchor, 0, 0);
+    return output != NULL ? (size_t) (output - outputStart) : 0;
+}
+
+/*
+ * Reads a length continued in bytes after its nibble. Returns false if the input ends first.
+ */
+static bool simfsCompressionGetLength(const unsigned char **input, const unsigned char *inputEnd, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*input >= inputEnd)
+            return false;
+        byte = *(*input)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/*
+ * Decompresses an extent of compressedSize bytes that must expand to exactly size bytes.
+ */
+static bool simfsDecompressExtent(const unsigned char *input, size_t compressedSize, unsigned char *output,
+                                  size_t size) {
+    const unsigned char *inputEnd = input + compressedSize;
+    unsigned char *outputStart = output;
+    unsigned char *outputEnd = output + size;
+
+    while (input < inputEnd) {
+        unsigned char token = *input++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !simfsCompressionGetLength(&input, inputEnd, &literals))
+            return false;
+        if (literals > (size_t) (inputEnd - input) || literals > (size_t) (outputEnd - output))
+            return false;
+        if (literals <= 16 && inputEnd - input >= 16 && outputEnd - output >= 16)
+            memcpy(output, input, 16); // a fixed size compiles to a single move; the excess is overwritten later
+        else
+            memcpy(output, input, literals);
+        input += literals;
+        output += literals;
+        if (input == inputEnd)
+            break; // the last sequence has no match
+
+        if (inputEnd - input < 2)
+            return false;
+        size_t offset = input[0] | (size_t) input[1] << 8;
+        input += 2;
+        size_t length = (token & 15) + SIMFS_COMPRESSION_MIN_MATCH;
+        if ((token & 15) == 15 && !simfsCompressionGetLength(&input, inputEnd, &length))
+            return false;
+        if (offset == 0 || offset > (size_t) (output - outputStart) || length > (size_t) (outputEnd - output))
+            return false;
+
+        const unsigned char *match = output - offset;
+        if (offset >= 16 && length <= 32 && outputEnd - output >= 32) {
+            memcpy(output, match, 16); // the second half may read bytes the first half wrote, as a match should
+            memcpy(output + 16, match + 16, 16);
+        } else if (offset >= length)
+            memcpy(output, match, length);
+        else if (offset >= 8 && (size_t) (outputEnd - output) >= length + 8) {
+            for (size_t i = 0; i < length; i += 8)
+                memcpy(output + i, match + i, 8);
+        } else {
+            for (size_t i = 0; i < length; i++) // the match overlaps the bytes it produces
+                output[i] = match[i];
+        }
+        output += length;
+    }
+
+    return output == outputEnd;
+}
+
+/*
+ * Compresses size bytes of content into a newly allocated buffer returned through stored.
+ *
+ * Returns the size of the compressed content. If it would not be smaller than the content, or if there is no
+ * memory for it, then *stored is set to NULL and the content should be stored as it is.
+ */
+size_t simfsCompress(const char *content, size_t size, char **stored) {
+    size_t numberOfExtents = (size + SIMFS_COMPRESSION_EXTENT_SIZE - 1) / SIMFS_COMPRESSION_EXTENT_SIZE;
+    unsigned char *buffer = NULL;
+    *stored = NULL;
+    if (size == 0 || (buffer = malloc(size + 2 * numberOfExtents)) == NULL)
+        return 0;
+
+    size_t storedSize = 0;
+    for (size_t offset = 0; offset < size; offset += SIMFS_COMPRESSION_EXTENT_SIZE) {
+        size_t length = size - offset < SIMFS_COMPRESSION_EXTENT_SIZE ? size - offset : SIMFS_COMPRESSION_EXTENT_SIZE;
+        unsigned char *header = buffer + storedSize;
+        size_t compressedLength = simfsCompressExtent((const unsigned char *) content + offset, length, header + 2,
+                                                      length - 1);
+        if (compressedLength == 0) {
+            memcpy(header + 2, content + offset, length);
+            compressedLength = length;
+            header[0] = header[1] = 0;
+        } else {
+            header[0] = compressedLength & 0xFF;
+            header[1] = compressedLength >> 8;
+        }
+        storedSize += 2 + compressedLength;
+    }
+
+    if (storedSize >= size) {
+        free(buffer);
+        return 0;
+    }
+    *stored = (char *) buffer;
+    return storedSize;
+}
+
+/*
+ * Expands storedSize bytes produced by simfsCompress() into the size bytes of content they came from.
+ *
+ * Returns false if the compressed content is damaged.
+ */
+bool simfsDecompress(const char *stored, size_t storedSize, char *content, size_t size) {
+    const unsigned char *input = (const unsigned char *) stored;
+    const unsigned char *inputEnd = input + storedSize;
+
+    for (size_t offset = 0; offset < size; offset += SIMFS_COMPRESSION_EXTENT_SIZE) {
+        size_t length = size - offset < SIMFS_COMPRESSION_EXTENT_SIZE ? size - offset : SIMFS_COMPRESSION_EXTENT_SIZE;
+        if (inputEnd - input < 2)
+            return false;
+        size_t compressedLength = input[0] | (size_t) input[1] << 8;
+        input += 2;
+        if (compressedLength == 0) {
+            if ((size_t) (inputEnd - input) < length)
+                return false;
+            memcpy(content + offset, input, length);
+            input += length;
+        } else {
+            if ((size_t) (inputEnd - input) < compressedLength ||
+                !simfsDecompressExtent(input, compressedLength, (unsigned char *) content + offset, length))
+                return false;
+            input += compressedLength;
+        }
+    }
+
+    return input == inputEnd;
+}
@@ -0,0 +1,217 @@
+#include "simfs.h"
+
+#include <sched.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// epoch-based reclamation for lock-free readers
+//
+// Readers bracket their traversals with simfsEpochEnter() / simfsEpochExit(). Writers unlink objects and hand
+// them to simfsEpochRetire(); an object retired in epoch e is reclaimed once the global epoch reaches e + 2,
+// because by then every reader that could have seen it has left its critical section. The reclaim functions run
+// outside of the lock of the retired list; simfsReclaimsInFlight counts the threads running them, so that
+// simfsEpochSynchronize() can also wait for those another thread took off the list before.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_EPOCH_QUIESCENT 0UL // value of a record's epoch while its thread is outside of a critical section
+#define SIMFS_EPOCH_RECLAIM_THRESHOLD 64 // number of pending objects that triggers a reclamation attempt
+
+typedef struct simfs_epoch_record_type {
+    _Atomic unsigned long epoch; // epoch observed on entry, or SIMFS_EPOCH_QUIESCENT
+    _Atomic bool inUse; // records of exited threads are recycled instead of freed
+    unsigned int nesting; // only the owning thread touches this
+    struct simfs_epoch_record_type *next;
+} SIMFS_EPOCH_RECORD_TYPE;
+
+typedef struct simfs_retired_type {
+    void *object;
+    SIMFS_RECLAIM_FUNCTION reclaim;
+    void *arg;
+    unsigned long epoch; // global epoch at the time of retirement
+    struct simfs_retired_type *next;
+} SIMFS_RETIRED_TYPE;
+
+static _Atomic unsigned long simfsGlobalEpoch = 1;
+static _Atomic(SIMFS_EPOCH_RECORD_TYPE *) simfsEpochRecords = NULL; // records are only ever prepended
+
+static pthread_mutex_t simfsRetiredLock = PTHREAD_MUTEX_INITIALIZER;
+static SIMFS_RETIRED_TYPE *simfsRetiredList = NULL; // newest first
+static unsigned int simfsRetiredCount = 0;
+static _Atomic unsigned int simfsReclaimsInFlight = 0; // raised under simfsRetiredLock when objects are taken off
+
+static pthread_once_t simfsEpochKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t simfsEpochKey; // releases the record of the thread on thread exit
+static _Thread_local SIMFS_EPOCH_RECORD_TYPE *simfsThreadRecord = NULL;
+
+static void simfsEpochReleaseRecord(void *record) {
+    atomic_store_explicit(&((SIMFS_EPOCH_RECORD_TYPE *) record)->epoch, SIMFS_EPOCH_QUIESCENT,
+                          memory_order_release);
+    atomic_store_explicit(&((SIMFS_EPOCH_RECORD_TYPE *) record)->inUse, false, memory_order_release);
+}
+
+static void simfsEpochCreateKey(void) {
+    pthread_key_create(&simfsEpochKey, simfsEpochReleaseRecord);
+}
+
+/*
+ * Returns the record of the calling thread, recycling the record of an exited thread if there is one.
+ */
+static SIMFS_EPOCH_RECORD_TYPE *simfsEpochThreadRecord(void) {
+    if (simfsThreadRecord != NULL)
+        return simfsThreadRecord;
+
+    pthread_once(&simfsEpochKeyOnce, simfsEpochCreateKey);
+
+    SIMFS_EPOCH_RECORD_TYPE *record = atomic_load_explicit(&simfsEpochRecords, memory_order_acquire);
+    for (; record != NULL; record = record->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&record->inUse, &expected, true))
+            break;
+    }
+
+    if (record == NULL) {
+        record = malloc(sizeof(SIMFS_EPOCH_RECORD_TYPE));
+        if (record == NULL)
+            return NULL;
+        atomic_init(&record->epoch, SIMFS_EPOCH_QUIESCENT);
+        atomic_init(&record->inUse, true);
+        record->next = atomic_load_explicit(&simfsEpochRecords, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak(&simfsEpochRecords, &record->next, record));
+    }
+
+    record->nesting = 0;
+    simfsThreadRecord = record;
+    pthread_setspecific(simfsEpochKey, record);
+    return record;
+}
+
+/*
+ * Marks the beginning of a read-side critical section. Sections nest.
+ *
+ * The fence orders the publication of the observed epoch before any load of shared pointers, so that a writer
+ * advancing the epoch either sees this thread as active or this thread sees the writer's unlinking.
+ */
+void simfsEpochEnter(void) {
+    SIMFS_EPOCH_RECORD_TYPE *record = simfsEpochThreadRecord();
+    if (record == NULL) // a reader that cannot announce itself could see reclaimed memory
+        abort();
+
+    if (record->nesting++ == 0) {
+        atomic_store_explicit(&record->epoch, atomic_load_explicit(&simfsGlobalEpoch, memory_order_relaxed),
+                              memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+/*
+ * Marks the end of a read-side critical section.
+ */
+void simfsEpochExit(void) {
+    SIMFS_EPOCH_RECORD_TYPE *record = simfsThreadRecord;
+
+    if (--record->nesting == 0)
+        atomic_store_explicit(&record->epoch, SIMFS_EPOCH_QUIESCENT, memory_order_release);
+}
+
+/*
+ * Advances the global epoch if every active reader has observed the current one.
+ */
+static void simfsEpochTryAdvance(void) {
+    unsigned long current = atomic_load_explicit(&simfsGlobalEpoch, memory_order_acquire);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    SIMFS_EPOCH_RECORD_TYPE *record = atomic_load_explicit(&simfsEpochRecords, memory_order_acquire);
+    for (; record != NULL; record = record->next) {
+        unsigned long observed = atomic_load_explicit(&record->epoch, memory_order_acquire);
+        if (observed != SIMFS_EPOCH_QUIESCENT && observed != current)
+            return;
+    }
+
+    atomic_compare_exchange_strong(&simfsGlobalEpoch, &current, current + 1);
+}
+
+/*
+ * Detaches all retired objects that are safe to reclaim and runs their reclaim functions outside of the lock.
+ */
+static void simfsEpochReclaim(void) {
+    unsigned long safe = atomic_load_explicit(&simfsGlobalEpoch, memory_order_acquire);
+    SIMFS_RETIRED_TYPE *reclaimable = NULL;
+
+    pthread_mutex_lock(&simfsRetiredLock);
+    SIMFS_RETIRED_TYPE **link = &simfsRetiredList;
+    while (*link != NULL) {
+        SIMFS_RETIRED_TYPE *retired = *link;
+        if (retired->epoch + 2 <= safe) {
+            *link = retired->next;
+            retired->next = reclaimable;
+            reclaimable = retired;
+            simfsRetiredCount--;
+        } else
+            link = &retired->next;
+    }
+    if (reclaimable != NULL)
+        atomic_fetch_add_explicit(&simfsReclaimsInFlight, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&simfsRetiredLock);
+
+    if (reclaimable == NULL)
+        return;
+
+    while (reclaimable != NULL) {
+        SIMFS_RETIRED_TYPE *next = reclaimable->next;
+        reclaimable->reclaim(reclaimable->object, reclaimable->arg);
+        free(reclaimable);
+        reclaimable = next;
+    }
+    atomic_fetch_sub_explicit(&simfsReclaimsInFlight, 1, memory_order_release);
+}
+
+/*
+ * Hands an unlinked object over for deferred reclamation. reclaim(object, arg) is called once no reader
+ * can still hold a reference to the object. Must not be called from inside a read-side critical section
+ * of the calling thread if the reclaim function takes locks held by the caller.
+ */
+void simfsEpochRetire(void *object, SIMFS_RECLAIM_FUNCTION reclaim, void *arg) {
+    SIMFS_RETIRED_TYPE *retired = malloc(sizeof(SIMFS_RETIRED_TYPE));
+    if (retired == NULL) { // cannot defer; wait for the readers instead
+        simfsEpochSynchronize();
+        reclaim(object, arg);
+        return;
+    }
+
+    retired->object = object;
+    retired->reclaim = reclaim;
+    retired->arg = arg;
+    retired->epoch = atomic_load_explicit(&simfsGlobalEpoch, memory_order_acquire);
+
+    pthread_mutex_lock(&simfsRetiredLock);
+    retired->next = simfsRetiredList;
+    simfsRetiredList = retired;
+    bool reclaimNow = ++simfsRetiredCount >= SIMFS_EPOCH_RECLAIM_THRESHOLD;
+    pthread_mutex_unlock(&simfsRetiredLock);
+
+    if (reclaimNow) {
+        simfsEpochTryAdvance();
+        simfsEpochReclaim();
+    }
+}
+
+/*
+ * Waits until every object retired before the call has been reclaimed, including those whose reclaim functions
+ * other threads are still running, so that what they reference can be freed once this returns.
+ *
+ * Must be called outside of any read-side critical section of the calling thread, and not from a reclaim function.
+ */
+void simfsEpochSynchronize(void) {
+    unsigned long target = atomic_load_explicit(&simfsGlobalEpoch, memory_order_acquire) + 2;
+
+    while (atomic_load_explicit(&simfsGlobalEpoch, memory_order_acquire) < target) {
+        simfsEpochTryAdvance();
+        if (atomic_load_explicit(&simfsGlobalEpoch, memory_order_acquire) < target)
+            sched_yield();
+    }
+
+    simfsEpochReclaim();
+    while (atomic_load_explicit(&simfsReclaimsInFlight, memory_order_acquire) > 0)
+        sched_yield();
+}
@@ -0,0 +1,127 @@
+#include "simfs.h"
+
+#include <stdio.h>
+
+//
+// consistency check and repair of a volume file
+//
+// usage: simfs_fsck [--threads N] [--repair] VOLUME_FILE
+//
+// Reads the volume file as saved on unmounting, without mounting it, and reports the result of
+// simfsCheckVolume(). --repair runs simfsRepairVolume() on a damaged volume, writes it back, and checks it again.
+// --threads sets the number of scanning threads; the default is one per online CPU.
+//
+// The exit status follows e2fsck: 0 if the volume is clean, 1 if errors were corrected, 4 if errors are left, and
+// 8 if the check could not be done.
+//
+
+#define FSCK_CLEAN 0
+#define FSCK_CORRECTED 1
+#define FSCK_UNCORRECTED 4
+#define FSCK_OPERATIONAL_ERROR 8
+
+static void fsckPrintCheck(SIMFS_CHECK_TYPE *check) {
+    if (check->badSuperblock)
+        printf("  bad superblock\n");
+    printf("  %zu orphaned blocks\n", check->orphanedBlocks);
+    printf("  %zu unmarked blocks\n", check->unmarkedBlocks);
+    printf("  %zu doubly referenced blocks\n", check->doublyReferencedBlocks);
+    printf("  %zu out of range references\n", check->outOfRangeReferences);
+    printf("  %zu invalid index references\n", check->invalidIndexReferences);
+    printf("  %zu references to blocks of the wrong type\n", check->wrongTypeReferences);
+    printf("  %zu descriptors with the wrong parent\n", check->wrongParents);
+    printf("  %zu checksum mismatches\n", check->checksumMismatches);
+    printf("  %zu snapshots that cannot be read\n", check->badSnapshots);
+}
+
+int main(int argc, char *argv[]) {
+    bool repair = false;
+    unsigned int numberOfThreads = 0;
+    char *volumeFileName = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--repair") == 0)
+            repair = true;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            numberOfThreads = atoi(argv[++i]);
+        else if (volumeFileName == NULL && argv[i][0] != '-')
+            volumeFileName = argv[i];
+        else {
+            volumeFileName = NULL;
+            break;
+        }
+    }
+    if (volumeFileName == NULL) {
+        fprintf(stderr, "usage: %s [--threads N] [--repair] VOLUME_FILE\n", argv[0]);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+
+    FILE *file = fopen(volumeFileName, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], volumeFileName);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    SIMFS_VOLUME *volume = NULL;
+    if (simfsVolumeRead(file, &volume) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: %s is not a simfs volume\n", argv[0], volumeFileName);
+        fclose(file);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    fclose(file);
+
+    SIMFS_CHECK_TYPE check;
+    if (simfsCheckVolume(volume, numberOfThreads, &check) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    if (simfsCheckIsClean(&check)) {
+        printf("%s: clean\n", volumeFileName);
+        simfsVolumeFree(volume);
+        return FSCK_CLEAN;
+    }
+    printf("%s: errors found\n", volumeFileName);
+    fsckPrintCheck(&check);
+    if (!repair) {
+        simfsVolumeFree(volume);
+        return FSCK_UNCORRECTED;
+    }
+
+    SIMFS_REPAIR_TYPE repaired;
+    SIMFS_ERROR error = simfsRepairVolume(volume, &repaired);
+    if (error == SIMFS_READ_ERROR) {
+        fprintf(stderr, "%s: the superblock is damaged; nothing was repaired\n", argv[0]);
+        simfsVolumeFree(volume);
+        return FSCK_UNCORRECTED;
+    } else if (error != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: the repair failed; the volume was not written\n", argv[0]);
+        simfsVolumeFree(volume);
+        return FSCK_UNCORRECTED;
+    }
+    printf("repaired: %zu files truncated, %zu folder entries dropped, %zu parents corrected, %zu blocks freed, "
+           "%zu blocks marked used, %zu snapshots dropped\n", repaired.truncatedFiles, repaired.droppedEntries,
+           repaired.reparentedFiles, repaired.freedBlocks, repaired.markedBlocks, repaired.droppedSnapshots);
+
+    file = fopen(volumeFileName, "wb");
+    if (file == NULL || !simfsVolumeWrite(file, volume)) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], volumeFileName);
+        if (file != NULL)
+            fclose(file);
+        simfsVolumeFree(volume);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    fclose(file);
+
+    if (simfsCheckVolume(volume, numberOfThreads, &check) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        simfsVolumeFree(volume);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    simfsVolumeFree(volume);
+    if (!simfsCheckIsClean(&check)) {
+        printf("%s: errors left after the repair\n", volumeFileName);
+        fsckPrintCheck(&check);
+        return FSCK_UNCORRECTED;
+    }
+    printf("%s: clean\n", volumeFileName);
+    return FSCK_CORRECTED;
+}
@@ -0,0 +1,91 @@
+#include "simfs.h"
+
+//////////////////////////////////////////////////////////////////////////
+//
+// volume snapshots
+//
+// The live tree of a volume has a generation, and taking a snapshot records the generation and the root folder
+// and starts the next generation; nothing else is copied, so a snapshot costs the same on any volume. Every used
+// block has a life: the generations from its birth, when it was allocated or last preserved, to its death, when it
+// left the live tree. A snapshot holds the blocks that were alive in its generation.
+//
+// Blocks change in place only in descriptors and in the index chains of folders. Before such a change, a block
+// that a snapshot holds is preserved: its version is copied to a new block whose life ends in the current generation
+// and whose origin is the block it came from, and the block itself is born again. A block that leaves the live tree
+// while a snapshot holds it stays allocated with its content and gets a death instead of being freed. Deleting
+// the last snapshot that holds a block frees it.
+//
+// A snapshot is read through a view: a volume image with every block that the snapshot holds put back in the
+// place of its origin, so the references between the blocks of the snapshot tree are valid in it again.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Tells whether a snapshot of the volume holds a version of a block that lives from birth to death; a death of 0
+ * means that the version is still alive.
+ */
+bool simfsSnapshotHolds(SIMFS_VOLUME *volume, unsigned int birth, unsigned int death) {
+    for (size_t i = 0; i < SIMFS_MAX_SNAPSHOTS; i++) {
+        unsigned int generation = volume->snapshot[i].generation;
+        if (generation != 0 && birth <= generation && (death == 0 || generation < death))
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Returns the slot of the snapshot with the given generation, or NULL if the volume has none.
+ */
+SIMFS_SNAPSHOT_TYPE *simfsSnapshotFind(SIMFS_VOLUME *volume, unsigned int generation) {
+    for (size_t i = 0; generation != 0 && i < SIMFS_MAX_SNAPSHOTS; i++) {
+        if (volume->snapshot[i].generation == generation)
+            return &volume->snapshot[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Builds the view of a snapshot in view, a volume of the same size: a volume without snapshots whose root is the
+ * root of the snapshot and whose used blocks are the versions the snapshot holds, with their checksums.
+ *
+ * Returns SIMFS_NOT_FOUND_ERROR if there is no such snapshot, and SIMFS_READ_ERROR if the lives of the blocks
+ * are damaged, so that two versions come to one place or the root folder is missing.
+ */
+SIMFS_ERROR simfsSnapshotView(SIMFS_VOLUME *volume, unsigned int generation, SIMFS_VOLUME *view) {
+    SIMFS_SNAPSHOT_TYPE *snapshot = simfsSnapshotFind(volume, generation);
+    if (snapshot == NULL)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    size_t numberOfBlocks = simfsVolumeBlocks(volume);
+    memset(view->image, 0, view->imageSize);
+    memset(view->snapshot, 0, sizeof(view->snapshot));
+    for (size_t block = 0; block < numberOfBlocks; block++)
+        view->block[block].type = INVALID_CONTENT_TYPE;
+    view->superblock = volume->superblock;
+    view->superblock.attr.rootNodeIndex = snapshot->rootNodeIndex;
+    view->generation = generation;
+
+    for (size_t block = 0; block < numberOfBlocks; block++) {
+        SIMFS_BLOCK_LIFE_TYPE *life = &volume->life[block];
+        if (((unsigned char) volume->bitvector[block / 8] & (0x80 >> (block % 8))) == 0 ||
+            life->birth > generation || (life->death != 0 && life->death <= generation))
+            continue;
+
+        SIMFS_INDEX_TYPE origin = life->origin;
+        if (origin >= numberOfBlocks || ((unsigned char) view->bitvector[origin / 8] & (0x80 >> (origin % 8))))
+            return SIMFS_READ_ERROR;
+        view->block[origin] = volume->block[block];
+        view->checksum[origin] = volume->checksum[block];
+        view->life[origin].birth = life->birth;
+        view->life[origin].origin = origin;
+        simfsSetBit((unsigned char *) view->bitvector, origin);
+    }
+    SIMFS_INDEX_TYPE root = snapshot->rootNodeIndex;
+    if (root >= numberOfBlocks || ((unsigned char) view->bitvector[root / 8] & (0x80 >> (root % 8))) == 0)
+        return SIMFS_READ_ERROR;
+
+    view->mapChecksum = simfsMapChecksum(view);
+    return SIMFS_NO_ERROR;
+}
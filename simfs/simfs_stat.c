@@ -0,0 +1,172 @@
+#include "simfs.h"
+
+#include <stdio.h>
+
+//
+// fragmentation and allocation map report of a volume file
+//
+// usage: simfs_stat [--threads N] [--files] [--json] VOLUME_FILE
+//
+// Reads the volume file as saved on unmounting, without mounting it, and prints the result of
+// simfsAnalyzeVolume(): block counts by type, the number of extents the blocks of the files form, and the
+// runs of free blocks. The references to data blocks over their number is the deduplication ratio, which is 1 on
+// a volume without sharing; holes of sparse files are not references, while blocks reserved by simfsFallocate()
+// are. The blocks kept only for snapshots are counted apart from the live tree, which the other figures describe.
+// Histogram rows are power-of-two buckets. --files adds the size and the number of extents of every file.
+// --threads sets the number of scanning threads; the default is one per online CPU.
+//
+
+static const char *statTypeNames[INVALID_CONTENT_TYPE + 1] = {"folder", "file", "index", "data", "compressed",
+                                                             "unwritten", "untyped"};
+
+static void statBucketLabel(unsigned int bucket, char *label, size_t size) {
+    size_t low = (size_t) 1 << bucket;
+    if (bucket == SIMFS_ANALYSIS_BUCKETS - 1)
+        snprintf(label, size, "%zu+", low);
+    else if (bucket == 0)
+        snprintf(label, size, "1");
+    else
+        snprintf(label, size, "%zu-%zu", low, 2 * low - 1);
+}
+
+static void statPrintHistogram(const char *title, size_t *histogram, bool json) {
+    char label[32];
+    bool first = true;
+
+    if (json)
+        printf("  \"%s\": {", title);
+    else
+        printf("%s:\n", title);
+    for (unsigned int bucket = 0; bucket < SIMFS_ANALYSIS_BUCKETS; bucket++) {
+        if (histogram[bucket] == 0)
+            continue;
+        statBucketLabel(bucket, label, sizeof(label));
+        if (json)
+            printf("%s\"%s\": %zu", first ? "" : ", ", label, histogram[bucket]);
+        else
+            printf("  %-10s %zu\n", label, histogram[bucket]);
+        first = false;
+    }
+    if (json)
+        printf("}");
+}
+
+static void statPrintFiles(SIMFS_VOLUME *volume, bool json) {
+    bool first = true;
+
+    if (json)
+        printf(",\n  \"files\": [");
+    else
+        printf("files:\n");
+    for (size_t block = 0; block < simfsVolumeBlocks(volume); block++) {
+        if (((unsigned char) volume->bitvector[block / 8] & (0x80 >> (block % 8))) == 0 ||
+            volume->block[block].type != FILE_CONTENT_TYPE || !SIMFS_BLOCK_IS_LIVE(volume, block))
+            continue;
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &volume->block[block].content.fileDescriptor;
+        size_t extents = simfsFileExtents(volume, block);
+        SIMFS_NAME_TYPE name; // the name in the folder if the full path does not fit
+        if (!simfsFilePath(volume, block, name))
+            snprintf(name, sizeof(name), "%.*s", SIMFS_MAX_NAME_LENGTH - 1, descriptor->name);
+        if (json)
+            printf("%s\n    {\"block\": %zu, \"name\": \"%s\", \"size\": %zu, \"stored\": %zu, "
+                   "\"extents\": %zu}", first ? "" : ",", block, name, descriptor->size, descriptor->storedSize,
+                   extents);
+        else
+            printf("  %6zu %-32s %8zu bytes %8zu stored %6zu extents\n", block, name, descriptor->size,
+                   descriptor->storedSize, extents);
+        first = false;
+    }
+    if (json)
+        printf("\n  ]");
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    bool files = false;
+    unsigned int numberOfThreads = 0;
+    char *volumeFileName = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "--files") == 0)
+            files = true;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            numberOfThreads = atoi(argv[++i]);
+        else if (volumeFileName == NULL && argv[i][0] != '-')
+            volumeFileName = argv[i];
+        else {
+            volumeFileName = NULL;
+            break;
+        }
+    }
+    if (volumeFileName == NULL) {
+        fprintf(stderr, "usage: %s [--threads N] [--files] [--json] VOLUME_FILE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = fopen(volumeFileName, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], volumeFileName);
+        return EXIT_FAILURE;
+    }
+    SIMFS_VOLUME *volume = NULL;
+    if (simfsVolumeRead(file, &volume) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: %s is not a simfs volume\n", argv[0], volumeFileName);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+    fclose(file);
+
+    SIMFS_ANALYSIS_TYPE analysis;
+    if (simfsAnalyzeVolume(volume, numberOfThreads, &analysis) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t dataBlocks = analysis.blocksByType[DATA_CONTENT_TYPE] + analysis.blocksByType[COMPRESSED_CONTENT_TYPE] +
+                        analysis.blocksByType[UNWRITTEN_CONTENT_TYPE];
+    double dedupRatio = dataBlocks > 0 ? (double) analysis.numberOfDataReferences / dataBlocks : 1;
+    double meanExtents = analysis.numberOfFiles > analysis.numberOfEmptyFiles ?
+                         (double) analysis.numberOfExtents / (analysis.numberOfFiles - analysis.numberOfEmptyFiles) : 0;
+    if (json) {
+        printf("{\n  \"usedBlocks\": %zu, \"freeBlocks\": %zu, \"snapshots\": %zu, \"snapshotBlocks\": %zu,\n"
+               "  \"blocksByType\": {", analysis.usedBlocks, analysis.freeBlocks, analysis.numberOfSnapshots,
+               analysis.snapshotBlocks);
+        for (int type = 0; type <= INVALID_CONTENT_TYPE; type++)
+            printf("%s\"%s\": %zu", type == 0 ? "" : ", ", statTypeNames[type], analysis.blocksByType[type]);
+        printf("},\n  \"folders\": %zu, \"files\": %zu, \"emptyFiles\": %zu, \"fragmentedFiles\": %zu,\n"
+               "  \"extents\": %zu, \"meanExtents\": %.2f, \"maxExtents\": %zu,\n",
+               analysis.numberOfFolders, analysis.numberOfFiles, analysis.numberOfEmptyFiles,
+               analysis.numberOfFragmentedFiles, analysis.numberOfExtents, meanExtents, analysis.maxExtents);
+        printf("  \"dataReferences\": %zu, \"dedupRatio\": %.2f, \"holes\": %zu,\n", analysis.numberOfDataReferences,
+               dedupRatio, analysis.numberOfHoles);
+        printf("  \"freeRuns\": %zu, \"largestFreeRun\": %zu,\n", analysis.numberOfFreeRuns,
+               analysis.largestFreeRun);
+        statPrintHistogram("extentsHistogram", analysis.extentsHistogram, json);
+        printf(",\n");
+        statPrintHistogram("freeRunHistogram", analysis.freeRunHistogram, json);
+        if (files)
+            statPrintFiles(volume, json);
+        printf("\n}\n");
+    } else {
+        printf("blocks: %zu used, %zu free\n", analysis.usedBlocks, analysis.freeBlocks);
+        printf("snapshots: %zu, %zu blocks kept for them\n", analysis.numberOfSnapshots, analysis.snapshotBlocks);
+        for (int type = 0; type <= INVALID_CONTENT_TYPE; type++)
+            printf("  %-10s %zu\n", statTypeNames[type], analysis.blocksByType[type]);
+        printf("folders: %zu, files: %zu (%zu empty, %zu fragmented)\n", analysis.numberOfFolders,
+               analysis.numberOfFiles, analysis.numberOfEmptyFiles, analysis.numberOfFragmentedFiles);
+        printf("extents: %zu, %.2f per non-empty file, at most %zu\n", analysis.numberOfExtents, meanExtents,
+               analysis.maxExtents);
+        printf("data references: %zu, %.2f per data block, %zu holes\n", analysis.numberOfDataReferences, dedupRatio,
+               analysis.numberOfHoles);
+        statPrintHistogram("files by extents", analysis.extentsHistogram, json);
+        printf("free runs: %zu, largest %zu blocks\n", analysis.numberOfFreeRuns, analysis.largestFreeRun);
+        statPrintHistogram("free runs by length", analysis.freeRunHistogram, json);
+        if (files)
+            statPrintFiles(volume, json);
+    }
+
+    simfsVolumeFree(volume);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,300 @@
+#include "simfs.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//
+// operation statistics
+//
+// Every thread counts into its own record, so the fast path is a thread-local pointer and a few plain stores;
+// the atomics are only there so that simfsGetStats() can read the records while their threads keep counting.
+// Records are never freed; the record of an exited thread is handed to the next new thread and keeps adding
+// to the same totals.
+//
+// Latencies go into HDR-style histograms: values below 2 * SIMFS_STATS_SUB_BUCKETS ticks have a bucket each,
+// larger values share SIMFS_STATS_SUB_BUCKETS buckets per power of two, which bounds the relative error of a
+// reported percentile to 1 / SIMFS_STATS_SUB_BUCKETS. On x86 the ticks come from the time stamp counter and
+// are converted to nanoseconds only when the statistics are read.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_STATS_SUB_BUCKET_BITS 4
+#define SIMFS_STATS_SUB_BUCKETS (1 << SIMFS_STATS_SUB_BUCKET_BITS)
+#define SIMFS_STATS_MAX_BITS 40 // latencies are capped at 2^40 ticks
+#define SIMFS_STATS_BUCKETS ((SIMFS_STATS_MAX_BITS - SIMFS_STATS_SUB_BUCKET_BITS + 1) * SIMFS_STATS_SUB_BUCKETS)
+
+typedef struct simfs_stats_record_type {
+    _Atomic unsigned long latency[SIMFS_NUMBER_OF_OPERATIONS][SIMFS_STATS_BUCKETS];
+    _Atomic unsigned long totalTicks[SIMFS_NUMBER_OF_OPERATIONS];
+    _Atomic unsigned long maxTicks[SIMFS_NUMBER_OF_OPERATIONS];
+    _Atomic unsigned long errors[SIMFS_NUMBER_OF_OPERATIONS];
+    _Atomic unsigned long counter[SIMFS_NUMBER_OF_COUNTERS];
+    _Atomic unsigned long chainLength[SIMFS_STATS_CHAIN_LENGTHS];
+    _Atomic bool inUse;
+    struct simfs_stats_record_type *next;
+} SIMFS_STATS_RECORD_TYPE;
+
+static _Atomic(SIMFS_STATS_RECORD_TYPE *) simfsStatsRecords = NULL; // records are only ever prepended
+
+static pthread_once_t simfsStatsKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t simfsStatsKey; // hands the record of the thread back on thread exit
+static _Thread_local SIMFS_STATS_RECORD_TYPE *simfsThreadStats = NULL;
+
+static unsigned long simfsStatsReferenceTicks; // time stamp counter and clock at the first measurement
+static struct timespec simfsStatsReferenceTime;
+
+static const char *simfsOperationNames[SIMFS_NUMBER_OF_OPERATIONS] = {
+        "create", "delete", "getinfo", "open", "read", "write", "close", "mount", "umount", "rename"
+};
+
+static const char *simfsCounterNames[SIMFS_NUMBER_OF_COUNTERS] = {
+        "blocks_allocated", "blocks_freed", "blocks_read", "bytes_read", "bytes_written", "checksum_errors",
+        "blocks_deduplicated", "blocks_preserved"
+};
+
+_Thread_local unsigned int simfsBlocksTouched = 0;
+
+static void simfsStatsReleaseRecord(void *record) {
+    atomic_store_explicit(&((SIMFS_STATS_RECORD_TYPE *) record)->inUse, false, memory_order_release);
+}
+
+static void simfsStatsInit(void) {
+    pthread_key_create(&simfsStatsKey, simfsStatsReleaseRecord);
+#if defined(__x86_64__) || defined(__i386__)
+    clock_gettime(CLOCK_MONOTONIC, &simfsStatsReferenceTime);
+    simfsStatsReferenceTicks = __rdtsc();
+#endif
+}
+
+/*
+ * Returns the record of the calling thread, taking over the record of an exited thread if there is one.
+ * Returns NULL if there is no memory for a record; the thread then goes uncounted.
+ */
+static SIMFS_STATS_RECORD_TYPE *simfsStatsThreadRecord(void) {
+    if (simfsThreadStats != NULL)
+        return simfsThreadStats;
+
+    pthread_once(&simfsStatsKeyOnce, simfsStatsInit);
+
+    SIMFS_STATS_RECORD_TYPE *record = atomic_load_explicit(&simfsStatsRecords, memory_order_acquire);
+    for (; record != NULL; record = record->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&record->inUse, &expected, true))
+            break;
+    }
+
+    if (record == NULL) {
+        record = calloc(1, sizeof(SIMFS_STATS_RECORD_TYPE));
+        if (record == NULL)
+            return NULL;
+        atomic_init(&record->inUse, true);
+        record->next = atomic_load_explicit(&simfsStatsRecords, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak(&simfsStatsRecords, &record->next, record));
+    }
+
+    simfsThreadStats = record;
+    pthread_setspecific(simfsStatsKey, record);
+    return record;
+}
+
+/*
+ * Adds to a counter that only the calling thread writes; a plain load and store instead of a locked add.
+ */
+static inline void simfsStatsAdd(_Atomic unsigned long *counter, unsigned long value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline unsigned int simfsStatsBucket(unsigned long ticks) {
+    if (ticks >= 1UL << SIMFS_STATS_MAX_BITS)
+        ticks = (1UL << SIMFS_STATS_MAX_BITS) - 1;
+    if (ticks < SIMFS_STATS_SUB_BUCKETS)
+        return (unsigned int) ticks;
+
+    unsigned int shift = (63 - __builtin_clzl(ticks)) - SIMFS_STATS_SUB_BUCKET_BITS;
+    return shift * SIMFS_STATS_SUB_BUCKETS + (unsigned int) (ticks >> shift);
+}
+
+/*
+ * Returns the middle of the range of ticks counted in the bucket.
+ */
+static double simfsStatsBucketValue(unsigned int bucket) {
+    if (bucket < 2 * SIMFS_STATS_SUB_BUCKETS)
+        return bucket;
+
+    unsigned int shift = bucket / SIMFS_STATS_SUB_BUCKETS - 1;
+    return (double) ((unsigned long) (bucket - shift * SIMFS_STATS_SUB_BUCKETS) << shift) + (1UL << shift) / 2.0;
+}
+
+/*
+ * Returns the current time in ticks.
+ */
+unsigned long simfsStatsTicks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000UL + time.tv_nsec;
+#endif
+}
+
+/*
+ * Returns the current time in ticks for simfsStatsFinish(), and starts counting the blocks touched by the
+ * operation.
+ */
+unsigned long simfsStatsStart(void) {
+    simfsBlocksTouched = 0;
+    return simfsStatsTicks();
+}
+
+/*
+ * Records the latency of an operation that started at start and its outcome.
+ */
+void simfsStatsFinish(SIMFS_OPERATION_TYPE operation, unsigned long start, SIMFS_ERROR error) {
+    unsigned long ticks = simfsStatsTicks() - start;
+    SIMFS_STATS_RECORD_TYPE *record = simfsStatsThreadRecord();
+    if (record == NULL)
+        return;
+
+    simfsStatsAdd(&record->latency[operation][simfsStatsBucket(ticks)], 1);
+    simfsStatsAdd(&record->totalTicks[operation], ticks);
+    if (ticks > atomic_load_explicit(&record->maxTicks[operation], memory_order_relaxed))
+        atomic_store_explicit(&record->maxTicks[operation], ticks, memory_order_relaxed);
+    if (error != SIMFS_NO_ERROR)
+        simfsStatsAdd(&record->errors[operation], 1);
+}
+
+void simfsStatsCount(SIMFS_COUNTER_TYPE counter, unsigned long value) {
+    if (counter <= SIMFS_BLOCKS_READ_COUNTER)
+        simfsBlocksTouched += value;
+
+    SIMFS_STATS_RECORD_TYPE *record = simfsStatsThreadRecord();
+    if (record != NULL)
+        simfsStatsAdd(&record->counter[counter], value);
+}
+
+/*
+ * Records the number of directory entries a lookup compared before it found the name or reached the end of the
+ * list; longer lists go into the last slot.
+ */
+void simfsStatsChainLength(unsigned int length) {
+    SIMFS_STATS_RECORD_TYPE *record = simfsStatsThreadRecord();
+    if (record != NULL)
+        simfsStatsAdd(&record->chainLength[length < SIMFS_STATS_CHAIN_LENGTHS ? length : SIMFS_STATS_CHAIN_LENGTHS - 1], 1);
+}
+
+/*
+ * Returns the length of a tick in nanoseconds, measured against the clock since the first measurement.
+ */
+double simfsStatsNanosecondsPerTick(void) {
+    pthread_once(&simfsStatsKeyOnce, simfsStatsInit);
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec now;
+    unsigned long ticks;
+    double nanoseconds;
+
+    do { // the reference is taken on the first measurement; give the clocks a millisecond to drift apart
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ticks = __rdtsc();
+        nanoseconds = (now.tv_sec - simfsStatsReferenceTime.tv_sec) * 1e9 +
+                      (now.tv_nsec - simfsStatsReferenceTime.tv_nsec);
+    } while (nanoseconds < 1e6);
+
+    return nanoseconds / (double) (ticks - simfsStatsReferenceTicks);
+#else
+    return 1.0;
+#endif
+}
+
+const char *simfsOperationName(SIMFS_OPERATION_TYPE operation) {
+    return simfsOperationNames[operation];
+}
+
+/*
+ * Sums the records of all threads into stats. The counts of threads that are counting at the same time may be
+ * off by the operations in flight.
+ */
+SIMFS_ERROR simfsGetStats(SIMFS_STATS_TYPE *stats) {
+    unsigned long merged[SIMFS_STATS_BUCKETS];
+
+    memset(stats, 0, sizeof(SIMFS_STATS_TYPE));
+    double nanosecondsPerTick = simfsStatsNanosecondsPerTick();
+
+    for (int operation = 0; operation < SIMFS_NUMBER_OF_OPERATIONS; operation++) {
+        SIMFS_OPERATION_STATS_TYPE *operationStats = &stats->operations[operation];
+        unsigned long totalTicks = 0, maxTicks = 0;
+
+        memset(merged, 0, sizeof(merged));
+        SIMFS_STATS_RECORD_TYPE *record = atomic_load_explicit(&simfsStatsRecords, memory_order_acquire);
+        for (; record != NULL; record = record->next) {
+            for (int bucket = 0; bucket < SIMFS_STATS_BUCKETS; bucket++)
+                merged[bucket] += atomic_load_explicit(&record->latency[operation][bucket], memory_order_relaxed);
+            totalTicks += atomic_load_explicit(&record->totalTicks[operation], memory_order_relaxed);
+            unsigned long recordMax = atomic_load_explicit(&record->maxTicks[operation], memory_order_relaxed);
+            maxTicks = recordMax > maxTicks ? recordMax : maxTicks;
+            operationStats->errors += atomic_load_explicit(&record->errors[operation], memory_order_relaxed);
+        }
+
+        for (int bucket = 0; bucket < SIMFS_STATS_BUCKETS; bucket++)
+            operationStats->count += merged[bucket];
+        if (operationStats->count == 0)
+            continue;
+
+        operationStats->meanNanoseconds = totalTicks * nanosecondsPerTick / operationStats->count;
+        operationStats->maxNanoseconds = maxTicks * nanosecondsPerTick;
+
+        double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+        double *results[] = {&operationStats->p50Nanoseconds, &operationStats->p90Nanoseconds,
+                             &operationStats->p99Nanoseconds, &operationStats->p999Nanoseconds};
+        unsigned long seen = 0;
+        int next = 0;
+        for (int bucket = 0; bucket < SIMFS_STATS_BUCKETS && next < 4; bucket++) {
+            seen += merged[bucket];
+            while (next < 4 && seen >= percentiles[next] * operationStats->count) {
+                double value = simfsStatsBucketValue(bucket) * nanosecondsPerTick;
+                *results[next++] = value < operationStats->maxNanoseconds ? value : operationStats->maxNanoseconds;
+            }
+        }
+    }
+
+    SIMFS_STATS_RECORD_TYPE *record = atomic_load_explicit(&simfsStatsRecords, memory_order_acquire);
+    for (; record != NULL; record = record->next) {
+        for (int counter = 0; counter < SIMFS_NUMBER_OF_COUNTERS; counter++)
+            stats->counter[counter] += atomic_load_explicit(&record->counter[counter], memory_order_relaxed);
+        for (int length = 0; length < SIMFS_STATS_CHAIN_LENGTHS; length++)
+            stats->chainLength[length] += atomic_load_explicit(&record->chainLength[length], memory_order_relaxed);
+    }
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Returns the statistics as text in a buffer allocated with malloc(), or NULL if there is no memory.
+ */
+char *simfsFormatStats(SIMFS_STATS_TYPE *stats) {
+    size_t size = 4096;
+    char *text = malloc(size);
+    if (text == NULL)
+        return NULL;
+
+    int length = snprintf(text, size, "%-8s %12s %8s %12s %12s %12s %12s %12s %12s\n", "op", "count", "errors",
+                          "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns");
+    for (int operation = 0; operation < SIMFS_NUMBER_OF_OPERATIONS; operation++) {
+        SIMFS_OPERATION_STATS_TYPE *operationStats = &stats->operations[operation];
+        length += snprintf(text + length, size - length, "%-8s %12lu %8lu %12.0f %12.0f %12.0f %12.0f %12.0f %12.0f\n",
+                           simfsOperationNames[operation], operationStats->count, operationStats->errors,
+                           operationStats->meanNanoseconds, operationStats->p50Nanoseconds,
+                           operationStats->p90Nanoseconds, operationStats->p99Nanoseconds,
+                           operationStats->p999Nanoseconds, operationStats->maxNanoseconds);
+    }
+    for (int counter = 0; counter < SIMFS_NUMBER_OF_COUNTERS; counter++)
+        length += snprintf(text + length, size - length, "%s %lu\n", simfsCounterNames[counter],
+                           stats->counter[counter]);
+    for (int chainLength = 0; chainLength < SIMFS_STATS_CHAIN_LENGTHS; chainLength++)
+        length += snprintf(text + length, size - length, "chain_length_%d%s %lu\n", chainLength,
+                           chainLength == SIMFS_STATS_CHAIN_LENGTHS - 1 ? "+" : "", stats->chainLength[chainLength]);
+
+    return text;
+}
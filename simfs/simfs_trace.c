@@ -0,0 +1,195 @@
+#include "simfs.h"
+
+//////////////////////////////////////////////////////////////////////////
+//
+// operation tracing
+//
+// Every thread writes to its own ring buffer, so recording an event takes no lock and no read-modify-write.
+// The owner fills in the event and then publishes it by advancing the head of the ring with a release store.
+// simfsTraceDump() copies the rings while their threads keep writing. It reads each head before and after the
+// copy, and drops the events that may have been overwritten in between. The event fields are relaxed atomics
+// for the same reason.
+//
+// Rings are allocated the first time a thread records an event. On thread exit a ring goes back to a free list,
+// and its events stay in it until the next thread overwrites them.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct simfs_trace_event_type {
+    _Atomic unsigned long info; // operation | error << 8 | blocks touched << 32
+    _Atomic unsigned long object; // hash of the name, or the file handle
+    _Atomic unsigned long start; // ticks
+    _Atomic unsigned long end;
+} SIMFS_TRACE_EVENT_TYPE;
+
+typedef struct simfs_trace_ring_type {
+    _Atomic unsigned long head; // number of events ever written; the next one goes to head % SIMFS_TRACE_RING_SIZE
+    _Atomic bool inUse;
+    unsigned int number; // thread number in the dump
+    struct simfs_trace_ring_type *next;
+    SIMFS_TRACE_EVENT_TYPE event[SIMFS_TRACE_RING_SIZE];
+} SIMFS_TRACE_RING_TYPE;
+
+atomic_bool simfsTraceEnabled = false;
+
+static _Atomic(SIMFS_TRACE_RING_TYPE *) simfsTraceRings = NULL; // rings are only ever prepended
+static _Atomic unsigned int simfsNumberOfTraceRings = 0;
+
+static pthread_once_t simfsTraceKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t simfsTraceKey; // hands the ring of the thread back on thread exit
+static _Thread_local SIMFS_TRACE_RING_TYPE *simfsThreadRing = NULL;
+
+static void simfsTraceReleaseRing(void *ring) {
+    atomic_store_explicit(&((SIMFS_TRACE_RING_TYPE *) ring)->inUse, false, memory_order_release);
+}
+
+static void simfsTraceCreateKey(void) {
+    pthread_key_create(&simfsTraceKey, simfsTraceReleaseRing);
+}
+
+/*
+ * Returns the ring of the calling thread, taking over the ring of an exited thread if there is one.
+ */
+static SIMFS_TRACE_RING_TYPE *simfsTraceThreadRing(void) {
+    if (simfsThreadRing != NULL)
+        return simfsThreadRing;
+
+    pthread_once(&simfsTraceKeyOnce, simfsTraceCreateKey);
+
+    SIMFS_TRACE_RING_TYPE *ring = atomic_load_explicit(&simfsTraceRings, memory_order_acquire);
+    for (; ring != NULL; ring = ring->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&ring->inUse, &expected, true))
+            break;
+    }
+
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(SIMFS_TRACE_RING_TYPE));
+        if (ring == NULL)
+            return NULL;
+        atomic_init(&ring->inUse, true);
+        ring->number = atomic_fetch_add(&simfsNumberOfTraceRings, 1);
+        ring->next = atomic_load_explicit(&simfsTraceRings, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak(&simfsTraceRings, &ring->next, ring));
+    }
+
+    simfsThreadRing = ring;
+    pthread_setspecific(simfsTraceKey, ring);
+    return ring;
+}
+
+/*
+ * Turns tracing on or off for all threads. Calls that are running when tracing is switched may or may not
+ * be recorded.
+ */
+void simfsTraceEnable(bool enable) {
+    atomic_store_explicit(&simfsTraceEnabled, enable, memory_order_relaxed);
+}
+
+/*
+ * Appends an event for a call that started at start (in simfsStatsTicks() ticks) and ends now. The object of the
+ * event is the hash of name if there is one, and handle otherwise. Use simfsTraceOperation(), which skips the
+ * call while tracing is disabled.
+ */
+void simfsTraceRecord(SIMFS_OPERATION_TYPE operation, char *name, long handle, unsigned long start,
+                      SIMFS_ERROR error) {
+    unsigned long end = simfsStatsTicks();
+    SIMFS_TRACE_RING_TYPE *ring = simfsTraceThreadRing();
+    if (ring == NULL)
+        return;
+
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    SIMFS_TRACE_EVENT_TYPE *event = &ring->event[head % SIMFS_TRACE_RING_SIZE];
+    atomic_store_explicit(&event->info, (unsigned long) operation | (unsigned long) error << 8 |
+                                        (unsigned long) simfsBlocksTouched << 32, memory_order_relaxed);
+    atomic_store_explicit(&event->object, name != NULL ? hash((unsigned char *) name) : (unsigned long) handle,
+                          memory_order_relaxed);
+    atomic_store_explicit(&event->start, start, memory_order_relaxed);
+    atomic_store_explicit(&event->end, end, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/*
+ * Copies the events that are in the ring and not overwritten during the copy to events, and returns their number.
+ */
+static size_t simfsTraceCopyRing(SIMFS_TRACE_RING_TYPE *ring, SIMFS_TRACE_FILE_EVENT_TYPE *events,
+                                 unsigned long *ticks) {
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned long first = head > SIMFS_TRACE_RING_SIZE ? head - SIMFS_TRACE_RING_SIZE : 0;
+
+    for (unsigned long i = first; i < head; i++) {
+        SIMFS_TRACE_EVENT_TYPE *event = &ring->event[i % SIMFS_TRACE_RING_SIZE];
+        SIMFS_TRACE_FILE_EVENT_TYPE *copy = &events[i - first];
+        unsigned long info = atomic_load_explicit(&event->info, memory_order_relaxed);
+        copy->thread = ring->number;
+        copy->operation = (unsigned char) info;
+        copy->error = (unsigned char) (info >> 8);
+        copy->reserved = 0;
+        copy->blocksTouched = (unsigned int) (info >> 32);
+        copy->object = atomic_load_explicit(&event->object, memory_order_relaxed);
+        ticks[2 * (i - first)] = atomic_load_explicit(&event->start, memory_order_relaxed);
+        ticks[2 * (i - first) + 1] = atomic_load_explicit(&event->end, memory_order_relaxed);
+    }
+
+    // everything before the new head minus the ring size may have been overwritten while we were copying
+    atomic_thread_fence(memory_order_acquire);
+    unsigned long newHead = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned long valid = newHead > SIMFS_TRACE_RING_SIZE ? newHead - SIMFS_TRACE_RING_SIZE : 0;
+    if (valid <= first)
+        return head - first;
+    if (valid >= head)
+        return 0;
+
+    size_t dropped = valid - first;
+    memmove(events, events + dropped, (head - valid) * sizeof(SIMFS_TRACE_FILE_EVENT_TYPE));
+    memmove(ticks, ticks + 2 * dropped, 2 * (head - valid) * sizeof(unsigned long));
+    return head - valid;
+}
+
+/*
+ * Saves the events in the rings of all threads to traceFileName. Times are converted to microseconds since the
+ * earliest event in the file.
+ */
+SIMFS_ERROR simfsTraceDump(char *traceFileName) {
+    unsigned int numberOfRings = atomic_load_explicit(&simfsNumberOfTraceRings, memory_order_acquire);
+    SIMFS_TRACE_FILE_EVENT_TYPE *events = malloc((numberOfRings * (size_t) SIMFS_TRACE_RING_SIZE + 1) *
+                                                 sizeof(SIMFS_TRACE_FILE_EVENT_TYPE));
+    unsigned long *ticks = malloc((numberOfRings * (size_t) SIMFS_TRACE_RING_SIZE + 1) * 2 * sizeof(unsigned long));
+    if (events == NULL || ticks == NULL) {
+        free(events);
+        free(ticks);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    size_t numberOfEvents = 0;
+    unsigned int copiedRings = 0;
+    SIMFS_TRACE_RING_TYPE *ring = atomic_load_explicit(&simfsTraceRings, memory_order_acquire);
+    for (; ring != NULL && copiedRings < numberOfRings; ring = ring->next, copiedRings++)
+        numberOfEvents += simfsTraceCopyRing(ring, events + numberOfEvents, ticks + 2 * numberOfEvents);
+
+    unsigned long firstTick = numberOfEvents > 0 ? ticks[0] : 0;
+    for (size_t i = 1; i < numberOfEvents; i++)
+        firstTick = ticks[2 * i] < firstTick ? ticks[2 * i] : firstTick;
+    double microsecondsPerTick = simfsStatsNanosecondsPerTick() / 1000.0;
+    for (size_t i = 0; i < numberOfEvents; i++) {
+        events[i].startMicroseconds = (ticks[2 * i] - firstTick) * microsecondsPerTick;
+        events[i].durationMicroseconds = (ticks[2 * i + 1] - ticks[2 * i]) * microsecondsPerTick;
+    }
+    free(ticks);
+
+    SIMFS_TRACE_FILE_HEADER_TYPE header;
+    memcpy(header.magic, SIMFS_TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.numberOfEvents = numberOfEvents;
+
+    FILE *file = fopen(traceFileName, "wb");
+    if (file == NULL) {
+        free(events);
+        return SIMFS_WRITE_ERROR;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(events, sizeof(SIMFS_TRACE_FILE_EVENT_TYPE), numberOfEvents, file) == numberOfEvents;
+    written = fclose(file) == 0 && written;
+    free(events);
+
+    return written ? SIMFS_NO_ERROR : SIMFS_WRITE_ERROR;
+}
@@ -0,0 +1,90 @@
+#include "simfs.h"
+
+#include <stdio.h>
+
+//
+// converts a trace saved by simfsTraceDump() for viewing
+//
+// usage: simfs_tracedump [--perf] TRACE_FILE
+//
+// The default output is Chrome trace_event JSON, for chrome://tracing or Perfetto: one complete ("X") event per
+// call, with one track per thread. --perf prints one line per call in the layout of perf script instead, so the
+// usual perf script tooling can process it.
+//
+
+static void tracedumpChrome(SIMFS_TRACE_FILE_EVENT_TYPE *events, unsigned long numberOfEvents) {
+    printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (unsigned long i = 0; i < numberOfEvents; i++) {
+        SIMFS_TRACE_FILE_EVENT_TYPE *event = &events[i];
+        printf("  {\"name\": \"%s\", \"cat\": \"simfs\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+               "\"dur\": %.3f, \"args\": {\"object\": \"0x%lx\", \"blocks\": %u, \"error\": %u}}%s\n",
+               simfsOperationName(event->operation), event->thread, event->startMicroseconds,
+               event->durationMicroseconds, event->object, event->blocksTouched, event->error,
+               i + 1 < numberOfEvents ? "," : "");
+    }
+    printf("]}\n");
+}
+
+static void tracedumpPerf(SIMFS_TRACE_FILE_EVENT_TYPE *events, unsigned long numberOfEvents) {
+    for (unsigned long i = 0; i < numberOfEvents; i++) {
+        SIMFS_TRACE_FILE_EVENT_TYPE *event = &events[i];
+        double seconds = event->startMicroseconds / 1e6;
+        printf("simfs %6u/%-6u [000] %.6f: simfs:%s: object=0x%lx blocks=%u error=%u duration_ns=%.0f\n",
+               1, event->thread, seconds, simfsOperationName(event->operation), event->object,
+               event->blocksTouched, event->error, event->durationMicroseconds * 1000.0);
+    }
+}
+
+static int tracedumpCompareEvents(const void *a, const void *b) {
+    double difference = ((const SIMFS_TRACE_FILE_EVENT_TYPE *) a)->startMicroseconds -
+                        ((const SIMFS_TRACE_FILE_EVENT_TYPE *) b)->startMicroseconds;
+    return (difference > 0) - (difference < 0);
+}
+
+int main(int argc, char *argv[]) {
+    bool perf = argc == 3 && strcmp(argv[1], "--perf") == 0;
+    if (argc != 2 && !perf) {
+        fprintf(stderr, "usage: %s [--perf] TRACE_FILE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *traceFileName = argv[argc - 1];
+    FILE *file = fopen(traceFileName, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], traceFileName);
+        return EXIT_FAILURE;
+    }
+
+    SIMFS_TRACE_FILE_HEADER_TYPE header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, SIMFS_TRACE_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s: %s is not a simfs trace\n", argv[0], traceFileName);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    SIMFS_TRACE_FILE_EVENT_TYPE *events = malloc((header.numberOfEvents + 1) * sizeof(SIMFS_TRACE_FILE_EVENT_TYPE));
+    if (events == NULL ||
+        fread(events, sizeof(SIMFS_TRACE_FILE_EVENT_TYPE), header.numberOfEvents, file) != header.numberOfEvents) {
+        fprintf(stderr, "%s: %s is truncated\n", argv[0], traceFileName);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+    fclose(file);
+
+    for (unsigned long i = 0; i < header.numberOfEvents; i++) {
+        if (events[i].operation >= SIMFS_NUMBER_OF_OPERATIONS) {
+            fprintf(stderr, "%s: %s has an unknown operation in event %lu\n", argv[0], traceFileName, i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    qsort(events, header.numberOfEvents, sizeof(SIMFS_TRACE_FILE_EVENT_TYPE), tracedumpCompareEvents);
+    if (perf)
+        tracedumpPerf(events, header.numberOfEvents);
+    else
+        tracedumpChrome(events, header.numberOfEvents);
+
+    free(events);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+#include "simfs.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+//
+// mdtest-style metadata workload
+//
+// Builds a tree of N folders with M files each and runs the phases below against it from K simulated processes.
+// Every process is a thread that calls simfs_debug_set_context() with its own pid, so that its file handles
+// behave like those of a separate process, and works on every K-th folder or file. The volume is a plain volume
+// file; no FUSE mount is involved.
+//
+//   mkdir   create the folders
+//   create  create the files
+//   stat    simfsGetFileInfo on every file
+//   open    simfsOpenFile followed by simfsCloseFile on every file (the pair is timed)
+//   write   replace the content of every file (open and close are not timed)
+//   read    read the content of every file (open and close are not timed)
+//   mixed   random stat / read / write on random files of the process, in the ratio 70 / 20 / 10
+//   delete  delete the files
+//   rmdir   delete the folders
+//
+// For every phase the tool reports the throughput of all processes together and the latency percentiles of
+// the individual calls.
+//
+// usage: simfs_workload [--dirs N] [--files M] [--processes K] [--size BYTES] [--mixed OPS] [--json]
+//                       [--trace TRACE_FILE] [--defragment BLOCKS_PER_SECOND]
+//
+// --trace records every call and saves the last SIMFS_TRACE_RING_SIZE calls of each process to TRACE_FILE for
+// simfs_tracedump
+//
+// --defragment runs the background defragmenter at the given rate during all phases
+//
+
+#define SIMFS_WORKLOAD_FILE_NAME "simfsWorkload.dta"
+#define SIMFS_WORKLOAD_NUMBER_OF_PHASES 9
+
+typedef enum {
+    MKDIR_PHASE,
+    CREATE_PHASE,
+    STAT_PHASE,
+    OPEN_PHASE,
+    WRITE_PHASE,
+    READ_PHASE,
+    MIXED_PHASE,
+    DELETE_PHASE,
+    RMDIR_PHASE
+} SIMFS_WORKLOAD_PHASE_TYPE;
+
+static const char *workloadPhaseNames[SIMFS_WORKLOAD_NUMBER_OF_PHASES] = {
+        "mkdir", "create", "stat", "open", "write", "read", "mixed", "delete", "rmdir"
+};
+
+typedef struct simfs_workload_result_type {
+    size_t numberOfOperations;
+    size_t numberOfErrors;
+    double seconds; // wall clock time of the phase
+    double p50, p90, p99, max; // microseconds per call
+} SIMFS_WORKLOAD_RESULT_TYPE;
+
+//
+// one simulated process
+//
+typedef struct simfs_workload_process_type {
+    pthread_t thread;
+    pid_t pid;
+    SIMFS_WORKLOAD_PHASE_TYPE phase;
+    char *content; // written in the write and mixed phases
+    unsigned int seed;
+    double *latencies; // microseconds per call in the current phase
+    size_t numberOfLatencies;
+    size_t numberOfErrors;
+} SIMFS_WORKLOAD_PROCESS_TYPE;
+
+static int workloadNumberOfFolders = 10;
+static int workloadFilesPerFolder = 20;
+static int workloadNumberOfProcesses = 4;
+static int workloadFileSize = 64;
+static int workloadMixedOperations = 1000; // per process
+
+static SIMFS_MOUNT *workloadMount;
+static SIMFS_WORKLOAD_PROCESS_TYPE *workloadProcesses;
+static SIMFS_WORKLOAD_RESULT_TYPE workloadResults[SIMFS_WORKLOAD_NUMBER_OF_PHASES];
+
+static double workloadNow(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void workloadFolderName(int folder, SIMFS_NAME_TYPE name) {
+    snprintf(name, sizeof(SIMFS_NAME_TYPE), "/mdtest%03d", folder);
+}
+
+static void workloadFileName(int file, SIMFS_NAME_TYPE name) {
+    snprintf(name, sizeof(SIMFS_NAME_TYPE), "/mdtest%03d/file%05d", file / workloadFilesPerFolder,
+             file % workloadFilesPerFolder);
+}
+
+static void workloadRecord(SIMFS_WORKLOAD_PROCESS_TYPE *process, double start, SIMFS_ERROR error) {
+    process->latencies[process->numberOfLatencies++] = (workloadNow() - start) * 1e6;
+    if (error != SIMFS_NO_ERROR)
+        process->numberOfErrors++;
+}
+
+//
+// runs one timed call on a file; open and close around reads and writes are not timed
+//
+static void workloadFileOperation(SIMFS_WORKLOAD_PROCESS_TYPE *process, SIMFS_WORKLOAD_PHASE_TYPE operation,
+                                  int file) {
+    SIMFS_NAME_TYPE name;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_FILE_HANDLE_TYPE handle;
+    char *content = NULL;
+    double start;
+
+    workloadFileName(file, name);
+
+    switch (operation) {
+        case CREATE_PHASE:
+            start = workloadNow();
+            workloadRecord(process, start, simfsCreateFile(workloadMount, name, FILE_CONTENT_TYPE));
+            break;
+        case STAT_PHASE:
+            start = workloadNow();
+            workloadRecord(process, start, simfsGetFileInfo(workloadMount, name, &info));
+            break;
+        case OPEN_PHASE:
+            start = workloadNow();
+            SIMFS_ERROR error = simfsOpenFile(workloadMount, name, &handle);
+            if (error == SIMFS_NO_ERROR)
+                error = simfsCloseFile(workloadMount, handle);
+            workloadRecord(process, start, error);
+            break;
+        case WRITE_PHASE:
+        case READ_PHASE:
+            if (simfsOpenFile(workloadMount, name, &handle) != SIMFS_NO_ERROR) {
+                process->numberOfErrors++;
+                break;
+            }
+            start = workloadNow();
+            if (operation == WRITE_PHASE)
+                workloadRecord(process, start, simfsWriteFile(workloadMount, handle, process->content));
+            else {
+                workloadRecord(process, start, simfsReadFile(workloadMount, handle, &content));
+                free(content);
+            }
+            simfsCloseFile(workloadMount, handle);
+            break;
+        case DELETE_PHASE:
+            start = workloadNow();
+            workloadRecord(process, start, simfsDeleteFile(workloadMount, name));
+            break;
+        default:
+            break;
+    }
+}
+
+static void *workloadProcess(void *arg) {
+    SIMFS_WORKLOAD_PROCESS_TYPE *process = arg;
+    int numberOfFiles = workloadNumberOfFolders * workloadFilesPerFolder;
+    SIMFS_NAME_TYPE name;
+
+    simfs_debug_set_context(process->pid, 1);
+
+    switch (process->phase) {
+        case MKDIR_PHASE:
+        case RMDIR_PHASE:
+            for (int folder = process->pid - 1; folder < workloadNumberOfFolders; folder += workloadNumberOfProcesses) {
+                workloadFolderName(folder, name);
+                double start = workloadNow();
+                workloadRecord(process, start, process->phase == MKDIR_PHASE ?
+                                               simfsCreateFile(workloadMount, name, FOLDER_CONTENT_TYPE) :
+                                               simfsDeleteFile(workloadMount, name));
+            }
+            break;
+        case MIXED_PHASE:
+            for (int i = 0; i < workloadMixedOperations; i++) {
+                // files of the process are those with file % K == pid - 1
+                int numberOfOwnFiles = (numberOfFiles - process->pid + workloadNumberOfProcesses) /
+                                       workloadNumberOfProcesses;
+                if (numberOfOwnFiles == 0)
+                    break;
+                int file = process->pid - 1 + (rand_r(&process->seed) % numberOfOwnFiles) * workloadNumberOfProcesses;
+                int dice = rand_r(&process->seed) % 100;
+                workloadFileOperation(process, dice < 70 ? STAT_PHASE : dice < 90 ? READ_PHASE : WRITE_PHASE, file);
+            }
+            break;
+        default:
+            for (int file = process->pid - 1; file < numberOfFiles; file += workloadNumberOfProcesses)
+                workloadFileOperation(process, process->phase, file);
+            break;
+    }
+
+    simfs_debug_set_context(0, 0);
+    return NULL;
+}
+
+static int workloadCompareLatencies(const void *a, const void *b) {
+    double difference = *(const double *) a - *(const double *) b;
+    return (difference > 0) - (difference < 0);
+}
+
+static void workloadRunPhase(SIMFS_WORKLOAD_PHASE_TYPE phase) {
+    size_t capacity = phase == MIXED_PHASE ? workloadMixedOperations :
+                      phase == MKDIR_PHASE || phase == RMDIR_PHASE ? workloadNumberOfFolders :
+                      workloadNumberOfFolders * workloadFilesPerFolder;
+
+    for (int i = 0; i < workloadNumberOfProcesses; i++) {
+        SIMFS_WORKLOAD_PROCESS_TYPE *process = &workloadProcesses[i];
+        process->phase = phase;
+        process->numberOfLatencies = 0;
+        process->numberOfErrors = 0;
+        process->latencies = malloc((capacity + 1) * sizeof(double));
+        if (process->latencies == NULL) {
+            fprintf(stderr, "simfs_workload: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    double start = workloadNow();
+    for (int i = 0; i < workloadNumberOfProcesses; i++)
+        pthread_create(&workloadProcesses[i].thread, NULL, workloadProcess, &workloadProcesses[i]);
+    for (int i = 0; i < workloadNumberOfProcesses; i++)
+        pthread_join(workloadProcesses[i].thread, NULL);
+
+    SIMFS_WORKLOAD_RESULT_TYPE *result = &workloadResults[phase];
+    result->seconds = workloadNow() - start;
+    result->numberOfOperations = 0;
+    result->numberOfErrors = 0;
+    for (int i = 0; i < workloadNumberOfProcesses; i++) {
+        result->numberOfOperations += workloadProcesses[i].numberOfLatencies;
+        result->numberOfErrors += workloadProcesses[i].numberOfErrors;
+    }
+
+    double *latencies = malloc((result->numberOfOperations + 1) * sizeof(double));
+    if (latencies == NULL) {
+        fprintf(stderr, "simfs_workload: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t numberOfLatencies = 0;
+    for (int i = 0; i < workloadNumberOfProcesses; i++) {
+        memcpy(latencies + numberOfLatencies, workloadProcesses[i].latencies,
+               workloadProcesses[i].numberOfLatencies * sizeof(double));
+        numberOfLatencies += workloadProcesses[i].numberOfLatencies;
+        free(workloadProcesses[i].latencies);
+    }
+
+    qsort(latencies, numberOfLatencies, sizeof(double), workloadCompareLatencies);
+    if (numberOfLatencies > 0) {
+        result->p50 = latencies[(size_t) (0.50 * (numberOfLatencies - 1) + 0.5)];
+        result->p90 = latencies[(size_t) (0.90 * (numberOfLatencies - 1) + 0.5)];
+        result->p99 = latencies[(size_t) (0.99 * (numberOfLatencies - 1) + 0.5)];
+        result->max = latencies[numberOfLatencies - 1];
+    } else
+        result->p50 = result->p90 = result->p99 = result->max = 0;
+    free(latencies);
+}
+
+static void workloadPrintTable(void) {
+    printf("%d folders x %d files, %d processes, %d bytes per file\n", workloadNumberOfFolders,
+           workloadFilesPerFolder, workloadNumberOfProcesses, workloadFileSize);
+    printf("%-8s %8s %8s %12s %10s %10s %10s %10s\n", "phase", "ops", "errors", "ops/s", "p50 us", "p90 us",
+           "p99 us", "max us");
+    for (int phase = 0; phase < SIMFS_WORKLOAD_NUMBER_OF_PHASES; phase++) {
+        SIMFS_WORKLOAD_RESULT_TYPE *result = &workloadResults[phase];
+        printf("%-8s %8zu %8zu %12.0f %10.2f %10.2f %10.2f %10.2f\n", workloadPhaseNames[phase],
+               result->numberOfOperations, result->numberOfErrors, result->numberOfOperations / result->seconds,
+               result->p50, result->p90, result->p99, result->max);
+    }
+}
+
+static void workloadPrintJson(void) {
+    printf("{\n  \"folders\": %d,\n  \"files_per_folder\": %d,\n  \"processes\": %d,\n  \"file_size\": %d,\n"
+           "  \"phases\": [\n", workloadNumberOfFolders, workloadFilesPerFolder, workloadNumberOfProcesses,
+           workloadFileSize);
+    for (int phase = 0; phase < SIMFS_WORKLOAD_NUMBER_OF_PHASES; phase++) {
+        SIMFS_WORKLOAD_RESULT_TYPE *result = &workloadResults[phase];
+        printf("    {\"name\": \"%s\", \"operations\": %zu, \"errors\": %zu, \"ops_per_second\": %.0f, "
+               "\"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f}%s\n",
+               workloadPhaseNames[phase], result->numberOfOperations, result->numberOfErrors,
+               result->numberOfOperations / result->seconds, result->p50, result->p90, result->p99, result->max,
+               phase + 1 < SIMFS_WORKLOAD_NUMBER_OF_PHASES ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    char *traceFileName = NULL;
+    int defragmentRate = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "--dirs") == 0 && i + 1 < argc)
+            workloadNumberOfFolders = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--files") == 0 && i + 1 < argc)
+            workloadFilesPerFolder = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--processes") == 0 && i + 1 < argc)
+            workloadNumberOfProcesses = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+            workloadFileSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--mixed") == 0 && i + 1 < argc)
+            workloadMixedOperations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            traceFileName = argv[++i];
+        else if (strcmp(argv[i], "--defragment") == 0 && i + 1 < argc)
+            defragmentRate = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [--dirs N] [--files M] [--processes K] [--size BYTES] [--mixed OPS] "
+                            "[--json] [--trace TRACE_FILE] [--defragment BLOCKS_PER_SECOND]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (workloadNumberOfFolders < 1 || workloadNumberOfFolders > 1000 || workloadFilesPerFolder < 0 ||
+        workloadFilesPerFolder > 100000 || workloadNumberOfProcesses < 1 || workloadFileSize < 0 ||
+        workloadMixedOperations < 0 || defragmentRate < 0) {
+        fprintf(stderr, "%s: parameter out of range\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    srand(1); // the same content in every run
+    simfsTraceEnable(traceFileName != NULL);
+
+    if (simfsCreateFileSystem(SIMFS_WORKLOAD_FILE_NAME, SIMFS_DEFAULT_NUMBER_OF_BLOCKS) != SIMFS_NO_ERROR ||
+        simfsMountFileSystem(SIMFS_WORKLOAD_FILE_NAME, &workloadMount) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: cannot create the volume %s\n", argv[0], SIMFS_WORKLOAD_FILE_NAME);
+        return EXIT_FAILURE;
+    }
+    if (defragmentRate > 0 && simfsDefragmentStart(workloadMount, defragmentRate) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: cannot start the defragmenter\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    workloadProcesses = calloc(workloadNumberOfProcesses, sizeof(SIMFS_WORKLOAD_PROCESS_TYPE));
+    if (workloadProcesses == NULL)
+        return EXIT_FAILURE;
+    for (int i = 0; i < workloadNumberOfProcesses; i++) {
+        workloadProcesses[i].pid = i + 1;
+        workloadProcesses[i].seed = i + 1;
+        workloadProcesses[i].content = simfsGenerateContent(workloadFileSize + 1); // the size includes the '\0'
+    }
+
+    for (int phase = 0; phase < SIMFS_WORKLOAD_NUMBER_OF_PHASES; phase++)
+        workloadRunPhase(phase);
+
+    for (int i = 0; i < workloadNumberOfProcesses; i++)
+        free(workloadProcesses[i].content);
+    free(workloadProcesses);
+
+    if (simfsUmountFileSystem(workloadMount) != SIMFS_NO_ERROR)
+        return EXIT_FAILURE;
+
+    if (traceFileName != NULL && simfsTraceDump(traceFileName) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: cannot save the trace to %s\n", argv[0], traceFileName);
+        return EXIT_FAILURE;
+    }
+
+    if (json)
+        workloadPrintJson();
+    else
+        workloadPrintTable();
+
+    return EXIT_SUCCESS;
+}
@@ -1,17 +1,50 @@
 #include "simfs.h"
 
 #include <stdio.h>
+#include <sys/stat.h>
 
 #define SIMFS_FILE_NAME "simfsFile.dta"
+#define SIMFS_SECOND_FILE_NAME "simfsSecondFile.dta"
+#define SIMFS_TRACE_FILE_NAME "simfsTrace.trc"
+#define SIMFS_LARGE_FILE_NAME "simfsLargeFile.dta"
+#define SIMFS_LARGE_NUMBER_OF_BLOCKS ((size_t) 1 << 24)
+
+//
+// copies the descriptor of /rewritten until told to stop, counting the copies that match neither of the two contents
+// it is rewritten with
+//
+typedef struct test_descriptor_reader_type {
+    SIMFS_MOUNT *mount;
+    atomic_bool stop;
+    size_t shortSize, longSize;
+    unsigned long reads;
+    unsigned long partial;
+} TEST_DESCRIPTOR_READER_TYPE;
+
+static void *testDescriptorReader(void *arg) {
+    TEST_DESCRIPTOR_READER_TYPE *reader = arg;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+
+    while(!atomic_load(&reader->stop)) {
+        if(simfsGetFileInfo(reader->mount, "/rewritten", &info) != SIMFS_NO_ERROR || info.size != info.storedSize ||
+           (info.size != reader->shortSize && info.size != reader->longSize))
+            reader->partial++;
+        reader->reads++;
+    }
+
+    return NULL;
+}
 
 int main()
 {
 //    srand(time(NULL)); // uncomment to get true random values in get_context()
 
-    if (simfsCreateFileSystem(SIMFS_FILE_NAME) != SIMFS_NO_ERROR)
+    SIMFS_MOUNT *mount;
+
+    if (simfsCreateFileSystem(SIMFS_FILE_NAME, SIMFS_DEFAULT_NUMBER_OF_BLOCKS) != SIMFS_NO_ERROR)
         exit(EXIT_FAILURE);
 
-    if (simfsMountFileSystem(SIMFS_FILE_NAME) != SIMFS_NO_ERROR)
+    if (simfsMountFileSystem(SIMFS_FILE_NAME, &mount) != SIMFS_NO_ERROR)
         exit(EXIT_FAILURE);
 
     // TODO: implement thorough testing of all the functionality
@@ -31,19 +64,246 @@ int main()
     // }
 
     //testing create file FILE_CONTENT_TYPE
-    if(simfsCreateFile("testFileForCreate", FILE_CONTENT_TYPE) == SIMFS_NO_ERROR)
+    if(simfsCreateFile(mount, "testFileForCreate", FILE_CONTENT_TYPE) == SIMFS_NO_ERROR)
         printf("testFileForCreate created successfully!\n" );
-    if(simfsCreateFile("testFileForCreate", FILE_CONTENT_TYPE) != SIMFS_DUPLICATE_ERROR)
+    if(simfsCreateFile(mount, "testFileForCreate", FILE_CONTENT_TYPE) != SIMFS_DUPLICATE_ERROR)
         printf("simfsCreateFile detected duplicate successfully\n");
 
+    //testing get file info
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    if(simfsGetFileInfo(mount, "/testFileForCreate", &info) == SIMFS_NO_ERROR && info.type == FILE_CONTENT_TYPE)
+        printf("simfsGetFileInfo found the test file\n");
+    else
+        printf("simfsGetFileInfo should have found the test file!\n");
+    if(simfsGetFileInfo(mount, "/fileDoesNotExist", &info) == SIMFS_NOT_FOUND_ERROR)
+        printf("simfsGetFileInfo correctly did not find the file!\n");
+
+
+    ///////////////////////////////////////////////////////////
+    //testing open and close file
+    SIMFS_FILE_HANDLE_TYPE handle, secondHandle;
+    simfs_debug_set_context(1, 1);
+    if(simfsOpenFile(mount, "testFileForCreate", &handle) == SIMFS_NO_ERROR &&
+       simfsOpenFile(mount, "testFileForCreate", &secondHandle) == SIMFS_DUPLICATE_ERROR && secondHandle == handle)
+        printf("simfsOpenFile opened the test file once per process\n");
+    else
+        printf("simfsOpenFile should have returned the same handle for the second open!\n");
+    if(simfsOpenFile(mount, "fileDoesNotExist", &secondHandle) == SIMFS_NOT_FOUND_ERROR)
+        printf("simfsOpenFile correctly did not find the file!\n");
+    //testing write and read file
+    char *content = simfsGenerateContent(200); // spans several index blocks
+    char *readContent = NULL;
+    if(simfsWriteFile(mount, handle, content) == SIMFS_NO_ERROR &&
+       simfsReadFile(mount, handle, &readContent) == SIMFS_NO_ERROR && strcmp(content, readContent) == 0 &&
+       simfsGetFileInfo(mount, "/testFileForCreate", &info) == SIMFS_NO_ERROR && info.size == strlen(content))
+        printf("simfsReadFile returned what simfsWriteFile wrote\n");
+    else
+        printf("simfsReadFile should have returned the written content!\n");
+    free(readContent);
+    free(content);
+    if(simfsWriteFile(mount, handle, "short") == SIMFS_NO_ERROR &&
+       simfsReadFile(mount, handle, &readContent) == SIMFS_NO_ERROR && strcmp(readContent, "short") == 0)
+        printf("simfsWriteFile replaced the content of the file\n");
+    else
+        printf("simfsWriteFile should have replaced the content of the file!\n");
+    free(readContent);
+
+    //testing checksums; a read fails on a damaged data block, unless the block was verified before in
+    //SIMFS_VERIFY_ONCE mode
+    size_t shortBlock = 0;
+    while(shortBlock < simfsVolumeBlocks(mount->volume) &&
+          (mount->volume->block[shortBlock].type != DATA_CONTENT_TYPE ||
+           memcmp(mount->volume->block[shortBlock].content.data, "short", 5) != 0))
+        shortBlock++;
+    if(simfsCrc32c(0, "123456789", 9) == 0xE3069283 && shortBlock < simfsVolumeBlocks(mount->volume)) {
+        readContent = NULL;
+        simfsSetVerifyMode(mount, SIMFS_VERIFY_ALWAYS);
+        mount->volume->block[shortBlock].content.data[0][0] ^= 1;
+        SIMFS_ERROR damagedRead = simfsReadFile(mount, handle, &readContent);
+        mount->volume->block[shortBlock].content.data[0][0] ^= 1;
+        simfsSetVerifyMode(mount, SIMFS_VERIFY_ONCE);
+        SIMFS_ERROR verifiedRead = simfsReadFile(mount, handle, &readContent);
+        free(readContent);
+        mount->volume->block[shortBlock].content.data[0][0] ^= 1;
+        SIMFS_ERROR onceRead = simfsReadFile(mount, handle, &readContent);
+        free(readContent);
+        mount->volume->block[shortBlock].content.data[0][0] ^= 1;
+        if(damagedRead == SIMFS_READ_ERROR && verifiedRead == SIMFS_NO_ERROR && onceRead == SIMFS_NO_ERROR)
+            printf("simfsReadFile checked the data block against its checksum (%s CRC32C)\n",
+                   simfsCrc32cIsAccelerated() ? "SSE4.2" : "table-driven");
+        else
+            printf("simfsReadFile should have failed on the damaged data block only!\n");
+    } else
+        printf("simfsCrc32c should have computed the CRC32C check value!\n");
+    //testing compression; repetitive content is stored in fewer blocks, random content as it is
+    char logContent[700] = "";
+    while(strlen(logContent) + 40 < sizeof(logContent))
+        sprintf(logContent + strlen(logContent), "[%zu] INFO simfs: block written\n", strlen(logContent) % 7);
+    content = simfsGenerateContent(300);
+    SIMFS_FILE_DESCRIPTOR_TYPE randomInfo;
+    if(simfsSetFileCompression(mount, "/testFileForCreate", true) == SIMFS_NO_ERROR &&
+       simfsWriteFile(mount, handle, logContent) == SIMFS_NO_ERROR &&
+       simfsReadFile(mount, handle, &readContent) == SIMFS_NO_ERROR && strcmp(readContent, logContent) == 0 &&
+       simfsGetFileInfo(mount, "/testFileForCreate", &info) == SIMFS_NO_ERROR && info.size == strlen(logContent) &&
+       info.storedSize * 4 < info.size && simfsWriteFile(mount, handle, content) == SIMFS_NO_ERROR &&
+       simfsGetFileInfo(mount, "/testFileForCreate", &randomInfo) == SIMFS_NO_ERROR &&
+       randomInfo.storedSize == randomInfo.size)
+        printf("simfsWriteFile compressed %zu bytes of log lines to %zu\n", info.size, info.storedSize);
+    else
+        printf("simfsWriteFile should have compressed the log lines only!\n");
+    free(readContent);
+    free(content);
+    simfsSetFileCompression(mount, "/testFileForCreate", false);
+    if(simfsCloseFile(mount, handle) == SIMFS_NO_ERROR && simfsCloseFile(mount, handle) == SIMFS_NOT_FOUND_ERROR)
+        printf("simfsCloseFile closed the test file\n");
+    else
+        printf("simfsCloseFile should have closed the test file exactly once!\n");
+    simfs_debug_set_context(0, 0);
+
+    SIMFS_MEMORY_USAGE_TYPE usage;
+    if(simfsGetMemoryUsage(mount, &usage) == SIMFS_NO_ERROR)
+        printf("memory usage: directory %zu, open files %zu, processes %zu, context %zu, volume %zu bytes\n",
+               usage.directory, usage.openFiles, usage.processes, usage.context, usage.volume);
+
+    //testing the volume analysis; a scan split among threads must agree with a single-threaded one
+    SIMFS_ANALYSIS_TYPE analysis, singleThreadAnalysis;
+    if(simfsAnalyzeVolume(mount->volume, 8, &analysis) == SIMFS_NO_ERROR &&
+       simfsAnalyzeVolume(mount->volume, 1, &singleThreadAnalysis) == SIMFS_NO_ERROR &&
+       memcmp(&analysis, &singleThreadAnalysis, sizeof(analysis)) == 0 && analysis.numberOfFiles == 1 &&
+       analysis.numberOfFolders == 1 && analysis.usedBlocks + analysis.freeBlocks == SIMFS_DEFAULT_NUMBER_OF_BLOCKS)
+        printf("simfsAnalyzeVolume: %zu blocks used, %zu extents, %zu free runs, largest %zu blocks\n",
+               analysis.usedBlocks, analysis.numberOfExtents, analysis.numberOfFreeRuns, analysis.largestFreeRun);
+    else
+        printf("simfsAnalyzeVolume should have found the root folder and the test file!\n");
+
+    //testing the volume check and repair on a damaged copy of the volume: a stray used bit and a data reference
+    //out of range
+    SIMFS_CHECK_TYPE check;
+    SIMFS_REPAIR_TYPE repair;
+    SIMFS_VOLUME *damaged = simfsVolumeCopy(mount->volume);
+    damaged->mapChecksum = simfsMapChecksum(damaged); // as unmounting would
+    bool wasClean = simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR && simfsCheckIsClean(&check);
+    for(size_t block = 0; block < simfsVolumeBlocks(damaged); block++) {
+        if(damaged->block[block].type == FILE_CONTENT_TYPE &&
+           ((unsigned char) damaged->bitvector[block / 8] & (0x80 >> (block % 8))) != 0) {
+            SIMFS_INDEX_TYPE indexBlock = damaged->block[block].content.fileDescriptor.block_ref;
+            damaged->block[indexBlock].content.index[0] = (SIMFS_INDEX_TYPE) simfsVolumeBlocks(damaged);
+            break;
+        }
+    }
+    simfsSetBit((unsigned char *) damaged->bitvector, simfsVolumeBlocks(damaged) - 1);
+    if(wasClean && simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR && check.outOfRangeReferences == 1 &&
+       check.orphanedBlocks >= 2 && check.checksumMismatches >= 2 &&
+       simfsRepairVolume(damaged, &repair) == SIMFS_NO_ERROR && repair.truncatedFiles == 1 && simfsCheckVolume(damaged, 1, &check) == SIMFS_NO_ERROR &&
+       simfsCheckIsClean(&check))
+        printf("simfsRepairVolume truncated %zu files and freed %zu blocks\n", repair.truncatedFiles,
+               repair.freedBlocks);
+    else
+        printf("simfsCheckVolume should have found the damage and simfsRepairVolume should have fixed it!\n");
+    simfsVolumeFree(damaged);
+
+    //testing that a lock-free reader never copies a descriptor that a write has changed only in part
+    SIMFS_FILE_HANDLE_TYPE rewrittenHandle;
+    simfs_debug_set_context(1, 1);
+    char *shortContent = simfsGenerateContent(100), *longContent = simfsGenerateContent(200);
+    simfsCreateFile(mount, "rewritten", FILE_CONTENT_TYPE);
+    simfsOpenFile(mount, "rewritten", &rewrittenHandle);
+    simfsWriteFile(mount, rewrittenHandle, shortContent);
+    TEST_DESCRIPTOR_READER_TYPE descriptorReader = {.mount = mount, .shortSize = strlen(shortContent),
+                                                    .longSize = strlen(longContent), .reads = 0, .partial = 0};
+    atomic_init(&descriptorReader.stop, false);
+    pthread_t readerThread;
+    pthread_create(&readerThread, NULL, testDescriptorReader, &descriptorReader);
+    for(int i = 0; i < 2000; i++) {
+        simfsWriteFile(mount, rewrittenHandle, i % 2 == 0 ? longContent : shortContent);
+        if(i % 16 == 0)
+            sched_yield(); // lets the reader run between the writes on a single processor
+    }
+    atomic_store(&descriptorReader.stop, true);
+    pthread_join(readerThread, NULL);
+    if(descriptorReader.reads > 0 && descriptorReader.partial == 0)
+        printf("simfsGetFileInfo copied %lu descriptors of a file being rewritten, none changed in part\n",
+               descriptorReader.reads);
+    else
+        printf("simfsGetFileInfo should never have copied a descriptor that a write changed in part!\n");
+    free(shortContent);
+    free(longContent);
+    simfsCloseFile(mount, rewrittenHandle);
+    simfsDeleteFile(mount, "rewritten");
+    simfs_debug_set_context(0, 0);
+
+    //testing the defragmenter; growing a file in place when another file follows it on the volume splits it
+    SIMFS_FILE_HANDLE_TYPE fragmentedHandle, neighbourHandle;
+    simfs_debug_set_context(1, 1);
+    content = simfsGenerateContent(150);
+    simfsCreateFile(mount, "fragmented", FILE_CONTENT_TYPE);
+    simfsCreateFile(mount, "neighbour", FILE_CONTENT_TYPE);
+    simfsOpenFile(mount, "fragmented", &fragmentedHandle);
+    simfsOpenFile(mount, "neighbour", &neighbourHandle);
+    simfsWriteFile(mount, fragmentedHandle, "thirty bytes of content here..");
+    simfsWriteFile(mount, neighbourHandle, "thirty bytes of content here..");
+    simfsWriteFileAt(mount, fragmentedHandle, 0, content, strlen(content));
+    size_t fragmentedBefore = simfsAnalyzeVolume(mount->volume, 1, &analysis) == SIMFS_NO_ERROR ?
+                              analysis.numberOfFragmentedFiles : 0;
+    if(fragmentedBefore > 0 && simfsDefragment(mount, SIMFS_DEFAULT_NUMBER_OF_BLOCKS) > 0 &&
+       simfsAnalyzeVolume(mount->volume, 1, &analysis) == SIMFS_NO_ERROR && analysis.numberOfFragmentedFiles == 0 &&
+       simfsReadFile(mount, fragmentedHandle, &readContent) == SIMFS_NO_ERROR && strcmp(content, readContent) == 0)
+        printf("simfsDefragment made %zu fragmented files contiguous\n", fragmentedBefore);
+    else
+        printf("simfsDefragment should have made the fragmented file contiguous!\n");
+    free(readContent);
+    free(content);
+    if(simfsDefragmentStart(mount, 1000) == SIMFS_NO_ERROR &&
+       simfsDefragmentStart(mount, 1000) == SIMFS_DUPLICATE_ERROR && simfsDefragmentStop(mount) == SIMFS_NO_ERROR && simfsDefragmentStop(mount) == SIMFS_NOT_FOUND_ERROR)
+        printf("simfsDefragmentStart started the background defragmenter once\n");
+    else
+        printf("simfsDefragmentStart should have started exactly one background defragmenter!\n");
+    simfsCloseFile(mount, fragmentedHandle);
+    simfsCloseFile(mount, neighbourHandle);
+    simfsDeleteFile(mount, "fragmented");
+    simfsDeleteFile(mount, "neighbour");
+    simfs_debug_set_context(0, 0);
+
+    //testing statistics and the stats file
+    SIMFS_STATS_TYPE stats;
+    char *statsText = NULL;
+    simfs_debug_set_context(1, 1);
+    if(simfsGetStats(&stats) == SIMFS_NO_ERROR && stats.operations[SIMFS_CREATE_OPERATION].count >= 2 &&
+       stats.operations[SIMFS_CREATE_OPERATION].errors >= 1 && stats.counter[SIMFS_BYTES_WRITTEN_COUNTER] > 0)
+        printf("simfsGetStats counted the calls so far\n");
+    else
+        printf("simfsGetStats should have counted the calls so far!\n");
+    if(simfsOpenFile(mount, SIMFS_STATS_FILE_NAME, &handle) == SIMFS_NO_ERROR &&
+       simfsReadFile(mount, handle, &statsText) == SIMFS_NO_ERROR &&
+       simfsWriteFile(mount, handle, "x") == SIMFS_ACCESS_ERROR && simfsCloseFile(mount, handle) == SIMFS_NO_ERROR)
+        printf("%s", statsText);
+    else
+        printf("The stats file should be readable and read-only!\n");
+    free(statsText);
+    simfs_debug_set_context(0, 0);
+
+    //testing tracing
+    SIMFS_TRACE_FILE_HEADER_TYPE traceHeader;
+    simfsTraceEnable(true);
+    simfsGetFileInfo(mount, "/testFileForCreate", &info);
+    simfsTraceEnable(false);
+    simfsGetFileInfo(mount, "/testFileForCreate", &info);
+    FILE *traceFile = NULL;
+    if(simfsTraceDump(SIMFS_TRACE_FILE_NAME) == SIMFS_NO_ERROR && (traceFile = fopen(SIMFS_TRACE_FILE_NAME, "rb")) &&
+       fread(&traceHeader, sizeof(traceHeader), 1, traceFile) == 1 && traceHeader.numberOfEvents == 1)
+        printf("simfsTraceDump saved the one traced call\n");
+    else
+        printf("simfsTraceDump should have saved exactly one call!\n");
+    if(traceFile != NULL)
+        fclose(traceFile);
 
     ///////////////////////////////////////////////////////////
     //testing delete file
-    if(simfsDeleteFile("fileDoesNotExist") == SIMFS_NOT_FOUND_ERROR)
+    if(simfsDeleteFile(mount, "fileDoesNotExist") == SIMFS_NOT_FOUND_ERROR)
         printf("We correctly did not find the file!\n");
     else
         printf("Should have produced a not found error!");
-    if(simfsDeleteFile("/testFileForCreate") == SIMFS_NO_ERROR)
+    if(simfsDeleteFile(mount, "/testFileForCreate") == SIMFS_NO_ERROR)
         printf("Correctly deleted the test file!");
     else
         printf("We did not correctly delete the test file!");
@@ -51,17 +311,458 @@ int main()
     // Also to test deleting a non empty folder
 
 
+    ///////////////////////////////////////////////////////////
+    //testing two volumes mounted at the same time
+    SIMFS_MOUNT *secondMount;
+    if (simfsCreateFileSystem(SIMFS_SECOND_FILE_NAME, SIMFS_DEFAULT_NUMBER_OF_BLOCKS) != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    //testing that a new volume file, written only where it is not zero, has its full size and checks clean
+    FILE *newVolumeFile = fopen(SIMFS_SECOND_FILE_NAME, "rb");
+    damaged = NULL;
+    if(newVolumeFile != NULL && simfsVolumeRead(newVolumeFile, &damaged) == SIMFS_NO_ERROR &&
+       simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR &&
+       simfsCheckIsClean(&check) && damaged->mapChecksum == simfsMapChecksum(damaged))
+        printf("\nsimfsCreateFileSystem wrote a complete volume with a clean root folder\n");
+    else
+        printf("simfsCreateFileSystem should have written a complete volume that checks clean!\n");
+    if(newVolumeFile != NULL)
+        fclose(newVolumeFile);
+    simfsVolumeFree(damaged);
+    //testing that a large new volume is a sparse file of its full size holding only the blocks that were written
+    SIMFS_VOLUME_LAYOUT_TYPE largeLayout;
+    struct stat largeStatus;
+    if(simfsVolumeLayout(SIMFS_LARGE_NUMBER_OF_BLOCKS, &largeLayout) &&
+       simfsCreateFileSystem(SIMFS_LARGE_FILE_NAME, SIMFS_LARGE_NUMBER_OF_BLOCKS) == SIMFS_NO_ERROR &&
+       stat(SIMFS_LARGE_FILE_NAME, &largeStatus) == 0 && largeStatus.st_size == (off_t) largeLayout.size &&
+       (size_t) largeStatus.st_blocks * 512 < largeLayout.size / 1024)
+        printf("simfsCreateFileSystem made a volume of %zu bytes that takes %lld bytes on disk\n",
+               largeLayout.size, (long long) largeStatus.st_blocks * 512);
+    else
+        printf("simfsCreateFileSystem should have made a large volume as a sparse file!\n");
+    remove(SIMFS_LARGE_FILE_NAME);
+    if (simfsMountFileSystem(SIMFS_SECOND_FILE_NAME, &secondMount) != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    if(simfsCreateFile(secondMount, "onlyOnSecondVolume", FILE_CONTENT_TYPE) == SIMFS_NO_ERROR &&
+       simfsGetFileInfo(mount, "/onlyOnSecondVolume", &info) == SIMFS_NOT_FOUND_ERROR &&
+       simfsGetFileInfo(secondMount, "/onlyOnSecondVolume", &info) == SIMFS_NO_ERROR)
+        printf("\nVolumes are independent of each other\n");
+    else
+        printf("\nA file created on one volume should not show up on the other!\n");
+    //testing deduplication; two copies of the same content share their data blocks until one is rewritten
+    SIMFS_FILE_HANDLE_TYPE copyHandle, originalHandle;
+    SIMFS_DEDUP_STATS_TYPE dedupStats, rewrittenStats;
+    simfs_debug_set_context(1, 1);
+    content = simfsGenerateContent(100);
+    readContent = NULL;
+    simfsCreateFile(secondMount, "original", FILE_CONTENT_TYPE);
+    simfsCreateFile(secondMount, "copy", FILE_CONTENT_TYPE);
+    simfsOpenFile(secondMount, "original", &originalHandle);
+    simfsOpenFile(secondMount, "copy", &copyHandle);
+    if(simfsGetDedupStats(secondMount, &dedupStats) == SIMFS_NOT_FOUND_ERROR &&
+       simfsEnableDeduplication(secondMount) == SIMFS_NO_ERROR &&
+       simfsWriteFile(secondMount, originalHandle, content) == SIMFS_NO_ERROR &&
+       simfsWriteFile(secondMount, copyHandle, content) == SIMFS_NO_ERROR &&
+       simfsGetDedupStats(secondMount, &dedupStats) == SIMFS_NO_ERROR && dedupStats.ratio >= 2 &&
+       simfsWriteFile(secondMount, copyHandle, "rewritten") == SIMFS_NO_ERROR &&
+       simfsGetDedupStats(secondMount, &rewrittenStats) == SIMFS_NO_ERROR && rewrittenStats.sharedBlocks == 0 &&
+       simfsReadFile(secondMount, originalHandle, &readContent) == SIMFS_NO_ERROR && strcmp(content, readContent) == 0)
+        printf("simfsWriteFile shared %zu of %zu data block references\n", dedupStats.sharedBlocks,
+               dedupStats.references);
+    else
+        printf("simfsWriteFile should have shared the data blocks of the copy until it was rewritten!\n");
+    free(readContent);
+    simfsWriteFile(secondMount, copyHandle, content);
+    damaged = simfsVolumeCopy(secondMount->volume);
+    damaged->mapChecksum = simfsMapChecksum(damaged);
+    if(simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR && simfsCheckIsClean(&check))
+        printf("simfsCheckVolume accepted the shared data blocks\n");
+    else
+        printf("simfsCheckVolume should have accepted the shared data blocks!\n");
+    simfsVolumeFree(damaged);
+    free(content);
+    simfsCloseFile(secondMount, originalHandle);
+    simfsCloseFile(secondMount, copyHandle);
+    simfs_debug_set_context(0, 0);
+    if (simfsUmountFileSystem(secondMount) != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    if (simfsMountFileSystem(SIMFS_SECOND_FILE_NAME, &secondMount) != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    if(simfsGetDedupStats(secondMount, &rewrittenStats) == SIMFS_NO_ERROR &&
+       rewrittenStats.references == dedupStats.references && rewrittenStats.blocks == dedupStats.blocks)
+        printf("simfsMountFileSystem rebuilt the deduplication index\n");
+    else
+        printf("simfsMountFileSystem should have rebuilt the deduplication index!\n");
+    //testing snapshots; a snapshot keeps the volume as it was while the live files change
+    unsigned int snapshot;
+    SIMFS_MOUNT *snapshotMount;
+    simfs_debug_set_context(1, 1);
+    content = simfsGenerateContent(100);
+    readContent = NULL;
+    simfsOpenFile(secondMount, "original", &originalHandle);
+    simfsWriteFile(secondMount, originalHandle, content);
+    bool snapshotWorks = simfsCreateSnapshot(secondMount, &snapshot) == SIMFS_NO_ERROR &&
+                         simfsWriteFile(secondMount, originalHandle, "rewritten") == SIMFS_NO_ERROR &&
+                         simfsDeleteFile(secondMount, "copy") == SIMFS_NO_ERROR &&
+                         simfsCreateFile(secondMount, "afterSnapshot", FILE_CONTENT_TYPE) == SIMFS_NO_ERROR &&
+                         simfsMountSnapshot(secondMount, snapshot, &snapshotMount) == SIMFS_NO_ERROR;
+    if (snapshotWorks) {
+        snapshotWorks = simfsOpenFile(snapshotMount, "original", &copyHandle) == SIMFS_NO_ERROR &&
+                        simfsReadFile(snapshotMount, copyHandle, &readContent) == SIMFS_NO_ERROR &&
+                        strcmp(content, readContent) == 0 &&
+                        simfsWriteFile(snapshotMount, copyHandle, "rewritten") == SIMFS_ACCESS_ERROR &&
+                        simfsGetFileInfo(snapshotMount, "/copy", &info) == SIMFS_NO_ERROR &&
+                        simfsGetFileInfo(snapshotMount, "/afterSnapshot", &info) == SIMFS_NOT_FOUND_ERROR;
+        simfsCloseFile(snapshotMount, copyHandle);
+        simfsUmountFileSystem(snapshotMount);
+    }
+    free(readContent);
+    readContent = NULL;
+    snapshotWorks = snapshotWorks && simfsReadFile(secondMount, originalHandle, &readContent) == SIMFS_NO_ERROR &&
+                    strcmp("rewritten", readContent) == 0;
+    simfsCloseFile(secondMount, originalHandle);
+    simfsEpochSynchronize(); // the deleted file leaves its blocks to the snapshot
+    damaged = simfsVolumeCopy(secondMount->volume);
+    damaged->mapChecksum = simfsMapChecksum(damaged);
+    snapshotWorks = snapshotWorks && simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR &&
+                    simfsCheckIsClean(&check) && simfsDeleteSnapshot(secondMount, snapshot) == SIMFS_NO_ERROR &&
+                    simfsDeleteSnapshot(secondMount, snapshot) == SIMFS_NOT_FOUND_ERROR;
+    simfsVolumeFree(damaged);
+    damaged = simfsVolumeCopy(secondMount->volume);
+    damaged->mapChecksum = simfsMapChecksum(damaged);
+    if(snapshotWorks && simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR && simfsCheckIsClean(&check))
+        printf("simfsMountSnapshot read the files as they were when the snapshot was taken\n");
+    else
+        printf("simfsMountSnapshot should have read the files as they were when the snapshot was taken!\n");
+    simfsVolumeFree(damaged);
+    free(readContent);
+    free(content);
+    //testing sparse files; a file grows by a hole that reads as zeros, and a ranged write only fills its blocks
+    SIMFS_FILE_HANDLE_TYPE sparseHandle;
+    char zeros[1000] = {0};
+    readContent = NULL;
+    simfsCreateFile(secondMount, "sparse", FILE_CONTENT_TYPE);
+    simfsOpenFile(secondMount, "sparse", &sparseHandle);
+    bool sparseWorks = simfsTruncateFile(secondMount, sparseHandle, 1000) == SIMFS_NO_ERROR &&
+                       simfsGetFileInfo(secondMount, "/sparse", &info) == SIMFS_NO_ERROR && info.size == 1000 &&
+                       simfsReadFile(secondMount, sparseHandle, &readContent) == SIMFS_NO_ERROR &&
+                       memcmp(readContent, zeros, 1000) == 0;
+    free(readContent);
+    readContent = NULL;
+    sparseWorks = sparseWorks && simfsWriteFileAt(secondMount, sparseHandle, 2000, "", 0) == SIMFS_NO_ERROR &&
+                  simfsGetFileInfo(secondMount, "/sparse", &info) == SIMFS_NO_ERROR && info.size == 1000 &&
+                  simfsWriteFileAt(secondMount, sparseHandle, 500, "hello", 5) == SIMFS_NO_ERROR &&
+                  simfsReadFile(secondMount, sparseHandle, &readContent) == SIMFS_NO_ERROR &&
+                  memcmp(readContent + 500, "hello", 5) == 0 && memcmp(readContent, zeros, 500) == 0 &&
+                  memcmp(readContent + 505, zeros, 495) == 0;
+    free(readContent);
+    readContent = NULL;
+    damaged = simfsVolumeCopy(secondMount->volume);
+    damaged->mapChecksum = simfsMapChecksum(damaged);
+    sparseWorks = sparseWorks && simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR &&
+                  simfsCheckIsClean(&check) && simfsAnalyzeVolume(damaged, 1, &analysis) == SIMFS_NO_ERROR &&
+                  analysis.numberOfHoles >= 70 &&
+                  simfsPunchHole(secondMount, sparseHandle, 490, 30) == SIMFS_NO_ERROR &&
+                  simfsReadFile(secondMount, sparseHandle, &readContent) == SIMFS_NO_ERROR &&
+                  memcmp(readContent, zeros, 1000) == 0 &&
+                  simfsTruncateFile(secondMount, sparseHandle, 3) == SIMFS_NO_ERROR &&
+                  simfsGetFileInfo(secondMount, "/sparse", &info) == SIMFS_NO_ERROR && info.size == 3;
+    simfsVolumeFree(damaged);
+    damaged = simfsVolumeCopy(secondMount->volume);
+    damaged->mapChecksum = simfsMapChecksum(damaged);
+    if(sparseWorks && simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR && simfsCheckIsClean(&check))
+        printf("simfsWriteFileAt filled a hole of a sparse file that simfsPunchHole cleared again\n");
+    else
+        printf("simfsWriteFileAt should have filled a hole of a sparse file that simfsPunchHole cleared again!\n");
+    free(readContent);
+    simfsCloseFile(secondMount, sparseHandle);
+    //testing preallocation; a write into blocks reserved past the end of a file takes none from the allocator
+    SIMFS_ANALYSIS_TYPE reservedAnalysis;
+    content = simfsGenerateContent(140);
+    readContent = NULL;
+    simfsCreateFile(secondMount, "reserved", FILE_CONTENT_TYPE);
+    simfsOpenFile(secondMount, "reserved", &sparseHandle);
+    bool fallocateWorks = simfsFallocate(secondMount, sparseHandle, 0, 140, SIMFS_FALLOCATE_KEEP_SIZE) ==
+                          SIMFS_NO_ERROR &&
+                          simfsGetFileInfo(secondMount, "/reserved", &info) == SIMFS_NO_ERROR && info.size == 0 &&
+                          simfsAnalyzeVolume(secondMount->volume, 1, &analysis) == SIMFS_NO_ERROR &&
+                          analysis.blocksByType[UNWRITTEN_CONTENT_TYPE] == 10 &&
+                          simfsWriteFileAt(secondMount, sparseHandle, 0, content, 140) == SIMFS_NO_ERROR &&
+                          simfsAnalyzeVolume(secondMount->volume, 1, &reservedAnalysis) == SIMFS_NO_ERROR &&
+                          reservedAnalysis.freeBlocks == analysis.freeBlocks &&
+                          simfsReadFile(secondMount, sparseHandle, &readContent) == SIMFS_NO_ERROR &&
+                          strcmp(content, readContent) == 0 &&
+                          simfsFallocate(secondMount, sparseHandle, 140, 20, 0) == SIMFS_NO_ERROR &&
+                          simfsGetFileInfo(secondMount, "/reserved", &info) == SIMFS_NO_ERROR && info.size == 160;
+    simfsVolumeFree(damaged);
+    damaged = simfsVolumeCopy(secondMount->volume);
+    damaged->mapChecksum = simfsMapChecksum(damaged);
+    if(fallocateWorks && simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR && simfsCheckIsClean(&check))
+        printf("simfsFallocate reserved the blocks that simfsWriteFileAt filled\n");
+    else
+        printf("simfsFallocate should have reserved the blocks that simfsWriteFileAt filled!\n");
+    free(readContent);
+    readContent = NULL;
+    //testing online resizing; shrinking to one allocation group moves the blocks of the files out of the others,
+    //the volume grows past the size of a new one, and the volume file is cut and extended with the image
+    SIMFS_VOLUME_LAYOUT_TYPE smallLayout, fullLayout;
+    struct stat smallFile, fullFile;
+    simfsVolumeLayout(SIMFS_BLOCKS_PER_ALLOCATION_GROUP, &smallLayout);
+    simfsVolumeLayout(4 * SIMFS_DEFAULT_NUMBER_OF_BLOCKS, &fullLayout);
+    bool resizeWorks = simfsResizeVolume(secondMount, 100) == SIMFS_WRITE_ERROR &&
+                       simfsResizeVolume(secondMount, SIMFS_BLOCKS_PER_ALLOCATION_GROUP) == SIMFS_NO_ERROR &&
+                       secondMount->volume->imageSize == smallLayout.size &&
+                       stat(SIMFS_SECOND_FILE_NAME, &smallFile) == 0 && smallFile.st_size == smallLayout.size &&
+                       simfsReadFile(secondMount, sparseHandle, &readContent) == SIMFS_NO_ERROR &&
+                       memcmp(content, readContent, 140) == 0 &&
+                       simfsGetFileInfo(secondMount, "/original", &info) == SIMFS_NO_ERROR &&
+                       simfsAnalyzeVolume(secondMount->volume, 1, &analysis) == SIMFS_NO_ERROR &&
+                       analysis.usedBlocks + analysis.freeBlocks == SIMFS_BLOCKS_PER_ALLOCATION_GROUP;
+    simfsVolumeFree(damaged);
+    damaged = simfsVolumeCopy(secondMount->volume);
+    damaged->mapChecksum = simfsMapChecksum(damaged);
+    resizeWorks = resizeWorks && simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR &&
+                  simfsCheckIsClean(&check) &&
+                  simfsResizeVolume(secondMount, 4 * SIMFS_DEFAULT_NUMBER_OF_BLOCKS) == SIMFS_NO_ERROR &&
+                  secondMount->volume->imageSize == fullLayout.size &&
+                  stat(SIMFS_SECOND_FILE_NAME, &fullFile) == 0 && fullFile.st_size == fullLayout.size &&
+                  simfsCreateFile(secondMount, "afterGrowing", FILE_CONTENT_TYPE) == SIMFS_NO_ERROR &&
+                  simfsAnalyzeVolume(secondMount->volume, 1, &analysis) == SIMFS_NO_ERROR &&
+                  analysis.usedBlocks + analysis.freeBlocks == 4 * SIMFS_DEFAULT_NUMBER_OF_BLOCKS;
+    simfsVolumeFree(damaged);
+    damaged = simfsVolumeCopy(secondMount->volume);
+    damaged->mapChecksum = simfsMapChecksum(damaged);
+    if(resizeWorks && simfsCheckVolume(damaged, 8, &check) == SIMFS_NO_ERROR && simfsCheckIsClean(&check))
+        printf("simfsResizeVolume shrank the volume file to %lld bytes and grew it to %lld with the files in place\n",
+               (long long) smallFile.st_size, (long long) fullFile.st_size);
+    else
+        printf("simfsResizeVolume should have shrunk and grown the volume and its file with the files in place!\n");
+    simfsVolumeFree(damaged);
+    free(readContent);
+    free(content);
+    simfsCloseFile(secondMount, sparseHandle);
+    simfs_debug_set_context(0, 0);
+    if (simfsUmountFileSystem(secondMount) != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+
     ///////////////////////////////////////////////////////////
 
-    if (simfsUmountFileSystem(SIMFS_FILE_NAME) != SIMFS_NO_ERROR)
+    if (simfsUmountFileSystem(mount) != SIMFS_NO_ERROR)
         exit(EXIT_FAILURE);
 
-    if (simfsMountFileSystem(SIMFS_FILE_NAME) != SIMFS_NO_ERROR)
+    if (simfsMountFileSystem(SIMFS_FILE_NAME, &mount) != SIMFS_NO_ERROR)
         exit(EXIT_FAILURE);
 
-    if (simfsUmountFileSystem(SIMFS_FILE_NAME) != SIMFS_NO_ERROR)
+    if (simfsUmountFileSystem(mount) != SIMFS_NO_ERROR)
         exit(EXIT_FAILURE);
 
+    //testing lazy mounting; folders are loaded as paths go through them, and the changes are saved on unmounting
+    SIMFS_FILE_DESCRIPTOR_TYPE lazyInfo;
+    SIMFS_FILE_HANDLE_TYPE lazyHandle;
+    char *lazyContent = NULL;
+    simfs_debug_set_context(1, 1);
+    bool lazyWorks = simfsMountFileSystemLazy(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                     simfsCreateFile(mount, "/lazyFolder", FOLDER_CONTENT_TYPE) == SIMFS_NO_ERROR &&
+                     simfsCreateFile(mount, "/lazyFolder/inner", FOLDER_CONTENT_TYPE) == SIMFS_NO_ERROR &&
+                     simfsCreateFile(mount, "/lazyFolder/inner/file", FILE_CONTENT_TYPE) == SIMFS_NO_ERROR &&
+                     simfsOpenFile(mount, "/lazyFolder/inner/file", &lazyHandle) == SIMFS_NO_ERROR &&
+                     simfsWriteFile(mount, lazyHandle, "lazily mounted") == SIMFS_NO_ERROR &&
+                     simfsCloseFile(mount, lazyHandle) == SIMFS_NO_ERROR &&
+                     simfsUmountFileSystem(mount) == SIMFS_NO_ERROR;
+    lazyWorks = lazyWorks && simfsMountFileSystemLazy(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                simfsCreateFile(mount, "/lazyFolder/inner/file", FILE_CONTENT_TYPE) == SIMFS_DUPLICATE_ERROR &&
+                simfsDeleteFile(mount, "/lazyFolder/inner") == SIMFS_NOT_EMPTY_ERROR &&
+                simfsOpenFile(mount, "/lazyFolder/inner/file", &lazyHandle) == SIMFS_NO_ERROR &&
+                simfsReadFile(mount, lazyHandle, &lazyContent) == SIMFS_NO_ERROR &&
+                strcmp(lazyContent, "lazily mounted") == 0 &&
+                simfsCloseFile(mount, lazyHandle) == SIMFS_NO_ERROR &&
+                simfsDeleteFile(mount, "/lazyFolder/inner/file") == SIMFS_NO_ERROR &&
+                simfsUmountFileSystem(mount) == SIMFS_NO_ERROR;
+    free(lazyContent);
+    lazyWorks = lazyWorks && simfsMountFileSystem(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                simfsGetFileInfo(mount, "/lazyFolder/inner", &lazyInfo) == SIMFS_NO_ERROR && lazyInfo.size == 0 &&
+                simfsGetFileInfo(mount, "/lazyFolder/inner/file", &lazyInfo) == SIMFS_NOT_FOUND_ERROR &&
+                simfsUmountFileSystem(mount) == SIMFS_NO_ERROR;
+    simfs_debug_set_context(0, 0);
+    if(lazyWorks)
+        printf("simfsMountFileSystemLazy loaded the folders on the way to the files it was asked for\n");
+    else
+        printf("simfsMountFileSystemLazy should have found and saved the files as simfsMountFileSystem does!\n");
+
+    //testing batches; a folder and its content are created and deleted in one call each, and repeats are dropped
+    char *batchFolders[] = {"/batch/a", "/batch", "/batch"};
+    char *batchFiles[] = {"/batch/a/f1", "/batch/a/f2", "/batch/a/f3", "/batch/a/f4", "/batch/a/f5", "/batch/a/f6",
+                          "/batch/a/f7", "/batch/a/f1", "/batch/f8"};
+    char *batchDeletes[] = {"/batch", "/batch/a", "/batch/a/f1", "/batch/a/f2", "/batch/a/f3", "/batch/a/f4",
+                            "/batch/a/f5", "/batch/a/f6", "/batch/a/f7", "/batch/f8", "/batch/missing", "/batch/f8"};
+    SIMFS_ERROR batchErrors[12];
+    SIMFS_FILE_DESCRIPTOR_TYPE batchInfo;
+    SIMFS_FILE_HANDLE_TYPE batchHandle;
+    char *batchContent = NULL;
+    simfs_debug_set_context(1, 1);
+    bool batchWorks = simfsMountFileSystem(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                      simfsCreateFiles(mount, batchFolders, 3, FOLDER_CONTENT_TYPE, batchErrors) == SIMFS_NO_ERROR &&
+                      batchErrors[1] == SIMFS_NO_ERROR && batchErrors[2] == SIMFS_NO_ERROR &&
+                      simfsCreateFiles(mount, batchFiles, 9, FILE_CONTENT_TYPE, batchErrors) == SIMFS_NO_ERROR &&
+                      batchErrors[7] == SIMFS_NO_ERROR &&
+                      simfsCreateFiles(mount, batchFiles, 2, FILE_CONTENT_TYPE, batchErrors) ==
+                      SIMFS_DUPLICATE_ERROR && batchErrors[1] == SIMFS_DUPLICATE_ERROR &&
+                      simfsGetFileInfo(mount, "/batch/a", &batchInfo) == SIMFS_NO_ERROR && batchInfo.size == 7 &&
+                      simfsGetFileInfo(mount, "/batch/a/f7", &batchInfo) == SIMFS_NO_ERROR &&
+                      simfsDeleteFile(mount, "/batch/a") == SIMFS_NOT_EMPTY_ERROR &&
+                      simfsOpenFile(mount, "/batch/a/f2", &batchHandle) == SIMFS_NO_ERROR &&
+                      simfsDeleteFiles(mount, batchDeletes, 12, batchErrors) == SIMFS_NOT_FOUND_ERROR &&
+                      batchErrors[0] == SIMFS_NO_ERROR && batchErrors[9] == SIMFS_NO_ERROR &&
+                      batchErrors[10] == SIMFS_NOT_FOUND_ERROR && batchErrors[11] == SIMFS_NO_ERROR &&
+                      simfsGetFileInfo(mount, "/batch", &batchInfo) == SIMFS_NOT_FOUND_ERROR &&
+                      simfsReadFile(mount, batchHandle, &batchContent) == SIMFS_NOT_FOUND_ERROR &&
+                      simfsCloseFile(mount, batchHandle) == SIMFS_NO_ERROR &&
+                      simfsUmountFileSystem(mount) == SIMFS_NO_ERROR;
+    simfs_debug_set_context(0, 0);
+    free(batchContent);
+    if(batchWorks)
+        printf("simfsCreateFiles and simfsDeleteFiles created and deleted a folder with its content in one call\n");
+    else
+        printf("simfsCreateFiles and simfsDeleteFiles should have worked as a call for each name would!\n");
+
+    //testing recursive deletion; the subtree is gone at once, also while its entries are unlinked in the background
+    //and new files take its names, and its blocks are free again after unmounting
+    char *treeFolders[] = {"/tree", "/tree/a", "/tree/a/b", "/tree/c"};
+    char *treeFiles[] = {"/tree/f", "/tree/a/f", "/tree/a/b/f1", "/tree/a/b/f2", "/tree/a/b/f3", "/tree/a/b/f4",
+                         "/tree/a/b/f5", "/tree/a/b/f6", "/tree/a/b/f7", "/tree/c/f"};
+    SIMFS_ANALYSIS_TYPE treeBefore, treeAfter;
+    SIMFS_FILE_HANDLE_TYPE treeHandle;
+    char *treeContent = NULL, *treeData = simfsGenerateContent(200);
+    simfs_debug_set_context(1, 1);
+    bool treeWorks = simfsMountFileSystem(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                     simfsAnalyzeVolume(mount->volume, 1, &treeBefore) == SIMFS_NO_ERROR &&
+                     simfsCreateFiles(mount, treeFolders, 4, FOLDER_CONTENT_TYPE, NULL) == SIMFS_NO_ERROR &&
+                     simfsCreateFiles(mount, treeFiles, 10, FILE_CONTENT_TYPE, NULL) == SIMFS_NO_ERROR &&
+                     simfsOpenFile(mount, "/tree/a/b/f7", &treeHandle) == SIMFS_NO_ERROR &&
+                     simfsWriteFile(mount, treeHandle, treeData) == SIMFS_NO_ERROR &&
+                     simfsDeleteTree(mount, "/tree/a/b/f8") == SIMFS_NOT_FOUND_ERROR &&
+                     simfsDeleteTree(mount, "/") == SIMFS_NOT_FOUND_ERROR &&
+                     simfsDeleteTree(mount, "/tree") == SIMFS_NO_ERROR &&
+                     simfsGetFileInfo(mount, "/tree", &lazyInfo) == SIMFS_NOT_FOUND_ERROR &&
+                     simfsGetFileInfo(mount, "/tree/a/b/f1", &lazyInfo) == SIMFS_NOT_FOUND_ERROR &&
+                     simfsReadFile(mount, treeHandle, &treeContent) != SIMFS_NO_ERROR &&
+                     simfsCloseFile(mount, treeHandle) == SIMFS_NO_ERROR &&
+                     simfsCreateFile(mount, "/tree", FOLDER_CONTENT_TYPE) == SIMFS_NO_ERROR &&
+                     simfsCreateFile(mount, "/tree/a", FOLDER_CONTENT_TYPE) == SIMFS_NO_ERROR &&
+                     simfsGetFileInfo(mount, "/tree/a", &lazyInfo) == SIMFS_NO_ERROR &&
+                     simfsGetFileInfo(mount, "/tree/a/b", &lazyInfo) == SIMFS_NOT_FOUND_ERROR &&
+                     simfsDeleteTree(mount, "/tree") == SIMFS_NO_ERROR &&
+                     simfsUmountFileSystem(mount) == SIMFS_NO_ERROR &&
+                     simfsMountFileSystem(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                     simfsAnalyzeVolume(mount->volume, 1, &treeAfter) == SIMFS_NO_ERROR &&
+                     treeAfter.usedBlocks == treeBefore.usedBlocks &&
+                     simfsUmountFileSystem(mount) == SIMFS_NO_ERROR;
+    simfs_debug_set_context(0, 0);
+    free(treeData);
+    if(treeWorks)
+        printf("simfsDeleteTree deleted a folder with its content and freed all of its blocks\n");
+    else
+        printf("simfsDeleteTree should have deleted the folder with everything in it!\n");
+
+    //testing folder listings; a listing resumed after deletions returns every remaining child once, and none that
+    //was deleted before it came up
+    char *listFiles[] = {"/list", "/list/f0", "/list/f1", "/list/f2", "/list/f3", "/list/f4", "/list/f5", "/list/f6",
+                         "/list/f7", "/list/f8"};
+    SIMFS_FOLDER_ENTRY_TYPE listEntries[3];
+    SIMFS_FILE_DESCRIPTOR_TYPE listDescriptors[16];
+    SIMFS_DIR_COOKIE_TYPE listCookie = SIMFS_DIR_COOKIE_START;
+    SIMFS_FILE_HANDLE_TYPE listHandle;
+    size_t listed = 0, listBatch = 3, listSeen[9] = {0};
+    simfs_debug_set_context(1, 1);
+    bool listWorks = simfsMountFileSystem(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                     simfsCreateFiles(mount, listFiles, 1, FOLDER_CONTENT_TYPE, NULL) == SIMFS_NO_ERROR &&
+                     simfsCreateFiles(mount, listFiles + 1, 9, FILE_CONTENT_TYPE, NULL) == SIMFS_NO_ERROR &&
+                     simfsOpenFile(mount, "/list", &listHandle) == SIMFS_NO_ERROR;
+    while (listWorks && listBatch == 3) {
+        listWorks = simfsReadDir(mount, listHandle, &listCookie, listEntries, 3, &listBatch) == SIMFS_NO_ERROR;
+        for (size_t i = 0; listWorks && i < listBatch; i++, listed++)
+            listSeen[listEntries[i].name[1] - '0']++;
+        if (listed == 3) // the child at the end of the chain moves up when f0 goes
+            listWorks = simfsDeleteFile(mount, "/list/f0") == SIMFS_NO_ERROR &&
+                        simfsDeleteFile(mount, "/list/f8") == SIMFS_NO_ERROR;
+    }
+    for (size_t i = 1; i < 9; i++)
+        listWorks = listWorks && listSeen[i] == (i < 8);
+    listCookie = SIMFS_DIR_COOKIE_START;
+    listWorks = listWorks && simfsReadDirPlus(mount, listHandle, &listCookie, listDescriptors, 16, &listBatch) ==
+                             SIMFS_NO_ERROR && listBatch == 7 && strncmp(listDescriptors[0].name, "f", 1) == 0 &&
+                simfsCloseFile(mount, listHandle) == SIMFS_NO_ERROR &&
+                simfsDeleteTree(mount, "/list") == SIMFS_NO_ERROR &&
+                simfsUmountFileSystem(mount) == SIMFS_NO_ERROR;
+    simfs_debug_set_context(0, 0);
+    if(listWorks)
+        printf("simfsReadDir listed every child of a folder once while the folder changed\n");
+    else
+        printf("simfsReadDir should have listed every child that stayed in the folder exactly once!\n");
+
+    //testing renaming; a file replaces another one with the same open handle, and a folder moves with its content
+    char *renameFolders[] = {"/ren", "/ren/a", "/ren/a/b"};
+    char *renameFiles[] = {"/ren/new", "/ren/old", "/ren/a/f", "/ren/a/b/f"};
+    SIMFS_ANALYSIS_TYPE renameBefore, renameAfter;
+    SIMFS_FILE_HANDLE_TYPE renameHandle;
+    char *renameContent = NULL, *renameData = simfsGenerateContent(200);
+    char renameLongName[SIMFS_MAX_NAME_LENGTH - 3] = "/"; // "/b/f" in the folder moved to it would not fit
+    memset(renameLongName + 1, 'x', sizeof(renameLongName) - 2);
+    simfs_debug_set_context(1, 1);
+    bool renameWorks = simfsMountFileSystem(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                       simfsAnalyzeVolume(mount->volume, 1, &renameBefore) == SIMFS_NO_ERROR &&
+                       simfsCreateFiles(mount, renameFolders, 3, FOLDER_CONTENT_TYPE, NULL) == SIMFS_NO_ERROR &&
+                       simfsCreateFiles(mount, renameFiles, 4, FILE_CONTENT_TYPE, NULL) == SIMFS_NO_ERROR &&
+                       simfsOpenFile(mount, "/ren/new", &renameHandle) == SIMFS_NO_ERROR &&
+                       simfsWriteFile(mount, renameHandle, renameData) == SIMFS_NO_ERROR &&
+                       simfsRename(mount, "/ren/new", "/ren/old") == SIMFS_NO_ERROR &&
+                       simfsGetFileInfo(mount, "/ren/new", &lazyInfo) == SIMFS_NOT_FOUND_ERROR &&
+                       simfsReadFile(mount, renameHandle, &renameContent) == SIMFS_NO_ERROR &&
+                       strcmp(renameContent, renameData) == 0 &&
+                       simfsCloseFile(mount, renameHandle) == SIMFS_NO_ERROR &&
+                       simfsGetFileInfo(mount, "/ren/old", &lazyInfo) == SIMFS_NO_ERROR &&
+                       lazyInfo.size == strlen(renameData) &&
+                       simfsRename(mount, "/ren/old", "/ren/a") == SIMFS_DUPLICATE_ERROR &&
+                       simfsRename(mount, "/ren/a", "/ren/a/b/c") == SIMFS_ACCESS_ERROR &&
+                       simfsRename(mount, "/ren/a", "/moved") == SIMFS_NO_ERROR &&
+                       simfsRename(mount, "/moved", renameLongName) == SIMFS_ALLOC_ERROR &&
+                       simfsGetFileInfo(mount, renameLongName, &lazyInfo) == SIMFS_NOT_FOUND_ERROR &&
+                       simfsGetFileInfo(mount, "/ren/a/b/f", &lazyInfo) == SIMFS_NOT_FOUND_ERROR &&
+                       simfsUmountFileSystem(mount) == SIMFS_NO_ERROR &&
+                       simfsMountFileSystemLazy(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                       simfsGetFileInfo(mount, "/moved/b/f", &lazyInfo) == SIMFS_NO_ERROR &&
+                       strcmp(lazyInfo.name, "/moved/b/f") == 0 &&
+                       simfsRename(mount, "/moved/b/f", "/ren/old") == SIMFS_NO_ERROR &&
+                       simfsGetFileInfo(mount, "/ren/old", &lazyInfo) == SIMFS_NO_ERROR && lazyInfo.size == 0 &&
+                       simfsDeleteTree(mount, "/ren") == SIMFS_NO_ERROR &&
+                       simfsDeleteTree(mount, "/moved") == SIMFS_NO_ERROR &&
+                       simfsUmountFileSystem(mount) == SIMFS_NO_ERROR &&
+                       simfsMountFileSystem(SIMFS_FILE_NAME, &mount) == SIMFS_NO_ERROR &&
+                       simfsAnalyzeVolume(mount->volume, 1, &renameAfter) == SIMFS_NO_ERROR &&
+                       renameAfter.usedBlocks == renameBefore.usedBlocks &&
+                       simfsUmountFileSystem(mount) == SIMFS_NO_ERROR;
+    simfs_debug_set_context(0, 0);
+    free(renameContent);
+    free(renameData);
+    if(renameWorks)
+        printf("simfsRename replaced a file, moved a folder with its content and kept the paths in it short enough\n");
+    else
+        printf("simfsRename should have moved the files to their new names!\n");
+
+    //testing the width of block references; a volume recorded with 16-bit references is not mounted
+    SIMFS_SUPERBLOCK_TYPE superblock;
+    FILE *volumeFile = fopen(SIMFS_FILE_NAME, "r+b");
+    bool widthWorks = volumeFile != NULL && fread(&superblock, sizeof(superblock), 1, volumeFile) == 1 &&
+                      superblock.attr.indexSize == sizeof(SIMFS_INDEX_TYPE);
+    superblock.attr.indexSize = 2;
+    widthWorks = widthWorks && fseek(volumeFile, 0, SEEK_SET) == 0 &&
+                 fwrite(&superblock, sizeof(superblock), 1, volumeFile) == 1;
+    if (volumeFile != NULL)
+        fclose(volumeFile);
+    if(widthWorks && simfsMountFileSystem(SIMFS_FILE_NAME, &mount) == SIMFS_READ_ERROR)
+        printf("simfsMountFileSystem refused a volume with another width of block references\n");
+    else
+        printf("simfsMountFileSystem should have refused a volume with another width of block references!\n");
+
     // unsigned char testBitVector[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
     // simfsFlipBit(testBitVector, 44);
     // printf("Found free block at %d\n", simfsFindFreeBlock(testBitVector));